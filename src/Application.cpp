@@ -1,4 +1,23 @@
 #include "Core.h"
+#include "TransientAttachments.h"
+#include "DeferredDeletionQueue.h"
+#include "GeometryBuffer.h"
+#include "HostMemory.h"
+#include "GpuMemoryReport.h"
+#include "DeviceFeatures.h"
+#include "DescriptorAllocator.h"
+#include "BindlessTable.h"
+#include "DynamicState.h"
+#include "PipelineCache.h"
+#include "PipelineCompiler.h"
+#include "ShaderLibrary.h"
+#include "PipelineManifest.h"
+#include "RenderGraph.h"
+#include "GpuProfiler.h"
+#include "GpuSync.h"
+#include "JobSystem.h"
+#include "CommandBufferManager.h"
+#include "ParallelCommandRecorder.h"
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 
@@ -10,10 +29,13 @@
 #include <map>
 #include <optional>
 #include <set>
+#include <chrono>
+#include <cstring>
 #include <cstdint> // Necessary for UINT32_MAX
 
 const int WIDTH = 800;
 const int HEIGHT = 600;
+const uint32_t MAX_FRAMES_IN_FLIGHT = 2;
 
 class HelloTriangleApplication
 {
@@ -25,6 +47,8 @@ private:
 	VkDevice m_logicalDevice = VK_NULL_HANDLE;
 	VkQueue m_graphicsQueue;	// graphics queue
 	VkQueue m_presentQueue;		// presentation queue
+	VkQueue m_computeQueue;		// async compute queue, the graphics queue when the device has no separate family
+	VkQueue m_transferQueue;	// transfer queue, likewise
 	VkSurfaceKHR m_surface;		// rendering window view
 
 	std::vector<VkImage> m_swapChainImages;			// each individual image
@@ -33,12 +57,72 @@ private:
 	VkExtent2D m_swapChainExtent;					// "extents" of the buffer. (width and height of the surface
 	std::vector<VkImageView> m_swapChainImageViews; // schematic on how to access a single image on the swap chain
 
+	// Intermediate render targets, aliased in memory by the passes they live across
+	enum FramePass : uint32_t { ePass_GBuffer, ePass_Lighting, ePass_PostProcess, ePass_Composite };	// SkyLut runs beside GBuffer to PostProcess
+	TransientAttachmentAllocator m_renderTargets;
+	TransientAttachmentAllocator::Handle m_depthTarget;
+	TransientAttachmentAllocator::Handle m_gBufferAlbedo;
+	TransientAttachmentAllocator::Handle m_gBufferNormal;
+	TransientAttachmentAllocator::Handle m_hdrTarget;
+	TransientAttachmentAllocator::Handle m_postScratch;
+	TransientAttachmentAllocator::Handle m_skyLut;
+
+	// Passes of the frame and the barriers between them, rebuilt every frame
+	RenderGraph m_renderGraph;
+	RenderGraphStats m_lastReportedGraphStats;
+	GpuProfiler m_gpuProfiler;					// per pass timestamps on every queue
+
+	// Frame pacing. Frame numbers start at 1, a frame is complete once GpuSync has seen its last submission complete.
+	// The render graph splits a frame into several submissions, each queue type has its own pool.
+	GpuSync m_gpuSync;							// every vkQueueSubmit goes through here
+	CommandBufferManager m_commandBuffers;		// pools are reset whole once the slot's last frame is complete
+	CommandBufferManager::PoolHandle m_queuePools[QUEUE_TYPE_COUNT];
+	JobSystem m_jobSystem;						// the render thread is worker 0
+	ParallelCommandRecorder m_parallelRecorder;	// secondary command buffers of passes recorded across the workers
+	VkSemaphore m_imageAvailableSemaphores[MAX_FRAMES_IN_FLIGHT];
+	std::vector<VkSemaphore> m_renderFinishedSemaphores;		// per swapchain image, presentation may hold it past the frame
+	std::vector<GpuSyncPoint> m_submissionPoints;	// of the frame being submitted, indexed like the render graph's submissions
+	uint64_t m_frameNumber = 1;					// frame currently being recorded
+	uint64_t m_completedFrameNumber = 0;		// last frame the GPU is known to have finished
+	DeferredDeletionQueue m_deletionQueue;		// destroy through here anything that may still be in flight
+
+	// Every mesh of a vertex format lives in one shared vertex/index buffer pair
+	const VertexFormat m_staticMeshFormat = { "StaticMesh", 32 }; // position, normal, uv
+	GeometryBuffer m_staticGeometry;
+
+	// Per frame scratch memory, reset at the top of drawFrame(). Nothing allocated from it may outlive the frame.
+	FrameArena m_frameArena;
+	uint64_t m_heapAllocationsAtFrameStart = 0;
+	uint64_t m_lastReportedHeapAllocations = 0;
+
+	// Optional device functionality found at device creation, and the resource table that depends on it
+	DeviceFeatures m_deviceFeatures;
+	DescriptorAllocator m_descriptorAllocator;	// transient sets for the classic path, reset per frame slot
+	BindlessTable m_resourceTable;
+	VkSampler m_defaultSampler = VK_NULL_HANDLE;
+
+	DynamicStateFunctions m_dynamicState;		// which pipeline state lives on the command buffer, and its entry points
+	CommandStateTracker m_stateTracker;			// for the frame's graphics command buffer
+	PipelineCache m_pipelineCache;				// every VkPipeline, shader module and pipeline layout comes from here
+	PipelineCompiler m_pipelineCompiler;		// builds pipelines requested by the frame loop off the render thread
+	ShaderLibrary m_shaderLibrary;				// shaders.pack plus edited sources from shaders/, reloaded when saved
+
+	// Pipelines the last session used, prewarmed at startup and written back with this session's on exit
+	const char* m_pipelineManifestPath = "pipelines.manifest";
+	bool m_usePipelineManifest = true;
+	std::vector<PipelineDesc> m_pipelineManifest;
+	std::chrono::steady_clock::time_point m_startTime;
+	bool m_firstMinuteReported = false;
+
+	bool m_memoryReportKeyDown = false;			// F9 dumps the GPU memory report
+	bool m_gpuTimelineKeyDown = false;			// F10 writes the GPU timeline of the last frames
+
 	const std::vector<const char*> deviceExtensions = { VK_KHR_SWAPCHAIN_EXTENSION_NAME }; // Add desired extensions here
 
 
 public:
-	HelloTriangleApplication()
-		: m_window(nullptr)	{}
+	explicit HelloTriangleApplication(bool _usePipelineManifest = true)
+		: m_window(nullptr), m_usePipelineManifest(_usePipelineManifest) {}
 
 	void emergencyCleanup()
 	{
@@ -46,6 +130,7 @@ public:
 	}
 	void run()
 	{
+		m_startTime = std::chrono::steady_clock::now();
 		initWindow();
 		initVulkan();
 		
@@ -74,8 +159,128 @@ private:
 		createLogicalDevice();
 		createSwapChain();
 		createImageViews();
+		createRenderTargets();
+		createSyncObjects();
+		createGeometryBuffers();
+		createResourceTable();
+		m_dynamicState.load(m_logicalDevice, m_deviceFeatures);
+		m_stateTracker.init(m_dynamicState);
+		m_pipelineCache.init(m_logicalDevice, m_dynamicState.mask);
+		m_pipelineCompiler.init(m_pipelineCache);
+		m_shaderLibrary.init(m_pipelineCache, m_pipelineCompiler, m_deletionQueue, "shaders", "shaders.pack");
+		prewarmPipelines();
 		CLog(0, "initVulkan: Success.");
 	}
+	// Layouts the manifest can't rebuild from bindings are recorded by id, then last session's pipelines are queued on
+	// the compiler workers in the order they were first used, so early frames find theirs done or at the head of the queue.
+	void prewarmPipelines()
+	{
+		m_pipelineCache.registerExternalSetLayout(m_resourceTable.getSetLayout(), hashBytes("bindless", 8));
+		m_pipelineCache.registerExternalLayout(m_resourceTable.getPipelineLayout(), hashBytes("bindless", 8));
+		if (!m_usePipelineManifest)
+		{
+			CLog(0, "Pipeline manifest disabled.");
+			return;
+		}
+		m_pipelineManifest = PipelineManifest::load(m_pipelineManifestPath, m_pipelineCache);
+		m_pipelineCompiler.prewarm(m_pipelineManifest);
+	}
+	void createResourceTable()
+	{
+		m_descriptorAllocator.init(m_logicalDevice, MAX_FRAMES_IN_FLIGHT, {
+			{ VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, 1.0f },
+			{ VK_DESCRIPTOR_TYPE_SAMPLER, 1.0f },
+			{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1.0f },
+			{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1.0f },
+			{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2.0f } });
+		m_resourceTable.init(m_logicalDevice, m_deviceFeatures, m_descriptorAllocator);
+
+		VkSamplerCreateInfo samplerInfo = {};
+		samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+		samplerInfo.magFilter = VK_FILTER_LINEAR;
+		samplerInfo.minFilter = VK_FILTER_LINEAR;
+		samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+		samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+		VkResult result = vkCreateSampler(m_logicalDevice, &samplerInfo, nullptr, &m_defaultSampler);
+		CVerifyCrash(result == VK_SUCCESS, "Failed to create default sampler. Result: {}", result);
+		m_resourceTable.addSampler(m_defaultSampler);
+
+		// Render targets read by later passes
+		m_resourceTable.addSampledImage(m_renderTargets.getImageView(m_hdrTarget), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+		m_resourceTable.addSampledImage(m_renderTargets.getImageView(m_postScratch), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	}
+	void createGeometryBuffers()
+	{
+		m_staticGeometry.init(m_logicalDevice, m_physicalDevice, m_staticMeshFormat, 1024 * 1024, 3 * 1024 * 1024);
+	}
+	void createSyncObjects()
+	{
+		m_deletionQueue.init(m_logicalDevice);
+
+		const VkQueue queues[QUEUE_TYPE_COUNT] = { getQueue(QueueType::Graphics), getQueue(QueueType::Compute), getQueue(QueueType::Transfer) };
+		m_gpuSync.init(m_logicalDevice, m_deviceFeatures, queues);
+
+		VkSemaphoreCreateInfo semaphoreInfo = {};
+		semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+		for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+		{
+			VkResult result = vkCreateSemaphore(m_logicalDevice, &semaphoreInfo, nullptr, &m_imageAvailableSemaphores[i]);
+			CVerifyCrash(result == VK_SUCCESS, "Failed to create image available semaphore {}. Result: {}", i, result);
+		}
+		const char* const poolNames[QUEUE_TYPE_COUNT] = { "Graphics", "Compute", "Transfer" };
+		m_commandBuffers.init(m_logicalDevice, MAX_FRAMES_IN_FLIGHT);
+		for (uint32_t q = 0; q < QUEUE_TYPE_COUNT; q++)
+		{
+			m_queuePools[q] = m_commandBuffers.createPool(m_deviceFeatures.queueFamilies[q], poolNames[q]);
+		}
+		m_renderFinishedSemaphores.resize(m_swapChainImages.size());
+		for (auto& it : m_renderFinishedSemaphores)
+		{
+			VkResult result = vkCreateSemaphore(m_logicalDevice, &semaphoreInfo, nullptr, &it);
+			CVerifyCrash(result == VK_SUCCESS, "Failed to create render finished semaphore. Result: {}", result);
+		}
+		// The pipeline compiler keeps threads of its own, the job system gets the remaining hardware threads
+		const uint32_t hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+		m_jobSystem.init(std::max(2u, hardwareThreads - PipelineCompiler::getWorkerCount(hardwareThreads)));
+		m_parallelRecorder.init(m_commandBuffers, m_deviceFeatures.queueFamilies[static_cast<uint32_t>(QueueType::Graphics)], m_jobSystem);
+		m_renderGraph.init(m_logicalDevice, m_deviceFeatures);
+		m_gpuProfiler.init(m_logicalDevice, m_deviceFeatures, MAX_FRAMES_IN_FLIGHT);
+		m_renderGraph.setProfiler(&m_gpuProfiler);
+	}
+
+	VkQueue getQueue(QueueType _queue) const
+	{
+		switch (_queue)
+		{
+		case QueueType::Compute:	return m_computeQueue;
+		case QueueType::Transfer:	return m_transferQueue;
+		default:					return m_graphicsQueue;
+		}
+	}
+	void createRenderTargets()
+	{
+		const VkImageUsageFlags gBufferUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
+		const VkImageUsageFlags sampledColorUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+
+		m_depthTarget = m_renderTargets.declare({ "Depth", VK_FORMAT_D32_SFLOAT, m_swapChainExtent,
+			VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT, VK_IMAGE_ASPECT_DEPTH_BIT, ePass_GBuffer, ePass_Lighting });
+		m_gBufferAlbedo = m_renderTargets.declare({ "GBuffer_Albedo", VK_FORMAT_R8G8B8A8_UNORM, m_swapChainExtent,
+			gBufferUsage, VK_IMAGE_ASPECT_COLOR_BIT, ePass_GBuffer, ePass_Lighting });
+		m_gBufferNormal = m_renderTargets.declare({ "GBuffer_Normal", VK_FORMAT_A2B10G10R10_UNORM_PACK32, m_swapChainExtent,
+			gBufferUsage, VK_IMAGE_ASPECT_COLOR_BIT, ePass_GBuffer, ePass_Lighting });
+		m_hdrTarget = m_renderTargets.declare({ "HDR_Lighting", VK_FORMAT_R16G16B16A16_SFLOAT, m_swapChainExtent,
+			sampledColorUsage, VK_IMAGE_ASPECT_COLOR_BIT, ePass_Lighting, ePass_PostProcess });
+		m_postScratch = m_renderTargets.declare({ "Post_Scratch", VK_FORMAT_R16G16B16A16_SFLOAT, m_swapChainExtent,
+			sampledColorUsage, VK_IMAGE_ASPECT_COLOR_BIT, ePass_PostProcess, ePass_Composite });
+		m_skyLut = m_renderTargets.declare({ "Sky_LUT", VK_FORMAT_R16G16B16A16_SFLOAT, { 256, 64 },
+			VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_IMAGE_ASPECT_COLOR_BIT, ePass_GBuffer, ePass_Composite });
+
+		m_renderTargets.build(m_logicalDevice, m_physicalDevice);
+	}
 	void createImageViews()
 	{
 		m_swapChainImageViews.resize(m_swapChainImages.size());
@@ -171,11 +376,266 @@ private:
 		while (!glfwWindowShouldClose(m_window))
 		{
 			glfwPollEvents();
+			pollDebugKeys();
+			drawFrame();
+		}
+	}
+
+	void pollDebugKeys()
+	{
+		const bool memoryReportKeyDown = glfwGetKey(m_window, GLFW_KEY_F9) == GLFW_PRESS;
+		if (memoryReportKeyDown && !m_memoryReportKeyDown)
+		{
+			GpuMemoryRegistry::instance().requestDump("gpu_memory_frame" + std::to_string(m_frameNumber) + ".json");
+		}
+		m_memoryReportKeyDown = memoryReportKeyDown;
+
+		const bool gpuTimelineKeyDown = glfwGetKey(m_window, GLFW_KEY_F10) == GLFW_PRESS;
+		if (gpuTimelineKeyDown && !m_gpuTimelineKeyDown)
+		{
+			m_gpuProfiler.writeTrace("gpu_timeline_frame" + std::to_string(m_frameNumber) + ".json");
+		}
+		m_gpuTimelineKeyDown = gpuTimelineKeyDown;
+	}
+
+	void drawFrame()
+	{
+		const uint32_t slot = m_frameNumber % MAX_FRAMES_IN_FLIGHT;
+		beginFrameHeapTracking();
+		GpuMemoryRegistry::instance().setFrame(m_frameNumber);
+
+		// The frame that last used the slot has to be done before its command pools are reset. Whatever else the GPU
+		// finished by now is retired too, everything is tagged with frame numbers.
+		if (m_frameNumber > MAX_FRAMES_IN_FLIGHT)
+			m_gpuSync.waitForFrame(m_frameNumber - MAX_FRAMES_IN_FLIGHT);
+		m_completedFrameNumber = m_gpuSync.getCompletedFrame();
+		m_deletionQueue.flush(m_completedFrameNumber);
+		m_staticGeometry.collect(m_completedFrameNumber);
+
+		uint32_t imageIndex;
+		VkResult result = vkAcquireNextImageKHR(m_logicalDevice, m_swapChain, UINT64_MAX, m_imageAvailableSemaphores[slot], VK_NULL_HANDLE, &imageIndex);
+		if (result == VK_ERROR_OUT_OF_DATE_KHR)
+			return;	// minimized, the window can't be resized so the swapchain comes back as it was
+		CVerifyCrash(result == VK_SUCCESS || result == VK_SUBOPTIMAL_KHR, "Failed to acquire swapchain image. Result: {}", result);
+
+		m_shaderLibrary.update(m_frameNumber);
+		m_descriptorAllocator.beginFrame(slot);
+		m_resourceTable.beginFrame(m_completedFrameNumber);
+		m_gpuProfiler.beginFrame(slot, m_frameNumber);
+
+		m_commandBuffers.beginFrame(slot);
+		recordFrame(slot, imageIndex);
+
+		VkPresentInfoKHR presentInfo = {};
+		presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+		presentInfo.waitSemaphoreCount = 1;
+		presentInfo.pWaitSemaphores = &m_renderFinishedSemaphores[imageIndex];
+		presentInfo.swapchainCount = 1;
+		presentInfo.pSwapchains = &m_swapChain;
+		presentInfo.pImageIndices = &imageIndex;
+		result = vkQueuePresentKHR(m_presentQueue, &presentInfo);
+		CVerifyCrash(result == VK_SUCCESS || result == VK_SUBOPTIMAL_KHR || result == VK_ERROR_OUT_OF_DATE_KHR, "Failed to present frame {}. Result: {}", m_frameNumber, result);
+
+		m_resourceTable.endFrame();
+		m_pipelineCompiler.endFrame(m_frameNumber);
+		reportStartup();
+		m_frameNumber++;
+	}
+
+	// Time to first frame and the first minute's compile hitches, to compare runs with and without the pipeline manifest.
+	void reportStartup()
+	{
+		const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_startTime).count();
+		const char* manifest = m_usePipelineManifest ? "on" : "off";
+		if (m_frameNumber == 1)
+		{
+			CLog(0, "Time to first frame: {:.1f} ms (pipeline manifest {:s}).", seconds * 1000.0, manifest);
+		}
+		else if (!m_firstMinuteReported && seconds >= 60.0)
+		{
+			const PipelineCompilerStats stats = m_pipelineCompiler.getStats();
+			CLog(0, "First minute (pipeline manifest {:s}): {} frames, {} hitches, {:.2f} ms blocked on compiles, {} fallback draws, {} skipped draws.",
+				manifest, m_frameNumber, stats.hitchFrames, stats.totalWaitMicroseconds / 1000.0, stats.fallbackDraws, stats.skippedDraws);
+			m_firstMinuteReported = true;
+		}
+	}
+
+	// Passes declare what they touch and the graph works out the barriers. Nothing draws yet, the passes' render pass
+	// loads clear their targets; draws go in the pass callbacks and use pipelines made for getRenderPass() and
+	// getSubpass(), GBuffer and Lighting end up as two subpasses of one render pass. A pass with many draws would mark
+	// itself secondaryCommandBuffers() and record them from its callback through m_parallelRecorder with
+	// getInheritance(); none does until the passes draw something. SkyLut only runs compute shaders, so it goes to the
+	// async compute queue when there is one and overlaps everything up to Composite.
+	void recordFrame(uint32_t _slot, uint32_t _imageIndex)
+	{
+		m_renderGraph.beginFrame();
+		const RenderGraph::ImageHandle depth = m_renderGraph.importTransient(m_renderTargets, m_depthTarget);
+		const RenderGraph::ImageHandle albedo = m_renderGraph.importTransient(m_renderTargets, m_gBufferAlbedo);
+		const RenderGraph::ImageHandle normal = m_renderGraph.importTransient(m_renderTargets, m_gBufferNormal);
+		const RenderGraph::ImageHandle hdr = m_renderGraph.importTransient(m_renderTargets, m_hdrTarget);
+		const RenderGraph::ImageHandle postScratch = m_renderGraph.importTransient(m_renderTargets, m_postScratch);
+		const RenderGraph::ImageHandle skyLut = m_renderGraph.importTransient(m_renderTargets, m_skyLut);
+		const RenderGraph::ImageHandle backBuffer = m_renderGraph.importImage("Swapchain", m_swapChainImages[_imageIndex], m_swapChainImageViews[_imageIndex],
+			m_swapChainImageFormat, m_swapChainExtent, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+
+		const VkClearColorValue black = {};
+		const VkClearColorValue background = { { 0.1f, 0.1f, 0.12f, 1.0f } };
+		const VkClearDepthStencilValue farDepth = { 1.0f, 0 };
+
+		m_renderGraph.addPass("SkyLut", nullptr).write(skyLut, ResourceUsage::StorageWrite);
+		m_renderGraph.addPass("GBuffer", nullptr).depth(depth, farDepth).color(albedo, black).color(normal, black);
+		m_renderGraph.addPass("Lighting", nullptr).input(albedo).input(normal).input(depth).color(hdr, black);
+		m_renderGraph.addPass("PostProcess", nullptr).read(hdr, ResourceUsage::SampledFragment).color(postScratch);
+		m_renderGraph.addPass("Composite", nullptr).read(postScratch, ResourceUsage::SampledFragment).read(skyLut, ResourceUsage::SampledFragment)
+			.color(backBuffer, background);
+		m_renderGraph.compile();
+		submitFrame(_slot, _imageIndex);
+		reportRenderGraph();
+	}
+
+	// One command buffer and GpuSync submission per graph submission, in order, waiting on the points of the earlier
+	// submissions the graph says it needs. The first graphics submission waits for the swapchain image, the last one
+	// (always graphics, after the other queues) signals presentation and ends the frame.
+	void submitFrame(uint32_t _slot, uint32_t _imageIndex)
+	{
+		const uint32_t submissionCount = m_renderGraph.getSubmissionCount();
+		m_submissionPoints.resize(submissionCount);
+		bool acquireWaited = false;
+		for (uint32_t i = 0; i < submissionCount; i++)
+		{
+			const RenderGraph::Submission submission = m_renderGraph.getSubmission(i);
+			VkCommandBuffer commandBuffer = m_commandBuffers.get(m_queuePools[static_cast<uint32_t>(submission.queue)]);
+			VkCommandBufferBeginInfo beginInfo = {};
+			beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+			beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+			vkBeginCommandBuffer(commandBuffer, &beginInfo);
+			if (submission.queue == QueueType::Graphics)
+				m_stateTracker.begin(commandBuffer);
+			m_renderGraph.execute(i, commandBuffer);
+			VkResult result = vkEndCommandBuffer(commandBuffer);
+			CVerifyCrash(result == VK_SUCCESS, "Failed to record frame {}. Result: {}", m_frameNumber, result);
+
+			GpuSync::Wait waits[16];
+			CVerifyCrash(submission.waitCount <= 16, "Frame {}: submission {} waits on too many submissions.", m_frameNumber, i);
+			for (uint32_t w = 0; w < submission.waitCount; w++)
+			{
+				waits[w] = { m_submissionPoints[submission.waitSubmissions[w]], submission.waitStages[w] };
+			}
+
+			const bool last = i + 1 == submissionCount;
+			// The swapchain image is first written as a color attachment, everything before that can run while it's acquired
+			const VkPipelineStageFlags acquireStage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+			GpuSync::SubmitDesc desc;
+			desc.commandBufferCount = 1;
+			desc.commandBuffers = &commandBuffer;
+			desc.waitCount = submission.waitCount;
+			desc.waits = waits;
+			if (submission.queue == QueueType::Graphics && !acquireWaited)
+			{
+				desc.binaryWaitCount = 1;
+				desc.binaryWaits = &m_imageAvailableSemaphores[_slot];
+				desc.binaryWaitStages = &acquireStage;
+				acquireWaited = true;
+			}
+			if (last)
+			{
+				desc.binarySignalCount = 1;
+				desc.binarySignals = &m_renderFinishedSemaphores[_imageIndex];
+			}
+			// Slots the passes added while recording get their descriptors before the GPU can read them
+			m_resourceTable.flushUpdates();
+			m_submissionPoints[i] = m_gpuSync.submit(submission.queue, desc);
 		}
+		m_gpuSync.endFrame(m_frameNumber, m_submissionPoints[submissionCount - 1]);
+	}
+
+	// Like the heap tracking below, only frames whose barrier or render pass counts differ from the last reported one are logged.
+	void reportRenderGraph()
+	{
+		const RenderGraphStats& stats = m_renderGraph.getFrameStats();
+		const bool changed = stats.passes != m_lastReportedGraphStats.passes || stats.imageBarriers != m_lastReportedGraphStats.imageBarriers ||
+			stats.bufferBarriers != m_lastReportedGraphStats.bufferBarriers || stats.layoutTransitions != m_lastReportedGraphStats.layoutTransitions ||
+			stats.renderPasses != m_lastReportedGraphStats.renderPasses || stats.bytesSaved != m_lastReportedGraphStats.bytesSaved ||
+			stats.submissions != m_lastReportedGraphStats.submissions;
+		if (changed)
+		{
+			CLog(0, "Frame {}: render graph {} passes, {} image / {} buffer barriers ({} layout transitions, {} merged) in {} batches, compiled in {} us.",
+				m_frameNumber, stats.passes, stats.imageBarriers, stats.bufferBarriers, stats.layoutTransitions, stats.mergedBarriers, stats.barrierBatches, stats.compileMicroseconds);
+			CLog(0, "Frame {}: {} passes culled, {} merged into {} render passes, {} attachment loads and {} stores avoided ({:.2f} MiB).",
+				m_frameNumber, stats.culledPasses, stats.mergedPasses, stats.renderPasses, stats.loadsAvoided, stats.storesAvoided, stats.bytesSaved / (1024.0 * 1024.0));
+			CLog(0, "Frame {}: {} passes on async queues, {} submissions, {} queue waits, {} ownership transfers.",
+				m_frameNumber, stats.asyncPasses, stats.submissions, stats.queueWaits, stats.ownershipTransfers);
+			m_lastReportedGraphStats = stats;
+		}
+	}
+
+	// Steady state frames should not touch the heap at all, report whenever the per frame count changes.
+	void beginFrameHeapTracking()
+	{
+		const uint64_t allocations = HeapTracking::getAllocationCount();
+		const uint64_t lastFrameAllocations = allocations - m_heapAllocationsAtFrameStart;
+		if (m_frameNumber > MAX_FRAMES_IN_FLIGHT + 1 && lastFrameAllocations != m_lastReportedHeapAllocations)
+		{
+			CLog(lastFrameAllocations > 0 ? 1 : 0, "Frame {}: {} heap allocations (arena peak {} bytes).", m_frameNumber - 1, lastFrameAllocations, m_frameArena.getPeakBytes());
+			m_lastReportedHeapAllocations = lastFrameAllocations;
+		}
+		m_frameArena.reset();
+		m_heapAllocationsAtFrameStart = HeapTracking::getAllocationCount();
 	}
 
 	void cleanup()
 	{
+		m_pipelineCompiler.shutdown();
+		m_shaderLibrary.shutdown();
+		if (m_usePipelineManifest)
+			PipelineManifest::save(m_pipelineManifestPath, m_pipelineCache, m_pipelineManifest);
+		vkDeviceWaitIdle(m_logicalDevice);
+		m_deletionQueue.flushAll();
+
+		GpuMemoryRegistry::instance().requestDump("gpu_memory_shutdown.json");
+		GpuMemoryRegistry::instance().waitForDump();
+
+		m_staticGeometry.logStats();
+		m_staticGeometry.destroy();
+
+		m_pipelineCompiler.logStats();
+		m_shaderLibrary.logStats();
+		m_stateTracker.logStats();
+		m_renderGraph.logStats();
+		m_renderGraph.destroy();
+		for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+		{
+			m_gpuProfiler.beginFrame((m_frameNumber + i) % MAX_FRAMES_IN_FLIGHT, m_frameNumber);	// collects the last frames, oldest first
+		}
+		m_gpuProfiler.writeTrace("gpu_timeline_shutdown.json");
+		m_gpuProfiler.logStats();
+		m_gpuProfiler.destroy();
+		m_gpuSync.logStats();
+		m_gpuSync.destroy();
+		m_parallelRecorder.logStats();
+		m_commandBuffers.logStats();
+		m_commandBuffers.destroy();
+		m_jobSystem.logStats();
+		m_jobSystem.shutdown();
+		m_pipelineCache.logStats();
+		m_pipelineCache.destroy();
+
+		m_resourceTable.logStats();
+		m_resourceTable.destroy();
+		m_descriptorAllocator.logStats();
+		m_descriptorAllocator.destroy();
+		vkDestroySampler(m_logicalDevice, m_defaultSampler, nullptr);
+
+		for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+		{
+			vkDestroySemaphore(m_logicalDevice, m_imageAvailableSemaphores[i], nullptr);
+		}
+		for (auto it : m_renderFinishedSemaphores)
+		{
+			vkDestroySemaphore(m_logicalDevice, it, nullptr);
+		}
+		m_renderTargets.destroy();
+
 		for (auto it : m_swapChainImageViews)
 		{
 			vkDestroyImageView(m_logicalDevice, it, nullptr);
@@ -196,15 +656,19 @@ private:
 
 	struct SwapChainSupportDetails
 	{
+		SwapChainSupportDetails(std::pmr::memory_resource* _memory)
+			: formats(_memory), presentModes(_memory)
+		{}
 		VkSurfaceCapabilitiesKHR capabilities;
-		std::vector<VkSurfaceFormatKHR> formats;
-		std::vector<VkPresentModeKHR> presentModes;
+		std::pmr::vector<VkSurfaceFormatKHR> formats;
+		std::pmr::vector<VkPresentModeKHR> presentModes;
 	};
+	// Results are frame arena backed, don't hold on to them.
 	SwapChainSupportDetails querySwapChainSupport(VkPhysicalDevice _physicalDevice)
 	{
 		uint32_t formatCount;
 		vkGetPhysicalDeviceSurfaceFormatsKHR(_physicalDevice, m_surface, &formatCount, nullptr);
-		SwapChainSupportDetails details;
+		SwapChainSupportDetails details(&m_frameArena);
 
 		if (formatCount != 0)
 		{
@@ -226,7 +690,7 @@ private:
 		return details;
 	}
 
-	VkSurfaceFormatKHR chooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& _availableFormats)
+	VkSurfaceFormatKHR chooseSwapSurfaceFormat(const std::pmr::vector<VkSurfaceFormatKHR>& _availableFormats)
 	{
 		for (const auto& it : _availableFormats)
 		{
@@ -239,7 +703,7 @@ private:
 		return _availableFormats[0];
 	}
 
-	VkPresentModeKHR chooseSwapPresentMode(const std::vector<VkPresentModeKHR>& _availablePresentModes)
+	VkPresentModeKHR chooseSwapPresentMode(const std::pmr::vector<VkPresentModeKHR>& _availablePresentModes)
 	{
 		for (const auto& it : _availablePresentModes)
 		{
@@ -290,7 +754,7 @@ private:
 		vkEnumeratePhysicalDevices(m_vkInstance, &deviceCount,nullptr);
 		CVerifyCrash(deviceCount != 0, "Failed to obtain physical devices.");
 
-		std::vector<VkPhysicalDevice> devices(deviceCount);
+		std::pmr::vector<VkPhysicalDevice> devices(deviceCount, &m_frameArena);
 		vkEnumeratePhysicalDevices(m_vkInstance, &deviceCount, devices.data());
 
 		std::multimap<uint32_t, VkPhysicalDevice> candidates;
@@ -316,7 +780,8 @@ private:
 
 		std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
 		
-		std::set<uint32_t> uniqueQueueFamilies = { indices.graphicsFamily.value(), indices.presentFamily.value() };
+		std::set<uint32_t> uniqueQueueFamilies = { indices.graphicsFamily.value(), indices.presentFamily.value(),
+			indices.computeFamily.value_or(indices.graphicsFamily.value()), indices.transferFamily.value_or(indices.graphicsFamily.value()) };
 
 
 		float queuePriority = 1.0f;
@@ -330,16 +795,104 @@ private:
 			queueCreateInfos.push_back(queueCreateInfo);
 		}
 
-		VkPhysicalDeviceFeatures deviceFeatures = {};
+		std::pmr::vector<const char*> enabledExtensions(deviceExtensions.begin(), deviceExtensions.end(), &m_frameArena);
+
+		// Optional features are enabled through the features2 chain, which replaces pEnabledFeatures
+		VkPhysicalDeviceFeatures2 deviceFeatures = {};
+		deviceFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+
+		VkPhysicalDeviceDescriptorIndexingFeatures descriptorIndexing = {};
+		descriptorIndexing.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES;
+		if (queryDescriptorIndexing(enabledExtensions))
+		{
+			descriptorIndexing.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+			descriptorIndexing.shaderStorageBufferArrayNonUniformIndexing = VK_TRUE;
+			descriptorIndexing.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+			descriptorIndexing.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+			descriptorIndexing.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+			descriptorIndexing.descriptorBindingPartiallyBound = VK_TRUE;
+			descriptorIndexing.runtimeDescriptorArray = VK_TRUE;
+			descriptorIndexing.pNext = deviceFeatures.pNext;
+			deviceFeatures.pNext = &descriptorIndexing;
+		}
+
+#ifdef VK_EXT_extended_dynamic_state
+		VkPhysicalDeviceExtendedDynamicStateFeaturesEXT extendedDynamicState = {};
+		extendedDynamicState.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_FEATURES_EXT;
+#endif
+#ifdef VK_EXT_extended_dynamic_state2
+		VkPhysicalDeviceExtendedDynamicState2FeaturesEXT extendedDynamicState2 = {};
+		extendedDynamicState2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_2_FEATURES_EXT;
+#endif
+#ifdef VK_EXT_extended_dynamic_state3
+		VkPhysicalDeviceExtendedDynamicState3FeaturesEXT extendedDynamicState3 = {};
+		extendedDynamicState3.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_3_FEATURES_EXT;
+#endif
+		queryExtendedDynamicState(enabledExtensions);
+#ifdef VK_EXT_extended_dynamic_state
+		if (m_deviceFeatures.extendedDynamicState && m_deviceFeatures.deviceApiVersion < VK_MAKE_VERSION(1, 3, 0))
+		{
+			extendedDynamicState.extendedDynamicState = VK_TRUE;
+			extendedDynamicState.pNext = deviceFeatures.pNext;
+			deviceFeatures.pNext = &extendedDynamicState;
+		}
+#endif
+#ifdef VK_EXT_extended_dynamic_state2
+		if (m_deviceFeatures.extendedDynamicState2 && m_deviceFeatures.deviceApiVersion < VK_MAKE_VERSION(1, 3, 0))
+		{
+			extendedDynamicState2.extendedDynamicState2 = VK_TRUE;
+			extendedDynamicState2.pNext = deviceFeatures.pNext;
+			deviceFeatures.pNext = &extendedDynamicState2;
+		}
+#endif
+#ifdef VK_EXT_extended_dynamic_state3
+		if (m_deviceFeatures.extendedDynamicState3PolygonMode)
+		{
+			extendedDynamicState3.extendedDynamicState3PolygonMode = VK_TRUE;
+			extendedDynamicState3.pNext = deviceFeatures.pNext;
+			deviceFeatures.pNext = &extendedDynamicState3;
+		}
+#endif
+
+#ifdef VK_KHR_synchronization2
+		VkPhysicalDeviceSynchronization2FeaturesKHR synchronization2 = {};
+		synchronization2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES_KHR;
+#endif
+		querySynchronization2(enabledExtensions);
+#ifdef VK_KHR_synchronization2
+		if (m_deviceFeatures.synchronization2)
+		{
+			synchronization2.synchronization2 = VK_TRUE;
+			synchronization2.pNext = deviceFeatures.pNext;
+			deviceFeatures.pNext = &synchronization2;
+		}
+#endif
+
+#ifdef VK_KHR_timeline_semaphore
+		VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineSemaphore = {};
+		timelineSemaphore.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+#endif
+		queryTimelineSemaphore(enabledExtensions);
+#ifdef VK_KHR_timeline_semaphore
+		if (m_deviceFeatures.timelineSemaphore)
+		{
+			timelineSemaphore.timelineSemaphore = VK_TRUE;
+			timelineSemaphore.pNext = deviceFeatures.pNext;
+			deviceFeatures.pNext = &timelineSemaphore;
+		}
+#endif
 
 		VkDeviceCreateInfo createInfo = {};
 		createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
 		createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
 		createInfo.pQueueCreateInfos = queueCreateInfos.data();
-		createInfo.pEnabledFeatures = &deviceFeatures;
+		if (m_deviceFeatures.instanceApiVersion >= VK_API_VERSION_1_1)
+			createInfo.pNext = &deviceFeatures;
+		else
+			createInfo.pEnabledFeatures = &deviceFeatures.features;
 
-		createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-		createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+		createInfo.enabledExtensionCount = static_cast<uint32_t>(enabledExtensions.size());
+		createInfo.ppEnabledExtensionNames = enabledExtensions.data();
 
 	  // Device specific validation layers are deprecated and the instance created layers are used instead, the following set up is for backwards compatibility. 
 #if _DEBUG
@@ -355,14 +908,226 @@ private:
 		// Retrieve queue handles
 		vkGetDeviceQueue(m_logicalDevice, indices.graphicsFamily.value(), 0, &m_graphicsQueue);
 		vkGetDeviceQueue(m_logicalDevice, indices.presentFamily.value(), 0, &m_presentQueue);
+		vkGetDeviceQueue(m_logicalDevice, indices.computeFamily.value_or(indices.graphicsFamily.value()), 0, &m_computeQueue);
+		vkGetDeviceQueue(m_logicalDevice, indices.transferFamily.value_or(indices.graphicsFamily.value()), 0, &m_transferQueue);
+		queryQueueFamilies(indices);
 
 		CDebugLog(0, "VK_Device created!");
 	}
+	// Fills m_deviceFeatures.descriptorIndexing and its limits, adding the extensions a pre 1.2 device needs for it.
+	// Everything the bindless table relies on must be present, otherwise it falls back to classic descriptor sets.
+	bool queryDescriptorIndexing(std::pmr::vector<const char*>& _enabledExtensions)
+	{
+		VkPhysicalDeviceProperties deviceProperties;
+		vkGetPhysicalDeviceProperties(m_physicalDevice, &deviceProperties);
+		m_deviceFeatures.deviceApiVersion = std::min(deviceProperties.apiVersion, m_deviceFeatures.instanceApiVersion);
+		m_deviceFeatures.descriptorIndexing = false;
+
+		// Feature queries through the pNext chain need 1.1 on the instance
+		if (m_deviceFeatures.instanceApiVersion < VK_API_VERSION_1_1)
+		{
+			CLog(1, "Descriptor indexing unavailable: instance is Vulkan 1.0, using classic descriptor sets.");
+			return false;
+		}
+		const bool core = m_deviceFeatures.deviceApiVersion >= VK_API_VERSION_1_2;
+		if (!core && !isDeviceExtensionAvailable(m_physicalDevice, VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME))
+		{
+			CLog(1, "Descriptor indexing unavailable: device lacks {:s}, using classic descriptor sets.", VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+			return false;
+		}
+
+		VkPhysicalDeviceDescriptorIndexingFeatures supported = {};
+		supported.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES;
+		VkPhysicalDeviceFeatures2 features = {};
+		features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+		features.pNext = &supported;
+		vkGetPhysicalDeviceFeatures2(m_physicalDevice, &features);
+
+		const bool complete = supported.shaderSampledImageArrayNonUniformIndexing && supported.shaderStorageBufferArrayNonUniformIndexing
+			&& supported.descriptorBindingSampledImageUpdateAfterBind && supported.descriptorBindingStorageBufferUpdateAfterBind
+			&& supported.descriptorBindingUpdateUnusedWhilePending && supported.descriptorBindingPartiallyBound && supported.runtimeDescriptorArray;
+		if (!complete)
+		{
+			CLog(1, "Descriptor indexing is missing features the bindless table needs, using classic descriptor sets.");
+			return false;
+		}
+
+		VkPhysicalDeviceDescriptorIndexingProperties limits = {};
+		limits.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES;
+		VkPhysicalDeviceProperties2 properties = {};
+		properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+		properties.pNext = &limits;
+		vkGetPhysicalDeviceProperties2(m_physicalDevice, &properties);
+
+		m_deviceFeatures.descriptorIndexing = true;
+		m_deviceFeatures.maxBindlessSampledImages = std::min(limits.maxPerStageDescriptorUpdateAfterBindSampledImages, limits.maxDescriptorSetUpdateAfterBindSampledImages);
+		m_deviceFeatures.maxBindlessSamplers = std::min(limits.maxPerStageDescriptorUpdateAfterBindSamplers, limits.maxDescriptorSetUpdateAfterBindSamplers);
+		m_deviceFeatures.maxBindlessStorageBuffers = std::min(limits.maxPerStageDescriptorUpdateAfterBindStorageBuffers, limits.maxDescriptorSetUpdateAfterBindStorageBuffers);
+
+		if (!core)
+		{
+			_enabledExtensions.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+			if (m_deviceFeatures.deviceApiVersion < VK_API_VERSION_1_1)
+				_enabledExtensions.push_back(VK_KHR_MAINTENANCE3_EXTENSION_NAME);
+		}
+		return true;
+	}
+	// Extended dynamic state 1 and 2 are core in 1.3, 3 is always an extension. Needs queryDescriptorIndexing() to have
+	// set deviceApiVersion.
+	void queryExtendedDynamicState(std::pmr::vector<const char*>& _enabledExtensions)
+	{
+		m_deviceFeatures.extendedDynamicState = false;
+		m_deviceFeatures.extendedDynamicState2 = false;
+		m_deviceFeatures.extendedDynamicState3PolygonMode = false;
+#ifdef VK_EXT_extended_dynamic_state
+		if (m_deviceFeatures.instanceApiVersion < VK_API_VERSION_1_1)
+		{
+			CLog(1, "Extended dynamic state unavailable: instance is Vulkan 1.0, cull mode, depth state and topology stay in the pipeline.");
+			return;
+		}
+		const bool core = m_deviceFeatures.deviceApiVersion >= VK_MAKE_VERSION(1, 3, 0);
+		const bool hasExtension = core || isDeviceExtensionAvailable(m_physicalDevice, VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME);
+#ifdef VK_EXT_extended_dynamic_state2
+		const bool hasExtension2 = core || isDeviceExtensionAvailable(m_physicalDevice, VK_EXT_EXTENDED_DYNAMIC_STATE_2_EXTENSION_NAME);
+#endif
+#ifdef VK_EXT_extended_dynamic_state3
+		const bool hasExtension3 = isDeviceExtensionAvailable(m_physicalDevice, VK_EXT_EXTENDED_DYNAMIC_STATE_3_EXTENSION_NAME);
+#endif
+
+		VkPhysicalDeviceFeatures2 features = {};
+		features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+		VkPhysicalDeviceExtendedDynamicStateFeaturesEXT supported = {};
+		supported.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_FEATURES_EXT;
+		if (hasExtension && !core)
+		{
+			supported.pNext = features.pNext;
+			features.pNext = &supported;
+		}
+#ifdef VK_EXT_extended_dynamic_state2
+		VkPhysicalDeviceExtendedDynamicState2FeaturesEXT supported2 = {};
+		supported2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_2_FEATURES_EXT;
+		if (hasExtension2 && !core)
+		{
+			supported2.pNext = features.pNext;
+			features.pNext = &supported2;
+		}
+#endif
+#ifdef VK_EXT_extended_dynamic_state3
+		VkPhysicalDeviceExtendedDynamicState3FeaturesEXT supported3 = {};
+		supported3.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_3_FEATURES_EXT;
+		if (hasExtension3)
+		{
+			supported3.pNext = features.pNext;
+			features.pNext = &supported3;
+		}
+#endif
+		vkGetPhysicalDeviceFeatures2(m_physicalDevice, &features);
+
+		m_deviceFeatures.extendedDynamicState = core || (hasExtension && supported.extendedDynamicState);
+		if (m_deviceFeatures.extendedDynamicState && !core)
+			_enabledExtensions.push_back(VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME);
+#ifdef VK_EXT_extended_dynamic_state2
+		m_deviceFeatures.extendedDynamicState2 = core || (hasExtension2 && supported2.extendedDynamicState2);
+		if (m_deviceFeatures.extendedDynamicState2 && !core)
+			_enabledExtensions.push_back(VK_EXT_EXTENDED_DYNAMIC_STATE_2_EXTENSION_NAME);
+#endif
+#ifdef VK_EXT_extended_dynamic_state3
+		m_deviceFeatures.extendedDynamicState3PolygonMode = hasExtension3 && supported3.extendedDynamicState3PolygonMode;
+		if (m_deviceFeatures.extendedDynamicState3PolygonMode)
+			_enabledExtensions.push_back(VK_EXT_EXTENDED_DYNAMIC_STATE_3_EXTENSION_NAME);
+#endif
+#else
+		(void)_enabledExtensions;
+		CLog(1, "Extended dynamic state unavailable: Vulkan headers predate it, cull mode, depth state and topology stay in the pipeline.");
+#endif
+	}
+	// Core in 1.3, an extension before; the feature has to be enabled either way. Needs queryDescriptorIndexing() to
+	// have set deviceApiVersion.
+	void querySynchronization2(std::pmr::vector<const char*>& _enabledExtensions)
+	{
+		m_deviceFeatures.synchronization2 = false;
+#ifdef VK_KHR_synchronization2
+		if (m_deviceFeatures.instanceApiVersion < VK_API_VERSION_1_1)
+		{
+			CLog(1, "Synchronization2 unavailable: instance is Vulkan 1.0, barriers use vkCmdPipelineBarrier.");
+			return;
+		}
+		const bool core = m_deviceFeatures.deviceApiVersion >= VK_MAKE_VERSION(1, 3, 0);
+		if (!core && !isDeviceExtensionAvailable(m_physicalDevice, VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME))
+		{
+			CLog(1, "Synchronization2 unavailable: device lacks {:s}, barriers use vkCmdPipelineBarrier.", VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME);
+			return;
+		}
+
+		VkPhysicalDeviceSynchronization2FeaturesKHR supported = {};
+		supported.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES_KHR;
+		VkPhysicalDeviceFeatures2 features = {};
+		features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+		features.pNext = &supported;
+		vkGetPhysicalDeviceFeatures2(m_physicalDevice, &features);
+
+		m_deviceFeatures.synchronization2 = supported.synchronization2 == VK_TRUE;
+		if (m_deviceFeatures.synchronization2 && !core)
+			_enabledExtensions.push_back(VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME);
+#else
+		(void)_enabledExtensions;
+		CLog(1, "Synchronization2 unavailable: Vulkan headers predate it, barriers use vkCmdPipelineBarrier.");
+#endif
+	}
+	// Core in 1.2, an extension before. Needs queryDescriptorIndexing() to have set deviceApiVersion.
+	void queryTimelineSemaphore(std::pmr::vector<const char*>& _enabledExtensions)
+	{
+		m_deviceFeatures.timelineSemaphore = false;
+#ifdef VK_KHR_timeline_semaphore
+		if (m_deviceFeatures.instanceApiVersion < VK_API_VERSION_1_1)
+		{
+			CLog(1, "Timeline semaphores unavailable: instance is Vulkan 1.0, GPU sync uses a fence per submission.");
+			return;
+		}
+		const bool core = m_deviceFeatures.deviceApiVersion >= VK_MAKE_VERSION(1, 2, 0);
+		if (!core && !isDeviceExtensionAvailable(m_physicalDevice, VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME))
+		{
+			CLog(1, "Timeline semaphores unavailable: device lacks {:s}, GPU sync uses a fence per submission.", VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+			return;
+		}
+
+		VkPhysicalDeviceTimelineSemaphoreFeaturesKHR supported = {};
+		supported.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+		VkPhysicalDeviceFeatures2 features = {};
+		features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+		features.pNext = &supported;
+		vkGetPhysicalDeviceFeatures2(m_physicalDevice, &features);
+
+		m_deviceFeatures.timelineSemaphore = supported.timelineSemaphore == VK_TRUE;
+		if (m_deviceFeatures.timelineSemaphore && !core)
+			_enabledExtensions.push_back(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+#else
+		(void)_enabledExtensions;
+		CLog(1, "Timeline semaphores unavailable: Vulkan headers predate them, GPU sync uses a fence per submission.");
+#endif
+	}
+	bool isDeviceExtensionAvailable(VkPhysicalDevice _physicalDevice, const char* _name)
+	{
+		uint32_t extentionCount;
+		vkEnumerateDeviceExtensionProperties(_physicalDevice, nullptr, &extentionCount, nullptr);
+
+		std::pmr::vector<VkExtensionProperties> availableExtentions(extentionCount, &m_frameArena);
+		vkEnumerateDeviceExtensionProperties(_physicalDevice, nullptr, &extentionCount, availableExtentions.data());
+
+		for (const auto& it : availableExtentions)
+		{
+			if (strcmp(it.extensionName, _name) == 0)
+				return true;
+		}
+		return false;
+	}
 	struct QueueFamilyIndices
 	{
 		// the uint32_t m_variables are associated with the queue that supports that call type
 		std::optional<uint32_t> graphicsFamily;
 		std::optional<uint32_t> presentFamily;
+		std::optional<uint32_t> computeFamily;		// compute without graphics, for async compute
+		std::optional<uint32_t> transferFamily;		// transfer only, usually the copy engine
 		bool isComplete() // All required device queues are accounted for
 		{
 			return this->graphicsFamily.has_value() && presentFamily.has_value();
@@ -377,30 +1142,58 @@ private:
 		uint32_t queueFamilyCount;
 		vkGetPhysicalDeviceQueueFamilyProperties(_physicalDevice, &queueFamilyCount, nullptr);
 
-		std::vector<VkQueueFamilyProperties> queueFamilyVec(queueFamilyCount);
+		std::pmr::vector<VkQueueFamilyProperties> queueFamilyVec(queueFamilyCount, &m_frameArena);
 		vkGetPhysicalDeviceQueueFamilyProperties(_physicalDevice, &queueFamilyCount, queueFamilyVec.data());
 
+		// Every family is looked at, the first of each kind wins
 		for (uint32_t i = 0; i< queueFamilyVec.size(); i++)
 		{
-			if (queueFamilyVec[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) // Does the queue support Graphics Bit?
+			const VkQueueFlags flags = queueFamilyVec[i].queueFlags;
+			if ((flags & VK_QUEUE_GRAPHICS_BIT) && !indices.graphicsFamily.has_value()) // Does the queue support Graphics Bit?
 			{
 				indices.graphicsFamily = i;
-			}			
+			}
 			VkBool32 presentSupport;
 			vkGetPhysicalDeviceSurfaceSupportKHR(_physicalDevice, i, m_surface, &presentSupport);
-			if (presentSupport) // Does the queue support presentation queue?
+			if (presentSupport && !indices.presentFamily.has_value()) // Does the queue support presentation queue?
 			{
 				indices.presentFamily = i;
 			}
-			if (indices.isComplete()) // Break if queues are accounted for
+			if ((flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT) && !indices.computeFamily.has_value())
 			{
-				break;
+				indices.computeFamily = i;
+			}
+			if ((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) && !indices.transferFamily.has_value())
+			{
+				indices.transferFamily = i;
 			}
-			i++;
 		}
 		CVerifyCrash(indices.isComplete(), "QueueFamilies doesnt support desired queue functionality!");
 		return indices;
 	}
+	// Fills the queue families of m_deviceFeatures and what the profiler needs to read timestamps on them.
+	void queryQueueFamilies(const QueueFamilyIndices& _indices)
+	{
+		const uint32_t families[QUEUE_TYPE_COUNT] = { _indices.graphicsFamily.value(),
+			_indices.computeFamily.value_or(_indices.graphicsFamily.value()), _indices.transferFamily.value_or(_indices.graphicsFamily.value()) };
+
+		uint32_t queueFamilyCount;
+		vkGetPhysicalDeviceQueueFamilyProperties(m_physicalDevice, &queueFamilyCount, nullptr);
+		std::pmr::vector<VkQueueFamilyProperties> queueFamilyVec(queueFamilyCount, &m_frameArena);
+		vkGetPhysicalDeviceQueueFamilyProperties(m_physicalDevice, &queueFamilyCount, queueFamilyVec.data());
+		VkPhysicalDeviceProperties deviceProperties;
+		vkGetPhysicalDeviceProperties(m_physicalDevice, &deviceProperties);
+
+		static const char* names[QUEUE_TYPE_COUNT] = { "graphics", "async compute", "transfer" };
+		for (uint32_t q = 0; q < QUEUE_TYPE_COUNT; q++)
+		{
+			m_deviceFeatures.queueFamilies[q] = families[q];
+			m_deviceFeatures.timestampValidBits[q] = queueFamilyVec[families[q]].timestampValidBits;
+			const bool shared = q != 0 && families[q] == families[0];
+			CLog(0, "Queue {:s}: family {}{:s}, {} timestamp bits.", names[q], families[q], shared ? " (shared with graphics)" : "", m_deviceFeatures.timestampValidBits[q]);
+		}
+		m_deviceFeatures.timestampPeriod = deviceProperties.limits.timestampPeriod;
+	}
 	bool isDeviceSuitable(VkPhysicalDevice _physicalDevice)
 	{
 		QueueFamilyIndices indicies = findQueueFamilies(_physicalDevice);
@@ -417,8 +1210,8 @@ private:
 	struct CheckExtentionHelper
 	{
 	public:
-		CheckExtentionHelper(const std::vector<const char*>& _vec)
-			: deviceExtensions(_vec), bfoundExtents(std::vector<bool>(_vec.size(), false))
+		CheckExtentionHelper(const std::vector<const char*>& _vec, std::pmr::memory_resource* _memory)
+			: deviceExtensions(_vec), bfoundExtents(_vec.size(), false, _memory)
 		{}
 		void changeBTrue(uint32_t i)
 		{
@@ -445,17 +1238,17 @@ private:
 		const std::vector<const char*>& deviceExtensions;
 	private:
 		bool m_isAllFound;
-		std::vector<bool> bfoundExtents;
+		std::pmr::vector<bool> bfoundExtents;
 	};
 	bool checkDeviceExtentionSupport(VkPhysicalDevice _physicalDevice)
 	{
-		CheckExtentionHelper extentHelp(deviceExtensions);
+		CheckExtentionHelper extentHelp(deviceExtensions, &m_frameArena);
 		
 
 		uint32_t extentionCount;
 		vkEnumerateDeviceExtensionProperties(_physicalDevice, nullptr, &extentionCount, nullptr);
 
-		std::vector<VkExtensionProperties> availableExtentions(extentionCount);
+		std::pmr::vector<VkExtensionProperties> availableExtentions(extentionCount, &m_frameArena);
 		vkEnumerateDeviceExtensionProperties(_physicalDevice, nullptr, &extentionCount, availableExtentions.data());
 
 		
@@ -511,7 +1304,8 @@ private:
 		appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
 		appInfo.pEngineName = "No Engine";
 		appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-		appInfo.apiVersion = VK_API_VERSION_1_0;
+		appInfo.apiVersion = negotiateInstanceApiVersion();
+		m_deviceFeatures.instanceApiVersion = appInfo.apiVersion;
 
 		VkInstanceCreateInfo createInfo = {};
 		createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
@@ -531,7 +1325,7 @@ private:
 #endif // _DEBUG		
 
 		// GLFW Instance extensions request setup
-		std::vector<const char*> extensions = getRequiredExtensions();
+		std::pmr::vector<const char*> extensions = getRequiredExtensions();
 		createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
 		createInfo.ppEnabledExtensionNames = extensions.data();
 
@@ -543,6 +1337,17 @@ private:
 		CLog(0,"VK_Instance created!");
 #endif
 	}
+	// Asks for up to Vulkan 1.2. A 1.0 loader has no vkEnumerateInstanceVersion and fails instance creation for any newer version.
+	uint32_t negotiateInstanceApiVersion()
+	{
+		auto enumerateInstanceVersion = (PFN_vkEnumerateInstanceVersion)vkGetInstanceProcAddr(nullptr, "vkEnumerateInstanceVersion");
+		if (enumerateInstanceVersion == nullptr)
+			return VK_API_VERSION_1_0;
+
+		uint32_t supported = VK_API_VERSION_1_0;
+		enumerateInstanceVersion(&supported);
+		return std::min(supported, VK_API_VERSION_1_2);
+	}
 	void setupDebugMessanger()
 	{
 #if !_DEBUG
@@ -628,13 +1433,13 @@ private:
 		}
 		return true;
 	}
-	std::vector<const char*> getRequiredExtensions()
+	std::pmr::vector<const char*> getRequiredExtensions()
 	{
 		uint32_t glfwExtensionCount = 0;
 		const char** glfwExtensions;
 		glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
 
-		std::vector<const char*> extensions(glfwExtensions, glfwExtensions + glfwExtensionCount);
+		std::pmr::vector<const char*> extensions(glfwExtensions, glfwExtensions + glfwExtensionCount, &m_frameArena);
 #if _DEBUG
 		
 		extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
@@ -672,9 +1477,16 @@ private:
 	}
 };
 
-int main() 
-{	
-	HelloTriangleApplication app;
+// --no-pipeline-manifest starts cold, for comparing startup against a prewarmed run.
+int main(int argc, char** argv)
+{
+	bool usePipelineManifest = true;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--no-pipeline-manifest") == 0)
+			usePipelineManifest = false;
+	}
+	HelloTriangleApplication app(usePipelineManifest);
 
 	app.run();
 	
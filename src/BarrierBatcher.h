@@ -0,0 +1,298 @@
+#pragma once
+#include "Core.h"
+#include "DeviceFeatures.h"
+#include <vulkan/vulkan.h>
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+
+struct BarrierBatcherStats
+{
+	uint64_t barriers = 0;		// added
+	uint64_t merged = 0;		// folded into another barrier of the same batch
+	uint64_t emitted = 0;
+	uint64_t batches = 0;		// barrier commands recorded
+};
+
+// Collects the image and buffer barriers between two passes and records them with one command. Barriers of the same
+// image or buffer with the same layouts and queue families whose ranges overlap or touch are merged, as long as the
+// union is still exactly a range (mip levels x array layers for images). With synchronization2 every barrier keeps its
+// own stage masks in one vkCmdPipelineBarrier2; the 1.0 path ORs them into the stage masks of one vkCmdPipelineBarrier.
+class BarrierBatcher
+{
+public:
+	struct ImageBarrier
+	{
+		VkImage image;
+		VkImageSubresourceRange range;
+		VkPipelineStageFlags srcStages;		// 0 when nothing has to finish first
+		VkAccessFlags srcAccess;
+		VkPipelineStageFlags dstStages;
+		VkAccessFlags dstAccess;
+		VkImageLayout oldLayout;
+		VkImageLayout newLayout;
+		uint32_t srcQueueFamily;
+		uint32_t dstQueueFamily;
+	};
+
+	struct BufferBarrier
+	{
+		VkBuffer buffer;
+		VkDeviceSize offset;
+		VkDeviceSize size;
+		VkPipelineStageFlags srcStages;
+		VkAccessFlags srcAccess;
+		VkPipelineStageFlags dstStages;
+		VkAccessFlags dstAccess;
+		uint32_t srcQueueFamily;
+		uint32_t dstQueueFamily;
+	};
+
+	void init(VkDevice _device, const DeviceFeatures& _features)
+	{
+		m_synchronization2 = false;
+#ifdef VK_KHR_synchronization2
+		if (_features.synchronization2)
+		{
+			// The 1.3 core entry point has the same signature as the extension one
+			const bool core = _features.deviceApiVersion >= VK_MAKE_VERSION(1, 3, 0);
+			m_cmdPipelineBarrier2 = (PFN_vkCmdPipelineBarrier2KHR)vkGetDeviceProcAddr(_device, core ? "vkCmdPipelineBarrier2" : "vkCmdPipelineBarrier2KHR");
+			m_synchronization2 = m_cmdPipelineBarrier2 != nullptr;
+		}
+#else
+		(void)_device;
+		(void)_features;
+#endif
+		CLog(0, "Barrier batcher: {:s}.", m_synchronization2 ? "vkCmdPipelineBarrier2" : "vkCmdPipelineBarrier");
+	}
+
+	bool usesSynchronization2() const { return m_synchronization2; }
+
+	void add(const ImageBarrier& _barrier)
+	{
+		m_stats.barriers++;
+		for (ImageBarrier& it : m_images)
+		{
+			if (tryMerge(it, _barrier))
+			{
+				m_stats.merged++;
+				return;
+			}
+		}
+		m_images.push_back(_barrier);
+	}
+
+	void add(const BufferBarrier& _barrier)
+	{
+		m_stats.barriers++;
+		for (BufferBarrier& it : m_buffers)
+		{
+			if (tryMerge(it, _barrier))
+			{
+				m_stats.merged++;
+				return;
+			}
+		}
+		m_buffers.push_back(_barrier);
+	}
+
+	// Records everything added since the last flush, nothing if that's nothing.
+	void flush(VkCommandBuffer _commandBuffer)
+	{
+		if (m_images.empty() && m_buffers.empty())
+			return;
+		m_stats.emitted += m_images.size() + m_buffers.size();
+		m_stats.batches++;
+#ifdef VK_KHR_synchronization2
+		if (m_synchronization2)
+			flush2(_commandBuffer);
+		else
+#endif
+			flushLegacy(_commandBuffer);
+		m_images.clear();
+		m_buffers.clear();
+	}
+
+	const BarrierBatcherStats& getStats() const { return m_stats; }
+
+	void logStats() const
+	{
+		CLog(0, "Barrier batcher: {} barriers, {} merged, {} emitted in {} batches ({:.2f} per batch).", m_stats.barriers, m_stats.merged, m_stats.emitted,
+			m_stats.batches, m_stats.batches > 0 ? static_cast<double>(m_stats.emitted) / m_stats.batches : 0.0);
+	}
+
+private:
+	// [begin, end) of a range given as offset and count, with "remaining" running to the end.
+	static uint64_t rangeEnd(uint64_t _begin, uint64_t _count, uint64_t _remaining)
+	{
+		return _count == _remaining ? ~0ull : _begin + _count;
+	}
+	static uint64_t rangeCount(uint64_t _begin, uint64_t _end, uint64_t _remaining)
+	{
+		return _end == ~0ull ? _remaining : _end - _begin;
+	}
+	// Overlapping or touching ranges, whose union is a single range.
+	static bool joins(uint64_t _beginA, uint64_t _endA, uint64_t _beginB, uint64_t _endB)
+	{
+		return _beginA <= _endB && _beginB <= _endA;
+	}
+
+	static bool tryMerge(ImageBarrier& _into, const ImageBarrier& _barrier)
+	{
+		if (_into.image != _barrier.image || _into.range.aspectMask != _barrier.range.aspectMask || _into.oldLayout != _barrier.oldLayout ||
+			_into.newLayout != _barrier.newLayout || _into.srcQueueFamily != _barrier.srcQueueFamily || _into.dstQueueFamily != _barrier.dstQueueFamily)
+			return false;
+
+		const uint64_t mipBegin[2] = { _into.range.baseMipLevel, _barrier.range.baseMipLevel };
+		const uint64_t mipEnd[2] = { rangeEnd(mipBegin[0], _into.range.levelCount, VK_REMAINING_MIP_LEVELS), rangeEnd(mipBegin[1], _barrier.range.levelCount, VK_REMAINING_MIP_LEVELS) };
+		const uint64_t layerBegin[2] = { _into.range.baseArrayLayer, _barrier.range.baseArrayLayer };
+		const uint64_t layerEnd[2] = { rangeEnd(layerBegin[0], _into.range.layerCount, VK_REMAINING_ARRAY_LAYERS), rangeEnd(layerBegin[1], _barrier.range.layerCount, VK_REMAINING_ARRAY_LAYERS) };
+		const bool sameMips = mipBegin[0] == mipBegin[1] && mipEnd[0] == mipEnd[1];
+		const bool sameLayers = layerBegin[0] == layerBegin[1] && layerEnd[0] == layerEnd[1];
+		const bool mergeLayers = sameMips && joins(layerBegin[0], layerEnd[0], layerBegin[1], layerEnd[1]);
+		const bool mergeMips = sameLayers && joins(mipBegin[0], mipEnd[0], mipBegin[1], mipEnd[1]);
+		if (!mergeLayers && !mergeMips)
+			return false;
+
+		const uint64_t newMipBegin = std::min(mipBegin[0], mipBegin[1]);
+		const uint64_t newLayerBegin = std::min(layerBegin[0], layerBegin[1]);
+		_into.range.baseMipLevel = static_cast<uint32_t>(newMipBegin);
+		_into.range.levelCount = static_cast<uint32_t>(rangeCount(newMipBegin, std::max(mipEnd[0], mipEnd[1]), VK_REMAINING_MIP_LEVELS));
+		_into.range.baseArrayLayer = static_cast<uint32_t>(newLayerBegin);
+		_into.range.layerCount = static_cast<uint32_t>(rangeCount(newLayerBegin, std::max(layerEnd[0], layerEnd[1]), VK_REMAINING_ARRAY_LAYERS));
+		_into.srcStages |= _barrier.srcStages;
+		_into.srcAccess |= _barrier.srcAccess;
+		_into.dstStages |= _barrier.dstStages;
+		_into.dstAccess |= _barrier.dstAccess;
+		return true;
+	}
+
+	static bool tryMerge(BufferBarrier& _into, const BufferBarrier& _barrier)
+	{
+		if (_into.buffer != _barrier.buffer || _into.srcQueueFamily != _barrier.srcQueueFamily || _into.dstQueueFamily != _barrier.dstQueueFamily)
+			return false;
+		const uint64_t end[2] = { rangeEnd(_into.offset, _into.size, VK_WHOLE_SIZE), rangeEnd(_barrier.offset, _barrier.size, VK_WHOLE_SIZE) };
+		if (!joins(_into.offset, end[0], _barrier.offset, end[1]))
+			return false;
+
+		const uint64_t offset = std::min(_into.offset, _barrier.offset);
+		_into.size = rangeCount(offset, std::max(end[0], end[1]), VK_WHOLE_SIZE);
+		_into.offset = offset;
+		_into.srcStages |= _barrier.srcStages;
+		_into.srcAccess |= _barrier.srcAccess;
+		_into.dstStages |= _barrier.dstStages;
+		_into.dstAccess |= _barrier.dstAccess;
+		return true;
+	}
+
+	void flushLegacy(VkCommandBuffer _commandBuffer)
+	{
+		VkPipelineStageFlags srcStages = 0;
+		VkPipelineStageFlags dstStages = 0;
+		m_legacyImages.resize(m_images.size());
+		for (size_t i = 0; i < m_images.size(); i++)
+		{
+			const ImageBarrier& it = m_images[i];
+			VkImageMemoryBarrier& barrier = m_legacyImages[i];
+			barrier = {};
+			barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+			barrier.srcAccessMask = it.srcAccess;
+			barrier.dstAccessMask = it.dstAccess;
+			barrier.oldLayout = it.oldLayout;
+			barrier.newLayout = it.newLayout;
+			barrier.srcQueueFamilyIndex = it.srcQueueFamily;
+			barrier.dstQueueFamilyIndex = it.dstQueueFamily;
+			barrier.image = it.image;
+			barrier.subresourceRange = it.range;
+			srcStages |= it.srcStages;
+			dstStages |= it.dstStages;
+		}
+		m_legacyBuffers.resize(m_buffers.size());
+		for (size_t i = 0; i < m_buffers.size(); i++)
+		{
+			const BufferBarrier& it = m_buffers[i];
+			VkBufferMemoryBarrier& barrier = m_legacyBuffers[i];
+			barrier = {};
+			barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+			barrier.srcAccessMask = it.srcAccess;
+			barrier.dstAccessMask = it.dstAccess;
+			barrier.srcQueueFamilyIndex = it.srcQueueFamily;
+			barrier.dstQueueFamilyIndex = it.dstQueueFamily;
+			barrier.buffer = it.buffer;
+			barrier.offset = it.offset;
+			barrier.size = it.size;
+			srcStages |= it.srcStages;
+			dstStages |= it.dstStages;
+		}
+		// Nothing to wait for, e.g. only first uses of transient attachments
+		if (srcStages == 0)
+			srcStages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+		if (dstStages == 0)
+			dstStages = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+		vkCmdPipelineBarrier(_commandBuffer, srcStages, dstStages, 0, 0, nullptr, static_cast<uint32_t>(m_legacyBuffers.size()), m_legacyBuffers.data(),
+			static_cast<uint32_t>(m_legacyImages.size()), m_legacyImages.data());
+	}
+
+#ifdef VK_KHR_synchronization2
+	// The 1.0 stage and access bits have the same values in the 64 bit masks, and an empty source scope is allowed.
+	void flush2(VkCommandBuffer _commandBuffer)
+	{
+		m_images2.resize(m_images.size());
+		for (size_t i = 0; i < m_images.size(); i++)
+		{
+			const ImageBarrier& it = m_images[i];
+			VkImageMemoryBarrier2KHR& barrier = m_images2[i];
+			barrier = {};
+			barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2_KHR;
+			barrier.srcStageMask = it.srcStages;
+			barrier.srcAccessMask = it.srcAccess;
+			barrier.dstStageMask = it.dstStages;
+			barrier.dstAccessMask = it.dstAccess;
+			barrier.oldLayout = it.oldLayout;
+			barrier.newLayout = it.newLayout;
+			barrier.srcQueueFamilyIndex = it.srcQueueFamily;
+			barrier.dstQueueFamilyIndex = it.dstQueueFamily;
+			barrier.image = it.image;
+			barrier.subresourceRange = it.range;
+		}
+		m_buffers2.resize(m_buffers.size());
+		for (size_t i = 0; i < m_buffers.size(); i++)
+		{
+			const BufferBarrier& it = m_buffers[i];
+			VkBufferMemoryBarrier2KHR& barrier = m_buffers2[i];
+			barrier = {};
+			barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2_KHR;
+			barrier.srcStageMask = it.srcStages;
+			barrier.srcAccessMask = it.srcAccess;
+			barrier.dstStageMask = it.dstStages;
+			barrier.dstAccessMask = it.dstAccess;
+			barrier.srcQueueFamilyIndex = it.srcQueueFamily;
+			barrier.dstQueueFamilyIndex = it.dstQueueFamily;
+			barrier.buffer = it.buffer;
+			barrier.offset = it.offset;
+			barrier.size = it.size;
+		}
+		VkDependencyInfoKHR dependency = {};
+		dependency.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO_KHR;
+		dependency.bufferMemoryBarrierCount = static_cast<uint32_t>(m_buffers2.size());
+		dependency.pBufferMemoryBarriers = m_buffers2.data();
+		dependency.imageMemoryBarrierCount = static_cast<uint32_t>(m_images2.size());
+		dependency.pImageMemoryBarriers = m_images2.data();
+		m_cmdPipelineBarrier2(_commandBuffer, &dependency);
+	}
+#endif
+
+	bool m_synchronization2 = false;
+	std::vector<ImageBarrier> m_images;
+	std::vector<BufferBarrier> m_buffers;
+	// Scratch for the recorded structs, kept so steady state frames don't allocate
+	std::vector<VkImageMemoryBarrier> m_legacyImages;
+	std::vector<VkBufferMemoryBarrier> m_legacyBuffers;
+#ifdef VK_KHR_synchronization2
+	PFN_vkCmdPipelineBarrier2KHR m_cmdPipelineBarrier2 = nullptr;
+	std::vector<VkImageMemoryBarrier2KHR> m_images2;
+	std::vector<VkBufferMemoryBarrier2KHR> m_buffers2;
+#endif
+	BarrierBatcherStats m_stats;
+};
@@ -0,0 +1,398 @@
+#pragma once
+#include "Core.h"
+#include "DeviceFeatures.h"
+#include "DescriptorStats.h"
+#include "DescriptorAllocator.h"
+#include <vulkan/vulkan.h>
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+// Indices a draw passes to its shaders through push constants, this is the whole per draw binding cost in bindless mode.
+struct BindlessDrawIndices
+{
+	uint32_t sampledImage;
+	uint32_t sampler;
+	uint32_t storageBuffer;
+	uint32_t drawData;		// free for the caller (instance id, material id...)
+};
+
+// Every sampled image, sampler and storage buffer the renderer uses gets a slot in one of three large descriptor arrays
+// and is addressed from shaders by that 32 bit index. The set is bound once per command buffer, draws only push indices.
+//
+// With descriptor indexing the arrays are update after bind / partially bound, so resources are added while frames are
+// in flight and a slot is only reused once the GPU has retired the frame that removed it. A slot's descriptor is written
+// by flushUpdates(), which has to run before any submission that uses it, even if the slot was added mid recording.
+// Without descriptor indexing the table falls back to classic sets: the same indices select the descriptors written
+// into a small per draw set, allocated from the frame's DescriptorAllocator pools. Both paths count their descriptor
+// traffic in the same DescriptorCounters.
+class BindlessTable
+{
+public:
+	enum class ResourceType : uint32_t
+	{
+		SampledImage, Sampler, StorageBuffer, Count
+	};
+	static constexpr uint32_t INVALID_INDEX = UINT32_MAX;
+
+	void init(VkDevice _device, const DeviceFeatures& _features, DescriptorAllocator& _allocator)
+	{
+		m_device = _device;
+		m_allocator = &_allocator;
+		m_bindless = _features.descriptorIndexing;
+
+		m_capacity[(uint32_t)ResourceType::SampledImage] = m_bindless ? std::min(MAX_SAMPLED_IMAGES, _features.maxBindlessSampledImages) : MAX_SAMPLED_IMAGES;
+		m_capacity[(uint32_t)ResourceType::Sampler] = m_bindless ? std::min(MAX_SAMPLERS, _features.maxBindlessSamplers) : MAX_SAMPLERS;
+		m_capacity[(uint32_t)ResourceType::StorageBuffer] = m_bindless ? std::min(MAX_STORAGE_BUFFERS, _features.maxBindlessStorageBuffers) : MAX_STORAGE_BUFFERS;
+		for (uint32_t i = 0; i < (uint32_t)ResourceType::Count; i++)
+		{
+			m_slots[i].resize(m_capacity[i]);
+		}
+
+		if (m_bindless)
+			createBindlessSet();
+		else
+			createClassicLayout();
+		createPipelineLayout();
+
+		CLog(0, "Descriptor model: {:s} ({} sampled images, {} samplers, {} storage buffers).", m_bindless ? "bindless" : "classic sets",
+			m_capacity[0], m_capacity[1], m_capacity[2]);
+	}
+
+	void destroy()
+	{
+		vkDestroyDescriptorPool(m_device, m_bindlessPool, nullptr);
+		vkDestroyPipelineLayout(m_device, m_pipelineLayout, nullptr);
+		vkDestroyDescriptorSetLayout(m_device, m_setLayout, nullptr);
+		m_bindlessPool = VK_NULL_HANDLE;
+		m_bindlessSet = VK_NULL_HANDLE;
+		m_pipelineLayout = VK_NULL_HANDLE;
+		m_setLayout = VK_NULL_HANDLE;
+	}
+
+	uint32_t addSampledImage(VkImageView _view, VkImageLayout _layout)
+	{
+		Slot slot = {};
+		slot.image = { VK_NULL_HANDLE, _view, _layout };
+		return add(ResourceType::SampledImage, slot);
+	}
+	uint32_t addSampler(VkSampler _sampler)
+	{
+		Slot slot = {};
+		slot.image = { _sampler, VK_NULL_HANDLE, VK_IMAGE_LAYOUT_UNDEFINED };
+		return add(ResourceType::Sampler, slot);
+	}
+	uint32_t addStorageBuffer(VkBuffer _buffer, VkDeviceSize _offset, VkDeviceSize _range)
+	{
+		Slot slot = {};
+		slot.buffer = { _buffer, _offset, _range };
+		return add(ResourceType::StorageBuffer, slot);
+	}
+
+	// In flight frames may still index the slot, it is handed out again once _retireValue has completed.
+	void remove(ResourceType _type, uint32_t _index, uint64_t _retireValue)
+	{
+		if (_index == INVALID_INDEX)
+			return;
+		m_pendingRemovals.push_back({ _type, _index, _retireValue });
+	}
+
+	// Slots are reused once the frame that removed them has retired.
+	void beginFrame(uint64_t _completedValue)
+	{
+		size_t kept = 0;
+		for (size_t i = 0; i < m_pendingRemovals.size(); i++)
+		{
+			const PendingRemoval& removal = m_pendingRemovals[i];
+			if (removal.retireValue <= _completedValue)
+			{
+				m_slots[(uint32_t)removal.type][removal.index] = Slot();
+				m_freeIndices[(uint32_t)removal.type].push_back(removal.index);
+			}
+			else
+			{
+				m_pendingRemovals[kept++] = removal;
+			}
+		}
+		m_pendingRemovals.resize(kept);
+		m_boundCommandBuffer = VK_NULL_HANDLE;
+	}
+
+	// Writes every slot added since the last flush in one vkUpdateDescriptorSets call, call before every submit. Classic mode
+	// writes at draw time instead.
+	void flushUpdates()
+	{
+		if (!m_bindless || m_dirty.empty())
+			return;
+
+		m_writes.clear();
+		m_writes.reserve(m_dirty.size());
+		for (const DirtySlot& dirty : m_dirty)
+		{
+			const Slot& slot = m_slots[(uint32_t)dirty.type][dirty.index];
+
+			VkWriteDescriptorSet write = {};
+			write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			write.dstSet = m_bindlessSet;
+			write.dstBinding = (uint32_t)dirty.type;
+			write.dstArrayElement = dirty.index;
+			write.descriptorCount = 1;
+			write.descriptorType = descriptorType(dirty.type);
+			if (dirty.type == ResourceType::StorageBuffer)
+				write.pBufferInfo = &slot.buffer;
+			else
+				write.pImageInfo = &slot.image;
+			m_writes.push_back(write);
+		}
+		vkUpdateDescriptorSets(m_device, static_cast<uint32_t>(m_writes.size()), m_writes.data(), 0, nullptr);
+
+		DescriptorStats& stats = m_counters.current();
+		stats.descriptorWrites += static_cast<uint32_t>(m_writes.size());
+		stats.updateCalls++;
+		m_dirty.clear();
+	}
+
+	// Makes _indices visible to the next draw. Bindless binds the table once per command buffer and pushes the indices,
+	// classic allocates, writes and binds a set for the draw.
+	void bindDraw(VkCommandBuffer _cmd, VkPipelineBindPoint _bindPoint, const BindlessDrawIndices& _indices)
+	{
+		DescriptorStats& stats = m_counters.current();
+		if (m_bindless)
+		{
+			if (_cmd != m_boundCommandBuffer)
+			{
+				vkCmdBindDescriptorSets(_cmd, _bindPoint, m_pipelineLayout, 0, 1, &m_bindlessSet, 0, nullptr);
+				m_boundCommandBuffer = _cmd;
+				stats.setBinds++;
+			}
+		}
+		else
+		{
+			VkDescriptorSet set = m_allocator->allocate(m_setLayout);
+			stats.setAllocations++;
+
+			VkWriteDescriptorSet writes[(uint32_t)ResourceType::Count];
+			uint32_t writeCount = 0;
+			const uint32_t indices[] = { _indices.sampledImage, _indices.sampler, _indices.storageBuffer };
+			for (uint32_t type = 0; type < (uint32_t)ResourceType::Count; type++)
+			{
+				if (indices[type] == INVALID_INDEX)
+					continue;
+				const Slot& slot = m_slots[type][indices[type]];
+
+				VkWriteDescriptorSet& write = writes[writeCount++];
+				write = {};
+				write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+				write.dstSet = set;
+				write.dstBinding = type;
+				write.descriptorCount = 1;
+				write.descriptorType = descriptorType((ResourceType)type);
+				if ((ResourceType)type == ResourceType::StorageBuffer)
+					write.pBufferInfo = &slot.buffer;
+				else
+					write.pImageInfo = &slot.image;
+			}
+			vkUpdateDescriptorSets(m_device, writeCount, writes, 0, nullptr);
+			stats.descriptorWrites += writeCount;
+			stats.updateCalls++;
+
+			vkCmdBindDescriptorSets(_cmd, _bindPoint, m_pipelineLayout, 0, 1, &set, 0, nullptr);
+			stats.setBinds++;
+		}
+		vkCmdPushConstants(_cmd, m_pipelineLayout, PUSH_CONSTANT_STAGES, 0, sizeof(BindlessDrawIndices), &_indices);
+	}
+
+	void endFrame()
+	{
+		m_counters.endFrame();
+	}
+
+	void logStats() const
+	{
+		const DescriptorStats& last = m_counters.lastFrame();
+		const DescriptorStats& peak = m_counters.peak();
+		CLog(0, "Descriptors ({:s}): last frame {} writes / {} update calls / {} binds / {} set allocations, peak {} / {} / {} / {}.",
+			m_bindless ? "bindless" : "classic sets",
+			last.descriptorWrites, last.updateCalls, last.setBinds, last.setAllocations,
+			peak.descriptorWrites, peak.updateCalls, peak.setBinds, peak.setAllocations);
+		CLog(0, "Bindless slots in use: {} sampled images, {} samplers, {} storage buffers.",
+			getUsedCount(ResourceType::SampledImage), getUsedCount(ResourceType::Sampler), getUsedCount(ResourceType::StorageBuffer));
+	}
+
+	bool isBindless() const { return m_bindless; }
+	VkDescriptorSetLayout getSetLayout() const { return m_setLayout; }
+	VkPipelineLayout getPipelineLayout() const { return m_pipelineLayout; }
+	const DescriptorCounters& getCounters() const { return m_counters; }
+	uint32_t getUsedCount(ResourceType _type) const
+	{
+		return m_nextIndex[(uint32_t)_type] - static_cast<uint32_t>(m_freeIndices[(uint32_t)_type].size());
+	}
+
+private:
+	static constexpr uint32_t MAX_SAMPLED_IMAGES = 16384;
+	static constexpr uint32_t MAX_SAMPLERS = 256;
+	static constexpr uint32_t MAX_STORAGE_BUFFERS = 4096;
+	static constexpr VkShaderStageFlags PUSH_CONSTANT_STAGES = VK_SHADER_STAGE_ALL_GRAPHICS | VK_SHADER_STAGE_COMPUTE_BIT;
+
+	struct Slot
+	{
+		VkDescriptorImageInfo image;
+		VkDescriptorBufferInfo buffer;
+	};
+	struct DirtySlot
+	{
+		ResourceType type;
+		uint32_t index;
+	};
+	struct PendingRemoval
+	{
+		ResourceType type;
+		uint32_t index;
+		uint64_t retireValue;
+	};
+
+	static VkDescriptorType descriptorType(ResourceType _type)
+	{
+		switch (_type)
+		{
+		case ResourceType::SampledImage:	return VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+		case ResourceType::Sampler:			return VK_DESCRIPTOR_TYPE_SAMPLER;
+		default:							return VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		}
+	}
+
+	uint32_t add(ResourceType _type, const Slot& _slot)
+	{
+		const uint32_t type = (uint32_t)_type;
+		uint32_t index;
+		if (!m_freeIndices[type].empty())
+		{
+			index = m_freeIndices[type].back();
+			m_freeIndices[type].pop_back();
+		}
+		else
+		{
+			CVerifyCrash(m_nextIndex[type] < m_capacity[type], "Bindless table full for resource type {} ({} slots).", type, m_capacity[type]);
+			index = m_nextIndex[type]++;
+		}
+		m_slots[type][index] = _slot;
+		if (m_bindless)
+			m_dirty.push_back({ _type, index });
+		return index;
+	}
+
+	void createBindlessSet()
+	{
+		VkDescriptorSetLayoutBinding bindings[(uint32_t)ResourceType::Count];
+		VkDescriptorBindingFlags bindingFlags[(uint32_t)ResourceType::Count];
+		VkDescriptorPoolSize poolSizes[(uint32_t)ResourceType::Count];
+		for (uint32_t type = 0; type < (uint32_t)ResourceType::Count; type++)
+		{
+			bindings[type] = {};
+			bindings[type].binding = type;
+			bindings[type].descriptorType = descriptorType((ResourceType)type);
+			bindings[type].descriptorCount = m_capacity[type];
+			bindings[type].stageFlags = VK_SHADER_STAGE_ALL;
+			bindingFlags[type] = VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT | VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT;
+			poolSizes[type] = { bindings[type].descriptorType, m_capacity[type] };
+		}
+
+		VkDescriptorSetLayoutBindingFlagsCreateInfo flagsInfo = {};
+		flagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+		flagsInfo.bindingCount = (uint32_t)ResourceType::Count;
+		flagsInfo.pBindingFlags = bindingFlags;
+
+		VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+		layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		layoutInfo.pNext = &flagsInfo;
+		layoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+		layoutInfo.bindingCount = (uint32_t)ResourceType::Count;
+		layoutInfo.pBindings = bindings;
+
+		VkResult result = vkCreateDescriptorSetLayout(m_device, &layoutInfo, nullptr, &m_setLayout);
+		CVerifyCrash(result == VK_SUCCESS, "Failed to create bindless descriptor set layout. Result: {}", result);
+
+		VkDescriptorPoolCreateInfo poolInfo = {};
+		poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+		poolInfo.maxSets = 1;
+		poolInfo.poolSizeCount = (uint32_t)ResourceType::Count;
+		poolInfo.pPoolSizes = poolSizes;
+
+		result = vkCreateDescriptorPool(m_device, &poolInfo, nullptr, &m_bindlessPool);
+		CVerifyCrash(result == VK_SUCCESS, "Failed to create bindless descriptor pool. Result: {}", result);
+
+		VkDescriptorSetAllocateInfo allocInfo = {};
+		allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		allocInfo.descriptorPool = m_bindlessPool;
+		allocInfo.descriptorSetCount = 1;
+		allocInfo.pSetLayouts = &m_setLayout;
+
+		result = vkAllocateDescriptorSets(m_device, &allocInfo, &m_bindlessSet);
+		CVerifyCrash(result == VK_SUCCESS, "Failed to allocate bindless descriptor set. Result: {}", result);
+		m_counters.current().setAllocations++;
+	}
+
+	void createClassicLayout()
+	{
+		VkDescriptorSetLayoutBinding bindings[(uint32_t)ResourceType::Count];
+		for (uint32_t type = 0; type < (uint32_t)ResourceType::Count; type++)
+		{
+			bindings[type] = {};
+			bindings[type].binding = type;
+			bindings[type].descriptorType = descriptorType((ResourceType)type);
+			bindings[type].descriptorCount = 1;
+			bindings[type].stageFlags = VK_SHADER_STAGE_ALL;
+		}
+
+		VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+		layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		layoutInfo.bindingCount = (uint32_t)ResourceType::Count;
+		layoutInfo.pBindings = bindings;
+
+		VkResult result = vkCreateDescriptorSetLayout(m_device, &layoutInfo, nullptr, &m_setLayout);
+		CVerifyCrash(result == VK_SUCCESS, "Failed to create per draw descriptor set layout. Result: {}", result);
+	}
+
+	void createPipelineLayout()
+	{
+		VkPushConstantRange pushRange = {};
+		pushRange.stageFlags = PUSH_CONSTANT_STAGES;
+		pushRange.offset = 0;
+		pushRange.size = sizeof(BindlessDrawIndices);
+
+		VkPipelineLayoutCreateInfo layoutInfo = {};
+		layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		layoutInfo.setLayoutCount = 1;
+		layoutInfo.pSetLayouts = &m_setLayout;
+		layoutInfo.pushConstantRangeCount = 1;
+		layoutInfo.pPushConstantRanges = &pushRange;
+
+		VkResult result = vkCreatePipelineLayout(m_device, &layoutInfo, nullptr, &m_pipelineLayout);
+		CVerifyCrash(result == VK_SUCCESS, "Failed to create bindless pipeline layout. Result: {}", result);
+	}
+
+	VkDevice m_device = VK_NULL_HANDLE;
+	bool m_bindless = false;
+	VkDescriptorSetLayout m_setLayout = VK_NULL_HANDLE;
+	VkPipelineLayout m_pipelineLayout = VK_NULL_HANDLE;
+
+	// Bindless path
+	VkDescriptorPool m_bindlessPool = VK_NULL_HANDLE;
+	VkDescriptorSet m_bindlessSet = VK_NULL_HANDLE;
+	VkCommandBuffer m_boundCommandBuffer = VK_NULL_HANDLE;
+	std::vector<DirtySlot> m_dirty;
+	std::vector<VkWriteDescriptorSet> m_writes;
+
+	// Classic path, per draw sets come from the frame's pools
+	DescriptorAllocator* m_allocator = nullptr;
+
+	uint32_t m_capacity[(uint32_t)ResourceType::Count] = {};
+	uint32_t m_nextIndex[(uint32_t)ResourceType::Count] = {};
+	std::vector<Slot> m_slots[(uint32_t)ResourceType::Count];
+	std::vector<uint32_t> m_freeIndices[(uint32_t)ResourceType::Count];
+	std::vector<PendingRemoval> m_pendingRemovals;
+
+	DescriptorCounters m_counters;
+};
@@ -0,0 +1,188 @@
+#pragma once
+#include "Core.h"
+#include <vulkan/vulkan.h>
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+
+struct CommandBufferManagerStats
+{
+	uint32_t frameCommandBuffers = 0;	// handed out for the current frame
+	uint32_t frameAllocationCalls = 0;	// vkAllocateCommandBuffers calls the current frame made, zero once warmed up
+	uint64_t allocationCalls = 0;		// lifetime totals
+	uint64_t commandBuffersAllocated = 0;
+	uint64_t framesWithAllocations = 0;
+	uint32_t pools = 0;
+};
+
+// Command buffers are never freed or reset one by one. Every pool the manager owns has a VkCommandPool per frame slot,
+// beginFrame() resets all of the slot's command pools in one call each once the frame that last used them is complete,
+// and get() hands their command buffers out again in order. Each pool remembers the most command buffers of each level
+// any frame took from it, and beginFrame() tops the slot up to that in one allocation, so a slot that hasn't seen the
+// busiest frame yet doesn't allocate in the middle of recording.
+//
+// Command pools are externally synchronized: get() on the same pool must not run on two threads at once, give every
+// recording thread its own pool. Different pools may be used concurrently.
+class CommandBufferManager
+{
+public:
+	typedef uint32_t PoolHandle;
+
+	void init(VkDevice _device, uint32_t _framesInFlight)
+	{
+		m_device = _device;
+		m_framesInFlight = _framesInFlight;
+	}
+
+	void destroy()
+	{
+		for (Pool& pool : m_pools)
+		{
+			for (SlotPool& it : pool.slots)
+			{
+				vkDestroyCommandPool(m_device, it.pool, nullptr);
+			}
+		}
+		m_pools.clear();
+	}
+
+	// Before the first beginFrame(). _name is only used for logging and must outlive the manager.
+	PoolHandle createPool(uint32_t _queueFamily, const char* _name)
+	{
+		Pool pool;
+		pool.name = _name;
+		pool.slots.resize(m_framesInFlight);
+		VkCommandPoolCreateInfo poolInfo = {};
+		poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+		poolInfo.queueFamilyIndex = _queueFamily;
+		for (SlotPool& it : pool.slots)
+		{
+			VkResult result = vkCreateCommandPool(m_device, &poolInfo, nullptr, &it.pool);
+			CVerifyCrash(result == VK_SUCCESS, "CommandBufferManager: failed to create command pool {:s}. Result: {}", _name, result);
+		}
+		m_pools.push_back(std::move(pool));
+		return static_cast<PoolHandle>(m_pools.size() - 1);
+	}
+
+	// The frame that last used _slot must be complete, and nothing may record from the manager's pools during the call.
+	void beginFrame(uint32_t _slot)
+	{
+		// The frame that just ended is done recording, fold its counts in before the slots change
+		uint32_t calls = 0;
+		for (Pool& pool : m_pools)
+		{
+			const SlotPool& ended = pool.slots[m_slot];
+			calls += ended.frameAllocationCalls;
+			for (uint32_t level = 0; level < LEVEL_COUNT; level++)
+			{
+				pool.highWater[level] = std::max(pool.highWater[level], ended.used[level]);
+			}
+		}
+		m_framesWithAllocations += calls > 0 ? 1 : 0;
+
+		m_slot = _slot;
+		for (Pool& pool : m_pools)
+		{
+			SlotPool& it = pool.slots[_slot];
+			vkResetCommandPool(m_device, it.pool, 0);
+			it.frameAllocationCalls = 0;
+			for (uint32_t level = 0; level < LEVEL_COUNT; level++)
+			{
+				it.used[level] = 0;
+				const uint32_t missing = pool.highWater[level] - std::min(pool.highWater[level], static_cast<uint32_t>(it.commandBuffers[level].size()));
+				if (missing > 0)
+					allocate(it, static_cast<VkCommandBufferLevel>(level), missing);
+			}
+		}
+	}
+
+	// The next unused command buffer of _pool for the current frame, not begun yet.
+	VkCommandBuffer get(PoolHandle _pool, VkCommandBufferLevel _level = VK_COMMAND_BUFFER_LEVEL_PRIMARY)
+	{
+		SlotPool& it = m_pools[_pool].slots[m_slot];
+		std::vector<VkCommandBuffer>& commandBuffers = it.commandBuffers[_level];
+		if (it.used[_level] == commandBuffers.size())
+		{
+			// Past anything seen so far, grow by half again so a frame that keeps growing doesn't allocate every time
+			allocate(it, _level, std::max(4u, it.used[_level] / 2));
+		}
+		return commandBuffers[it.used[_level]++];
+	}
+
+	// Only while nothing records from the manager's pools.
+	CommandBufferManagerStats getStats() const
+	{
+		CommandBufferManagerStats stats;
+		for (const Pool& pool : m_pools)
+		{
+			for (const SlotPool& it : pool.slots)
+			{
+				stats.allocationCalls += it.allocationCalls;
+				stats.commandBuffersAllocated += it.allocated;
+			}
+			const SlotPool& current = pool.slots[m_slot];
+			stats.frameCommandBuffers += current.used[0] + current.used[1];
+			stats.frameAllocationCalls += current.frameAllocationCalls;
+		}
+		stats.framesWithAllocations = m_framesWithAllocations;
+		stats.pools = static_cast<uint32_t>(m_pools.size());
+		return stats;
+	}
+
+	void logStats() const
+	{
+		const CommandBufferManagerStats stats = getStats();
+		CLog(0, "Command buffer manager: {} pools, {} command buffers this frame, {} allocation calls for {} command buffers in total, {} frames allocated.",
+			stats.pools, stats.frameCommandBuffers, stats.allocationCalls, stats.commandBuffersAllocated, stats.framesWithAllocations);
+		for (const Pool& pool : m_pools)
+		{
+			CLog(0, "  {:s}: high-water mark {} primary, {} secondary.", pool.name, pool.highWater[0], pool.highWater[1]);
+		}
+	}
+
+private:
+	static constexpr uint32_t LEVEL_COUNT = 2;	// VK_COMMAND_BUFFER_LEVEL_PRIMARY and _SECONDARY
+
+	// Written by the thread recording from it, padded so threads recording from neighbouring pools don't share lines.
+	struct alignas(64) SlotPool
+	{
+		VkCommandPool pool = VK_NULL_HANDLE;
+		std::vector<VkCommandBuffer> commandBuffers[LEVEL_COUNT];
+		uint32_t used[LEVEL_COUNT] = {};
+		uint32_t frameAllocationCalls = 0;		// since its beginFrame(), top-ups included
+		uint64_t allocationCalls = 0;
+		uint64_t allocated = 0;					// command buffers
+	};
+
+	struct Pool
+	{
+		const char* name = nullptr;
+		std::vector<SlotPool> slots;
+		uint32_t highWater[LEVEL_COUNT] = {};	// most command buffers one frame took, per level
+	};
+
+	void allocate(SlotPool& _slot, VkCommandBufferLevel _level, uint32_t _count)
+	{
+		std::vector<VkCommandBuffer>& commandBuffers = _slot.commandBuffers[_level];
+		const size_t first = commandBuffers.size();
+		commandBuffers.resize(first + _count);
+		VkCommandBufferAllocateInfo allocInfo = {};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.commandPool = _slot.pool;
+		allocInfo.level = _level;
+		allocInfo.commandBufferCount = _count;
+		VkResult result = vkAllocateCommandBuffers(m_device, &allocInfo, &commandBuffers[first]);
+		CVerifyCrash(result == VK_SUCCESS, "CommandBufferManager: failed to allocate {} command buffers. Result: {}", _count, result);
+		_slot.frameAllocationCalls++;
+		_slot.allocationCalls++;
+		_slot.allocated += _count;
+	}
+
+	VkDevice m_device = VK_NULL_HANDLE;
+	uint32_t m_framesInFlight = 0;
+	uint32_t m_slot = 0;
+	std::vector<Pool> m_pools;
+	uint64_t m_framesWithAllocations = 0;
+};
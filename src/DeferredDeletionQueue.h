@@ -0,0 +1,132 @@
+#pragma once
+#include "Core.h"
+#include "GpuMemoryReport.h"
+#include <vulkan/vulkan.h>
+
+#include <vector>
+#include <mutex>
+#include <cstdint>
+
+// Objects that may still be referenced by in flight GPU work can't be destroyed straight away.
+// Subsystems push them tagged with the frame (or timeline value) that last used them, and once the GPU
+// has passed that value flush() destroys everything that retired at or before it in one batch.
+class DeferredDeletionQueue
+{
+public:
+	enum class ObjectType : uint32_t
+	{
+		Image, ImageView, Buffer, BufferView, DeviceMemory, Sampler,
+		Pipeline, PipelineLayout, ShaderModule, RenderPass, Framebuffer,
+		DescriptorPool, DescriptorSetLayout, CommandPool, Semaphore, Fence, QueryPool, Swapchain
+	};
+
+	void init(VkDevice _device)
+	{
+		m_device = _device;
+	}
+
+	void push(VkImage _handle, uint64_t _retireValue)					{ pushImpl(ObjectType::Image, (uint64_t)_handle, _retireValue); }
+	void push(VkImageView _handle, uint64_t _retireValue)				{ pushImpl(ObjectType::ImageView, (uint64_t)_handle, _retireValue); }
+	void push(VkBuffer _handle, uint64_t _retireValue)					{ pushImpl(ObjectType::Buffer, (uint64_t)_handle, _retireValue); }
+	void push(VkBufferView _handle, uint64_t _retireValue)				{ pushImpl(ObjectType::BufferView, (uint64_t)_handle, _retireValue); }
+	void push(VkDeviceMemory _handle, uint64_t _retireValue)			{ pushImpl(ObjectType::DeviceMemory, (uint64_t)_handle, _retireValue); }
+	void push(VkSampler _handle, uint64_t _retireValue)					{ pushImpl(ObjectType::Sampler, (uint64_t)_handle, _retireValue); }
+	void push(VkPipeline _handle, uint64_t _retireValue)				{ pushImpl(ObjectType::Pipeline, (uint64_t)_handle, _retireValue); }
+	void push(VkPipelineLayout _handle, uint64_t _retireValue)			{ pushImpl(ObjectType::PipelineLayout, (uint64_t)_handle, _retireValue); }
+	void push(VkShaderModule _handle, uint64_t _retireValue)			{ pushImpl(ObjectType::ShaderModule, (uint64_t)_handle, _retireValue); }
+	void push(VkRenderPass _handle, uint64_t _retireValue)				{ pushImpl(ObjectType::RenderPass, (uint64_t)_handle, _retireValue); }
+	void push(VkFramebuffer _handle, uint64_t _retireValue)				{ pushImpl(ObjectType::Framebuffer, (uint64_t)_handle, _retireValue); }
+	void push(VkDescriptorPool _handle, uint64_t _retireValue)			{ pushImpl(ObjectType::DescriptorPool, (uint64_t)_handle, _retireValue); }
+	void push(VkDescriptorSetLayout _handle, uint64_t _retireValue)		{ pushImpl(ObjectType::DescriptorSetLayout, (uint64_t)_handle, _retireValue); }
+	void push(VkCommandPool _handle, uint64_t _retireValue)				{ pushImpl(ObjectType::CommandPool, (uint64_t)_handle, _retireValue); }
+	void push(VkSemaphore _handle, uint64_t _retireValue)				{ pushImpl(ObjectType::Semaphore, (uint64_t)_handle, _retireValue); }
+	void push(VkFence _handle, uint64_t _retireValue)					{ pushImpl(ObjectType::Fence, (uint64_t)_handle, _retireValue); }
+	void push(VkQueryPool _handle, uint64_t _retireValue)				{ pushImpl(ObjectType::QueryPool, (uint64_t)_handle, _retireValue); }
+	void push(VkSwapchainKHR _handle, uint64_t _retireValue)			{ pushImpl(ObjectType::Swapchain, (uint64_t)_handle, _retireValue); }
+
+	// Destroys everything retired at or before _completedValue. Returns the number of objects destroyed.
+	uint32_t flush(uint64_t _completedValue)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		uint32_t destroyed = 0;
+		size_t kept = 0;
+		for (size_t i = 0; i < m_entries.size(); i++)
+		{
+			if (m_entries[i].retireValue <= _completedValue)
+			{
+				destroy(m_entries[i]);
+				destroyed++;
+			}
+			else
+			{
+				m_entries[kept++] = m_entries[i];
+			}
+		}
+		m_entries.resize(kept);
+		m_totalDestroyed += destroyed;
+		return destroyed;
+	}
+
+	// Only safe once the device is idle.
+	uint32_t flushAll()
+	{
+		return flush(UINT64_MAX);
+	}
+
+	size_t getPendingCount()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_entries.size();
+	}
+	uint64_t getTotalDestroyed() const { return m_totalDestroyed; }
+
+private:
+	struct Entry
+	{
+		ObjectType type;
+		uint64_t handle;
+		uint64_t retireValue;
+	};
+
+	void pushImpl(ObjectType _type, uint64_t _handle, uint64_t _retireValue)
+	{
+		if (_handle == 0)
+			return;
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_entries.push_back({ _type, _handle, _retireValue });
+	}
+
+	void destroy(const Entry& _entry)
+	{
+		switch (_entry.type)
+		{
+		case ObjectType::Image:					vkDestroyImage(m_device, (VkImage)_entry.handle, nullptr); break;
+		case ObjectType::ImageView:				vkDestroyImageView(m_device, (VkImageView)_entry.handle, nullptr); break;
+		case ObjectType::Buffer:				vkDestroyBuffer(m_device, (VkBuffer)_entry.handle, nullptr); break;
+		case ObjectType::BufferView:			vkDestroyBufferView(m_device, (VkBufferView)_entry.handle, nullptr); break;
+		case ObjectType::DeviceMemory:
+			GpuMemoryRegistry::instance().unregisterBlock((VkDeviceMemory)_entry.handle);
+			vkFreeMemory(m_device, (VkDeviceMemory)_entry.handle, nullptr);
+			break;
+		case ObjectType::Sampler:				vkDestroySampler(m_device, (VkSampler)_entry.handle, nullptr); break;
+		case ObjectType::Pipeline:				vkDestroyPipeline(m_device, (VkPipeline)_entry.handle, nullptr); break;
+		case ObjectType::PipelineLayout:		vkDestroyPipelineLayout(m_device, (VkPipelineLayout)_entry.handle, nullptr); break;
+		case ObjectType::ShaderModule:			vkDestroyShaderModule(m_device, (VkShaderModule)_entry.handle, nullptr); break;
+		case ObjectType::RenderPass:			vkDestroyRenderPass(m_device, (VkRenderPass)_entry.handle, nullptr); break;
+		case ObjectType::Framebuffer:			vkDestroyFramebuffer(m_device, (VkFramebuffer)_entry.handle, nullptr); break;
+		case ObjectType::DescriptorPool:		vkDestroyDescriptorPool(m_device, (VkDescriptorPool)_entry.handle, nullptr); break;
+		case ObjectType::DescriptorSetLayout:	vkDestroyDescriptorSetLayout(m_device, (VkDescriptorSetLayout)_entry.handle, nullptr); break;
+		case ObjectType::CommandPool:			vkDestroyCommandPool(m_device, (VkCommandPool)_entry.handle, nullptr); break;
+		case ObjectType::Semaphore:				vkDestroySemaphore(m_device, (VkSemaphore)_entry.handle, nullptr); break;
+		case ObjectType::Fence:					vkDestroyFence(m_device, (VkFence)_entry.handle, nullptr); break;
+		case ObjectType::QueryPool:				vkDestroyQueryPool(m_device, (VkQueryPool)_entry.handle, nullptr); break;
+		case ObjectType::Swapchain:				vkDestroySwapchainKHR(m_device, (VkSwapchainKHR)_entry.handle, nullptr); break;
+		}
+	}
+
+	VkDevice m_device = VK_NULL_HANDLE;
+	std::mutex m_mutex;
+	std::vector<Entry> m_entries;
+	uint64_t m_totalDestroyed = 0;
+};
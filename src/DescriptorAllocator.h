@@ -0,0 +1,278 @@
+#pragma once
+#include "Core.h"
+#include "Hash.h"
+#include "DeferredDeletionQueue.h"
+#include <vulkan/vulkan.h>
+
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <algorithm>
+
+struct DescriptorAllocatorStats
+{
+	uint32_t frameSetAllocations = 0;	// sets handed out for the current frame
+	uint32_t framePoolsInUse = 0;		// pools the current frame has drawn from
+	uint32_t poolsCreated = 0;			// lifetime total, growth shows up here
+	uint32_t freePools = 0;				// reset pools waiting to be reused
+	uint32_t immutableSets = 0;			// sets held by the content cache
+	uint64_t immutableHits = 0;
+	uint64_t immutableMisses = 0;
+};
+
+// Transient descriptor sets for the classic (non bindless) path. Every frame in flight owns a list of pools; sets are
+// never freed individually, beginFrame() resets the slot's pools wholesale once its fence has signalled and hands them
+// to a shared free list. When a pool runs out the next one is taken from the free list or created, each new pool twice
+// the size of the last up to a cap.
+//
+// Sets whose contents never change (material textures, static buffers) can instead come from getImmutableSet(), which
+// keys them on layout and contents and returns the same set for the same inputs. Those live in separate pools that are
+// never reset.
+class DescriptorAllocator
+{
+public:
+	struct PoolRatio
+	{
+		VkDescriptorType type;
+		float descriptorsPerSet;
+	};
+
+	void init(VkDevice _device, uint32_t _framesInFlight, const std::vector<PoolRatio>& _ratios, uint32_t _initialSetsPerPool = 128)
+	{
+		m_device = _device;
+		m_ratios = _ratios;
+		m_setsPerPool = _initialSetsPerPool;
+		m_frames.resize(_framesInFlight);
+	}
+
+	void destroy()
+	{
+		for (auto& frame : m_frames)
+		{
+			for (VkDescriptorPool pool : frame.pools)
+			{
+				vkDestroyDescriptorPool(m_device, pool, nullptr);
+			}
+			frame.pools.clear();
+		}
+		for (VkDescriptorPool pool : m_freePools)
+		{
+			vkDestroyDescriptorPool(m_device, pool, nullptr);
+		}
+		m_freePools.clear();
+		for (VkDescriptorPool pool : m_immutablePools)
+		{
+			vkDestroyDescriptorPool(m_device, pool, nullptr);
+		}
+		m_immutablePools.clear();
+		m_immutableSets.clear();
+	}
+
+	// Call after waiting on the slot's fence: everything allocated the last time the slot was recorded is dead.
+	void beginFrame(uint32_t _frameSlot)
+	{
+		m_currentFrame = _frameSlot;
+		Frame& frame = m_frames[_frameSlot];
+		for (VkDescriptorPool pool : frame.pools)
+		{
+			vkResetDescriptorPool(m_device, pool, 0);
+			m_freePools.push_back(pool);
+		}
+		frame.pools.clear();
+		frame.setAllocations = 0;
+	}
+
+	// Valid until the current frame slot comes round again.
+	VkDescriptorSet allocate(VkDescriptorSetLayout _layout)
+	{
+		Frame& frame = m_frames[m_currentFrame];
+		if (frame.pools.empty())
+			frame.pools.push_back(acquirePool());
+
+		VkDescriptorSet set;
+		VkResult result = allocateFrom(frame.pools.back(), _layout, set);
+		if (result == VK_ERROR_OUT_OF_POOL_MEMORY || result == VK_ERROR_FRAGMENTED_POOL)
+		{
+			frame.pools.push_back(acquirePool());
+			result = allocateFrom(frame.pools.back(), _layout, set);
+		}
+		CVerifyCrash(result == VK_SUCCESS, "Failed to allocate descriptor set from a fresh pool. Result: {}", result);
+		frame.setAllocations++;
+		return set;
+	}
+
+	// Returns the cached set for this layout and contents, writing a new one on a miss. The dstSet of _writes is ignored.
+	// Only image/buffer writes are supported, which covers everything the renderer puts in immutable sets.
+	VkDescriptorSet getImmutableSet(VkDescriptorSetLayout _layout, const VkWriteDescriptorSet* _writes, uint32_t _writeCount)
+	{
+		flattenContents(_layout, _writes, _writeCount, m_keyScratch);
+		auto it = m_immutableSets.find(m_keyScratch);
+		if (it != m_immutableSets.end())
+		{
+			m_immutableHits++;
+			return it->second;
+		}
+		m_immutableMisses++;
+
+		VkDescriptorSet set = VK_NULL_HANDLE;
+		VkResult result = m_immutablePools.empty() ? VK_ERROR_OUT_OF_POOL_MEMORY : allocateFrom(m_immutablePools.back(), _layout, set);
+		if (result == VK_ERROR_OUT_OF_POOL_MEMORY || result == VK_ERROR_FRAGMENTED_POOL)
+		{
+			m_immutablePools.push_back(createPool());
+			result = allocateFrom(m_immutablePools.back(), _layout, set);
+		}
+		CVerifyCrash(result == VK_SUCCESS, "Failed to allocate immutable descriptor set. Result: {}", result);
+
+		m_writeScratch.assign(_writes, _writes + _writeCount);
+		for (auto& write : m_writeScratch)
+		{
+			write.dstSet = set;
+		}
+		vkUpdateDescriptorSets(m_device, _writeCount, m_writeScratch.data(), 0, nullptr);
+
+		m_immutableSets.emplace(m_keyScratch, set);
+		return set;
+	}
+
+	// Drops every immutable set, e.g. when the resources they reference are reloaded. The pools are destroyed once
+	// _retireValue has completed.
+	void clearImmutableSets(DeferredDeletionQueue& _deletionQueue, uint64_t _retireValue)
+	{
+		for (VkDescriptorPool pool : m_immutablePools)
+		{
+			_deletionQueue.push(pool, _retireValue);
+		}
+		m_immutablePools.clear();
+		m_immutableSets.clear();
+	}
+
+	DescriptorAllocatorStats getStats() const
+	{
+		DescriptorAllocatorStats stats;
+		stats.frameSetAllocations = m_frames[m_currentFrame].setAllocations;
+		stats.framePoolsInUse = static_cast<uint32_t>(m_frames[m_currentFrame].pools.size());
+		stats.poolsCreated = m_poolsCreated;
+		stats.freePools = static_cast<uint32_t>(m_freePools.size());
+		stats.immutableSets = static_cast<uint32_t>(m_immutableSets.size());
+		stats.immutableHits = m_immutableHits;
+		stats.immutableMisses = m_immutableMisses;
+		return stats;
+	}
+
+	void logStats() const
+	{
+		const DescriptorAllocatorStats stats = getStats();
+		CLog(0, "Descriptor allocator: {} sets from {} pools this frame, {} pools created ({} free), next pool {} sets. Immutable cache: {} sets, {} hits / {} misses.",
+			stats.frameSetAllocations, stats.framePoolsInUse, stats.poolsCreated, stats.freePools, m_setsPerPool,
+			stats.immutableSets, stats.immutableHits, stats.immutableMisses);
+	}
+
+private:
+	static constexpr uint32_t MAX_SETS_PER_POOL = 4096;
+
+	struct Frame
+	{
+		std::vector<VkDescriptorPool> pools;	// last one is the one being allocated from
+		uint32_t setAllocations = 0;
+	};
+
+	VkResult allocateFrom(VkDescriptorPool _pool, VkDescriptorSetLayout _layout, VkDescriptorSet& _set)
+	{
+		VkDescriptorSetAllocateInfo allocInfo = {};
+		allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		allocInfo.descriptorPool = _pool;
+		allocInfo.descriptorSetCount = 1;
+		allocInfo.pSetLayouts = &_layout;
+		return vkAllocateDescriptorSets(m_device, &allocInfo, &_set);
+	}
+
+	VkDescriptorPool acquirePool()
+	{
+		if (!m_freePools.empty())
+		{
+			VkDescriptorPool pool = m_freePools.back();
+			m_freePools.pop_back();
+			return pool;
+		}
+		VkDescriptorPool pool = createPool();
+		m_setsPerPool = std::min(m_setsPerPool * 2, MAX_SETS_PER_POOL);
+		return pool;
+	}
+
+	VkDescriptorPool createPool()
+	{
+		std::vector<VkDescriptorPoolSize> sizes;
+		sizes.reserve(m_ratios.size());
+		for (const auto& it : m_ratios)
+		{
+			sizes.push_back({ it.type, std::max(1u, static_cast<uint32_t>(it.descriptorsPerSet * m_setsPerPool)) });
+		}
+
+		VkDescriptorPoolCreateInfo poolInfo = {};
+		poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		poolInfo.maxSets = m_setsPerPool;
+		poolInfo.poolSizeCount = static_cast<uint32_t>(sizes.size());
+		poolInfo.pPoolSizes = sizes.data();
+
+		VkDescriptorPool pool;
+		VkResult result = vkCreateDescriptorPool(m_device, &poolInfo, nullptr, &pool);
+		CVerifyCrash(result == VK_SUCCESS, "Failed to create descriptor pool ({} sets). Result: {}", m_setsPerPool, result);
+		m_poolsCreated++;
+		return pool;
+	}
+
+	// Layout and everything the writes put into the set, compared in full on lookup so a hash collision can't return a
+	// set pointing at other resources.
+	struct ImmutableSetKey
+	{
+		VkDescriptorSetLayout layout = VK_NULL_HANDLE;
+		std::vector<uint64_t> contents;
+
+		bool operator==(const ImmutableSetKey& _other) const
+		{
+			return layout == _other.layout && contents == _other.contents;
+		}
+	};
+	struct ImmutableSetKeyHasher
+	{
+		size_t operator()(const ImmutableSetKey& _key) const
+		{
+			return static_cast<size_t>(Hasher().value(_key.layout).bytes(_key.contents.data(), _key.contents.size() * sizeof(uint64_t)).get());
+		}
+	};
+
+	// Refills _key in place, so lookups that hit don't allocate once the scratch key has grown.
+	static void flattenContents(VkDescriptorSetLayout _layout, const VkWriteDescriptorSet* _writes, uint32_t _writeCount, ImmutableSetKey& _key)
+	{
+		_key.layout = _layout;
+		_key.contents.clear();
+		for (uint32_t w = 0; w < _writeCount; w++)
+		{
+			const VkWriteDescriptorSet& write = _writes[w];
+			_key.contents.insert(_key.contents.end(), { write.dstBinding, write.dstArrayElement, write.descriptorCount, (uint64_t)write.descriptorType });
+			for (uint32_t d = 0; d < write.descriptorCount; d++)
+			{
+				if (write.pImageInfo != nullptr)
+					_key.contents.insert(_key.contents.end(), { (uint64_t)write.pImageInfo[d].sampler, (uint64_t)write.pImageInfo[d].imageView, (uint64_t)write.pImageInfo[d].imageLayout });
+				if (write.pBufferInfo != nullptr)
+					_key.contents.insert(_key.contents.end(), { (uint64_t)write.pBufferInfo[d].buffer, write.pBufferInfo[d].offset, write.pBufferInfo[d].range });
+			}
+		}
+	}
+
+	VkDevice m_device = VK_NULL_HANDLE;
+	std::vector<PoolRatio> m_ratios;
+	uint32_t m_setsPerPool = 0;			// size of the next pool created
+
+	std::vector<Frame> m_frames;
+	uint32_t m_currentFrame = 0;
+	std::vector<VkDescriptorPool> m_freePools;
+	uint32_t m_poolsCreated = 0;
+
+	std::vector<VkDescriptorPool> m_immutablePools;
+	std::unordered_map<ImmutableSetKey, VkDescriptorSet, ImmutableSetKeyHasher> m_immutableSets;
+	ImmutableSetKey m_keyScratch;
+	std::vector<VkWriteDescriptorSet> m_writeScratch;
+	uint64_t m_immutableHits = 0;
+	uint64_t m_immutableMisses = 0;
+};
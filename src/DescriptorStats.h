@@ -0,0 +1,36 @@
+#pragma once
+#include <cstdint>
+#include <algorithm>
+
+// Descriptor traffic of one frame, counted the same way for the bindless and the classic descriptor set path
+// so the two can be compared directly.
+struct DescriptorStats
+{
+	uint32_t descriptorWrites = 0;	// individual descriptors written by vkUpdateDescriptorSets
+	uint32_t updateCalls = 0;		// vkUpdateDescriptorSets calls
+	uint32_t setBinds = 0;			// descriptor sets bound through vkCmdBindDescriptorSets
+	uint32_t setAllocations = 0;	// descriptor sets allocated from pools
+};
+
+class DescriptorCounters
+{
+public:
+	DescriptorStats& current() { return m_current; }
+	const DescriptorStats& lastFrame() const { return m_lastFrame; }
+	const DescriptorStats& peak() const { return m_peak; }
+
+	void endFrame()
+	{
+		m_lastFrame = m_current;
+		m_peak.descriptorWrites = std::max(m_peak.descriptorWrites, m_current.descriptorWrites);
+		m_peak.updateCalls = std::max(m_peak.updateCalls, m_current.updateCalls);
+		m_peak.setBinds = std::max(m_peak.setBinds, m_current.setBinds);
+		m_peak.setAllocations = std::max(m_peak.setAllocations, m_current.setAllocations);
+		m_current = DescriptorStats();
+	}
+
+private:
+	DescriptorStats m_current;
+	DescriptorStats m_lastFrame;
+	DescriptorStats m_peak;
+};
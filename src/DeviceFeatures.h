@@ -0,0 +1,42 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <cstdint>
+
+enum class QueueType : uint32_t
+{
+	Graphics,		// also presents
+	Compute,		// async compute
+	Transfer,
+};
+static constexpr uint32_t QUEUE_TYPE_COUNT = 3;
+
+// Optional device functionality found by createLogicalDevice(). Subsystems check these flags and pick their fallback
+// path, nothing outside createLogicalDevice() should query the physical device for it again.
+struct DeviceFeatures
+{
+	uint32_t instanceApiVersion = VK_API_VERSION_1_0;	// what createInstance() negotiated with the loader
+	uint32_t deviceApiVersion = VK_API_VERSION_1_0;		// min(instance, physical device)
+
+	// Queue family of each QueueType. Compute and transfer get their own family when the device has one, otherwise
+	// they share the graphics family and that work stays on the graphics queue.
+	uint32_t queueFamilies[QUEUE_TYPE_COUNT] = {};
+	uint32_t timestampValidBits[QUEUE_TYPE_COUNT] = {};	// 0 when the queue can't write timestamps
+	float timestampPeriod = 1.0f;						// nanoseconds per timestamp tick
+
+	// Bindless resources: update after bind, partially bound, non uniform indexed descriptor arrays.
+	bool descriptorIndexing = false;
+	uint32_t maxBindlessSampledImages = 0;
+	uint32_t maxBindlessSamplers = 0;
+	uint32_t maxBindlessStorageBuffers = 0;
+
+	// Extended dynamic state (DynamicState.h), needs Vulkan headers that know the extensions.
+	bool extendedDynamicState = false;			// cull mode, front face, topology, depth test/write/compare
+	bool extendedDynamicState2 = false;			// depth bias enable, primitive restart enable
+	bool extendedDynamicState3PolygonMode = false;
+
+	// vkCmdPipelineBarrier2 with per barrier stage masks (BarrierBatcher.h), core in 1.3.
+	bool synchronization2 = false;
+
+	// One timeline semaphore per queue (GpuSync.h), core in 1.2. Without it GpuSync keeps a fence per submission.
+	bool timelineSemaphore = false;
+};
@@ -0,0 +1,301 @@
+#pragma once
+#include "Core.h"
+#include "DeviceFeatures.h"
+#include "PipelineDesc.h"
+#include <vulkan/vulkan.h>
+
+#include <cstring>
+#include <cstdint>
+
+// Pipeline state that VK_EXT_extended_dynamic_state / _2 / _3 (the first two core in 1.3) let us set on the command
+// buffer. States the device supports are taken out of the pipeline key by normalizeDynamicState(), so descriptions that
+// only differ in them share one pipeline, and CommandStateTracker sets them when a pipeline is bound. Everything here
+// compiles down to the static path with headers that predate the extensions.
+enum DynamicStateBits : uint32_t
+{
+	DYNAMIC_STATE_CULL_MODE = 1u << 0,
+	DYNAMIC_STATE_FRONT_FACE = 1u << 1,
+	DYNAMIC_STATE_TOPOLOGY = 1u << 2,			// within its class, see normalizeDynamicState()
+	DYNAMIC_STATE_DEPTH_TEST = 1u << 3,
+	DYNAMIC_STATE_DEPTH_WRITE = 1u << 4,
+	DYNAMIC_STATE_DEPTH_COMPARE = 1u << 5,
+	DYNAMIC_STATE_DEPTH_BIAS_ENABLE = 1u << 6,
+	DYNAMIC_STATE_PRIMITIVE_RESTART = 1u << 7,
+	DYNAMIC_STATE_POLYGON_MODE = 1u << 8,
+};
+static constexpr uint32_t DYNAMIC_STATE_COUNT = 9;
+static constexpr uint32_t MAX_PIPELINE_DYNAMIC_STATES = DYNAMIC_STATE_COUNT + 2;	// plus viewport and scissor
+
+// Command buffer entry points for the supported states, loaded once the device exists.
+struct DynamicStateFunctions
+{
+	uint32_t mask = 0;		// DynamicStateBits the device supports
+
+#ifdef VK_EXT_extended_dynamic_state
+	PFN_vkCmdSetCullModeEXT cmdSetCullMode = nullptr;
+	PFN_vkCmdSetFrontFaceEXT cmdSetFrontFace = nullptr;
+	PFN_vkCmdSetPrimitiveTopologyEXT cmdSetPrimitiveTopology = nullptr;
+	PFN_vkCmdSetDepthTestEnableEXT cmdSetDepthTestEnable = nullptr;
+	PFN_vkCmdSetDepthWriteEnableEXT cmdSetDepthWriteEnable = nullptr;
+	PFN_vkCmdSetDepthCompareOpEXT cmdSetDepthCompareOp = nullptr;
+#endif
+#ifdef VK_EXT_extended_dynamic_state2
+	PFN_vkCmdSetDepthBiasEnableEXT cmdSetDepthBiasEnable = nullptr;
+	PFN_vkCmdSetPrimitiveRestartEnableEXT cmdSetPrimitiveRestartEnable = nullptr;
+#endif
+#ifdef VK_EXT_extended_dynamic_state3
+	PFN_vkCmdSetPolygonModeEXT cmdSetPolygonMode = nullptr;
+#endif
+
+	void load(VkDevice _device, const DeviceFeatures& _features)
+	{
+		mask = 0;
+		// The 1.3 core entry points have the same signatures as the extension ones
+		const bool core = _features.deviceApiVersion >= VK_MAKE_VERSION(1, 3, 0);
+		(void)_device;
+		(void)core;
+#ifdef VK_EXT_extended_dynamic_state
+		if (_features.extendedDynamicState)
+		{
+			cmdSetCullMode = (PFN_vkCmdSetCullModeEXT)vkGetDeviceProcAddr(_device, core ? "vkCmdSetCullMode" : "vkCmdSetCullModeEXT");
+			cmdSetFrontFace = (PFN_vkCmdSetFrontFaceEXT)vkGetDeviceProcAddr(_device, core ? "vkCmdSetFrontFace" : "vkCmdSetFrontFaceEXT");
+			cmdSetPrimitiveTopology = (PFN_vkCmdSetPrimitiveTopologyEXT)vkGetDeviceProcAddr(_device, core ? "vkCmdSetPrimitiveTopology" : "vkCmdSetPrimitiveTopologyEXT");
+			cmdSetDepthTestEnable = (PFN_vkCmdSetDepthTestEnableEXT)vkGetDeviceProcAddr(_device, core ? "vkCmdSetDepthTestEnable" : "vkCmdSetDepthTestEnableEXT");
+			cmdSetDepthWriteEnable = (PFN_vkCmdSetDepthWriteEnableEXT)vkGetDeviceProcAddr(_device, core ? "vkCmdSetDepthWriteEnable" : "vkCmdSetDepthWriteEnableEXT");
+			cmdSetDepthCompareOp = (PFN_vkCmdSetDepthCompareOpEXT)vkGetDeviceProcAddr(_device, core ? "vkCmdSetDepthCompareOp" : "vkCmdSetDepthCompareOpEXT");
+			if (cmdSetCullMode && cmdSetFrontFace && cmdSetPrimitiveTopology && cmdSetDepthTestEnable && cmdSetDepthWriteEnable && cmdSetDepthCompareOp)
+			{
+				mask |= DYNAMIC_STATE_CULL_MODE | DYNAMIC_STATE_FRONT_FACE | DYNAMIC_STATE_TOPOLOGY
+					| DYNAMIC_STATE_DEPTH_TEST | DYNAMIC_STATE_DEPTH_WRITE | DYNAMIC_STATE_DEPTH_COMPARE;
+			}
+		}
+#endif
+#ifdef VK_EXT_extended_dynamic_state2
+		if (_features.extendedDynamicState2)
+		{
+			cmdSetDepthBiasEnable = (PFN_vkCmdSetDepthBiasEnableEXT)vkGetDeviceProcAddr(_device, core ? "vkCmdSetDepthBiasEnable" : "vkCmdSetDepthBiasEnableEXT");
+			cmdSetPrimitiveRestartEnable = (PFN_vkCmdSetPrimitiveRestartEnableEXT)vkGetDeviceProcAddr(_device, core ? "vkCmdSetPrimitiveRestartEnable" : "vkCmdSetPrimitiveRestartEnableEXT");
+			if (cmdSetDepthBiasEnable && cmdSetPrimitiveRestartEnable)
+				mask |= DYNAMIC_STATE_DEPTH_BIAS_ENABLE | DYNAMIC_STATE_PRIMITIVE_RESTART;
+		}
+#endif
+#ifdef VK_EXT_extended_dynamic_state3
+		if (_features.extendedDynamicState3PolygonMode)
+		{
+			cmdSetPolygonMode = (PFN_vkCmdSetPolygonModeEXT)vkGetDeviceProcAddr(_device, "vkCmdSetPolygonModeEXT");
+			if (cmdSetPolygonMode)
+				mask |= DYNAMIC_STATE_POLYGON_MODE;
+		}
+#endif
+		CLog(0, "Extended dynamic state: {} of {} pipeline states set on the command buffer.", countBits(mask), DYNAMIC_STATE_COUNT);
+	}
+
+	static uint32_t countBits(uint32_t _value)
+	{
+		uint32_t count = 0;
+		for (; _value != 0; _value &= _value - 1)
+		{
+			count++;
+		}
+		return count;
+	}
+};
+
+// VkDynamicState list for a pipeline built with _mask dynamic, viewport and scissor are always dynamic.
+inline uint32_t getVkDynamicStates(uint32_t _mask, VkDynamicState* _states)
+{
+	uint32_t count = 0;
+	_states[count++] = VK_DYNAMIC_STATE_VIEWPORT;
+	_states[count++] = VK_DYNAMIC_STATE_SCISSOR;
+#ifdef VK_EXT_extended_dynamic_state
+	if (_mask & DYNAMIC_STATE_CULL_MODE)			_states[count++] = VK_DYNAMIC_STATE_CULL_MODE_EXT;
+	if (_mask & DYNAMIC_STATE_FRONT_FACE)			_states[count++] = VK_DYNAMIC_STATE_FRONT_FACE_EXT;
+	if (_mask & DYNAMIC_STATE_TOPOLOGY)				_states[count++] = VK_DYNAMIC_STATE_PRIMITIVE_TOPOLOGY_EXT;
+	if (_mask & DYNAMIC_STATE_DEPTH_TEST)			_states[count++] = VK_DYNAMIC_STATE_DEPTH_TEST_ENABLE_EXT;
+	if (_mask & DYNAMIC_STATE_DEPTH_WRITE)			_states[count++] = VK_DYNAMIC_STATE_DEPTH_WRITE_ENABLE_EXT;
+	if (_mask & DYNAMIC_STATE_DEPTH_COMPARE)		_states[count++] = VK_DYNAMIC_STATE_DEPTH_COMPARE_OP_EXT;
+#endif
+#ifdef VK_EXT_extended_dynamic_state2
+	if (_mask & DYNAMIC_STATE_DEPTH_BIAS_ENABLE)	_states[count++] = VK_DYNAMIC_STATE_DEPTH_BIAS_ENABLE_EXT;
+	if (_mask & DYNAMIC_STATE_PRIMITIVE_RESTART)	_states[count++] = VK_DYNAMIC_STATE_PRIMITIVE_RESTART_ENABLE_EXT;
+#endif
+#ifdef VK_EXT_extended_dynamic_state3
+	if (_mask & DYNAMIC_STATE_POLYGON_MODE)			_states[count++] = VK_DYNAMIC_STATE_POLYGON_MODE_EXT;
+#endif
+	(void)_mask;
+	return count;
+}
+
+// The description that is actually compiled: dynamic states are reset to the PipelineDesc defaults. Without
+// dynamicPrimitiveTopologyUnrestricted the pipeline's topology has to be in the same class as the one set later, so
+// topology collapses to the list of its class instead.
+inline PipelineDesc normalizeDynamicState(const PipelineDesc& _desc, uint32_t _mask)
+{
+	static const PipelineDesc defaults;
+	PipelineDesc desc = _desc;
+	if (_mask & DYNAMIC_STATE_CULL_MODE)			desc.cullMode = defaults.cullMode;
+	if (_mask & DYNAMIC_STATE_FRONT_FACE)			desc.frontFace = defaults.frontFace;
+	if (_mask & DYNAMIC_STATE_DEPTH_TEST)			desc.depthTestEnable = defaults.depthTestEnable;
+	if (_mask & DYNAMIC_STATE_DEPTH_WRITE)			desc.depthWriteEnable = defaults.depthWriteEnable;
+	if (_mask & DYNAMIC_STATE_DEPTH_COMPARE)		desc.depthCompareOp = defaults.depthCompareOp;
+	if (_mask & DYNAMIC_STATE_DEPTH_BIAS_ENABLE)	desc.depthBiasEnable = defaults.depthBiasEnable;
+	if (_mask & DYNAMIC_STATE_PRIMITIVE_RESTART)	desc.primitiveRestart = defaults.primitiveRestart;
+	if (_mask & DYNAMIC_STATE_POLYGON_MODE)			desc.polygonMode = defaults.polygonMode;
+	if (_mask & DYNAMIC_STATE_TOPOLOGY)
+	{
+		switch (desc.topology)
+		{
+		case VK_PRIMITIVE_TOPOLOGY_LINE_STRIP:
+		case VK_PRIMITIVE_TOPOLOGY_LINE_LIST_WITH_ADJACENCY:
+		case VK_PRIMITIVE_TOPOLOGY_LINE_STRIP_WITH_ADJACENCY:
+			desc.topology = VK_PRIMITIVE_TOPOLOGY_LINE_LIST;
+			break;
+		case VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP:
+		case VK_PRIMITIVE_TOPOLOGY_TRIANGLE_FAN:
+		case VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST_WITH_ADJACENCY:
+		case VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP_WITH_ADJACENCY:
+			desc.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+			break;
+		default:
+			break;
+		}
+	}
+	return desc;
+}
+
+struct DynamicStateStats
+{
+	uint64_t pipelineBinds = 0;
+	uint64_t redundantPipelineBinds = 0;	// same pipeline as the one already bound, skipped
+	uint64_t stateSets = 0;
+	uint64_t redundantStateSets = 0;		// value already current on the command buffer, skipped
+};
+
+// Shadows the dynamic state of one command buffer so binds and state sets that wouldn't change anything are dropped.
+// bindPipeline() takes the description the caller asked for, before normalization, and sets whatever of its dynamic
+// state differs from what's current.
+class CommandStateTracker
+{
+public:
+	void init(const DynamicStateFunctions& _functions)
+	{
+		m_functions = &_functions;
+	}
+
+	// Nothing is known about a command buffer that just started recording.
+	void begin(VkCommandBuffer _commandBuffer)
+	{
+		m_commandBuffer = _commandBuffer;
+		m_pipeline = VK_NULL_HANDLE;
+		m_validStates = 0;
+		m_viewportValid = false;
+		m_scissorValid = false;
+	}
+
+	void bindPipeline(VkPipeline _pipeline, const PipelineDesc& _desc)
+	{
+		if (_pipeline == m_pipeline)
+		{
+			m_stats.redundantPipelineBinds++;
+		}
+		else
+		{
+			vkCmdBindPipeline(m_commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _pipeline);
+			m_pipeline = _pipeline;
+			m_stats.pipelineBinds++;
+		}
+
+		const uint32_t values[DYNAMIC_STATE_COUNT] =
+		{
+			_desc.cullMode, _desc.frontFace, _desc.topology, _desc.depthTestEnable, _desc.depthWriteEnable,
+			_desc.depthCompareOp, _desc.depthBiasEnable, _desc.primitiveRestart, _desc.polygonMode
+		};
+		for (uint32_t i = 0; i < DYNAMIC_STATE_COUNT; i++)
+		{
+			const uint32_t bit = 1u << i;
+			if (!(m_functions->mask & bit))
+				continue;
+			if ((m_validStates & bit) && m_values[i] == values[i])
+			{
+				m_stats.redundantStateSets++;
+				continue;
+			}
+			emit(bit, values[i]);
+			m_values[i] = values[i];
+			m_validStates |= bit;
+			m_stats.stateSets++;
+		}
+	}
+
+	void setViewport(const VkViewport& _viewport)
+	{
+		if (m_viewportValid && memcmp(&m_viewport, &_viewport, sizeof(VkViewport)) == 0)
+		{
+			m_stats.redundantStateSets++;
+			return;
+		}
+		vkCmdSetViewport(m_commandBuffer, 0, 1, &_viewport);
+		m_viewport = _viewport;
+		m_viewportValid = true;
+		m_stats.stateSets++;
+	}
+
+	void setScissor(const VkRect2D& _scissor)
+	{
+		if (m_scissorValid && memcmp(&m_scissor, &_scissor, sizeof(VkRect2D)) == 0)
+		{
+			m_stats.redundantStateSets++;
+			return;
+		}
+		vkCmdSetScissor(m_commandBuffer, 0, 1, &_scissor);
+		m_scissor = _scissor;
+		m_scissorValid = true;
+		m_stats.stateSets++;
+	}
+
+	const DynamicStateStats& getStats() const { return m_stats; }
+
+	void logStats() const
+	{
+		CLog(0, "Command state: {} pipeline binds ({} redundant skipped), {} dynamic state sets ({} redundant skipped).",
+			m_stats.pipelineBinds, m_stats.redundantPipelineBinds, m_stats.stateSets, m_stats.redundantStateSets);
+	}
+
+private:
+	void emit(uint32_t _bit, uint32_t _value)
+	{
+		(void)_value;
+		switch (_bit)
+		{
+#ifdef VK_EXT_extended_dynamic_state
+		case DYNAMIC_STATE_CULL_MODE:			m_functions->cmdSetCullMode(m_commandBuffer, _value); break;
+		case DYNAMIC_STATE_FRONT_FACE:			m_functions->cmdSetFrontFace(m_commandBuffer, (VkFrontFace)_value); break;
+		case DYNAMIC_STATE_TOPOLOGY:			m_functions->cmdSetPrimitiveTopology(m_commandBuffer, (VkPrimitiveTopology)_value); break;
+		case DYNAMIC_STATE_DEPTH_TEST:			m_functions->cmdSetDepthTestEnable(m_commandBuffer, _value); break;
+		case DYNAMIC_STATE_DEPTH_WRITE:			m_functions->cmdSetDepthWriteEnable(m_commandBuffer, _value); break;
+		case DYNAMIC_STATE_DEPTH_COMPARE:		m_functions->cmdSetDepthCompareOp(m_commandBuffer, (VkCompareOp)_value); break;
+#endif
+#ifdef VK_EXT_extended_dynamic_state2
+		case DYNAMIC_STATE_DEPTH_BIAS_ENABLE:	m_functions->cmdSetDepthBiasEnable(m_commandBuffer, _value); break;
+		case DYNAMIC_STATE_PRIMITIVE_RESTART:	m_functions->cmdSetPrimitiveRestartEnable(m_commandBuffer, _value); break;
+#endif
+#ifdef VK_EXT_extended_dynamic_state3
+		case DYNAMIC_STATE_POLYGON_MODE:		m_functions->cmdSetPolygonMode(m_commandBuffer, (VkPolygonMode)_value); break;
+#endif
+		default:
+			CVerifyCrash(false, "Dynamic state {:x} is in the mask but has no entry point.", _bit);
+		}
+	}
+
+	const DynamicStateFunctions* m_functions = nullptr;
+	VkCommandBuffer m_commandBuffer = VK_NULL_HANDLE;
+	VkPipeline m_pipeline = VK_NULL_HANDLE;
+	uint32_t m_validStates = 0;
+	uint32_t m_values[DYNAMIC_STATE_COUNT] = {};
+	VkViewport m_viewport = {};
+	VkRect2D m_scissor = {};
+	bool m_viewportValid = false;
+	bool m_scissorValid = false;
+
+	DynamicStateStats m_stats;
+};
@@ -0,0 +1,103 @@
+#pragma once
+#include "Core.h"
+
+#include <memory>
+#include <cstddef>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <ucontext.h>
+#endif
+
+// An execution context with its own stack that threads switch to cooperatively (Windows fibers, ucontext elsewhere).
+// A thread has to adopt its own context with adoptThread() before it can switch to a fiber, and switching back to
+// that context is the only way to get the thread's own stack back.
+class Fiber
+{
+public:
+	Fiber() = default;
+	Fiber(const Fiber&) = delete;
+	Fiber& operator=(const Fiber&) = delete;
+	~Fiber() { destroy(); }
+
+	// The calling thread's own context, so it can switch to fibers and other threads can switch back into it.
+	void adoptThread()
+	{
+#if defined(_WIN32)
+		m_ownsThread = !IsThreadAFiber();
+		m_fiber = m_ownsThread ? ConvertThreadToFiber(nullptr) : GetCurrentFiber();
+		CVerifyCrash(m_fiber != nullptr, "Fiber: ConvertThreadToFiber failed. Error: {}", GetLastError());
+#endif
+	}
+
+	// Call on the adopted thread, while it runs its own context.
+	void releaseThread()
+	{
+#if defined(_WIN32)
+		if (m_ownsThread)
+			ConvertFiberToThread();
+		m_fiber = nullptr;
+		m_ownsThread = false;
+#endif
+	}
+
+	// A fiber that calls _entry() the first time it's switched to. _entry must never return, it has to switch away.
+	void create(size_t _stackSize, void (*_entry)())
+	{
+		m_entry = _entry;
+#if defined(_WIN32)
+		m_fiber = CreateFiber(_stackSize, &Fiber::start, this);
+		CVerifyCrash(m_fiber != nullptr, "Fiber: CreateFiber failed. Error: {}", GetLastError());
+#else
+		m_stack.reset(new unsigned char[_stackSize]);
+		CVerifyCrash(getcontext(&m_context) == 0, "Fiber: getcontext failed.");
+		m_context.uc_stack.ss_sp = m_stack.get();
+		m_context.uc_stack.ss_size = _stackSize;
+		m_context.uc_link = nullptr;
+		makecontext(&m_context, _entry, 0);
+#endif
+	}
+
+	void destroy()
+	{
+#if defined(_WIN32)
+		if (m_fiber != nullptr && m_entry != nullptr)
+			DeleteFiber(m_fiber);
+		m_fiber = nullptr;
+#else
+		m_stack.reset();
+#endif
+		m_entry = nullptr;
+	}
+
+	// Saves the running context into _from, which has to be the fiber the calling thread is on, and continues _to.
+	// Returns when something switches back to _from, possibly on another thread.
+	static void switchTo(Fiber& _from, Fiber& _to)
+	{
+#if defined(_WIN32)
+		(void)_from;
+		SwitchToFiber(_to.m_fiber);
+#else
+		swapcontext(&_from.m_context, &_to.m_context);
+#endif
+	}
+
+private:
+#if defined(_WIN32)
+	static VOID CALLBACK start(LPVOID _fiber)
+	{
+		static_cast<Fiber*>(_fiber)->m_entry();
+	}
+
+	LPVOID m_fiber = nullptr;
+	bool m_ownsThread = false;
+#else
+	ucontext_t m_context = {};
+	std::unique_ptr<unsigned char[]> m_stack;
+#endif
+	void (*m_entry)() = nullptr;
+};
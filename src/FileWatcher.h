@@ -0,0 +1,209 @@
+#pragma once
+#include "Core.h"
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined(__linux__)
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+// Watches a directory on a background thread (ReadDirectoryChangesW on Windows, recursive; inotify on Linux, top
+// level only) and queues the files that were written. Editors often write a file several times per save, repeated
+// notifications for a path that is already queued only refresh its timestamp.
+class FileWatcher
+{
+public:
+	struct Change
+	{
+		std::string path;	// relative to the watched directory, '/' separated
+		std::chrono::steady_clock::time_point time;
+	};
+
+	~FileWatcher()
+	{
+		stop();
+	}
+
+	bool start(const std::string& _directory)
+	{
+		m_directory = _directory;
+#if defined(_WIN32)
+		m_handle = CreateFileA(_directory.c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+			nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr);
+		if (m_handle == INVALID_HANDLE_VALUE)
+			return false;
+		m_stopEvent = CreateEventA(nullptr, TRUE, FALSE, nullptr);
+#elif defined(__linux__)
+		m_inotify = inotify_init1(IN_NONBLOCK);
+		if (m_inotify < 0)
+			return false;
+		if (inotify_add_watch(m_inotify, _directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+		{
+			close(m_inotify);
+			m_inotify = -1;
+			return false;
+		}
+#else
+		return false;
+#endif
+		m_running = true;
+		m_thread = std::thread([this]() { watchLoop(); });
+		return true;
+	}
+
+	void stop()
+	{
+		if (!m_running)
+			return;
+		m_running = false;
+#if defined(_WIN32)
+		SetEvent(m_stopEvent);
+#endif
+		m_thread.join();
+#if defined(_WIN32)
+		CloseHandle(m_handle);
+		CloseHandle(m_stopEvent);
+		m_handle = INVALID_HANDLE_VALUE;
+#elif defined(__linux__)
+		close(m_inotify);
+		m_inotify = -1;
+#endif
+	}
+
+	// Changes whose last notification is at least _settle old; newer ones stay queued until the writer is done.
+	std::vector<Change> poll(std::chrono::milliseconds _settle = std::chrono::milliseconds(50))
+	{
+		std::vector<Change> result;
+		const auto now = std::chrono::steady_clock::now();
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		size_t kept = 0;
+		for (size_t i = 0; i < m_changes.size(); i++)
+		{
+			if (now - m_changes[i].time >= _settle)
+				result.push_back(std::move(m_changes[i]));
+			else
+				m_changes[kept++] = std::move(m_changes[i]);
+		}
+		m_changes.resize(kept);
+		return result;
+	}
+
+	bool isRunning() const { return m_running; }
+	const std::string& getDirectory() const { return m_directory; }
+
+private:
+	void push(std::string _path)
+	{
+		std::replace(_path.begin(), _path.end(), '\\', '/');
+		const auto now = std::chrono::steady_clock::now();
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (auto& it : m_changes)
+		{
+			if (it.path == _path)
+			{
+				it.time = now;
+				return;
+			}
+		}
+		m_changes.push_back({ std::move(_path), now });
+	}
+
+#if defined(_WIN32)
+	void watchLoop()
+	{
+		alignas(DWORD) char buffer[16 * 1024];
+		OVERLAPPED overlapped = {};
+		overlapped.hEvent = CreateEventA(nullptr, TRUE, FALSE, nullptr);
+		const HANDLE events[] = { overlapped.hEvent, m_stopEvent };
+
+		while (m_running)
+		{
+			ResetEvent(overlapped.hEvent);
+			if (!ReadDirectoryChangesW(m_handle, buffer, sizeof(buffer), TRUE, FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME, nullptr, &overlapped, nullptr))
+			{
+				CLog(2, "ReadDirectoryChangesW failed on {:s} ({}), shader watching stopped.", m_directory, GetLastError());
+				break;
+			}
+			DWORD bytes = 0;
+			if (WaitForMultipleObjects(2, events, FALSE, INFINITE) != WAIT_OBJECT_0)
+			{
+				// The read can still complete into buffer and signal the event until the cancellation is through
+				CancelIo(m_handle);
+				GetOverlappedResult(m_handle, &overlapped, &bytes, TRUE);
+				break;
+			}
+
+			if (!GetOverlappedResult(m_handle, &overlapped, &bytes, FALSE) || bytes == 0)
+				continue;	// overflowed, nothing to report
+
+			const char* cursor = buffer;
+			while (true)
+			{
+				const FILE_NOTIFY_INFORMATION* info = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(cursor);
+				if (info->Action == FILE_ACTION_MODIFIED || info->Action == FILE_ACTION_ADDED || info->Action == FILE_ACTION_RENAMED_NEW_NAME)
+				{
+					const int wideLength = static_cast<int>(info->FileNameLength / sizeof(WCHAR));
+					const int length = WideCharToMultiByte(CP_UTF8, 0, info->FileName, wideLength, nullptr, 0, nullptr, nullptr);
+					std::string path(length, '\0');
+					WideCharToMultiByte(CP_UTF8, 0, info->FileName, wideLength, &path[0], length, nullptr, nullptr);
+					push(std::move(path));
+				}
+				if (info->NextEntryOffset == 0)
+					break;
+				cursor += info->NextEntryOffset;
+			}
+		}
+		CloseHandle(overlapped.hEvent);
+	}
+
+	HANDLE m_handle = INVALID_HANDLE_VALUE;
+	HANDLE m_stopEvent = nullptr;
+#elif defined(__linux__)
+	void watchLoop()
+	{
+		alignas(inotify_event) char buffer[16 * 1024];
+		pollfd fd = { m_inotify, POLLIN, 0 };
+
+		while (m_running)
+		{
+			// Wake up regularly to notice stop()
+			if (::poll(&fd, 1, 100) <= 0)
+				continue;
+
+			const ssize_t bytes = read(m_inotify, buffer, sizeof(buffer));
+			for (ssize_t offset = 0; offset < bytes;)
+			{
+				const inotify_event* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+				if (event->len > 0 && !(event->mask & IN_ISDIR))
+					push(event->name);
+				offset += sizeof(inotify_event) + event->len;
+			}
+		}
+	}
+
+	int m_inotify = -1;
+#else
+	void watchLoop() {}
+#endif
+
+	std::string m_directory;
+	std::thread m_thread;
+	std::atomic<bool> m_running{ false };
+	std::mutex m_mutex;
+	std::vector<Change> m_changes;
+};
@@ -0,0 +1,416 @@
+#pragma once
+#include "Core.h"
+#include "OffsetAllocator.h"
+#include "DeferredDeletionQueue.h"
+#include "GpuMemory.h"
+#include "GpuMemoryReport.h"
+#include <vulkan/vulkan.h>
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+
+// Vertex layout shared by every mesh living in one GeometryBuffer.
+struct VertexFormat
+{
+	const char* name;
+	uint32_t stride;
+};
+
+typedef uint32_t MeshHandle;
+const MeshHandle INVALID_MESH = ~0u;
+
+// Where a mesh lives inside the shared buffers. Indices are mesh local, vertexOffset is applied as the base vertex.
+struct MeshRange
+{
+	uint32_t vertexOffset;
+	uint32_t vertexCount;
+	uint32_t firstIndex;
+	uint32_t indexCount;
+};
+
+struct GeometryBufferStats
+{
+	uint32_t meshCount;
+	uint32_t vertexCapacity, verticesUsed, vertexFreeBlocks, largestVertexFreeBlock;
+	uint32_t indexCapacity, indicesUsed, indexFreeBlocks, largestIndexFreeBlock;
+	uint32_t compactions;
+};
+
+// One big vertex buffer and one 32 bit index buffer per vertex format. Meshes are sub-ranges of them, so every draw of
+// the format shares the same bindings and can go through a single vkCmdDrawIndexedIndirect.
+// Meshes are always referred to by handle, compact() moves them around.
+class GeometryBuffer
+{
+public:
+	void init(VkDevice _device, VkPhysicalDevice _physicalDevice, const VertexFormat& _format, uint32_t _vertexCapacity, uint32_t _indexCapacity)
+	{
+		m_device = _device;
+		m_format = _format;
+		vkGetPhysicalDeviceMemoryProperties(_physicalDevice, &m_memoryProperties);
+
+		createBuffer(static_cast<VkDeviceSize>(_vertexCapacity) * m_format.stride, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, m_vertexBuffer, m_vertexMemory, "VertexBuffer");
+		createBuffer(static_cast<VkDeviceSize>(_indexCapacity) * sizeof(uint32_t), VK_BUFFER_USAGE_INDEX_BUFFER_BIT, m_indexBuffer, m_indexMemory, "IndexBuffer");
+
+		m_vertexAllocator.init(_vertexCapacity);
+		m_indexAllocator.init(_indexCapacity);
+
+		CDebugLog(0, "GeometryBuffer {:s}: {} vertices, {} indices.", m_format.name, _vertexCapacity, _indexCapacity);
+	}
+
+	void destroy()
+	{
+		GpuMemoryRegistry::instance().unregisterBlock(m_vertexMemory);
+		GpuMemoryRegistry::instance().unregisterBlock(m_indexMemory);
+		vkDestroyBuffer(m_device, m_vertexBuffer, nullptr);
+		vkFreeMemory(m_device, m_vertexMemory, nullptr);
+		vkDestroyBuffer(m_device, m_indexBuffer, nullptr);
+		vkFreeMemory(m_device, m_indexMemory, nullptr);
+		m_meshes.clear();
+		m_freeHandles.clear();
+		m_pendingFrees.clear();
+	}
+
+	// Reserves space for a mesh. Returns INVALID_MESH when there is no single free block big enough,
+	// needsCompaction() tells whether compact() would make room. _tag names the mesh in memory reports and must outlive it.
+	MeshHandle allocateMesh(uint32_t _vertexCount, uint32_t _indexCount, const char* _tag = "Mesh")
+	{
+		const uint32_t vertexOffset = m_vertexAllocator.allocate(_vertexCount);
+		if (vertexOffset == OffsetAllocator::INVALID_OFFSET)
+		{
+			CLog(1, "GeometryBuffer {:s}: out of vertex space for {} vertices ({} free, largest block {}).",
+				m_format.name, _vertexCount, m_vertexAllocator.getFree(), m_vertexAllocator.getLargestFreeBlock());
+			return INVALID_MESH;
+		}
+		const uint32_t firstIndex = m_indexAllocator.allocate(_indexCount);
+		if (firstIndex == OffsetAllocator::INVALID_OFFSET)
+		{
+			m_vertexAllocator.free(vertexOffset, _vertexCount);
+			CLog(1, "GeometryBuffer {:s}: out of index space for {} indices ({} free, largest block {}).",
+				m_format.name, _indexCount, m_indexAllocator.getFree(), m_indexAllocator.getLargestFreeBlock());
+			return INVALID_MESH;
+		}
+
+		Mesh mesh;
+		mesh.range = { vertexOffset, _vertexCount, firstIndex, _indexCount };
+		mesh.isLive = true;
+		mesh.tag = _tag;
+		registerMeshMemory(mesh);
+
+		MeshHandle handle;
+		if (!m_freeHandles.empty())
+		{
+			handle = m_freeHandles.back();
+			m_freeHandles.pop_back();
+			m_meshes[handle] = mesh;
+		}
+		else
+		{
+			handle = static_cast<MeshHandle>(m_meshes.size());
+			m_meshes.push_back(mesh);
+		}
+		m_liveMeshCount++;
+		return handle;
+	}
+
+	// The mesh stays drawable by in flight frames, its ranges are only reused once collect() sees _retireValue complete.
+	void freeMesh(MeshHandle _handle, uint64_t _retireValue)
+	{
+		Mesh& mesh = m_meshes[_handle];
+		CVerifyCrash(mesh.isLive, "GeometryBuffer {:s}: double free of mesh {}.", m_format.name, _handle);
+		mesh.isLive = false;
+		m_liveMeshCount--;
+		m_pendingFrees.push_back({ mesh.range, mesh.vertexSubAllocation, mesh.indexSubAllocation, _retireValue });
+		m_freeHandles.push_back(_handle);
+	}
+
+	void collect(uint64_t _completedValue)
+	{
+		size_t kept = 0;
+		for (size_t i = 0; i < m_pendingFrees.size(); i++)
+		{
+			const PendingFree& pending = m_pendingFrees[i];
+			if (pending.retireValue <= _completedValue)
+			{
+				m_vertexAllocator.free(pending.range.vertexOffset, pending.range.vertexCount);
+				m_indexAllocator.free(pending.range.firstIndex, pending.range.indexCount);
+				GpuMemoryRegistry::instance().unregisterSubAllocation(m_vertexMemory, pending.vertexSubAllocation);
+				GpuMemoryRegistry::instance().unregisterSubAllocation(m_indexMemory, pending.indexSubAllocation);
+			}
+			else
+			{
+				m_pendingFrees[kept++] = pending;
+			}
+		}
+		m_pendingFrees.resize(kept);
+	}
+
+	// Copies vertex and index data for a mesh out of a staging buffer. Vertices are read at _vertexSrcOffset, indices at _indexSrcOffset.
+	// Call recordTransferBarrier() once after the batch of uploads.
+	void recordUpload(VkCommandBuffer _cmd, VkBuffer _stagingBuffer, VkDeviceSize _vertexSrcOffset, VkDeviceSize _indexSrcOffset, MeshHandle _handle)
+	{
+		const MeshRange& range = m_meshes[_handle].range;
+
+		VkBufferCopy vertexCopy = {};
+		vertexCopy.srcOffset = _vertexSrcOffset;
+		vertexCopy.dstOffset = static_cast<VkDeviceSize>(range.vertexOffset) * m_format.stride;
+		vertexCopy.size = static_cast<VkDeviceSize>(range.vertexCount) * m_format.stride;
+		vkCmdCopyBuffer(_cmd, _stagingBuffer, m_vertexBuffer, 1, &vertexCopy);
+
+		VkBufferCopy indexCopy = {};
+		indexCopy.srcOffset = _indexSrcOffset;
+		indexCopy.dstOffset = static_cast<VkDeviceSize>(range.firstIndex) * sizeof(uint32_t);
+		indexCopy.size = static_cast<VkDeviceSize>(range.indexCount) * sizeof(uint32_t);
+		vkCmdCopyBuffer(_cmd, _stagingBuffer, m_indexBuffer, 1, &indexCopy);
+	}
+
+	void recordTransferBarrier(VkCommandBuffer _cmd)
+	{
+		VkBufferMemoryBarrier barriers[2] = {};
+		for (auto& it : barriers)
+		{
+			it.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+			it.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			it.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			it.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			it.offset = 0;
+			it.size = VK_WHOLE_SIZE;
+		}
+		barriers[0].dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+		barriers[0].buffer = m_vertexBuffer;
+		barriers[1].dstAccessMask = VK_ACCESS_INDEX_READ_BIT;
+		barriers[1].buffer = m_indexBuffer;
+
+		vkCmdPipelineBarrier(_cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 0, nullptr, 2, barriers, 0, nullptr);
+	}
+
+	bool needsCompaction(uint32_t _vertexCount, uint32_t _indexCount) const
+	{
+		const bool vertexFits = m_vertexAllocator.getLargestFreeBlock() >= _vertexCount;
+		const bool indexFits = m_indexAllocator.getLargestFreeBlock() >= _indexCount;
+		return (!vertexFits && m_vertexAllocator.getFree() >= _vertexCount) || (!indexFits && m_indexAllocator.getFree() >= _indexCount);
+	}
+
+	// Packs every live mesh to the front of fresh buffers with GPU copies recorded into _cmd. The old buffers are retired
+	// through the deletion queue so frames in flight keep drawing from them, which also means pending frees can simply be
+	// dropped: their ranges only exist in the old buffers. _retireValue is the frame _cmd is submitted in.
+	void compact(VkCommandBuffer _cmd, DeferredDeletionQueue& _deletionQueue, uint64_t _retireValue)
+	{
+		VkBuffer newVertexBuffer, newIndexBuffer;
+		VkDeviceMemory newVertexMemory, newIndexMemory;
+		createBuffer(static_cast<VkDeviceSize>(m_vertexAllocator.getCapacity()) * m_format.stride, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, newVertexBuffer, newVertexMemory, "VertexBuffer");
+		createBuffer(static_cast<VkDeviceSize>(m_indexAllocator.getCapacity()) * sizeof(uint32_t), VK_BUFFER_USAGE_INDEX_BUFFER_BIT, newIndexBuffer, newIndexMemory, "IndexBuffer");
+
+		// Keep the relative order, neighbouring meshes then become single copies.
+		std::vector<MeshHandle> order;
+		for (MeshHandle i = 0; i < m_meshes.size(); i++)
+		{
+			if (m_meshes[i].isLive)
+				order.push_back(i);
+		}
+		std::sort(order.begin(), order.end(), [this](MeshHandle _a, MeshHandle _b)
+		{
+			return m_meshes[_a].range.vertexOffset < m_meshes[_b].range.vertexOffset;
+		});
+
+		m_vertexAllocator.init(m_vertexAllocator.getCapacity());
+		m_indexAllocator.init(m_indexAllocator.getCapacity());
+
+		std::vector<VkBufferCopy> vertexCopies;
+		std::vector<VkBufferCopy> indexCopies;
+		for (MeshHandle handle : order)
+		{
+			MeshRange& range = m_meshes[handle].range;
+			const uint32_t newVertexOffset = m_vertexAllocator.allocate(range.vertexCount);
+			const uint32_t newFirstIndex = m_indexAllocator.allocate(range.indexCount);
+
+			appendCopy(vertexCopies, static_cast<VkDeviceSize>(range.vertexOffset) * m_format.stride,
+				static_cast<VkDeviceSize>(newVertexOffset) * m_format.stride, static_cast<VkDeviceSize>(range.vertexCount) * m_format.stride);
+			appendCopy(indexCopies, static_cast<VkDeviceSize>(range.firstIndex) * sizeof(uint32_t),
+				static_cast<VkDeviceSize>(newFirstIndex) * sizeof(uint32_t), static_cast<VkDeviceSize>(range.indexCount) * sizeof(uint32_t));
+
+			range.vertexOffset = newVertexOffset;
+			range.firstIndex = newFirstIndex;
+		}
+
+		// Uploads recorded earlier into _cmd may still be writing the old buffers
+		VkBufferMemoryBarrier barriers[2] = {};
+		for (auto& it : barriers)
+		{
+			it.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+			it.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			it.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+			it.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			it.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			it.offset = 0;
+			it.size = VK_WHOLE_SIZE;
+		}
+		barriers[0].buffer = m_vertexBuffer;
+		barriers[1].buffer = m_indexBuffer;
+		vkCmdPipelineBarrier(_cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 2, barriers, 0, nullptr);
+
+		if (!vertexCopies.empty())
+			vkCmdCopyBuffer(_cmd, m_vertexBuffer, newVertexBuffer, static_cast<uint32_t>(vertexCopies.size()), vertexCopies.data());
+		if (!indexCopies.empty())
+			vkCmdCopyBuffer(_cmd, m_indexBuffer, newIndexBuffer, static_cast<uint32_t>(indexCopies.size()), indexCopies.data());
+
+		_deletionQueue.push(m_vertexBuffer, _retireValue);
+		_deletionQueue.push(m_vertexMemory, _retireValue);
+		_deletionQueue.push(m_indexBuffer, _retireValue);
+		_deletionQueue.push(m_indexMemory, _retireValue);
+
+		m_vertexBuffer = newVertexBuffer;
+		m_vertexMemory = newVertexMemory;
+		m_indexBuffer = newIndexBuffer;
+		m_indexMemory = newIndexMemory;
+		m_pendingFrees.clear();
+		m_compactions++;
+
+		// The old blocks leave the memory report when the deletion queue frees them, the meshes move to the new ones.
+		for (MeshHandle handle : order)
+		{
+			registerMeshMemory(m_meshes[handle]);
+		}
+
+		recordTransferBarrier(_cmd);
+		CDebugLog(0, "GeometryBuffer {:s}: compacted {} meshes into {} vertex / {} index copies.", m_format.name, order.size(), vertexCopies.size(), indexCopies.size());
+	}
+
+	void bind(VkCommandBuffer _cmd) const
+	{
+		const VkDeviceSize offset = 0;
+		vkCmdBindVertexBuffers(_cmd, 0, 1, &m_vertexBuffer, &offset);
+		vkCmdBindIndexBuffer(_cmd, m_indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+	}
+
+	// Ready to be written into an indirect buffer, draws of the same format can then be merged into one multi-draw.
+	VkDrawIndexedIndirectCommand getDrawCommand(MeshHandle _handle, uint32_t _instanceCount = 1, uint32_t _firstInstance = 0) const
+	{
+		const MeshRange& range = m_meshes[_handle].range;
+		VkDrawIndexedIndirectCommand command;
+		command.indexCount = range.indexCount;
+		command.instanceCount = _instanceCount;
+		command.firstIndex = range.firstIndex;
+		command.vertexOffset = static_cast<int32_t>(range.vertexOffset);
+		command.firstInstance = _firstInstance;
+		return command;
+	}
+
+	const MeshRange& getMesh(MeshHandle _handle) const { return m_meshes[_handle].range; }
+	VkBuffer getVertexBuffer() const { return m_vertexBuffer; }
+	VkBuffer getIndexBuffer() const { return m_indexBuffer; }
+	const VertexFormat& getFormat() const { return m_format; }
+
+	GeometryBufferStats getStats() const
+	{
+		GeometryBufferStats stats;
+		stats.meshCount = m_liveMeshCount;
+		stats.vertexCapacity = m_vertexAllocator.getCapacity();
+		stats.verticesUsed = m_vertexAllocator.getUsed();
+		stats.vertexFreeBlocks = m_vertexAllocator.getFreeBlockCount();
+		stats.largestVertexFreeBlock = m_vertexAllocator.getLargestFreeBlock();
+		stats.indexCapacity = m_indexAllocator.getCapacity();
+		stats.indicesUsed = m_indexAllocator.getUsed();
+		stats.indexFreeBlocks = m_indexAllocator.getFreeBlockCount();
+		stats.largestIndexFreeBlock = m_indexAllocator.getLargestFreeBlock();
+		stats.compactions = m_compactions;
+		return stats;
+	}
+
+	void logStats() const
+	{
+		const GeometryBufferStats stats = getStats();
+		CLog(0, "GeometryBuffer {:s}: {} meshes, vertices {}/{} ({:.1f}%, {} free blocks, largest {}), indices {}/{} ({:.1f}%, {} free blocks, largest {}), {} compactions.",
+			m_format.name, stats.meshCount,
+			stats.verticesUsed, stats.vertexCapacity, 100.0 * stats.verticesUsed / std::max(stats.vertexCapacity, 1u), stats.vertexFreeBlocks, stats.largestVertexFreeBlock,
+			stats.indicesUsed, stats.indexCapacity, 100.0 * stats.indicesUsed / std::max(stats.indexCapacity, 1u), stats.indexFreeBlocks, stats.largestIndexFreeBlock,
+			stats.compactions);
+	}
+
+private:
+	struct Mesh
+	{
+		MeshRange range;
+		bool isLive;
+		const char* tag;
+		uint64_t vertexSubAllocation;
+		uint64_t indexSubAllocation;
+	};
+	struct PendingFree
+	{
+		MeshRange range;
+		uint64_t vertexSubAllocation;
+		uint64_t indexSubAllocation;
+		uint64_t retireValue;
+	};
+
+	void registerMeshMemory(Mesh& _mesh)
+	{
+		GpuMemoryRegistry& registry = GpuMemoryRegistry::instance();
+		_mesh.vertexSubAllocation = registry.registerSubAllocation(m_vertexMemory, static_cast<VkDeviceSize>(_mesh.range.vertexOffset) * m_format.stride,
+			static_cast<VkDeviceSize>(_mesh.range.vertexCount) * m_format.stride, MemoryCategory::Mesh, _mesh.tag);
+		_mesh.indexSubAllocation = registry.registerSubAllocation(m_indexMemory, static_cast<VkDeviceSize>(_mesh.range.firstIndex) * sizeof(uint32_t),
+			static_cast<VkDeviceSize>(_mesh.range.indexCount) * sizeof(uint32_t), MemoryCategory::Mesh, _mesh.tag);
+	}
+
+	static void appendCopy(std::vector<VkBufferCopy>& _copies, VkDeviceSize _src, VkDeviceSize _dst, VkDeviceSize _size)
+	{
+		if (_size == 0)
+			return;
+		if (!_copies.empty())
+		{
+			VkBufferCopy& last = _copies.back();
+			if (last.srcOffset + last.size == _src && last.dstOffset + last.size == _dst)
+			{
+				last.size += _size;
+				return;
+			}
+		}
+		_copies.push_back({ _src, _dst, _size });
+	}
+
+	void createBuffer(VkDeviceSize _size, VkBufferUsageFlags _usage, VkBuffer& _outBuffer, VkDeviceMemory& _outMemory, const char* _tag)
+	{
+		VkBufferCreateInfo createInfo = {};
+		createInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		createInfo.size = _size;
+		// Transfer src as well so compaction can copy out of it
+		createInfo.usage = _usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+		createInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+		VkResult result = vkCreateBuffer(m_device, &createInfo, nullptr, &_outBuffer);
+		CVerifyCrash(result == VK_SUCCESS, "GeometryBuffer {:s}: failed to create buffer of {} bytes. Result: {}", m_format.name, _size, result);
+
+		VkMemoryRequirements requirements;
+		vkGetBufferMemoryRequirements(m_device, _outBuffer, &requirements);
+
+		VkMemoryAllocateInfo allocInfo = {};
+		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		allocInfo.allocationSize = requirements.size;
+		bool found = findMemoryType(m_memoryProperties, requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, allocInfo.memoryTypeIndex);
+		CVerifyCrash(found, "GeometryBuffer {:s}: no device local memory type!", m_format.name);
+
+		result = vkAllocateMemory(m_device, &allocInfo, nullptr, &_outMemory);
+		CVerifyCrash(result == VK_SUCCESS, "GeometryBuffer {:s}: failed to allocate {} bytes. Result: {}", m_format.name, requirements.size, result);
+		vkBindBufferMemory(m_device, _outBuffer, _outMemory, 0);
+		GpuMemoryRegistry::instance().registerBlock(_outMemory, requirements.size, allocInfo.memoryTypeIndex, m_memoryProperties, MemoryCategory::Mesh, _tag);
+	}
+
+	VkDevice m_device = VK_NULL_HANDLE;
+	VkPhysicalDeviceMemoryProperties m_memoryProperties;
+	VertexFormat m_format;
+
+	VkBuffer m_vertexBuffer = VK_NULL_HANDLE;
+	VkDeviceMemory m_vertexMemory = VK_NULL_HANDLE;
+	VkBuffer m_indexBuffer = VK_NULL_HANDLE;
+	VkDeviceMemory m_indexMemory = VK_NULL_HANDLE;
+
+	OffsetAllocator m_vertexAllocator;	// in vertices
+	OffsetAllocator m_indexAllocator;	// in indices
+
+	std::vector<Mesh> m_meshes;
+	std::vector<MeshHandle> m_freeHandles;
+	std::vector<PendingFree> m_pendingFrees;
+	uint32_t m_liveMeshCount = 0;
+	uint32_t m_compactions = 0;
+};
@@ -0,0 +1,17 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <cstdint>
+
+// Picks the first memory type allowed by _typeBits (from VkMemoryRequirements) that has all of _properties.
+inline bool findMemoryType(const VkPhysicalDeviceMemoryProperties& _memoryProperties, uint32_t _typeBits, VkMemoryPropertyFlags _properties, uint32_t& _outIndex)
+{
+	for (uint32_t i = 0; i < _memoryProperties.memoryTypeCount; i++)
+	{
+		if ((_typeBits & (1u << i)) && (_memoryProperties.memoryTypes[i].propertyFlags & _properties) == _properties)
+		{
+			_outIndex = i;
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,311 @@
+#pragma once
+#include "Core.h"
+#include <vulkan/vulkan.h>
+
+#include <vector>
+#include <string>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <fstream>
+#include <cstdint>
+#include <cstdio>
+
+enum class MemoryCategory : uint32_t
+{
+	Texture, Mesh, RenderTarget, Staging, Other, Count
+};
+
+inline const char* memoryCategoryName(MemoryCategory _category)
+{
+	switch (_category)
+	{
+	case MemoryCategory::Texture:		return "Texture";
+	case MemoryCategory::Mesh:			return "Mesh";
+	case MemoryCategory::RenderTarget:	return "RenderTarget";
+	case MemoryCategory::Staging:		return "Staging";
+	default:							return "Other";
+	}
+}
+
+// Bookkeeping of every VkDeviceMemory block the allocators own and what they placed inside it.
+// It never talks to the device: allocators register/unregister metadata as they go, snapshot() copies it under a short
+// lock and the JSON is written from a background thread, so a dump costs the frame loop one copy.
+class GpuMemoryRegistry
+{
+public:
+	struct SubAllocation
+	{
+		uint64_t id;
+		VkDeviceSize offset;
+		VkDeviceSize size;
+		MemoryCategory category;
+		std::string tag;
+		uint64_t createdFrame;
+	};
+	struct Block
+	{
+		uint64_t handle;	// VkDeviceMemory
+		VkDeviceSize size;
+		uint32_t memoryTypeIndex;
+		uint32_t heapIndex;
+		VkMemoryPropertyFlags propertyFlags;
+		MemoryCategory category;
+		std::string tag;
+		uint64_t createdFrame;
+		std::vector<SubAllocation> subAllocations;
+	};
+	struct Snapshot
+	{
+		uint64_t frame;
+		std::vector<Block> blocks;
+	};
+
+	static GpuMemoryRegistry& instance()
+	{
+		static GpuMemoryRegistry* _instance = new GpuMemoryRegistry();
+		return *_instance;
+	}
+
+	// Lifetimes are recorded in frames.
+	void setFrame(uint64_t _frame)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_frame = _frame;
+	}
+
+	void registerBlock(VkDeviceMemory _memory, VkDeviceSize _size, uint32_t _memoryTypeIndex, const VkPhysicalDeviceMemoryProperties& _memoryProperties,
+		MemoryCategory _category, const char* _tag)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		Block block;
+		block.handle = (uint64_t)_memory;
+		block.size = _size;
+		block.memoryTypeIndex = _memoryTypeIndex;
+		block.heapIndex = _memoryProperties.memoryTypes[_memoryTypeIndex].heapIndex;
+		block.propertyFlags = _memoryProperties.memoryTypes[_memoryTypeIndex].propertyFlags;
+		block.category = _category;
+		block.tag = _tag;
+		block.createdFrame = m_frame;
+		m_blocks.push_back(std::move(block));
+	}
+
+	// Drops the block and everything placed in it. Unknown handles are ignored.
+	void unregisterBlock(VkDeviceMemory _memory)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (size_t i = 0; i < m_blocks.size(); i++)
+		{
+			if (m_blocks[i].handle == (uint64_t)_memory)
+			{
+				m_blocks[i] = std::move(m_blocks.back());
+				m_blocks.pop_back();
+				return;
+			}
+		}
+	}
+
+	uint64_t registerSubAllocation(VkDeviceMemory _memory, VkDeviceSize _offset, VkDeviceSize _size, MemoryCategory _category, const char* _tag)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		Block* block = findBlock((uint64_t)_memory);
+		if (block == nullptr)
+			return 0;
+
+		SubAllocation sub;
+		sub.id = ++m_nextSubAllocationId;
+		sub.offset = _offset;
+		sub.size = _size;
+		sub.category = _category;
+		sub.tag = _tag;
+		sub.createdFrame = m_frame;
+		block->subAllocations.push_back(std::move(sub));
+		return m_nextSubAllocationId;
+	}
+
+	void unregisterSubAllocation(VkDeviceMemory _memory, uint64_t _id)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		Block* block = findBlock((uint64_t)_memory);
+		if (block == nullptr)
+			return;
+		auto& subs = block->subAllocations;
+		for (size_t i = 0; i < subs.size(); i++)
+		{
+			if (subs[i].id == _id)
+			{
+				subs[i] = std::move(subs.back());
+				subs.pop_back();
+				return;
+			}
+		}
+	}
+
+	Snapshot snapshot()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		Snapshot result;
+		result.frame = m_frame;
+		result.blocks = m_blocks;
+		return result;
+	}
+
+	// Snapshots now and writes the JSON on a background thread. Ignored while the previous report is still being
+	// written, so the caller never waits on the writer.
+	void requestDump(const std::string& _path)
+	{
+		if (m_writing.load(std::memory_order_acquire))
+		{
+			CLog(1, "GPU memory report still being written, ignoring the request for {:s}.", _path);
+			return;
+		}
+		waitForDump();	// finished, returns at once
+		m_writing.store(true, std::memory_order_relaxed);
+		Snapshot snap = snapshot();
+		m_writer = std::thread([this, snap = std::move(snap), _path]()
+		{
+			std::ofstream file(_path);
+			file << toJson(snap);
+			CLog(0, "GPU memory report written to {:s} ({} blocks).", _path, snap.blocks.size());
+			m_writing.store(false, std::memory_order_release);
+		});
+	}
+
+	// Joins the writer, for shutdown.
+	void waitForDump()
+	{
+		if (m_writer.joinable())
+			m_writer.join();
+	}
+
+	static std::string toJson(const Snapshot& _snapshot)
+	{
+		struct CategoryTotals
+		{
+			uint64_t blockCount = 0, blockBytes = 0, subAllocationCount = 0, subAllocatedBytes = 0;
+		};
+		CategoryTotals totals[static_cast<uint32_t>(MemoryCategory::Count)];
+		uint64_t totalBytes = 0;
+		uint64_t totalSubAllocated = 0;
+
+		std::string json;
+		json.reserve(256 + _snapshot.blocks.size() * 512);
+		json += "{\n\t\"frame\": " + std::to_string(_snapshot.frame) + ",\n\t\"blocks\": [";
+
+		for (size_t b = 0; b < _snapshot.blocks.size(); b++)
+		{
+			const Block& block = _snapshot.blocks[b];
+			CategoryTotals& blockTotals = totals[static_cast<uint32_t>(block.category)];
+			blockTotals.blockCount++;
+			blockTotals.blockBytes += block.size;
+			totalBytes += block.size;
+
+			char handle[32];
+			snprintf(handle, sizeof(handle), "0x%016llx", static_cast<unsigned long long>(block.handle));
+
+			json += b == 0 ? "\n" : ",\n";
+			json += "\t\t{ \"handle\": \"" + std::string(handle) + "\"";
+			json += ", \"size\": " + std::to_string(block.size);
+			json += ", \"memoryType\": " + std::to_string(block.memoryTypeIndex);
+			json += ", \"heap\": " + std::to_string(block.heapIndex);
+			json += ", \"flags\": " + memoryFlagsToJson(block.propertyFlags);
+			json += ", \"category\": \"" + std::string(memoryCategoryName(block.category)) + "\"";
+			json += ", \"tag\": " + escape(block.tag);
+			json += ", \"createdFrame\": " + std::to_string(block.createdFrame);
+			json += ", \"ageFrames\": " + std::to_string(_snapshot.frame - block.createdFrame);
+			json += ",\n\t\t  \"subAllocations\": [";
+
+			for (size_t s = 0; s < block.subAllocations.size(); s++)
+			{
+				const SubAllocation& sub = block.subAllocations[s];
+				CategoryTotals& subTotals = totals[static_cast<uint32_t>(sub.category)];
+				subTotals.subAllocationCount++;
+				subTotals.subAllocatedBytes += sub.size;
+				totalSubAllocated += sub.size;
+
+				json += s == 0 ? "\n" : ",\n";
+				json += "\t\t\t{ \"offset\": " + std::to_string(sub.offset);
+				json += ", \"size\": " + std::to_string(sub.size);
+				json += ", \"category\": \"" + std::string(memoryCategoryName(sub.category)) + "\"";
+				json += ", \"tag\": " + escape(sub.tag);
+				json += ", \"createdFrame\": " + std::to_string(sub.createdFrame);
+				json += ", \"ageFrames\": " + std::to_string(_snapshot.frame - sub.createdFrame) + " }";
+			}
+			json += block.subAllocations.empty() ? "] }" : "\n\t\t  ] }";
+		}
+
+		json += "\n\t],\n\t\"summary\": {\n";
+		json += "\t\t\"totalBytes\": " + std::to_string(totalBytes) + ",\n";
+		json += "\t\t\"subAllocatedBytes\": " + std::to_string(totalSubAllocated) + ",\n";
+		json += "\t\t\"blockCount\": " + std::to_string(_snapshot.blocks.size()) + ",\n";
+		json += "\t\t\"categories\": {";
+		for (uint32_t c = 0; c < static_cast<uint32_t>(MemoryCategory::Count); c++)
+		{
+			json += c == 0 ? "\n" : ",\n";
+			json += "\t\t\t\"" + std::string(memoryCategoryName(static_cast<MemoryCategory>(c))) + "\": { ";
+			json += "\"blocks\": " + std::to_string(totals[c].blockCount);
+			json += ", \"blockBytes\": " + std::to_string(totals[c].blockBytes);
+			json += ", \"subAllocations\": " + std::to_string(totals[c].subAllocationCount);
+			json += ", \"subAllocatedBytes\": " + std::to_string(totals[c].subAllocatedBytes) + " }";
+		}
+		json += "\n\t\t}\n\t}\n}\n";
+		return json;
+	}
+
+private:
+	GpuMemoryRegistry() {}
+
+	Block* findBlock(uint64_t _handle)
+	{
+		for (auto& it : m_blocks)
+		{
+			if (it.handle == _handle)
+				return &it;
+		}
+		return nullptr;
+	}
+
+	static std::string memoryFlagsToJson(VkMemoryPropertyFlags _flags)
+	{
+		std::string result = "[";
+		const struct { VkMemoryPropertyFlags bit; const char* name; } names[] =
+		{
+			{ VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, "DEVICE_LOCAL" },
+			{ VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, "HOST_VISIBLE" },
+			{ VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, "HOST_COHERENT" },
+			{ VK_MEMORY_PROPERTY_HOST_CACHED_BIT, "HOST_CACHED" },
+			{ VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT, "LAZILY_ALLOCATED" },
+		};
+		for (const auto& it : names)
+		{
+			if (_flags & it.bit)
+			{
+				result += result.size() > 1 ? ", \"" : "\"";
+				result += it.name;
+				result += "\"";
+			}
+		}
+		return result + "]";
+	}
+
+	static std::string escape(const std::string& _value)
+	{
+		std::string result = "\"";
+		for (char c : _value)
+		{
+			if (c == '"' || c == '\\')
+				result += '\\';
+			if (static_cast<unsigned char>(c) < 0x20)
+				continue;
+			result += c;
+		}
+		return result + "\"";
+	}
+
+	std::mutex m_mutex;
+	std::vector<Block> m_blocks;
+	uint64_t m_frame = 0;
+	uint64_t m_nextSubAllocationId = 0;
+	std::thread m_writer;
+	std::atomic<bool> m_writing{ false };
+};
@@ -0,0 +1,244 @@
+#pragma once
+#include "Core.h"
+#include "DeviceFeatures.h"
+#include <vulkan/vulkan.h>
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+
+// GPU timestamps per scope and per queue. Every frame slot has one query pool per queue type, the queue resets its
+// own pool in its first command buffer of the frame so queues never race on a reset. Results are read back in
+// beginFrame() after the slot's fence wait and kept for the last HISTORY_FRAMES frames, writeTrace() turns them
+// into a chrome://tracing (or Perfetto) JSON with one track per queue.
+class GpuProfiler
+{
+public:
+	static constexpr uint32_t MAX_SCOPES = 64;			// per queue per frame
+	static constexpr uint32_t HISTORY_FRAMES = 120;
+	static constexpr uint32_t NONE = ~0u;
+
+	void init(VkDevice _device, const DeviceFeatures& _features, uint32_t _framesInFlight)
+	{
+		m_device = _device;
+		m_nsPerTick = _features.timestampPeriod;
+		m_slots.resize(_framesInFlight);
+		for (uint32_t q = 0; q < QUEUE_TYPE_COUNT; q++)
+		{
+			uint32_t bits = _features.timestampValidBits[q];
+			m_validMask[q] = bits == 0 ? 0 : bits >= 64 ? ~0ull : (1ull << bits) - 1;
+		}
+
+		VkQueryPoolCreateInfo poolInfo = {};
+		poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		poolInfo.queryCount = MAX_SCOPES * 2;
+		for (Slot& slot : m_slots)
+		{
+			for (uint32_t q = 0; q < QUEUE_TYPE_COUNT; q++)
+			{
+				if (m_validMask[q] == 0)
+					continue;
+				CVerifyCrash(vkCreateQueryPool(m_device, &poolInfo, nullptr, &slot.queues[q].pool) == VK_SUCCESS, "Failed to create timestamp query pool.");
+			}
+		}
+		m_events.reserve(HISTORY_FRAMES * MAX_SCOPES * 2);
+		m_results.resize(MAX_SCOPES * 2);
+	}
+
+	void destroy()
+	{
+		for (Slot& slot : m_slots)
+		{
+			for (uint32_t q = 0; q < QUEUE_TYPE_COUNT; q++)
+			{
+				if (slot.queues[q].pool != VK_NULL_HANDLE)
+					vkDestroyQueryPool(m_device, slot.queues[q].pool, nullptr);
+			}
+		}
+		m_slots.clear();
+	}
+
+	// Call after the slot's fence wait: collects what the slot recorded last time, then starts a new frame in it.
+	void beginFrame(uint32_t _slot, uint64_t _frameNumber)
+	{
+		m_slot = _slot;
+		Slot& slot = m_slots[_slot];
+		if (slot.recorded)
+			collect(slot);
+		slot.frameNumber = _frameNumber;
+		slot.recorded = true;
+		for (uint32_t q = 0; q < QUEUE_TYPE_COUNT; q++)
+		{
+			slot.queues[q].scopeCount = 0;
+			slot.queues[q].reset = false;
+		}
+	}
+
+	// Call at the start of every command buffer before any scope, outside of a render pass.
+	void beginCommandBuffer(VkCommandBuffer _cmd, QueueType _queue)
+	{
+		QueueSlot& queue = m_slots[m_slot].queues[static_cast<uint32_t>(_queue)];
+		if (queue.pool == VK_NULL_HANDLE || queue.reset)
+			return;
+		vkCmdResetQueryPool(_cmd, queue.pool, 0, MAX_SCOPES * 2);
+		queue.reset = true;
+	}
+
+	// _name must outlive the profiler, pass names are string literals.
+	uint32_t beginScope(VkCommandBuffer _cmd, QueueType _queue, const char* _name)
+	{
+		QueueSlot& queue = m_slots[m_slot].queues[static_cast<uint32_t>(_queue)];
+		if (!queue.reset || queue.scopeCount == MAX_SCOPES)
+			return NONE;
+		uint32_t scope = queue.scopeCount++;
+		queue.names[scope] = _name;
+		vkCmdWriteTimestamp(_cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queue.pool, scope * 2);
+		return scope;
+	}
+
+	void endScope(VkCommandBuffer _cmd, QueueType _queue, uint32_t _scope)
+	{
+		if (_scope == NONE)
+			return;
+		QueueSlot& queue = m_slots[m_slot].queues[static_cast<uint32_t>(_queue)];
+		vkCmdWriteTimestamp(_cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queue.pool, _scope * 2 + 1);
+	}
+
+	// Chrome trace JSON of the frames in the history, timestamps relative to the oldest one.
+	bool writeTrace(const std::string& _path) const
+	{
+		std::ofstream file(_path);
+		if (!file)
+			return false;
+		uint64_t origin = ~0ull;
+		for (const Event& event : m_events)
+			origin = std::min(origin, event.begin);
+
+		static const char* queueNames[QUEUE_TYPE_COUNT] = { "Graphics queue", "Async compute queue", "Transfer queue" };
+		file << "{\n\t\"displayTimeUnit\": \"ns\",\n\t\"traceEvents\": [";
+		for (uint32_t q = 0; q < QUEUE_TYPE_COUNT; q++)
+		{
+			file << (q == 0 ? "\n" : ",\n");
+			file << "\t\t{ \"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << q << ", \"args\": { \"name\": \"" << queueNames[q] << "\" } }";
+		}
+		char line[256];
+		for (const Event& event : m_events)
+		{
+			snprintf(line, sizeof(line), ",\n\t\t{ \"name\": \"%s\", \"cat\": \"gpu\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f, \"args\": { \"frame\": %llu } }",
+				event.name, event.queue, toMicroseconds(event.begin - origin), toMicroseconds(event.end - event.begin), static_cast<unsigned long long>(event.frame));
+			file << line;
+		}
+		file << "\n\t]\n}\n";
+		CLog(0, "GPU timeline written to {:s} ({} scopes).", _path, m_events.size());
+		return true;
+	}
+
+	void logStats() const
+	{
+		if (m_stats.frames == 0)
+			return;
+		double frames = static_cast<double>(m_stats.frames);
+		CLog(0, "GPU profiler: {} frames, graphics {:.1f} us, async compute {:.1f} us, transfer {:.1f} us, overlapped with graphics {:.1f} us per frame.",
+			m_stats.frames, m_stats.busyUs[0] / frames, m_stats.busyUs[1] / frames, m_stats.busyUs[2] / frames, m_stats.overlapUs / frames);
+	}
+
+private:
+	struct Event
+	{
+		const char* name;
+		uint32_t queue;
+		uint64_t frame;
+		uint64_t begin, end;	// ticks, masked to the valid bits
+	};
+
+	struct QueueSlot
+	{
+		VkQueryPool pool = VK_NULL_HANDLE;
+		uint32_t scopeCount = 0;
+		bool reset = false;
+		const char* names[MAX_SCOPES] = {};
+	};
+
+	struct Slot
+	{
+		QueueSlot queues[QUEUE_TYPE_COUNT];
+		uint64_t frameNumber = 0;
+		bool recorded = false;
+	};
+
+	struct Stats
+	{
+		uint64_t frames = 0;
+		double busyUs[QUEUE_TYPE_COUNT] = {};
+		double overlapUs = 0.0;
+	};
+
+	double toMicroseconds(uint64_t _ticks) const { return static_cast<double>(_ticks) * m_nsPerTick / 1000.0; }
+
+	void collect(Slot& _slot)
+	{
+		// Drop the oldest frame once the history is full, events stay in frame order.
+		if (m_historyFrames == HISTORY_FRAMES)
+		{
+			uint64_t oldest = m_events.front().frame;
+			m_events.erase(m_events.begin(), std::find_if(m_events.begin(), m_events.end(), [oldest](const Event& _e) { return _e.frame != oldest; }));
+			m_historyFrames--;
+		}
+
+		size_t first = m_events.size();
+		for (uint32_t q = 0; q < QUEUE_TYPE_COUNT; q++)
+		{
+			QueueSlot& queue = _slot.queues[q];
+			if (queue.scopeCount == 0)
+				continue;
+			VkResult result = vkGetQueryPoolResults(m_device, queue.pool, 0, queue.scopeCount * 2, queue.scopeCount * 2 * sizeof(uint64_t),
+				m_results.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+			if (result != VK_SUCCESS)
+				continue;
+			for (uint32_t s = 0; s < queue.scopeCount; s++)
+			{
+				uint64_t begin = m_results[s * 2] & m_validMask[q];
+				uint64_t end = m_results[s * 2 + 1] & m_validMask[q];
+				m_events.push_back({ queue.names[s], q, _slot.frameNumber, begin, std::max(begin, end) });
+			}
+		}
+		if (m_events.size() == first)
+			return;
+		m_historyFrames++;
+
+		// Busy time per queue and how much of the other queues' work ran while graphics was busy. Scopes on one
+		// queue don't overlap each other, so the pairwise sum is the overlap.
+		m_stats.frames++;
+		for (size_t i = first; i < m_events.size(); i++)
+		{
+			const Event& event = m_events[i];
+			m_stats.busyUs[event.queue] += toMicroseconds(event.end - event.begin);
+			if (event.queue == static_cast<uint32_t>(QueueType::Graphics))
+				continue;
+			for (size_t g = first; g < m_events.size(); g++)
+			{
+				const Event& graphics = m_events[g];
+				if (graphics.queue != static_cast<uint32_t>(QueueType::Graphics))
+					continue;
+				uint64_t begin = std::max(event.begin, graphics.begin);
+				uint64_t end = std::min(event.end, graphics.end);
+				if (end > begin)
+					m_stats.overlapUs += toMicroseconds(end - begin);
+			}
+		}
+	}
+
+	VkDevice m_device = VK_NULL_HANDLE;
+	float m_nsPerTick = 1.0f;
+	uint64_t m_validMask[QUEUE_TYPE_COUNT] = {};
+	std::vector<Slot> m_slots;
+	uint32_t m_slot = 0;
+	std::vector<uint64_t> m_results;
+	std::vector<Event> m_events;
+	uint32_t m_historyFrames = 0;
+	Stats m_stats;
+};
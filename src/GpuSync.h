@@ -0,0 +1,451 @@
+#pragma once
+#include "Core.h"
+#include "DeviceFeatures.h"
+#include <vulkan/vulkan.h>
+
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+
+// A value on a queue's timeline, signalled once the submission that returned it has completed. Every timeline starts
+// at 0, so a default constructed point is complete before anything was submitted.
+struct GpuSyncPoint
+{
+	QueueType queue = QueueType::Graphics;
+	uint64_t value = 0;
+};
+
+// GPU/CPU synchronization on one monotonically increasing value per queue type. submit() returns the point its
+// submission signals, later submissions on any queue wait on points and the CPU polls or waits on them. Completed
+// values are cached, so checking a point that is known to be done never calls into the driver.
+//
+// With timeline semaphores (core in 1.2) every queue type owns one timeline semaphore. Without them each submission
+// gets a fence from a pool and the completed value is the last submission whose fence has signalled, checked oldest
+// first. A GPU wait on another queue's point is then a binary semaphore signalled by an empty submission on that
+// queue: it comes after everything submitted there so far, the point included, so it waits at least as long.
+//
+// Frames are a timeline too: endFrame() ties a frame number to the point of its last submission. Everything retired
+// per frame (deferred deletion, geometry frees, descriptor and bindless slots) keeps using frame numbers, and
+// getCompletedFrame() is where they come from. Not thread safe, it belongs to the thread that submits.
+class GpuSync
+{
+public:
+	struct Wait
+	{
+		GpuSyncPoint point;
+		VkPipelineStageFlags stages;
+	};
+
+	// Binary semaphores are the caller's, for the swapchain's acquire and present.
+	struct SubmitDesc
+	{
+		uint32_t commandBufferCount = 0;
+		const VkCommandBuffer* commandBuffers = nullptr;
+		uint32_t waitCount = 0;
+		const Wait* waits = nullptr;
+		uint32_t binaryWaitCount = 0;
+		const VkSemaphore* binaryWaits = nullptr;
+		const VkPipelineStageFlags* binaryWaitStages = nullptr;
+		uint32_t binarySignalCount = 0;
+		const VkSemaphore* binarySignals = nullptr;
+	};
+
+	static constexpr uint32_t MAX_BINARY_SEMAPHORES = 8;	// per submission, waits and signals each
+
+	void init(VkDevice _device, const DeviceFeatures& _features, const VkQueue (&_queues)[QUEUE_TYPE_COUNT])
+	{
+		m_device = _device;
+		std::copy(_queues, _queues + QUEUE_TYPE_COUNT, m_vkQueues);
+		m_timelines = false;
+#ifdef VK_KHR_timeline_semaphore
+		if (_features.timelineSemaphore)
+		{
+			// The 1.2 core entry points have the same signatures as the extension ones
+			const bool core = _features.deviceApiVersion >= VK_MAKE_VERSION(1, 2, 0);
+			m_getSemaphoreCounterValue = (PFN_vkGetSemaphoreCounterValueKHR)vkGetDeviceProcAddr(_device, core ? "vkGetSemaphoreCounterValue" : "vkGetSemaphoreCounterValueKHR");
+			m_waitSemaphores = (PFN_vkWaitSemaphoresKHR)vkGetDeviceProcAddr(_device, core ? "vkWaitSemaphores" : "vkWaitSemaphoresKHR");
+			m_timelines = m_getSemaphoreCounterValue != nullptr && m_waitSemaphores != nullptr;
+		}
+		if (m_timelines)
+		{
+			VkSemaphoreTypeCreateInfoKHR typeInfo = {};
+			typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+			typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+			typeInfo.initialValue = 0;
+			VkSemaphoreCreateInfo createInfo = {};
+			createInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+			createInfo.pNext = &typeInfo;
+			for (Queue& queue : m_queues)
+			{
+				VkResult result = vkCreateSemaphore(m_device, &createInfo, nullptr, &queue.timeline);
+				CVerifyCrash(result == VK_SUCCESS, "GpuSync: failed to create a timeline semaphore. Result: {}", result);
+			}
+		}
+#else
+		(void)_features;
+#endif
+		CLog(0, "GPU sync: {:s}.", m_timelines ? "timeline semaphores" : "fence pool");
+	}
+
+	// Everything submitted must be complete, e.g. after vkDeviceWaitIdle().
+	void destroy()
+	{
+		for (Queue& queue : m_queues)
+		{
+			if (queue.timeline != VK_NULL_HANDLE)
+				vkDestroySemaphore(m_device, queue.timeline, nullptr);
+			queue.timeline = VK_NULL_HANDLE;
+			for (const Pending& it : queue.pending)
+			{
+				vkDestroyFence(m_device, it.fence, nullptr);
+			}
+			queue.pending.clear();
+		}
+		for (VkFence it : m_freeFences)
+		{
+			vkDestroyFence(m_device, it, nullptr);
+		}
+		m_freeFences.clear();
+		for (const BorrowedSemaphore& it : m_borrowedSemaphores)
+		{
+			vkDestroySemaphore(m_device, it.semaphore, nullptr);
+		}
+		m_borrowedSemaphores.clear();
+		for (VkSemaphore it : m_freeSemaphores)
+		{
+			vkDestroySemaphore(m_device, it, nullptr);
+		}
+		m_freeSemaphores.clear();
+	}
+
+	bool usesTimelineSemaphores() const { return m_timelines; }
+
+	// Waits on points that are already known to be complete are dropped, several on one queue become one.
+	GpuSyncPoint submit(QueueType _queue, const SubmitDesc& _desc)
+	{
+		Queue& queue = m_queues[static_cast<uint32_t>(_queue)];
+		const GpuSyncPoint point = { _queue, queue.submitted + 1 };
+		CVerifyCrash(_desc.binaryWaitCount <= MAX_BINARY_SEMAPHORES && _desc.binarySignalCount <= MAX_BINARY_SEMAPHORES,
+			"GpuSync: more than {} binary semaphores in one submission.", MAX_BINARY_SEMAPHORES);
+
+		uint64_t waitValues[QUEUE_TYPE_COUNT] = {};
+		VkPipelineStageFlags waitQueueStages[QUEUE_TYPE_COUNT] = {};
+		for (uint32_t i = 0; i < _desc.waitCount; i++)
+		{
+			const Wait& wait = _desc.waits[i];
+			const uint32_t source = static_cast<uint32_t>(wait.point.queue);
+			CVerifyCrash(wait.point.value <= m_queues[source].submitted, "GpuSync: {:s} submission waits on {:s} value {}, which was never submitted.",
+				QUEUE_NAMES[static_cast<uint32_t>(_queue)], QUEUE_NAMES[source], wait.point.value);
+			if (wait.point.value <= m_queues[source].completed)
+			{
+				m_stats.waitsSkipped++;
+				continue;
+			}
+			waitValues[source] = std::max(waitValues[source], wait.point.value);
+			waitQueueStages[source] |= wait.stages;
+		}
+
+		VkSemaphore waitSemaphores[QUEUE_TYPE_COUNT + MAX_BINARY_SEMAPHORES];
+		VkPipelineStageFlags waitStages[QUEUE_TYPE_COUNT + MAX_BINARY_SEMAPHORES];
+		uint64_t semaphoreWaitValues[QUEUE_TYPE_COUNT + MAX_BINARY_SEMAPHORES] = {};	// binary semaphores ignore theirs
+		uint32_t waitCount = 0;
+		for (uint32_t q = 0; q < QUEUE_TYPE_COUNT; q++)
+		{
+			if (waitValues[q] == 0)
+				continue;
+			waitSemaphores[waitCount] = m_timelines ? m_queues[q].timeline : signalOnQueue(static_cast<QueueType>(q), point);
+			semaphoreWaitValues[waitCount] = waitValues[q];
+			waitStages[waitCount++] = waitQueueStages[q];
+		}
+		for (uint32_t i = 0; i < _desc.binaryWaitCount; i++)
+		{
+			waitSemaphores[waitCount] = _desc.binaryWaits[i];
+			waitStages[waitCount++] = _desc.binaryWaitStages[i];
+		}
+
+		VkSemaphore signalSemaphores[1 + MAX_BINARY_SEMAPHORES];
+		uint64_t signalValues[1 + MAX_BINARY_SEMAPHORES] = {};
+		uint32_t signalCount = 0;
+		if (m_timelines)
+		{
+			signalSemaphores[signalCount] = queue.timeline;
+			signalValues[signalCount++] = point.value;
+		}
+		for (uint32_t i = 0; i < _desc.binarySignalCount; i++)
+		{
+			signalSemaphores[signalCount++] = _desc.binarySignals[i];
+		}
+
+		VkSubmitInfo submitInfo = {};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.waitSemaphoreCount = waitCount;
+		submitInfo.pWaitSemaphores = waitSemaphores;
+		submitInfo.pWaitDstStageMask = waitStages;
+		submitInfo.commandBufferCount = _desc.commandBufferCount;
+		submitInfo.pCommandBuffers = _desc.commandBuffers;
+		submitInfo.signalSemaphoreCount = signalCount;
+		submitInfo.pSignalSemaphores = signalSemaphores;
+		VkFence fence = VK_NULL_HANDLE;
+#ifdef VK_KHR_timeline_semaphore
+		VkTimelineSemaphoreSubmitInfoKHR timelineInfo = {};
+		if (m_timelines)
+		{
+			timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+			timelineInfo.waitSemaphoreValueCount = waitCount;
+			timelineInfo.pWaitSemaphoreValues = semaphoreWaitValues;
+			timelineInfo.signalSemaphoreValueCount = signalCount;
+			timelineInfo.pSignalSemaphoreValues = signalValues;
+			submitInfo.pNext = &timelineInfo;
+		}
+#endif
+		if (!m_timelines)
+		{
+			// Retires the queue's finished fences first, nothing else may poll a queue that is only ever submitted to
+			poll(_queue);
+			fence = acquireFence();
+		}
+
+		VkResult result = vkQueueSubmit(m_vkQueues[static_cast<uint32_t>(_queue)], 1, &submitInfo, fence);
+		CVerifyCrash(result == VK_SUCCESS, "GpuSync: vkQueueSubmit on the {:s} queue failed. Result: {}", QUEUE_NAMES[static_cast<uint32_t>(_queue)], result);
+		queue.submitted = point.value;
+		if (!m_timelines)
+			queue.pending.push_back({ point.value, fence });
+		m_stats.submissions++;
+		return point;
+	}
+
+	// The newest value of _queue the GPU has completed, asks the driver only while there is outstanding work.
+	uint64_t poll(QueueType _queue)
+	{
+		Queue& queue = m_queues[static_cast<uint32_t>(_queue)];
+		if (queue.completed == queue.submitted)
+			return queue.completed;
+		m_stats.polls++;
+#ifdef VK_KHR_timeline_semaphore
+		if (m_timelines)
+		{
+			uint64_t value = 0;
+			VkResult result = m_getSemaphoreCounterValue(m_device, queue.timeline, &value);
+			CVerifyCrash(result == VK_SUCCESS, "GpuSync: failed to read the {:s} timeline. Result: {}", QUEUE_NAMES[static_cast<uint32_t>(_queue)], result);
+			queue.completed = std::max(queue.completed, value);
+			return queue.completed;
+		}
+#endif
+		while (!queue.pending.empty())
+		{
+			VkResult result = vkGetFenceStatus(m_device, queue.pending.front().fence);
+			if (result == VK_NOT_READY)
+				break;
+			CVerifyCrash(result == VK_SUCCESS, "GpuSync: failed to read a {:s} fence. Result: {}", QUEUE_NAMES[static_cast<uint32_t>(_queue)], result);
+			retireOldest(queue);
+		}
+		recycleSemaphores();
+		return queue.completed;
+	}
+
+	bool isComplete(GpuSyncPoint _point)
+	{
+		return _point.value <= m_queues[static_cast<uint32_t>(_point.queue)].completed || _point.value <= poll(_point.queue);
+	}
+
+	// Blocks until _point is complete.
+	void wait(GpuSyncPoint _point)
+	{
+		if (isComplete(_point))
+			return;
+		const uint32_t index = static_cast<uint32_t>(_point.queue);
+		Queue& queue = m_queues[index];
+		CVerifyCrash(_point.value <= queue.submitted, "GpuSync: waiting on {:s} value {}, which was never submitted.", QUEUE_NAMES[index], _point.value);
+
+		const auto start = std::chrono::steady_clock::now();
+#ifdef VK_KHR_timeline_semaphore
+		if (m_timelines)
+		{
+			VkSemaphoreWaitInfoKHR waitInfo = {};
+			waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR;
+			waitInfo.semaphoreCount = 1;
+			waitInfo.pSemaphores = &queue.timeline;
+			waitInfo.pValues = &_point.value;
+			VkResult result = m_waitSemaphores(m_device, &waitInfo, UINT64_MAX);
+			CVerifyCrash(result == VK_SUCCESS, "GpuSync: waiting on the {:s} timeline failed. Result: {}", QUEUE_NAMES[index], result);
+			queue.completed = std::max(queue.completed, _point.value);
+		}
+#endif
+		while (queue.completed < _point.value)
+		{
+			VkResult result = vkWaitForFences(m_device, 1, &queue.pending.front().fence, VK_TRUE, UINT64_MAX);
+			CVerifyCrash(result == VK_SUCCESS, "GpuSync: waiting on a {:s} fence failed. Result: {}", QUEUE_NAMES[index], result);
+			retireOldest(queue);
+		}
+		recycleSemaphores();
+		m_stats.cpuWaits++;
+		m_stats.cpuWaitMicroseconds += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// The newest point submitted on _queue, waiting on it waits for everything submitted there so far.
+	GpuSyncPoint getLastSubmitted(QueueType _queue) const { return { _queue, m_queues[static_cast<uint32_t>(_queue)].submitted }; }
+
+	// _point is the frame's last submission, it has to wait for the frame's other submissions.
+	void endFrame(uint64_t _frameNumber, GpuSyncPoint _point)
+	{
+		CVerifyCrash(m_frames.empty() || m_frames.back().frameNumber < _frameNumber, "GpuSync: frame {} ended twice or out of order.", _frameNumber);
+		m_frames.push_back({ _frameNumber, _point });
+	}
+
+	// Newest frame the GPU has finished. Frames are checked oldest first, so a frame only counts once all before it do.
+	uint64_t getCompletedFrame()
+	{
+		while (!m_frames.empty() && isComplete(m_frames.front().point))
+		{
+			m_completedFrame = m_frames.front().frameNumber;
+			m_frames.pop_front();
+		}
+		return m_completedFrame;
+	}
+
+	// Frame pacing: blocks until _frameNumber and every frame before it are complete.
+	void waitForFrame(uint64_t _frameNumber)
+	{
+		while (!m_frames.empty() && m_frames.front().frameNumber <= _frameNumber)
+		{
+			wait(m_frames.front().point);
+			m_completedFrame = m_frames.front().frameNumber;
+			m_frames.pop_front();
+		}
+	}
+
+	void logStats() const
+	{
+		CLog(0, "GPU sync ({:s}): {} submissions, {} CPU waits ({:.1f} us average), {} polls, {} GPU waits dropped as already complete, {} emulated with binary semaphores, {} fences.",
+			m_timelines ? "timeline semaphores" : "fence pool", m_stats.submissions, m_stats.cpuWaits,
+			m_stats.cpuWaits > 0 ? static_cast<double>(m_stats.cpuWaitMicroseconds) / m_stats.cpuWaits : 0.0,
+			m_stats.polls, m_stats.waitsSkipped, m_stats.emulatedWaits, m_stats.fences);
+	}
+
+private:
+	static constexpr const char* QUEUE_NAMES[QUEUE_TYPE_COUNT] = { "graphics", "async compute", "transfer" };
+
+	// Fallback only: a submission's fence, in submission order.
+	struct Pending
+	{
+		uint64_t value;
+		VkFence fence;
+	};
+
+	struct Queue
+	{
+		VkSemaphore timeline = VK_NULL_HANDLE;
+		uint64_t submitted = 0;
+		uint64_t completed = 0;
+		std::deque<Pending> pending;
+	};
+
+	// Fallback only: free again once the submission waiting on it has completed.
+	struct BorrowedSemaphore
+	{
+		GpuSyncPoint waiter;
+		VkSemaphore semaphore;
+	};
+
+	struct Frame
+	{
+		uint64_t frameNumber;
+		GpuSyncPoint point;
+	};
+
+	struct Stats
+	{
+		uint64_t submissions = 0;
+		uint64_t polls = 0;
+		uint64_t cpuWaits = 0;
+		uint64_t cpuWaitMicroseconds = 0;
+		uint64_t waitsSkipped = 0;
+		uint64_t emulatedWaits = 0;
+		uint64_t fences = 0;
+	};
+
+	VkFence acquireFence()
+	{
+		if (!m_freeFences.empty())
+		{
+			VkFence fence = m_freeFences.back();
+			m_freeFences.pop_back();
+			return fence;
+		}
+		VkFenceCreateInfo createInfo = {};
+		createInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+		VkFence fence;
+		VkResult result = vkCreateFence(m_device, &createInfo, nullptr, &fence);
+		CVerifyCrash(result == VK_SUCCESS, "GpuSync: failed to create a fence. Result: {}", result);
+		m_stats.fences++;
+		return fence;
+	}
+
+	void retireOldest(Queue& _queue)
+	{
+		const Pending oldest = _queue.pending.front();
+		_queue.pending.pop_front();
+		_queue.completed = oldest.value;
+		vkResetFences(m_device, 1, &oldest.fence);
+		m_freeFences.push_back(oldest.fence);
+	}
+
+	// An empty submission on _source that signals a binary semaphore for _waiter to wait on.
+	VkSemaphore signalOnQueue(QueueType _source, GpuSyncPoint _waiter)
+	{
+		VkSemaphore semaphore;
+		if (!m_freeSemaphores.empty())
+		{
+			semaphore = m_freeSemaphores.back();
+			m_freeSemaphores.pop_back();
+		}
+		else
+		{
+			VkSemaphoreCreateInfo createInfo = {};
+			createInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+			VkResult result = vkCreateSemaphore(m_device, &createInfo, nullptr, &semaphore);
+			CVerifyCrash(result == VK_SUCCESS, "GpuSync: failed to create a semaphore. Result: {}", result);
+		}
+
+		VkSubmitInfo submitInfo = {};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.signalSemaphoreCount = 1;
+		submitInfo.pSignalSemaphores = &semaphore;
+		VkResult result = vkQueueSubmit(m_vkQueues[static_cast<uint32_t>(_source)], 1, &submitInfo, VK_NULL_HANDLE);
+		CVerifyCrash(result == VK_SUCCESS, "GpuSync: vkQueueSubmit on the {:s} queue failed. Result: {}", QUEUE_NAMES[static_cast<uint32_t>(_source)], result);
+		m_borrowedSemaphores.push_back({ _waiter, semaphore });
+		m_stats.emulatedWaits++;
+		return semaphore;
+	}
+
+	void recycleSemaphores()
+	{
+		size_t kept = 0;
+		for (size_t i = 0; i < m_borrowedSemaphores.size(); i++)
+		{
+			const BorrowedSemaphore& it = m_borrowedSemaphores[i];
+			if (it.waiter.value <= m_queues[static_cast<uint32_t>(it.waiter.queue)].completed)
+				m_freeSemaphores.push_back(it.semaphore);
+			else
+				m_borrowedSemaphores[kept++] = it;
+		}
+		m_borrowedSemaphores.resize(kept);
+	}
+
+	VkDevice m_device = VK_NULL_HANDLE;
+	VkQueue m_vkQueues[QUEUE_TYPE_COUNT] = {};
+	bool m_timelines = false;
+#ifdef VK_KHR_timeline_semaphore
+	PFN_vkGetSemaphoreCounterValueKHR m_getSemaphoreCounterValue = nullptr;
+	PFN_vkWaitSemaphoresKHR m_waitSemaphores = nullptr;
+#endif
+	Queue m_queues[QUEUE_TYPE_COUNT];
+	std::vector<VkFence> m_freeFences;
+	std::vector<BorrowedSemaphore> m_borrowedSemaphores;
+	std::vector<VkSemaphore> m_freeSemaphores;
+	std::deque<Frame> m_frames;					// ended but not known to be complete, oldest first
+	uint64_t m_completedFrame = 0;
+	Stats m_stats;
+};
@@ -0,0 +1,38 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+// 64 bit FNV-1a. Used for cache keys (descriptor contents, pipeline descriptions, shader code), not for anything
+// adversarial. Keys hash their fields explicitly rather than whole structs so padding never leaks into the result.
+class Hasher
+{
+public:
+	static constexpr uint64_t OFFSET_BASIS = 14695981039346656037ull;
+	static constexpr uint64_t PRIME = 1099511628211ull;
+
+	Hasher& bytes(const void* _data, size_t _size)
+	{
+		const uint8_t* data = static_cast<const uint8_t*>(_data);
+		for (size_t i = 0; i < _size; i++)
+		{
+			m_hash = (m_hash ^ data[i]) * PRIME;
+		}
+		return *this;
+	}
+	template<typename T>
+	Hasher& value(const T& _value)
+	{
+		static_assert(sizeof(T) <= 8, "Hash struct members individually");
+		return bytes(&_value, sizeof(T));
+	}
+
+	uint64_t get() const { return m_hash; }
+
+private:
+	uint64_t m_hash = OFFSET_BASIS;
+};
+
+inline uint64_t hashBytes(const void* _data, size_t _size)
+{
+	return Hasher().bytes(_data, _size).get();
+}
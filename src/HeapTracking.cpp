@@ -0,0 +1,52 @@
+#include "HostMemory.h"
+#include <cstdlib>
+
+// Replacement global allocation functions so per frame heap traffic shows up in HeapTracking counters.
+// The nothrow and array forms end up in these, aligned new is left to the default implementation.
+namespace
+{
+	std::atomic<uint64_t> s_allocationCount(0);
+	std::atomic<uint64_t> s_deallocationCount(0);
+	std::atomic<uint64_t> s_allocatedBytes(0);
+}
+
+namespace HeapTracking
+{
+	uint64_t getAllocationCount() { return s_allocationCount.load(std::memory_order_relaxed); }
+	uint64_t getDeallocationCount() { return s_deallocationCount.load(std::memory_order_relaxed); }
+	uint64_t getAllocatedBytes() { return s_allocatedBytes.load(std::memory_order_relaxed); }
+}
+
+void* operator new(size_t _size)
+{
+	s_allocationCount.fetch_add(1, std::memory_order_relaxed);
+	s_allocatedBytes.fetch_add(_size, std::memory_order_relaxed);
+
+	void* memory = std::malloc(_size == 0 ? 1 : _size);
+	if (memory == nullptr)
+		throw std::bad_alloc();
+	return memory;
+}
+void* operator new[](size_t _size)
+{
+	return operator new(_size);
+}
+void operator delete(void* _memory) noexcept
+{
+	if (_memory == nullptr)
+		return;
+	s_deallocationCount.fetch_add(1, std::memory_order_relaxed);
+	std::free(_memory);
+}
+void operator delete[](void* _memory) noexcept
+{
+	operator delete(_memory);
+}
+void operator delete(void* _memory, size_t) noexcept
+{
+	operator delete(_memory);
+}
+void operator delete[](void* _memory, size_t) noexcept
+{
+	operator delete(_memory);
+}
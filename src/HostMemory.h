@@ -0,0 +1,222 @@
+#pragma once
+#include <memory_resource>
+#include <new>
+#include <utility>
+#include <vector>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Process wide counters bumped by the replacement global operator new/delete in HeapTracking.cpp.
+// Sample them at frame boundaries to get heap calls per frame.
+namespace HeapTracking
+{
+	uint64_t getAllocationCount();
+	uint64_t getDeallocationCount();
+	uint64_t getAllocatedBytes();
+}
+
+// Bump allocator for temporaries that die before the end of the frame (query results, scratch containers...).
+// Deallocation is a no-op, reset() releases everything at once. When a frame needs more than the block it chains
+// overflow blocks from the upstream resource and the next reset() grows the main block to fit, so steady state frames
+// never touch the heap. Not thread safe, each thread wants its own arena.
+class FrameArena : public std::pmr::memory_resource
+{
+public:
+	explicit FrameArena(size_t _capacity = 64 * 1024, std::pmr::memory_resource* _upstream = std::pmr::new_delete_resource())
+		: m_upstream(_upstream)
+	{
+		allocateMainBlock(_capacity);
+	}
+	~FrameArena()
+	{
+		releaseOverflow();
+		m_upstream->deallocate(m_block, m_capacity, alignof(std::max_align_t));
+	}
+	FrameArena(const FrameArena&) = delete;
+	FrameArena& operator=(const FrameArena&) = delete;
+
+	void reset()
+	{
+		const size_t highWater = m_offset + m_overflowBytes;
+		m_peakBytes = highWater > m_peakBytes ? highWater : m_peakBytes;
+
+		if (!m_overflowBlocks.empty())
+		{
+			releaseOverflow();
+			m_upstream->deallocate(m_block, m_capacity, alignof(std::max_align_t));
+			allocateMainBlock(highWater + highWater / 2);
+		}
+		m_offset = 0;
+		m_overflowBytes = 0;
+	}
+
+	size_t getCapacity() const { return m_capacity; }
+	size_t getUsedBytes() const { return m_offset + m_overflowBytes; }
+	size_t getPeakBytes() const { return m_peakBytes; }
+
+private:
+	void* do_allocate(size_t _bytes, size_t _alignment) override
+	{
+		// The block itself is only max_align_t aligned, so align the address rather than the offset
+		const uintptr_t base = reinterpret_cast<uintptr_t>(m_block);
+		const size_t aligned = ((base + m_offset + _alignment - 1) & ~static_cast<uintptr_t>(_alignment - 1)) - base;
+		if (aligned <= m_capacity && _bytes <= m_capacity - aligned)
+		{
+			m_offset = aligned + _bytes;
+			return m_block + aligned;
+		}
+
+		OverflowBlock overflow = { _bytes, _alignment, m_upstream->allocate(_bytes, _alignment) };
+		m_overflowBlocks.push_back(overflow);
+		m_overflowBytes += _bytes + _alignment;
+		return overflow.memory;
+	}
+	void do_deallocate(void*, size_t, size_t) override {}
+	bool do_is_equal(const std::pmr::memory_resource& _other) const noexcept override
+	{
+		return this == &_other;
+	}
+
+	void allocateMainBlock(size_t _capacity)
+	{
+		m_capacity = _capacity;
+		m_block = static_cast<std::byte*>(m_upstream->allocate(m_capacity, alignof(std::max_align_t)));
+	}
+	void releaseOverflow()
+	{
+		for (auto& it : m_overflowBlocks)
+		{
+			m_upstream->deallocate(it.memory, it.bytes, it.alignment);
+		}
+		m_overflowBlocks.clear();
+	}
+
+	struct OverflowBlock
+	{
+		size_t bytes;
+		size_t alignment;
+		void* memory;
+	};
+
+	std::pmr::memory_resource* m_upstream;
+	std::byte* m_block = nullptr;
+	size_t m_capacity = 0;
+	size_t m_offset = 0;
+	size_t m_overflowBytes = 0;
+	size_t m_peakBytes = 0;
+	std::vector<OverflowBlock> m_overflowBlocks;
+};
+
+// Fixed size blocks carved out of chunks, freed blocks go onto an intrusive free list and are handed straight back out.
+// Allocations bigger than the block size go to upstream. Not thread safe.
+class FixedBlockPool : public std::pmr::memory_resource
+{
+public:
+	FixedBlockPool(size_t _blockSize, size_t _blocksPerChunk = 256, std::pmr::memory_resource* _upstream = std::pmr::new_delete_resource())
+		: m_blockSize(roundUp(_blockSize < sizeof(FreeBlock) ? sizeof(FreeBlock) : _blockSize, alignof(std::max_align_t)))
+		, m_blocksPerChunk(_blocksPerChunk)
+		, m_upstream(_upstream)
+	{}
+	~FixedBlockPool()
+	{
+		for (void* chunk : m_chunks)
+		{
+			m_upstream->deallocate(chunk, m_blockSize * m_blocksPerChunk, alignof(std::max_align_t));
+		}
+	}
+	FixedBlockPool(const FixedBlockPool&) = delete;
+	FixedBlockPool& operator=(const FixedBlockPool&) = delete;
+
+	size_t getBlockSize() const { return m_blockSize; }
+	size_t getLiveBlocks() const { return m_liveBlocks; }
+	size_t getCapacityBlocks() const { return m_chunks.size() * m_blocksPerChunk; }
+
+private:
+	struct FreeBlock
+	{
+		FreeBlock* next;
+	};
+
+	static size_t roundUp(size_t _value, size_t _alignment)
+	{
+		return (_value + _alignment - 1) & ~(_alignment - 1);
+	}
+
+	void* do_allocate(size_t _bytes, size_t _alignment) override
+	{
+		if (_bytes > m_blockSize || _alignment > alignof(std::max_align_t))
+			return m_upstream->allocate(_bytes, _alignment);
+
+		if (m_freeList == nullptr)
+			addChunk();
+
+		FreeBlock* block = m_freeList;
+		m_freeList = block->next;
+		m_liveBlocks++;
+		return block;
+	}
+	void do_deallocate(void* _memory, size_t _bytes, size_t _alignment) override
+	{
+		if (_bytes > m_blockSize || _alignment > alignof(std::max_align_t))
+		{
+			m_upstream->deallocate(_memory, _bytes, _alignment);
+			return;
+		}
+		FreeBlock* block = static_cast<FreeBlock*>(_memory);
+		block->next = m_freeList;
+		m_freeList = block;
+		m_liveBlocks--;
+	}
+	bool do_is_equal(const std::pmr::memory_resource& _other) const noexcept override
+	{
+		return this == &_other;
+	}
+
+	void addChunk()
+	{
+		std::byte* chunk = static_cast<std::byte*>(m_upstream->allocate(m_blockSize * m_blocksPerChunk, alignof(std::max_align_t)));
+		m_chunks.push_back(chunk);
+		for (size_t i = m_blocksPerChunk; i-- > 0;)
+		{
+			FreeBlock* block = reinterpret_cast<FreeBlock*>(chunk + i * m_blockSize);
+			block->next = m_freeList;
+			m_freeList = block;
+		}
+	}
+
+	const size_t m_blockSize;
+	const size_t m_blocksPerChunk;
+	std::pmr::memory_resource* m_upstream;
+	FreeBlock* m_freeList = nullptr;
+	std::vector<void*> m_chunks;
+	size_t m_liveBlocks = 0;
+};
+
+// Typed front end for FixedBlockPool, for engine objects that are created and destroyed often.
+template<typename T>
+class ObjectPool
+{
+public:
+	explicit ObjectPool(size_t _objectsPerChunk = 256)
+		: m_pool(sizeof(T), _objectsPerChunk)
+	{}
+
+	template<typename... Args>
+	T* create(Args&&... _args)
+	{
+		void* memory = m_pool.allocate(sizeof(T), alignof(T));
+		return new (memory) T(std::forward<Args>(_args)...);
+	}
+	void destroy(T* _object)
+	{
+		_object->~T();
+		m_pool.deallocate(_object, sizeof(T), alignof(T));
+	}
+
+	size_t getLiveCount() const { return m_pool.getLiveBlocks(); }
+	std::pmr::memory_resource* getResource() { return &m_pool; }
+
+private:
+	FixedBlockPool m_pool;
+};
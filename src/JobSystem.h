@@ -0,0 +1,704 @@
+#pragma once
+#include "Core.h"
+#include "Fiber.h"
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <atomic>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <algorithm>
+#include <cstdint>
+
+// One of a worker's fibers. A fiber stays with the worker that owns it, when it waits it is resumed on that worker.
+struct JobFiber
+{
+	Fiber fiber;
+	JobFiber* nextWaiter = nullptr;		// in the waiter list of the job it waits on
+	uint32_t worker = 0;
+};
+
+// Fixed size task. The callable lives inside the job, so creating one never touches the heap.
+struct alignas(64) Job
+{
+	static constexpr uint32_t DATA_SIZE = 64;
+	static constexpr uint32_t MAX_CONTINUATIONS = 7;
+
+	void (*function)(Job&);
+	Job* parent;
+	std::atomic<int32_t> unfinished{ 0 };		// itself plus unfinished children, 0 once the slot is free
+	std::atomic<int32_t> dependencies{ 0 };		// unfinished jobs it depends on, plus one until run() is called
+	std::atomic<uint32_t> continuationCount{ 0 };
+	Job* continuations[MAX_CONTINUATIONS];	// jobs depending on this one
+	std::atomic<JobFiber*> waiters{ nullptr };	// fibers suspended in wait() on it, with the fiber backend
+	alignas(16) unsigned char data[DATA_SIZE];
+};
+
+// Chase-Lev work stealing deque of a fixed capacity. The owning thread pushes and pops at the bottom, any thread
+// steals from the top. Memory orders follow "Correct and Efficient Work-Stealing for Weak Memory Models" (Lê et al.).
+class WorkStealingDeque
+{
+public:
+	explicit WorkStealingDeque(uint32_t _capacity) : m_mask(_capacity - 1), m_jobs(_capacity)
+	{
+		CVerifyCrash((_capacity & m_mask) == 0, "WorkStealingDeque: capacity {} is not a power of two.", _capacity);
+	}
+
+	// Owner only, false when full.
+	bool push(Job* _job)
+	{
+		const int64_t bottom = m_bottom.load(std::memory_order_relaxed);
+		const int64_t top = m_top.load(std::memory_order_acquire);
+		if (bottom - top > static_cast<int64_t>(m_mask))
+			return false;
+		m_jobs[bottom & m_mask].store(_job, std::memory_order_relaxed);
+		m_bottom.store(bottom + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Owner only, newest first.
+	Job* pop()
+	{
+		const int64_t bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+		m_bottom.store(bottom, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t top = m_top.load(std::memory_order_relaxed);
+		if (top > bottom)
+		{
+			m_bottom.store(bottom + 1, std::memory_order_relaxed);
+			return nullptr;
+		}
+		Job* job = m_jobs[bottom & m_mask].load(std::memory_order_relaxed);
+		if (top == bottom)
+		{
+			// Last one, race the thieves for it
+			if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+				job = nullptr;
+			m_bottom.store(bottom + 1, std::memory_order_relaxed);
+		}
+		return job;
+	}
+
+	// Any thread, oldest first. nullptr when empty or another thread won the race.
+	Job* steal()
+	{
+		int64_t top = m_top.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		const int64_t bottom = m_bottom.load(std::memory_order_acquire);
+		if (top >= bottom)
+			return nullptr;
+		Job* job = m_jobs[top & m_mask].load(std::memory_order_relaxed);
+		if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+			return nullptr;
+		return job;
+	}
+
+	bool empty() const { return m_bottom.load(std::memory_order_relaxed) <= m_top.load(std::memory_order_relaxed); }
+
+private:
+	alignas(64) std::atomic<int64_t> m_top{ 0 };
+	alignas(64) std::atomic<int64_t> m_bottom{ 0 };
+	const int64_t m_mask;
+	std::vector<std::atomic<Job*>> m_jobs;
+};
+
+struct JobSystemStats
+{
+	uint64_t executed = 0;
+	uint64_t stolen = 0;			// executed by another worker than the one that queued them
+	uint64_t injected = 0;			// queued from threads that aren't workers
+	uint64_t sleeps = 0;			// times a worker ran out of work and went to sleep
+	uint64_t suspends = 0;			// waits that parked their fiber, with the fiber backend
+	uint64_t fiberFallbacks = 0;	// waits that found no fiber to switch to and ran jobs on their own stack instead
+};
+
+// Work stealing job system. Every worker (the thread calling init() is worker 0) owns a deque: run() pushes to the
+// calling worker's deque, idle workers pop their own newest job and otherwise steal the oldest job of another worker.
+// Threads that aren't workers queue into a global injection queue.
+//
+// Jobs form trees: a job created with a parent keeps it unfinished until the child is done, so waiting on the root
+// waits for everything spawned under it. wait() never blocks, the waiting thread runs other jobs in the meantime.
+// dependsOn() orders jobs: a job whose dependencies aren't done is only queued once the last one finishes.
+//
+// By default those other jobs run on top of the waiting job's stack, so it can't continue before they return even if
+// what it waited for finished long ago, and waits nest as deep as jobs keep waiting. With the fiber backend every
+// worker runs jobs on a pool of fibers instead: a waiting job parks its fiber on the job it waits for and the worker
+// switches to another fiber, the finishing job hands the parked fiber back to its worker, which resumes it ahead of new
+// jobs. Fibers never move between workers, so a job sees the same worker index and thread locals before and after a
+// wait. A worker that has no free fiber left falls back to running jobs on the waiting stack.
+//
+// Worker 0 is the thread that called init() and only looks for jobs while it waits itself, a fiber parked there would
+// not be resumed before its next wait() no matter how idle the other workers are. So on worker 0 only the thread's own
+// waits park, jobs it picked up in the meantime wait by running other jobs on their stack as without fibers.
+//
+// Jobs come from a ring per worker, creating one takes the next finished slot. A thread can have at most
+// MAX_JOBS_PER_THREAD unfinished jobs, and wait() has to be called before the creating thread went around the ring
+// once more, which in practice it always is. parallelFor() splits ranges in halves so a range of any size only has
+// a few unfinished jobs per thread at a time.
+class JobSystem
+{
+public:
+	static constexpr uint32_t MAX_JOBS_PER_THREAD = 4096;
+	static constexpr uint32_t MAX_WORKERS = 64;
+	static constexpr uint32_t FIBERS_PER_WORKER = 32;
+	static constexpr size_t FIBER_STACK_SIZE = 128 * 1024;
+
+	JobSystem() = default;
+	JobSystem(const JobSystem&) = delete;
+	JobSystem& operator=(const JobSystem&) = delete;
+	~JobSystem() { shutdown(); }
+
+	// _workerCount includes the calling thread. 0 uses one worker per hardware thread, but at least two so jobs from
+	// threads that aren't workers always have a thread to run on. _fibers picks the fiber backend.
+	void init(uint32_t _workerCount = 0, bool _fibers = false)
+	{
+		if (_workerCount == 0)
+			_workerCount = std::max(2u, std::thread::hardware_concurrency());
+		_workerCount = std::min(_workerCount, MAX_WORKERS);
+		m_running = true;
+		m_fibers = _fibers;
+		m_workers.clear();
+		for (uint32_t i = 0; i < _workerCount; i++)
+		{
+			m_workers.emplace_back(new Worker());
+			if (_fibers)
+				createFibers(*m_workers.back(), i);
+		}
+		m_injectedPool.reset(new Job[MAX_JOBS_PER_THREAD]);
+		m_injection.assign(MAX_JOBS_PER_THREAD, nullptr);
+		m_injectionHead = 0;
+		m_injectionTail = 0;
+		bindThread(0);
+		for (uint32_t i = 1; i < _workerCount; i++)
+		{
+			m_threads.emplace_back([this, i]() { workerLoop(i); });
+		}
+		if (_fibers)
+			CLog(0, "Job system: {} workers, {} fibers of {} KB each.", _workerCount, FIBERS_PER_WORKER, FIBER_STACK_SIZE / 1024);
+		else
+			CLog(0, "Job system: {} workers.", _workerCount);
+	}
+
+	// Waits for the workers to run out of jobs and joins them. Call from the thread that called init().
+	void shutdown()
+	{
+		if (!m_running)
+			return;
+		{
+			std::lock_guard<std::mutex> lock(m_sleepMutex);
+			m_running = false;
+		}
+		m_wake.notify_all();
+		for (auto& it : m_threads)
+		{
+			it.join();
+		}
+		m_threads.clear();
+		unbindThread();
+	}
+
+	uint32_t getWorkerCount() const { return static_cast<uint32_t>(m_workers.size()); }
+	bool usesFibers() const { return m_fibers; }
+
+	// Index of the calling thread, ~0u when it isn't a worker of this system.
+	uint32_t getWorkerIndex() const { return t_system == this ? t_workerIndex : ~0u; }
+
+	// _function is called as _function(Job&) or _function() and has to fit into Job::DATA_SIZE.
+	template<typename F>
+	Job* create(F&& _function, Job* _parent = nullptr)
+	{
+		typedef typename std::decay<F>::type Function;
+		static_assert(sizeof(Function) <= Job::DATA_SIZE, "Job function too large, capture a pointer to the data instead.");
+		static_assert(alignof(Function) <= 16, "Job function alignment too large.");
+
+		Job* job = allocate();
+		job->function = [](Job& _job)
+		{
+			Function& function = *reinterpret_cast<Function*>(_job.data);
+			invoke(function, _job);
+			function.~Function();
+		};
+		new (job->data) Function(std::forward<F>(_function));
+		job->parent = _parent;
+		job->unfinished.store(1, std::memory_order_relaxed);
+		job->dependencies.store(1, std::memory_order_relaxed);
+		job->continuationCount.store(0, std::memory_order_relaxed);
+		if (_parent != nullptr)
+			_parent->unfinished.fetch_add(1, std::memory_order_relaxed);
+		return job;
+	}
+
+	// _job runs once _before has finished. Both must be created and not run yet.
+	void dependsOn(Job* _job, Job* _before)
+	{
+		const uint32_t index = _before->continuationCount.fetch_add(1, std::memory_order_relaxed);
+		CVerifyCrash(index < Job::MAX_CONTINUATIONS, "JobSystem: more than {} jobs depend on one job.", Job::MAX_CONTINUATIONS);
+		_before->continuations[index] = _job;
+		_job->dependencies.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	// Queues _job, or marks it ready to be queued by its last dependency.
+	void run(Job* _job)
+	{
+		if (_job->dependencies.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			enqueue(_job);
+	}
+
+	// Runs other jobs until _job and all its children are finished. With the fiber backend a worker parks the calling
+	// fiber instead, except for jobs running on worker 0.
+	void wait(const Job* _job)
+	{
+		Worker* self = m_fibers && t_system == this ? m_workers[t_workerIndex].get() : nullptr;
+		if (self != nullptr && t_workerIndex == 0 && self->current != &self->threadFiber)
+			self = nullptr;
+		while (_job->unfinished.load(std::memory_order_acquire) > 0)
+		{
+			if (self != nullptr && suspend(*self, const_cast<Job&>(*_job)))
+				continue;
+			Job* next = findJob();
+			if (next != nullptr)
+				execute(next);
+			else
+				std::this_thread::yield();
+		}
+	}
+
+	template<typename F>
+	void runAndWait(F&& _function)
+	{
+		Job* job = create(std::forward<F>(_function));
+		run(job);
+		wait(job);
+	}
+
+	// Calls _function(begin, end) on sub ranges of [0, _count) of at most _batchSize elements, and waits.
+	template<typename F>
+	void parallelFor(uint32_t _count, uint32_t _batchSize, const F& _function)
+	{
+		if (_count == 0)
+			return;
+		Job* root = create([]() {});
+		run(create(ParallelRange<F>{ this, &_function, root, 0, _count, std::max(1u, _batchSize) }, root));
+		run(root);
+		wait(root);
+	}
+
+	// Summed over the workers, only exact while no jobs run.
+	JobSystemStats getStats() const
+	{
+		JobSystemStats stats;
+		for (const auto& it : m_workers)
+		{
+			stats.executed += it->executed.load(std::memory_order_relaxed);
+			stats.stolen += it->stolen.load(std::memory_order_relaxed);
+			stats.sleeps += it->sleeps.load(std::memory_order_relaxed);
+			stats.suspends += it->suspends.load(std::memory_order_relaxed);
+			stats.fiberFallbacks += it->fiberFallbacks.load(std::memory_order_relaxed);
+		}
+		stats.injected = m_injected.load(std::memory_order_relaxed);
+		return stats;
+	}
+
+	void logStats() const
+	{
+		const JobSystemStats stats = getStats();
+		CLog(0, "Job system: {} workers, {} jobs executed, {} stolen, {} injected from other threads, {} worker sleeps.",
+			m_workers.size(), stats.executed, stats.stolen, stats.injected, stats.sleeps);
+		if (m_fibers)
+			CLog(0, "Job system: {} waits parked their fiber, {} found no free fiber.", stats.suspends, stats.fiberFallbacks);
+	}
+
+private:
+	struct alignas(64) Worker
+	{
+		Worker() : deque(MAX_JOBS_PER_THREAD), pool(new Job[MAX_JOBS_PER_THREAD]) {}
+
+		WorkStealingDeque deque;
+		std::unique_ptr<Job[]> pool;
+		uint32_t next = 0;						// into pool, only touched by the worker
+		uint32_t victim = 0;					// where stealing starts next time
+		std::atomic<uint64_t> executed{ 0 };
+		std::atomic<uint64_t> stolen{ 0 };
+		std::atomic<uint64_t> sleeps{ 0 };
+
+		// Fiber backend
+		JobFiber threadFiber;					// the worker thread's own stack
+		JobFiber* current = nullptr;			// the fiber the worker runs
+		std::unique_ptr<JobFiber[]> fibers;
+		std::vector<JobFiber*> freeFibers;		// only touched by the worker
+		std::mutex readyMutex;
+		std::deque<JobFiber*> ready;			// parked fibers whose job finished, oldest first
+		std::atomic<uint32_t> readyCount{ 0 };
+		std::atomic<uint64_t> suspends{ 0 };
+		std::atomic<uint64_t> fiberFallbacks{ 0 };
+	};
+
+	// Splits itself in halves down to batch size, the second half is left for other workers to steal.
+	template<typename F>
+	struct ParallelRange
+	{
+		JobSystem* system;
+		const F* function;
+		Job* root;
+		uint32_t begin, end, batchSize;
+
+		void operator()() const
+		{
+			uint32_t first = begin;
+			uint32_t last = end;
+			while (last - first > batchSize)
+			{
+				const uint32_t middle = first + (last - first) / 2;
+				system->run(system->create(ParallelRange{ system, function, root, middle, last, batchSize }, root));
+				last = middle;
+			}
+			(*function)(first, last);
+		}
+	};
+
+	template<typename Function>
+	static auto invoke(Function& _function, Job& _job) -> decltype(_function(_job), void()) { _function(_job); }
+	template<typename Function>
+	static auto invoke(Function& _function, Job&) -> decltype(_function(), void()) { _function(); }
+
+	Job* allocate()
+	{
+		if (t_system == this)
+		{
+			Worker& worker = *m_workers[t_workerIndex];
+			for (uint32_t i = 0; i < MAX_JOBS_PER_THREAD; i++)
+			{
+				Job* job = &worker.pool[worker.next++ & (MAX_JOBS_PER_THREAD - 1)];
+				if (job->unfinished.load(std::memory_order_acquire) == 0)
+					return job;
+			}
+		}
+		else
+		{
+			std::lock_guard<std::mutex> lock(m_injectionMutex);
+			for (uint32_t i = 0; i < MAX_JOBS_PER_THREAD; i++)
+			{
+				Job* job = &m_injectedPool[m_injectedNext++ & (MAX_JOBS_PER_THREAD - 1)];
+				if (job->unfinished.load(std::memory_order_acquire) == 0)
+					return job;
+			}
+		}
+		CVerifyCrash(false, "JobSystem: more than {} unfinished jobs created by one thread.", MAX_JOBS_PER_THREAD);
+		return nullptr;
+	}
+
+	void enqueue(Job* _job)
+	{
+		m_queued.fetch_add(1, std::memory_order_seq_cst);
+		if (t_system != this)
+		{
+			std::lock_guard<std::mutex> lock(m_injectionMutex);
+			if (m_injectionTail - m_injectionHead == m_injection.size())
+				growInjection();
+			m_injection[m_injectionTail++ & (m_injection.size() - 1)] = _job;
+			m_injectionSize.store(m_injectionTail - m_injectionHead, std::memory_order_relaxed);
+			m_injected.fetch_add(1, std::memory_order_relaxed);
+		}
+		else if (!m_workers[t_workerIndex]->deque.push(_job))
+		{
+			// Deque full, the job can't wait
+			m_queued.fetch_sub(1, std::memory_order_relaxed);
+			execute(_job);
+			return;
+		}
+		if (m_sleeping.load(std::memory_order_seq_cst) > 0)
+		{
+			std::lock_guard<std::mutex> lock(m_sleepMutex);
+			m_wake.notify_one();
+		}
+	}
+
+	// Own deque first, then the injection queue, then the other workers starting after the last one stolen from.
+	Job* findJob()
+	{
+		Job* job = nullptr;
+		Worker* self = t_system == this ? m_workers[t_workerIndex].get() : nullptr;
+		if (self != nullptr)
+			job = self->deque.pop();
+		if (job == nullptr && m_injectionSize.load(std::memory_order_relaxed) > 0)
+		{
+			std::lock_guard<std::mutex> lock(m_injectionMutex);
+			if (m_injectionTail != m_injectionHead)
+			{
+				job = m_injection[m_injectionHead++ & (m_injection.size() - 1)];
+				m_injectionSize.store(m_injectionTail - m_injectionHead, std::memory_order_relaxed);
+			}
+		}
+		if (job == nullptr)
+		{
+			const uint32_t count = static_cast<uint32_t>(m_workers.size());
+			const uint32_t start = self != nullptr ? self->victim : 0;
+			for (uint32_t i = 0; i < count && job == nullptr; i++)
+			{
+				const uint32_t victim = (start + i) % count;
+				if (m_workers[victim].get() == self)
+					continue;
+				job = m_workers[victim]->deque.steal();
+				if (job != nullptr && self != nullptr)
+				{
+					self->victim = victim;
+					self->stolen.fetch_add(1, std::memory_order_relaxed);
+				}
+			}
+		}
+		if (job != nullptr)
+			m_queued.fetch_sub(1, std::memory_order_relaxed);
+		return job;
+	}
+
+	// Doubles the injection ring, keeping the order. Only when more jobs are queued from other threads than one thread
+	// can create, with m_injectionMutex held.
+	void growInjection()
+	{
+		const size_t count = m_injectionTail - m_injectionHead;
+		std::vector<Job*> injection(m_injection.size() * 2, nullptr);
+		for (size_t i = 0; i < count; i++)
+		{
+			injection[i] = m_injection[(m_injectionHead + i) & (m_injection.size() - 1)];
+		}
+		m_injection.swap(injection);
+		m_injectionHead = 0;
+		m_injectionTail = count;
+	}
+
+	void execute(Job* _job)
+	{
+		_job->function(*_job);
+		if (t_system == this)
+			m_workers[t_workerIndex]->executed.fetch_add(1, std::memory_order_relaxed);
+		finish(_job);
+	}
+
+	// Children finish their parent, the last one also releases the parent's continuations. The slot can be reused
+	// as soon as unfinished reaches 0, so everything needed afterwards is read before.
+	void finish(Job* _job)
+	{
+		Job* parent = _job->parent;
+		const uint32_t continuationCount = _job->continuationCount.load(std::memory_order_relaxed);
+		Job* continuations[Job::MAX_CONTINUATIONS];
+		std::copy(_job->continuations, _job->continuations + continuationCount, continuations);
+		if (_job->unfinished.fetch_sub(1, std::memory_order_seq_cst) != 1)
+			return;
+		if (m_fibers)
+			wake(_job->waiters.exchange(nullptr, std::memory_order_seq_cst));
+		for (uint32_t i = 0; i < continuationCount; i++)
+		{
+			run(continuations[i]);
+		}
+		if (parent != nullptr)
+			finish(parent);
+	}
+
+	void workerLoop(uint32_t _index)
+	{
+		bindThread(_index);
+		Worker& worker = *m_workers[_index];
+		if (m_fibers)
+		{
+			// The thread's own stack only waits for shutdown, jobs run on the worker's fibers
+			JobFiber* first = worker.freeFibers.back();
+			worker.freeFibers.pop_back();
+			switchTo(worker, *first);
+		}
+		else
+		{
+			schedule(worker);
+		}
+		unbindThread();
+	}
+
+	// Resumes the worker's ready fibers and runs jobs until shutdown.
+	void schedule(Worker& _worker)
+	{
+		for (;;)
+		{
+			JobFiber* ready = m_fibers ? popReady(_worker) : nullptr;
+			if (ready != nullptr)
+			{
+				_worker.freeFibers.push_back(_worker.current);
+				switchTo(_worker, *ready);
+				continue;
+			}
+			Job* job = findJob();
+			if (job != nullptr)
+			{
+				execute(job);
+				continue;
+			}
+			if (!idle(_worker))
+				return;
+		}
+	}
+
+	// Spins a little, jobs often come in bursts, then sleeps until there is something to do. False once shut down.
+	bool idle(Worker& _worker)
+	{
+		for (uint32_t spin = 0; spin < 64; spin++)
+		{
+			std::this_thread::yield();
+			if (m_queued.load(std::memory_order_relaxed) > 0 || _worker.readyCount.load(std::memory_order_relaxed) > 0)
+				return true;
+		}
+
+		std::unique_lock<std::mutex> lock(m_sleepMutex);
+		m_sleeping.fetch_add(1, std::memory_order_seq_cst);
+		if (m_queued.load(std::memory_order_seq_cst) == 0 && _worker.readyCount.load(std::memory_order_seq_cst) == 0 && m_running)
+		{
+			_worker.sleeps.fetch_add(1, std::memory_order_relaxed);
+			m_wake.wait(lock);
+		}
+		m_sleeping.fetch_sub(1, std::memory_order_relaxed);
+		return m_running || m_queued.load(std::memory_order_relaxed) > 0 || _worker.readyCount.load(std::memory_order_relaxed) > 0;
+	}
+
+	void createFibers(Worker& _worker, uint32_t _index)
+	{
+		_worker.threadFiber.worker = _index;
+		_worker.fibers.reset(new JobFiber[FIBERS_PER_WORKER]);
+		for (uint32_t i = 0; i < FIBERS_PER_WORKER; i++)
+		{
+			JobFiber& fiber = _worker.fibers[i];
+			fiber.worker = _index;
+			fiber.fiber.create(FIBER_STACK_SIZE, &JobSystem::fiberMain);
+			_worker.freeFibers.push_back(&fiber);
+		}
+	}
+
+	// Entry of every fiber, which is only ever switched to on its own worker's thread.
+	static void fiberMain()
+	{
+		JobSystem& system = *t_system;
+		Worker& worker = *system.m_workers[t_workerIndex];
+		system.schedule(worker);
+		// Shut down, back to the thread's own stack so the thread can exit
+		system.switchTo(worker, worker.threadFiber);
+	}
+
+	void switchTo(Worker& _worker, JobFiber& _to)
+	{
+		JobFiber* from = _worker.current;
+		_worker.current = &_to;
+		Fiber::switchTo(from->fiber, _to.fiber);
+	}
+
+	// Parks the running fiber on _job and switches to a ready fiber of the worker, or to a free one that goes looking
+	// for jobs. False when there is neither, the caller has to run jobs on its own stack then.
+	bool suspend(Worker& _worker, Job& _job)
+	{
+		JobFiber* next = popReady(_worker);
+		if (next == nullptr && !_worker.freeFibers.empty())
+		{
+			next = _worker.freeFibers.back();
+			_worker.freeFibers.pop_back();
+		}
+		if (next == nullptr)
+		{
+			_worker.fiberFallbacks.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+
+		JobFiber* self = _worker.current;
+		JobFiber* head = _job.waiters.load(std::memory_order_relaxed);
+		do
+		{
+			self->nextWaiter = head;
+		} while (!_job.waiters.compare_exchange_weak(head, self, std::memory_order_seq_cst, std::memory_order_relaxed));
+		// The job may have finished before the fiber was on its list, with nobody left to hand it back
+		if (_job.unfinished.load(std::memory_order_seq_cst) <= 0)
+			wake(_job.waiters.exchange(nullptr, std::memory_order_seq_cst));
+
+		_worker.suspends.fetch_add(1, std::memory_order_relaxed);
+		switchTo(_worker, *next);
+		return true;
+	}
+
+	// Hands a list of parked fibers back to their workers. Nothing else can resume them, so the fiber is safe to queue
+	// even while its own worker is still switching away from it.
+	void wake(JobFiber* _fibers)
+	{
+		if (_fibers == nullptr)
+			return;
+		while (_fibers != nullptr)
+		{
+			JobFiber* fiber = _fibers;
+			_fibers = fiber->nextWaiter;
+			Worker& owner = *m_workers[fiber->worker];
+			{
+				std::lock_guard<std::mutex> lock(owner.readyMutex);
+				owner.ready.push_back(fiber);
+			}
+			owner.readyCount.fetch_add(1, std::memory_order_seq_cst);
+		}
+		// Only the owners can run them, wake everyone
+		if (m_sleeping.load(std::memory_order_seq_cst) > 0)
+		{
+			std::lock_guard<std::mutex> lock(m_sleepMutex);
+			m_wake.notify_all();
+		}
+	}
+
+	JobFiber* popReady(Worker& _worker)
+	{
+		if (_worker.readyCount.load(std::memory_order_relaxed) == 0)
+			return nullptr;
+		std::lock_guard<std::mutex> lock(_worker.readyMutex);
+		if (_worker.ready.empty())
+			return nullptr;
+		JobFiber* fiber = _worker.ready.front();
+		_worker.ready.pop_front();
+		_worker.readyCount.fetch_sub(1, std::memory_order_relaxed);
+		return fiber;
+	}
+
+	void bindThread(uint32_t _index)
+	{
+		t_system = this;
+		t_workerIndex = _index;
+		if (m_fibers)
+		{
+			Worker& worker = *m_workers[_index];
+			worker.threadFiber.fiber.adoptThread();
+			worker.current = &worker.threadFiber;
+		}
+	}
+	void unbindThread()
+	{
+		if (t_system != this)
+			return;
+		if (m_fibers)
+			m_workers[t_workerIndex]->threadFiber.fiber.releaseThread();
+		t_system = nullptr;
+	}
+
+	static inline thread_local JobSystem* t_system = nullptr;
+	static inline thread_local uint32_t t_workerIndex = 0;
+
+	std::vector<std::unique_ptr<Worker>> m_workers;
+	std::vector<std::thread> m_threads;
+	bool m_running = false;
+	bool m_fibers = false;
+
+	std::mutex m_injectionMutex;
+	std::vector<Job*> m_injection;				// ring of a power of two size, guarded by m_injectionMutex
+	size_t m_injectionHead = 0;
+	size_t m_injectionTail = 0;
+	std::atomic<size_t> m_injectionSize{ 0 };
+	std::unique_ptr<Job[]> m_injectedPool;		// for jobs created by threads that aren't workers
+	uint32_t m_injectedNext = 0;				// guarded by m_injectionMutex
+	std::atomic<uint64_t> m_injected{ 0 };
+
+	alignas(64) std::atomic<int64_t> m_queued{ 0 };		// in a deque or the injection queue
+	std::atomic<uint32_t> m_sleeping{ 0 };
+	std::mutex m_sleepMutex;
+	std::condition_variable m_wake;
+};
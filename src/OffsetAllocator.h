@@ -0,0 +1,127 @@
+#pragma once
+#include <map>
+#include <set>
+#include <utility>
+#include <cstdint>
+
+// Hands out [offset, offset + size) ranges from a fixed capacity, in whatever unit the owner uses (bytes, vertices, indices...).
+// Free ranges are kept twice: by offset to coalesce neighbours on free, and by (size, offset) for best fit lookups. Both are O(log n).
+class OffsetAllocator
+{
+public:
+	static constexpr uint32_t INVALID_OFFSET = ~0u;
+
+	void init(uint32_t _capacity)
+	{
+		m_freeByOffset.clear();
+		m_freeBySize.clear();
+		m_capacity = _capacity;
+		m_used = 0;
+		m_allocationCount = 0;
+		if (_capacity > 0)
+		{
+			insertFree(0, _capacity);
+		}
+	}
+
+	uint32_t allocate(uint32_t _size)
+	{
+		if (_size == 0)
+			return INVALID_OFFSET;
+
+		auto bySize = m_freeBySize.lower_bound(std::make_pair(_size, 0u)); // smallest block that fits, lowest offset first
+		if (bySize == m_freeBySize.end())
+			return INVALID_OFFSET;
+
+		const uint32_t blockOffset = bySize->second;
+		const uint32_t blockSize = bySize->first;
+		m_freeBySize.erase(bySize);
+		m_freeByOffset.erase(blockOffset);
+
+		if (blockSize > _size)
+		{
+			insertFree(blockOffset + _size, blockSize - _size);
+		}
+		m_used += _size;
+		m_allocationCount++;
+		return blockOffset;
+	}
+
+	void free(uint32_t _offset, uint32_t _size)
+	{
+		if (_offset == INVALID_OFFSET || _size == 0)
+			return;
+
+		m_used -= _size;
+		m_allocationCount--;
+
+		uint32_t offset = _offset;
+		uint32_t size = _size;
+
+		// Merge with the free block right after us
+		auto next = m_freeByOffset.find(offset + size);
+		if (next != m_freeByOffset.end())
+		{
+			size += next->second;
+			eraseFree(next);
+		}
+		// and the one right before us
+		auto prev = m_freeByOffset.lower_bound(offset);
+		if (prev != m_freeByOffset.begin())
+		{
+			--prev;
+			if (prev->first + prev->second == offset)
+			{
+				offset = prev->first;
+				size += prev->second;
+				eraseFree(prev);
+			}
+		}
+		insertFree(offset, size);
+	}
+
+	// Extends the range at the end, e.g. after the backing buffer was reallocated bigger.
+	void grow(uint32_t _newCapacity)
+	{
+		if (_newCapacity <= m_capacity)
+			return;
+		const uint32_t oldCapacity = m_capacity;
+		m_capacity = _newCapacity;
+		m_used += _newCapacity - oldCapacity; // free() below gives it straight back
+		m_allocationCount++;
+		free(oldCapacity, _newCapacity - oldCapacity);
+	}
+
+	uint32_t getCapacity() const { return m_capacity; }
+	uint32_t getUsed() const { return m_used; }
+	uint32_t getFree() const { return m_capacity - m_used; }
+	uint32_t getAllocationCount() const { return m_allocationCount; }
+	uint32_t getFreeBlockCount() const { return static_cast<uint32_t>(m_freeByOffset.size()); }
+	uint32_t getLargestFreeBlock() const { return m_freeBySize.empty() ? 0 : m_freeBySize.rbegin()->first; }
+
+	// 0 when all free space is one block, approaching 1 as it gets scattered into small pieces.
+	float getFragmentation() const
+	{
+		const uint32_t freeTotal = getFree();
+		return freeTotal == 0 ? 0.0f : 1.0f - static_cast<float>(getLargestFreeBlock()) / static_cast<float>(freeTotal);
+	}
+
+private:
+	void insertFree(uint32_t _offset, uint32_t _size)
+	{
+		m_freeByOffset.emplace(_offset, _size);
+		m_freeBySize.emplace(_size, _offset);
+	}
+
+	void eraseFree(std::map<uint32_t, uint32_t>::iterator _byOffset)
+	{
+		m_freeBySize.erase(std::make_pair(_byOffset->second, _byOffset->first));
+		m_freeByOffset.erase(_byOffset);
+	}
+
+	std::map<uint32_t, uint32_t> m_freeByOffset;		// offset -> size
+	std::set<std::pair<uint32_t, uint32_t>> m_freeBySize;	// (size, offset)
+	uint32_t m_capacity = 0;
+	uint32_t m_used = 0;
+	uint32_t m_allocationCount = 0;
+};
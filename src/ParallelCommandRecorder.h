@@ -0,0 +1,107 @@
+#pragma once
+#include "Core.h"
+#include "JobSystem.h"
+#include "CommandBufferManager.h"
+#include <vulkan/vulkan.h>
+
+#include <vector>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include <cstdint>
+
+struct RecordingThreadStats
+{
+	uint64_t chunks = 0;				// secondary command buffers recorded
+	uint64_t recordMicroseconds = 0;	// begin to end of those, summed
+};
+
+// Records the draws of one subpass on all job system workers at once. The work is split into chunks, every chunk is
+// recorded into a secondary command buffer by whichever worker picks it up and the primary executes them in chunk
+// order, so the result is the same as recording the chunks one after the other.
+//
+// Command pools are externally synchronized, so every worker has its own pool in the CommandBufferManager, which
+// recycles the secondary command buffers frame to frame.
+class ParallelCommandRecorder
+{
+public:
+	// Before _commandBuffers' first beginFrame().
+	void init(CommandBufferManager& _commandBuffers, uint32_t _queueFamily, JobSystem& _jobs)
+	{
+		m_commandBuffers = &_commandBuffers;
+		m_jobs = &_jobs;
+		m_threadStats.resize(_jobs.getWorkerCount());
+		for (uint32_t i = 0; i < _jobs.getWorkerCount(); i++)
+		{
+			m_pools.push_back(_commandBuffers.createPool(_queueFamily, "Parallel recording"));
+		}
+		CLog(0, "Parallel command recorder: {} threads.", _jobs.getWorkerCount());
+	}
+
+	// Calls _recordChunk(commandBuffer, chunk) for every chunk in [0, _chunkCount) in parallel and executes the
+	// results into _primary. With a render pass in _inheritance the primary must be inside that subpass, begun with
+	// VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS. Call from a job system worker.
+	void record(VkCommandBuffer _primary, const VkCommandBufferInheritanceInfo& _inheritance, uint32_t _chunkCount,
+		const std::function<void(VkCommandBuffer, uint32_t)>& _recordChunk)
+	{
+		if (_chunkCount == 0)
+			return;
+		CVerifyCrash(m_jobs->getWorkerIndex() != ~0u, "ParallelCommandRecorder: record() called from a thread that isn't a job system worker.");
+		m_chunks.resize(_chunkCount);
+		m_jobs->parallelFor(_chunkCount, 1, [&](uint32_t _begin, uint32_t _end)
+		{
+			for (uint32_t chunk = _begin; chunk < _end; chunk++)
+			{
+				m_chunks[chunk] = recordChunk(_inheritance, chunk, _recordChunk);
+			}
+		});
+		vkCmdExecuteCommands(_primary, _chunkCount, m_chunks.data());
+	}
+
+	const RecordingThreadStats& getThreadStats(uint32_t _worker) const { return m_threadStats[_worker]; }
+	void resetStats()
+	{
+		std::fill(m_threadStats.begin(), m_threadStats.end(), RecordingThreadStats());
+	}
+
+	void logStats() const
+	{
+		for (uint32_t i = 0; i < m_threadStats.size(); i++)
+		{
+			const RecordingThreadStats& stats = m_threadStats[i];
+			if (stats.chunks > 0)
+				CLog(0, "Parallel command recorder: thread {} recorded {} chunks in {:.2f} ms.", i, stats.chunks, stats.recordMicroseconds / 1000.0);
+		}
+	}
+
+private:
+	VkCommandBuffer recordChunk(const VkCommandBufferInheritanceInfo& _inheritance, uint32_t _chunk,
+		const std::function<void(VkCommandBuffer, uint32_t)>& _recordChunk)
+	{
+		const auto start = std::chrono::steady_clock::now();
+		const uint32_t worker = m_jobs->getWorkerIndex();
+		VkCommandBuffer commandBuffer = m_commandBuffers->get(m_pools[worker], VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+
+		VkCommandBufferBeginInfo beginInfo = {};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		if (_inheritance.renderPass != VK_NULL_HANDLE)
+			beginInfo.flags |= VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+		beginInfo.pInheritanceInfo = &_inheritance;
+		vkBeginCommandBuffer(commandBuffer, &beginInfo);
+		_recordChunk(commandBuffer, _chunk);
+		VkResult result = vkEndCommandBuffer(commandBuffer);
+		CVerifyCrash(result == VK_SUCCESS, "ParallelCommandRecorder: failed to record chunk {}. Result: {}", _chunk, result);
+
+		RecordingThreadStats& stats = m_threadStats[worker];
+		stats.chunks++;
+		stats.recordMicroseconds += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+		return commandBuffer;
+	}
+
+	CommandBufferManager* m_commandBuffers = nullptr;
+	JobSystem* m_jobs = nullptr;
+	std::vector<CommandBufferManager::PoolHandle> m_pools;	// per worker
+	std::vector<VkCommandBuffer> m_chunks;				// of the record() call in progress, in chunk order
+	std::vector<RecordingThreadStats> m_threadStats;	// per worker, each only written by its worker
+};
@@ -0,0 +1,1044 @@
+#pragma once
+#include "Core.h"
+#include "Hash.h"
+#include "PipelineDesc.h"
+#include "ShaderReflection.h"
+#include "DynamicState.h"
+#include <vulkan/vulkan.h>
+
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <cstdint>
+#include <utility>
+
+struct PipelineCacheStats
+{
+	uint64_t requests = 0;
+	uint64_t hits = 0;
+	uint64_t pipelinesCreated = 0;
+	uint64_t duplicateCompiles = 0;		// two threads missed on the same description, one result was thrown away
+	uint64_t totalCreateMicroseconds = 0;
+	uint64_t maxCreateMicroseconds = 0;
+	uint32_t shaderModules = 0;
+	uint64_t shaderDedupes = 0;			// registerShader() calls that found an identical module
+	uint32_t setLayouts = 0;
+	uint64_t setLayoutDedupes = 0;
+	uint32_t pipelineLayouts = 0;
+	uint64_t layoutDedupes = 0;
+	uint32_t renderPasses = 0;
+
+	// Specialization constant permutations (descriptions with specializationCount > 0)
+	uint32_t permutationFamilies = 0;		// distinct descriptions once the permutation bits are masked out
+	uint32_t livePermutations = 0;
+	uint64_t possiblePermutations = 0;		// every combination of every family's features
+	uint64_t permutationsCreated = 0;
+	uint64_t permutationCreateMicroseconds = 0;
+
+	// Extended dynamic state
+	uint32_t dynamicStates = 0;				// DynamicStateBits taken out of the pipeline key
+	uint32_t descVariants = 0;				// distinct descriptions requested before normalization
+	uint32_t pipelinesEliminated = 0;		// variants that share a pipeline with another
+};
+
+struct SetLayoutBinding
+{
+	uint32_t binding;
+	uint32_t type;		// VkDescriptorType
+	uint32_t count;
+	uint32_t stages;	// VkShaderStageFlags
+};
+
+// Owns every graphics pipeline, shader module, pipeline layout and the compatible render passes pipelines are built
+// against, handing out one object per unique description. Lookups take a shared lock so any thread can ask for
+// pipelines; a miss builds the pipeline outside the lock through the shared VkPipelineCache, and if another thread
+// published the same description meanwhile the loser's pipeline is destroyed.
+// With extended dynamic state every description is normalized first, descriptions that only differ in dynamic state get
+// the same pipeline and the caller sets that state through a CommandStateTracker.
+// Descriptions the game asks for are recorded in first use order for the warm-up manifest (PipelineManifest), builds
+// the compiler does on its own behalf aren't.
+class PipelineCache
+{
+public:
+	// A shader key's module, its reflection if it has one and the version replaceShader() gave it (0 until the first
+	// replacement).
+	struct ShaderState
+	{
+		VkShaderModule module = VK_NULL_HANDLE;
+		ShaderReflection reflection;
+		bool reflected = false;
+		uint64_t version = 0;
+	};
+
+	// A pipeline built by buildPipeline() and the versions of its shaders it was built from, VK_NULL_HANDLE if it failed.
+	struct BuiltPipeline
+	{
+		VkPipeline pipeline = VK_NULL_HANDLE;
+		uint64_t shaderVersions[PipelineDesc::MAX_SHADER_STAGES] = {};
+	};
+
+	void init(VkDevice _device, uint32_t _dynamicStates = 0)
+	{
+		m_device = _device;
+		m_dynamicStates = _dynamicStates;
+
+		VkPipelineCacheCreateInfo cacheInfo = {};
+		cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+		VkResult result = vkCreatePipelineCache(m_device, &cacheInfo, nullptr, &m_vkPipelineCache);
+		CVerifyCrash(result == VK_SUCCESS, "Failed to create VkPipelineCache. Result: {}", result);
+	}
+
+	void destroy()
+	{
+		for (auto& it : m_pipelines)
+		{
+			vkDestroyPipeline(m_device, it.second.pipeline, nullptr);
+		}
+		m_pipelines.clear();
+		for (auto& it : m_renderPasses)
+		{
+			vkDestroyRenderPass(m_device, it.second, nullptr);
+		}
+		m_renderPasses.clear();
+		for (auto& it : m_layouts)
+		{
+			vkDestroyPipelineLayout(m_device, it.second, nullptr);
+		}
+		m_layouts.clear();
+		for (auto& it : m_setLayouts)
+		{
+			vkDestroyDescriptorSetLayout(m_device, it.second, nullptr);
+		}
+		m_setLayouts.clear();
+		for (auto& it : m_shaderModules)
+		{
+			vkDestroyShaderModule(m_device, it.second, nullptr);
+		}
+		m_shaderModules.clear();
+		vkDestroyPipelineCache(m_device, m_vkPipelineCache, nullptr);
+		m_vkPipelineCache = VK_NULL_HANDLE;
+	}
+
+	// Returns the key PipelineDesc uses to refer to the shader: _key if given (shaders loaded from source use their path
+	// so the key survives edits), otherwise the SPIR-V content hash. A known key shares the existing module. Every module
+	// is reflected once here so layouts can be generated from it; one reflection can't describe still registers, its
+	// pipelines just need their layout and vertex input set by hand.
+	uint64_t registerShader(const uint32_t* _code, size_t _codeSize, uint64_t _key = 0)
+	{
+		return registerShader(_code, _codeSize, _key, nullptr);
+	}
+
+	// Same with reflection computed offline (shader packs), the SPIR-V isn't parsed.
+	uint64_t registerShader(const uint32_t* _code, size_t _codeSize, uint64_t _key, const ShaderReflection* _reflection)
+	{
+		const uint64_t hash = _key != 0 ? _key : hashBytes(_code, _codeSize);
+
+		std::lock_guard<std::mutex> lock(m_objectMutex);
+		if (m_shaderModules.count(hash) != 0)
+		{
+			m_shaderDedupes++;
+			return hash;
+		}
+
+		VkShaderModuleCreateInfo createInfo = {};
+		createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+		createInfo.codeSize = _codeSize;
+		createInfo.pCode = _code;
+
+		VkShaderModule module;
+		VkResult result = vkCreateShaderModule(m_device, &createInfo, nullptr, &module);
+		CVerifyCrash(result == VK_SUCCESS, "Failed to create shader module {:016x}. Result: {}", hash, result);
+		m_shaderModules.emplace(hash, module);
+		ShaderReflection reflection;
+		if (_reflection != nullptr)
+			m_reflections.emplace(hash, *_reflection);
+		else if (SpirvReflector::reflect(_code, _codeSize, reflection))
+			m_reflections.emplace(hash, std::move(reflection));
+		else
+			CLog(1, "Shader {:016x} has no reflection, its pipelines need a layout and vertex input set by hand.", hash);
+		return hash;
+	}
+
+	// Merged interface of the description's shaders, false if one of them has no reflection or they disagree.
+	bool getReflection(const PipelineDesc& _desc, ShaderReflection& _merged)
+	{
+		std::lock_guard<std::mutex> lock(m_objectMutex);
+		_merged = ShaderReflection();
+		for (uint32_t i = 0; i < _desc.shaderCount; i++)
+		{
+			CVerifyCrash(m_shaderModules.count(_desc.shaderKeys[i]) != 0, "Pipeline references unregistered shader {:016x}.", _desc.shaderKeys[i]);
+			auto it = m_reflections.find(_desc.shaderKeys[i]);
+			if (it == m_reflections.end() || !_merged.merge(it->second))
+				return false;
+		}
+		return true;
+	}
+
+	// Fills the description's layout from its shaders. Sets listed in _fixedSets (e.g. the bindless table at set 0) are
+	// used as given, every other set gets a layout built from reflection and shared with identical sets of other pipelines.
+	// Bindings and push constants are made visible to all stages and push constants always span the 128 bytes every
+	// device guarantees, so pipelines that agree on a set's contents get compatible layouts and switching between them
+	// doesn't disturb bound sets. False, and _desc untouched, if a shader has no reflection or the interface needs a layout
+	// given by hand: a runtime sized array outside the fixed sets, or more push constants than the guaranteed 128 bytes.
+	bool applyReflectedLayout(PipelineDesc& _desc, const VkDescriptorSetLayout* _fixedSets = nullptr, uint32_t _fixedSetCount = 0)
+	{
+		ShaderReflection reflection;
+		if (!getReflection(_desc, reflection))
+			return false;
+		const uint32_t setCount = std::max(reflection.getSetCount(), _fixedSetCount);
+		for (const auto& it : reflection.bindings)
+		{
+			if (it.count == 0 && (it.set >= _fixedSetCount || _fixedSets[it.set] == VK_NULL_HANDLE))
+			{
+				CLog(2, "Pipeline {:016x}: runtime sized array at set {} binding {} needs a fixed set layout.", _desc.hash(), it.set, it.binding);
+				return false;
+			}
+		}
+		if (reflection.pushConstantSize > MIN_PUSH_CONSTANT_SIZE)
+		{
+			CLog(2, "Pipeline {:016x}: push constant block of {} bytes exceeds the guaranteed {}.", _desc.hash(), reflection.pushConstantSize, MIN_PUSH_CONSTANT_SIZE);
+			return false;
+		}
+
+		std::vector<VkDescriptorSetLayout> setLayouts(setCount, VK_NULL_HANDLE);
+		std::vector<VkDescriptorSetLayoutBinding> bindings;
+		for (uint32_t set = 0; set < setCount; set++)
+		{
+			if (set < _fixedSetCount && _fixedSets[set] != VK_NULL_HANDLE)
+			{
+				setLayouts[set] = _fixedSets[set];
+				continue;
+			}
+			bindings.clear();
+			for (const auto& it : reflection.bindings)
+			{
+				if (it.set != set)
+					continue;
+				bindings.push_back({ it.binding, it.type, it.count, VK_SHADER_STAGE_ALL, nullptr });
+			}
+			setLayouts[set] = getDescriptorSetLayout(bindings.data(), static_cast<uint32_t>(bindings.size()));
+		}
+
+		const VkPushConstantRange pushConstants = { VK_SHADER_STAGE_ALL, 0, MIN_PUSH_CONSTANT_SIZE };
+		_desc.layout = (uint64_t)getPipelineLayout(setLayouts.data(), setCount, &pushConstants, 1);
+		return true;
+	}
+
+	// One interleaved vertex buffer at binding 0, attributes packed in location order. False, and _desc untouched, if a
+	// shader has no reflection or there are more inputs than a description holds.
+	bool applyReflectedVertexInput(PipelineDesc& _desc)
+	{
+		ShaderReflection reflection;
+		if (!getReflection(_desc, reflection))
+			return false;
+		if (reflection.vertexInputs.size() > PipelineDesc::MAX_VERTEX_ATTRIBUTES)
+		{
+			CLog(2, "Pipeline {:016x}: {} vertex inputs, at most {} are supported.", _desc.hash(), reflection.vertexInputs.size(), PipelineDesc::MAX_VERTEX_ATTRIBUTES);
+			return false;
+		}
+
+		_desc.vertexBindingCount = 0;
+		_desc.vertexAttributeCount = 0;
+		uint32_t offset = 0;
+		for (const auto& it : reflection.vertexInputs)
+		{
+			_desc.addVertexAttribute(it.location, 0, it.format, offset);
+			offset += it.size;
+		}
+		if (offset > 0)
+			_desc.addVertexBinding(0, offset);
+		return true;
+	}
+
+	// Identical binding lists share one VkDescriptorSetLayout.
+	VkDescriptorSetLayout getDescriptorSetLayout(const VkDescriptorSetLayoutBinding* _bindings, uint32_t _bindingCount)
+	{
+		SetLayoutKey key;
+		key.bindings.reserve(_bindingCount);
+		for (uint32_t i = 0; i < _bindingCount; i++)
+		{
+			CVerifyCrash(_bindings[i].pImmutableSamplers == nullptr, "Immutable samplers aren't supported by the set layout cache.");
+			key.bindings.push_back({ _bindings[i].binding, (uint32_t)_bindings[i].descriptorType, _bindings[i].descriptorCount, _bindings[i].stageFlags });
+		}
+
+		std::lock_guard<std::mutex> lock(m_objectMutex);
+		auto it = m_setLayouts.find(key);
+		if (it != m_setLayouts.end())
+		{
+			m_setLayoutDedupes++;
+			return it->second;
+		}
+
+		VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+		layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		layoutInfo.bindingCount = _bindingCount;
+		layoutInfo.pBindings = _bindings;
+
+		VkDescriptorSetLayout layout;
+		VkResult result = vkCreateDescriptorSetLayout(m_device, &layoutInfo, nullptr, &layout);
+		CVerifyCrash(result == VK_SUCCESS, "Failed to create descriptor set layout. Result: {}", result);
+		m_setLayouts.emplace(std::move(key), layout);
+		return layout;
+	}
+
+	// Points _key at new code with a new version. Pipelines built from now on use it, existing ones are untouched; the
+	// previous state is returned for the caller to retire the module or put it back with swapShader().
+	ShaderState replaceShader(uint64_t _key, const uint32_t* _code, size_t _codeSize)
+	{
+		VkShaderModuleCreateInfo createInfo = {};
+		createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+		createInfo.codeSize = _codeSize;
+		createInfo.pCode = _code;
+
+		ShaderState state;
+		VkResult result = vkCreateShaderModule(m_device, &createInfo, nullptr, &state.module);
+		CVerifyCrash(result == VK_SUCCESS, "Failed to create shader module {:016x}. Result: {}", _key, result);
+		state.reflected = SpirvReflector::reflect(_code, _codeSize, state.reflection);
+		{
+			std::lock_guard<std::mutex> lock(m_objectMutex);
+			state.version = ++m_lastShaderVersion;
+		}
+		swapShader(_key, state);
+		return state;
+	}
+
+	// Exchanges _key's current state with _state, e.g. to put back what replaceShader() returned.
+	void swapShader(uint64_t _key, ShaderState& _state)
+	{
+		std::lock_guard<std::mutex> lock(m_objectMutex);
+		std::swap(m_shaderModules[_key], _state.module);
+		std::swap(m_shaderVersions[_key], _state.version);
+		auto it = m_reflections.find(_key);
+		const bool reflected = it != m_reflections.end();
+		ShaderReflection reflection = reflected ? std::move(it->second) : ShaderReflection();
+		if (_state.reflected)
+			m_reflections[_key] = std::move(_state.reflection);
+		else if (reflected)
+			m_reflections.erase(it);
+		_state.reflection = std::move(reflection);
+		_state.reflected = reflected;
+	}
+
+	// Descriptions of every built pipeline that uses the shader but was built from another version of it.
+	std::vector<PipelineDesc> getStalePipelines(uint64_t _key)
+	{
+		std::vector<PipelineDesc> result;
+		std::lock_guard<std::mutex> objectLock(m_objectMutex);
+		const uint64_t version = getShaderVersion(_key);
+		std::shared_lock<std::shared_mutex> lock(m_pipelineMutex);
+		for (const auto& it : m_pipelines)
+		{
+			for (uint32_t i = 0; i < it.first.shaderCount; i++)
+			{
+				if (it.first.shaderKeys[i] == _key && it.second.shaderVersions[i] != version)
+				{
+					result.push_back(it.first);
+					break;
+				}
+			}
+		}
+		return result;
+	}
+
+	// Builds a pipeline without publishing it, for replacePipeline(). Doesn't crash when the driver rejects it, a shader
+	// edit that breaks the pipeline gives VK_NULL_HANDLE.
+	BuiltPipeline buildPipeline(const PipelineDesc& _desc)
+	{
+		PipelineDesc normalized;
+		BuiltPipeline built;
+		built.pipeline = createPipeline(resolve(_desc, normalized, false), built.shaderVersions);
+		return built;
+	}
+
+	// Publishes _built for _desc unless one of its shaders was replaced again since it was built, and returns the
+	// pipeline for the caller to retire: the one it replaced (VK_NULL_HANDLE if none), or _built's own if it was too old.
+	VkPipeline replacePipeline(const PipelineDesc& _desc, const BuiltPipeline& _built)
+	{
+		PipelineDesc normalized;
+		const PipelineDesc& desc = resolve(_desc, normalized, false);
+		std::lock_guard<std::mutex> objectLock(m_objectMutex);
+		for (uint32_t i = 0; i < desc.shaderCount; i++)
+		{
+			if (_built.shaderVersions[i] != getShaderVersion(desc.shaderKeys[i]))
+				return _built.pipeline;
+		}
+		std::unique_lock<std::shared_mutex> lock(m_pipelineMutex);
+		PipelineEntry& entry = m_pipelines[desc];
+		VkPipeline previous = entry.pipeline;
+		entry.pipeline = _built.pipeline;
+		memcpy(entry.shaderVersions, _built.shaderVersions, sizeof(entry.shaderVersions));
+		return previous;
+	}
+
+	VkShaderModule getShaderModule(uint64_t _hash)
+	{
+		std::lock_guard<std::mutex> lock(m_objectMutex);
+		auto it = m_shaderModules.find(_hash);
+		return it != m_shaderModules.end() ? it->second : VK_NULL_HANDLE;
+	}
+
+	// Identical set layouts and push constant ranges share one VkPipelineLayout.
+	VkPipelineLayout getPipelineLayout(const VkDescriptorSetLayout* _setLayouts, uint32_t _setLayoutCount, const VkPushConstantRange* _pushConstants, uint32_t _pushConstantCount)
+	{
+		LayoutKey key;
+		key.setLayouts.assign(_setLayouts, _setLayouts + _setLayoutCount);
+		key.pushConstants.assign(_pushConstants, _pushConstants + _pushConstantCount);
+
+		std::lock_guard<std::mutex> lock(m_objectMutex);
+		auto it = m_layouts.find(key);
+		if (it != m_layouts.end())
+		{
+			m_layoutDedupes++;
+			return it->second;
+		}
+
+		VkPipelineLayoutCreateInfo layoutInfo = {};
+		layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		layoutInfo.setLayoutCount = _setLayoutCount;
+		layoutInfo.pSetLayouts = _setLayouts;
+		layoutInfo.pushConstantRangeCount = _pushConstantCount;
+		layoutInfo.pPushConstantRanges = _pushConstants;
+
+		VkPipelineLayout layout;
+		VkResult result = vkCreatePipelineLayout(m_device, &layoutInfo, nullptr, &layout);
+		CVerifyCrash(result == VK_SUCCESS, "Failed to create pipeline layout. Result: {}", result);
+		m_layouts.emplace(std::move(key), layout);
+		return layout;
+	}
+
+	// A render pass compatible with the description's targets: same formats and sample count, nothing else matters for
+	// compatibility so load/store ops are don't care.
+	VkRenderPass getCompatibleRenderPass(const PipelineDesc& _desc)
+	{
+		RenderPassKey key;
+		memcpy(key.colorFormats, _desc.colorFormats, sizeof(key.colorFormats));
+		key.colorCount = _desc.colorTargetCount;
+		key.depthFormat = _desc.depthFormat;
+		key.samples = _desc.samples;
+
+		std::lock_guard<std::mutex> lock(m_objectMutex);
+		auto it = m_renderPasses.find(key);
+		if (it != m_renderPasses.end())
+			return it->second;
+
+		VkAttachmentDescription attachments[PipelineDesc::MAX_COLOR_TARGETS + 1];
+		VkAttachmentReference colorRefs[PipelineDesc::MAX_COLOR_TARGETS];
+		uint32_t attachmentCount = 0;
+		for (uint32_t i = 0; i < key.colorCount; i++)
+		{
+			attachments[attachmentCount] = makeAttachment((VkFormat)key.colorFormats[i], (VkSampleCountFlagBits)key.samples, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+			colorRefs[i] = { attachmentCount++, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+		}
+		VkAttachmentReference depthRef = { attachmentCount, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL };
+		if (key.depthFormat != VK_FORMAT_UNDEFINED)
+			attachments[attachmentCount++] = makeAttachment((VkFormat)key.depthFormat, (VkSampleCountFlagBits)key.samples, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+
+		VkSubpassDescription subpass = {};
+		subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+		subpass.colorAttachmentCount = key.colorCount;
+		subpass.pColorAttachments = colorRefs;
+		subpass.pDepthStencilAttachment = key.depthFormat != VK_FORMAT_UNDEFINED ? &depthRef : nullptr;
+
+		VkRenderPassCreateInfo renderPassInfo = {};
+		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+		renderPassInfo.attachmentCount = attachmentCount;
+		renderPassInfo.pAttachments = attachments;
+		renderPassInfo.subpassCount = 1;
+		renderPassInfo.pSubpasses = &subpass;
+
+		VkRenderPass renderPass;
+		VkResult result = vkCreateRenderPass(m_device, &renderPassInfo, nullptr, &renderPass);
+		CVerifyCrash(result == VK_SUCCESS, "Failed to create compatible render pass. Result: {}", result);
+		m_renderPasses.emplace(key, renderPass);
+		return renderPass;
+	}
+
+	VkPipeline getPipeline(const PipelineDesc& _desc)
+	{
+		return acquirePipeline(_desc, true);
+	}
+
+	// Same without counting as a use, for background compilation (PipelineCompiler, warm-up).
+	VkPipeline compilePipeline(const PipelineDesc& _desc)
+	{
+		return acquirePipeline(_desc, false);
+	}
+
+	// Non blocking lookup, VK_NULL_HANDLE if the description hasn't been built yet. Counts as a use either way.
+	VkPipeline findPipeline(const PipelineDesc& _desc)
+	{
+		PipelineDesc normalized;
+		const PipelineDesc& desc = resolve(_desc, normalized, true);
+		{
+			std::shared_lock<std::shared_mutex> lock(m_pipelineMutex);
+			auto it = m_pipelines.find(desc);
+			if (it != m_pipelines.end())
+			{
+				markUsed(desc, it->second);
+				return it->second.pipeline;
+			}
+		}
+		recordUse(desc);
+		return VK_NULL_HANDLE;
+	}
+
+	// Every description the game asked for this session, normalized, in first use order.
+	std::vector<PipelineDesc> getUsedPipelines()
+	{
+		std::lock_guard<std::mutex> lock(m_usageMutex);
+		return m_usedPipelines;
+	}
+
+	// Pipeline layouts in a form that survives a restart, for the warm-up manifest. Layouts the cache didn't create (and
+	// sets in them it didn't create) are recorded by the id they were registered under.
+	struct LayoutRecord
+	{
+		struct Set
+		{
+			uint64_t externalId = 0;
+			std::vector<SetLayoutBinding> bindings;
+		};
+		uint64_t externalId = 0;
+		std::vector<Set> sets;
+		std::vector<VkPushConstantRange> pushConstants;
+	};
+
+	void registerExternalSetLayout(VkDescriptorSetLayout _layout, uint64_t _id)
+	{
+		std::lock_guard<std::mutex> lock(m_objectMutex);
+		m_externalSetLayouts[_id] = _layout;
+	}
+	void registerExternalLayout(VkPipelineLayout _layout, uint64_t _id)
+	{
+		std::lock_guard<std::mutex> lock(m_objectMutex);
+		m_externalLayouts[_id] = _layout;
+	}
+
+	bool describeLayout(VkPipelineLayout _layout, LayoutRecord& _record)
+	{
+		std::lock_guard<std::mutex> lock(m_objectMutex);
+		_record = LayoutRecord();
+		for (const auto& it : m_externalLayouts)
+		{
+			if (it.second == _layout)
+			{
+				_record.externalId = it.first;
+				return true;
+			}
+		}
+		const LayoutKey* key = nullptr;
+		for (const auto& it : m_layouts)
+		{
+			if (it.second == _layout)
+				key = &it.first;
+		}
+		if (key == nullptr)
+			return false;
+
+		_record.pushConstants = key->pushConstants;
+		for (VkDescriptorSetLayout setLayout : key->setLayouts)
+		{
+			LayoutRecord::Set set;
+			bool found = false;
+			for (const auto& it : m_externalSetLayouts)
+			{
+				if (it.second == setLayout)
+				{
+					set.externalId = it.first;
+					found = true;
+				}
+			}
+			for (const auto& it : m_setLayouts)
+			{
+				if (!found && it.second == setLayout)
+				{
+					set.bindings = it.first.bindings;
+					found = true;
+				}
+			}
+			if (!found)
+				return false;
+			_record.sets.push_back(std::move(set));
+		}
+		return true;
+	}
+
+	// VK_NULL_HANDLE if the record refers to an external layout that hasn't been registered this run.
+	VkPipelineLayout restoreLayout(const LayoutRecord& _record)
+	{
+		if (_record.externalId != 0)
+		{
+			std::lock_guard<std::mutex> lock(m_objectMutex);
+			auto it = m_externalLayouts.find(_record.externalId);
+			return it != m_externalLayouts.end() ? it->second : VK_NULL_HANDLE;
+		}
+
+		std::vector<VkDescriptorSetLayout> setLayouts;
+		std::vector<VkDescriptorSetLayoutBinding> bindings;
+		for (const auto& set : _record.sets)
+		{
+			if (set.externalId != 0)
+			{
+				std::lock_guard<std::mutex> lock(m_objectMutex);
+				auto it = m_externalSetLayouts.find(set.externalId);
+				if (it == m_externalSetLayouts.end())
+					return VK_NULL_HANDLE;
+				setLayouts.push_back(it->second);
+				continue;
+			}
+			bindings.clear();
+			for (const auto& it : set.bindings)
+			{
+				bindings.push_back({ it.binding, (VkDescriptorType)it.type, it.count, it.stages, nullptr });
+			}
+			setLayouts.push_back(getDescriptorSetLayout(bindings.data(), static_cast<uint32_t>(bindings.size())));
+		}
+		return getPipelineLayout(setLayouts.data(), static_cast<uint32_t>(setLayouts.size()), _record.pushConstants.data(), static_cast<uint32_t>(_record.pushConstants.size()));
+	}
+
+	// The description the pipeline for _desc is stored under.
+	PipelineDesc normalize(const PipelineDesc& _desc) const
+	{
+		return m_dynamicStates != 0 ? normalizeDynamicState(_desc, m_dynamicStates) : _desc;
+	}
+	uint32_t getDynamicStates() const { return m_dynamicStates; }
+
+	VkPipelineCache getVkPipelineCache() const { return m_vkPipelineCache; }
+
+	PipelineCacheStats getStats()
+	{
+		PipelineCacheStats stats;
+		stats.requests = m_requests;
+		stats.hits = m_hits;
+		stats.pipelinesCreated = m_pipelinesCreated;
+		stats.duplicateCompiles = m_duplicateCompiles;
+		stats.totalCreateMicroseconds = m_totalCreateMicroseconds;
+		stats.maxCreateMicroseconds = m_maxCreateMicroseconds;
+
+		std::lock_guard<std::mutex> lock(m_objectMutex);
+		stats.shaderModules = static_cast<uint32_t>(m_shaderModules.size());
+		stats.shaderDedupes = m_shaderDedupes;
+		stats.setLayouts = static_cast<uint32_t>(m_setLayouts.size());
+		stats.setLayoutDedupes = m_setLayoutDedupes;
+		stats.pipelineLayouts = static_cast<uint32_t>(m_layouts.size());
+		stats.layoutDedupes = m_layoutDedupes;
+		stats.renderPasses = static_cast<uint32_t>(m_renderPasses.size());
+
+		stats.permutationsCreated = m_permutationsCreated;
+		stats.permutationCreateMicroseconds = m_permutationCreateMicroseconds;
+		std::shared_lock<std::shared_mutex> pipelineLock(m_pipelineMutex);
+		std::unordered_map<PipelineDesc, uint32_t, PipelineDescHasher> families;
+		for (const auto& it : m_pipelines)
+		{
+			if (it.first.specializationCount == 0)
+				continue;
+			PipelineDesc family = it.first;
+			family.specializationBits = 0;
+			families[family] = family.specializationCount;
+			stats.livePermutations++;
+		}
+		stats.permutationFamilies = static_cast<uint32_t>(families.size());
+
+		std::shared_lock<std::shared_mutex> variantLock(m_variantMutex);
+		stats.dynamicStates = m_dynamicStates;
+		stats.descVariants = static_cast<uint32_t>(m_variants.size());
+		stats.pipelinesEliminated = stats.descVariants > m_pipelines.size() ? stats.descVariants - static_cast<uint32_t>(m_pipelines.size()) : 0;
+		for (const auto& it : families)
+		{
+			stats.possiblePermutations += 1ull << it.second;
+		}
+		return stats;
+	}
+
+	void logStats()
+	{
+		const PipelineCacheStats stats = getStats();
+		const double hitRate = stats.requests > 0 ? 100.0 * stats.hits / stats.requests : 0.0;
+		const double averageMs = stats.pipelinesCreated > 0 ? stats.totalCreateMicroseconds / 1000.0 / stats.pipelinesCreated : 0.0;
+		CLog(0, "Pipeline cache: {} requests, {:.1f}% hit rate, {} pipelines created (avg {:.2f} ms, max {:.2f} ms, {} duplicate compiles).",
+			stats.requests, hitRate, stats.pipelinesCreated, averageMs, stats.maxCreateMicroseconds / 1000.0, stats.duplicateCompiles);
+		CLog(0, "Pipeline cache: {} shader modules ({} deduped), {} set layouts ({} deduped), {} pipeline layouts ({} deduped), {} compatible render passes.",
+			stats.shaderModules, stats.shaderDedupes, stats.setLayouts, stats.setLayoutDedupes, stats.pipelineLayouts, stats.layoutDedupes, stats.renderPasses);
+		if (stats.dynamicStates != 0)
+		{
+			CLog(0, "Pipeline cache: {} dynamic states, {} description variants served by {} fewer pipelines.",
+				DynamicStateFunctions::countBits(stats.dynamicStates), stats.descVariants, stats.pipelinesEliminated);
+		}
+		if (stats.permutationFamilies > 0)
+		{
+			// Saved time assumes the permutations nobody asked for would have cost as much as the ones that were built
+			const double averagePermutationMs = stats.permutationsCreated > 0 ? stats.permutationCreateMicroseconds / 1000.0 / stats.permutationsCreated : 0.0;
+			CLog(0, "Pipeline cache: {} live permutations of {} possible across {} shaders, ~{:.0f} ms of compilation skipped.",
+				stats.livePermutations, stats.possiblePermutations, stats.permutationFamilies, (stats.possiblePermutations - stats.livePermutations) * averagePermutationMs);
+		}
+	}
+
+private:
+	static constexpr uint32_t MIN_PUSH_CONSTANT_SIZE = 128;
+
+	struct PipelineEntry
+	{
+		VkPipeline pipeline = VK_NULL_HANDLE;
+		std::atomic<bool> used{ false };	// already in m_usedPipelines
+		uint64_t shaderVersions[PipelineDesc::MAX_SHADER_STAGES] = {};	// of the shaders it was built from
+	};
+
+	VkPipeline acquirePipeline(const PipelineDesc& _desc, bool _use)
+	{
+		m_requests++;
+		PipelineDesc normalized;
+		const PipelineDesc& desc = resolve(_desc, normalized, _use);
+		{
+			std::shared_lock<std::shared_mutex> lock(m_pipelineMutex);
+			auto it = m_pipelines.find(desc);
+			if (it != m_pipelines.end())
+			{
+				m_hits++;
+				if (_use)
+					markUsed(desc, it->second);
+				return it->second.pipeline;
+			}
+		}
+
+		uint64_t shaderVersions[PipelineDesc::MAX_SHADER_STAGES];
+		VkPipeline pipeline = createPipeline(desc, shaderVersions);
+		CVerifyCrash(pipeline != VK_NULL_HANDLE, "Failed to create graphics pipeline {:016x}.", desc.hash());
+
+		std::unique_lock<std::shared_mutex> lock(m_pipelineMutex);
+		auto inserted = m_pipelines.try_emplace(desc);
+		PipelineEntry& entry = inserted.first->second;
+		if (inserted.second)
+		{
+			entry.pipeline = pipeline;
+			memcpy(entry.shaderVersions, shaderVersions, sizeof(entry.shaderVersions));
+		}
+		else
+		{
+			m_duplicateCompiles++;
+			vkDestroyPipeline(m_device, pipeline, nullptr);
+		}
+		if (_use)
+			markUsed(desc, entry);
+		return entry.pipeline;
+	}
+
+	void markUsed(const PipelineDesc& _desc, PipelineEntry& _entry)
+	{
+		if (!_entry.used.load(std::memory_order_relaxed) && !_entry.used.exchange(true))
+			recordUse(_desc);
+	}
+	void recordUse(const PipelineDesc& _desc)
+	{
+		std::lock_guard<std::mutex> lock(m_usageMutex);
+		if (m_usedHashes.insert(_desc.hash()).second)
+			m_usedPipelines.push_back(_desc);
+	}
+
+	// _desc itself without dynamic state, otherwise its normalized form in _storage. Game facing lookups (_track) also
+	// remember every variant asked for.
+	const PipelineDesc& resolve(const PipelineDesc& _desc, PipelineDesc& _storage, bool _track)
+	{
+		if (m_dynamicStates == 0)
+			return _desc;
+		if (!_track)
+		{
+			_storage = normalizeDynamicState(_desc, m_dynamicStates);
+			return _storage;
+		}
+
+		const uint64_t hash = _desc.hash();
+		bool known;
+		{
+			std::shared_lock<std::shared_mutex> lock(m_variantMutex);
+			known = m_variants.count(hash) != 0;
+		}
+		if (!known)
+		{
+			std::unique_lock<std::shared_mutex> lock(m_variantMutex);
+			m_variants.insert(hash);
+		}
+		_storage = normalizeDynamicState(_desc, m_dynamicStates);
+		return _storage;
+	}
+
+	struct SetLayoutKey
+	{
+		using Binding = SetLayoutBinding;
+		std::vector<Binding> bindings;
+
+		bool operator==(const SetLayoutKey& _other) const
+		{
+			return bindings.size() == _other.bindings.size() && memcmp(bindings.data(), _other.bindings.data(), bindings.size() * sizeof(Binding)) == 0;
+		}
+	};
+	struct SetLayoutKeyHasher
+	{
+		size_t operator()(const SetLayoutKey& _key) const { return static_cast<size_t>(hashBytes(_key.bindings.data(), _key.bindings.size() * sizeof(SetLayoutKey::Binding))); }
+	};
+
+	struct LayoutKey
+	{
+		std::vector<VkDescriptorSetLayout> setLayouts;
+		std::vector<VkPushConstantRange> pushConstants;
+
+		bool operator==(const LayoutKey& _other) const
+		{
+			if (setLayouts != _other.setLayouts || pushConstants.size() != _other.pushConstants.size())
+				return false;
+			for (size_t i = 0; i < pushConstants.size(); i++)
+			{
+				const VkPushConstantRange& a = pushConstants[i];
+				const VkPushConstantRange& b = _other.pushConstants[i];
+				if (a.stageFlags != b.stageFlags || a.offset != b.offset || a.size != b.size)
+					return false;
+			}
+			return true;
+		}
+	};
+	struct LayoutKeyHasher
+	{
+		size_t operator()(const LayoutKey& _key) const
+		{
+			Hasher hasher;
+			for (VkDescriptorSetLayout it : _key.setLayouts)
+			{
+				hasher.value(it);
+			}
+			for (const auto& it : _key.pushConstants)
+			{
+				hasher.value(it.stageFlags).value(it.offset).value(it.size);
+			}
+			return static_cast<size_t>(hasher.get());
+		}
+	};
+
+	struct RenderPassKey
+	{
+		uint32_t colorFormats[PipelineDesc::MAX_COLOR_TARGETS];
+		uint32_t colorCount;
+		uint32_t depthFormat;
+		uint32_t samples;
+
+		bool operator==(const RenderPassKey& _other) const { return memcmp(this, &_other, sizeof(*this)) == 0; }
+	};
+	struct RenderPassKeyHasher
+	{
+		size_t operator()(const RenderPassKey& _key) const { return static_cast<size_t>(hashBytes(&_key, sizeof(_key))); }
+	};
+
+	static VkAttachmentDescription makeAttachment(VkFormat _format, VkSampleCountFlagBits _samples, VkImageLayout _layout)
+	{
+		VkAttachmentDescription attachment = {};
+		attachment.format = _format;
+		attachment.samples = _samples;
+		attachment.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		attachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		attachment.initialLayout = _layout;
+		attachment.finalLayout = _layout;
+		return attachment;
+	}
+
+	// Current version of a shader, m_objectMutex must be held.
+	uint64_t getShaderVersion(uint64_t _key) const
+	{
+		auto it = m_shaderVersions.find(_key);
+		return it != m_shaderVersions.end() ? it->second : 0;
+	}
+
+	// VK_NULL_HANDLE if the driver fails it. _shaderVersions gets the version of every stage's shader it was built from.
+	VkPipeline createPipeline(const PipelineDesc& _desc, uint64_t* _shaderVersions)
+	{
+		const auto start = std::chrono::steady_clock::now();
+
+		VkPipelineShaderStageCreateInfo stages[PipelineDesc::MAX_SHADER_STAGES];
+		{
+			std::lock_guard<std::mutex> lock(m_objectMutex);
+			for (uint32_t i = 0; i < _desc.shaderCount; i++)
+			{
+				auto it = m_shaderModules.find(_desc.shaderKeys[i]);
+				CVerifyCrash(it != m_shaderModules.end(), "Pipeline references unregistered shader {:016x}.", _desc.shaderKeys[i]);
+				stages[i] = {};
+				stages[i].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+				stages[i].stage = (VkShaderStageFlagBits)_desc.shaderStages[i];
+				stages[i].module = it->second;
+				stages[i].pName = "main";
+				_shaderVersions[i] = getShaderVersion(_desc.shaderKeys[i]);
+			}
+		}
+
+		// Every stage gets the same constants, ids a stage doesn't declare are ignored
+		VkSpecializationMapEntry specializationEntries[32];
+		VkBool32 specializationData[32];
+		VkSpecializationInfo specialization = {};
+		if (_desc.specializationCount > 0)
+		{
+			CVerifyCrash(_desc.specializationCount <= 32, "Pipeline {:016x} has {} specialization constants, at most 32 are supported.", _desc.hash(), _desc.specializationCount);
+			for (uint32_t i = 0; i < _desc.specializationCount; i++)
+			{
+				specializationEntries[i] = { i, i * (uint32_t)sizeof(VkBool32), sizeof(VkBool32) };
+				specializationData[i] = (_desc.specializationBits >> i) & 1u;
+			}
+			specialization.mapEntryCount = _desc.specializationCount;
+			specialization.pMapEntries = specializationEntries;
+			specialization.dataSize = _desc.specializationCount * sizeof(VkBool32);
+			specialization.pData = specializationData;
+			for (uint32_t i = 0; i < _desc.shaderCount; i++)
+			{
+				stages[i].pSpecializationInfo = &specialization;
+			}
+		}
+
+		VkVertexInputBindingDescription bindings[PipelineDesc::MAX_VERTEX_BINDINGS];
+		for (uint32_t i = 0; i < _desc.vertexBindingCount; i++)
+		{
+			bindings[i] = { _desc.vertexBindings[i].binding, _desc.vertexBindings[i].stride, (VkVertexInputRate)_desc.vertexBindings[i].inputRate };
+		}
+		VkVertexInputAttributeDescription attributes[PipelineDesc::MAX_VERTEX_ATTRIBUTES];
+		for (uint32_t i = 0; i < _desc.vertexAttributeCount; i++)
+		{
+			const auto& it = _desc.vertexAttributes[i];
+			attributes[i] = { it.location, it.binding, (VkFormat)it.format, it.offset };
+		}
+		VkPipelineVertexInputStateCreateInfo vertexInput = {};
+		vertexInput.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+		vertexInput.vertexBindingDescriptionCount = _desc.vertexBindingCount;
+		vertexInput.pVertexBindingDescriptions = bindings;
+		vertexInput.vertexAttributeDescriptionCount = _desc.vertexAttributeCount;
+		vertexInput.pVertexAttributeDescriptions = attributes;
+
+		VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
+		inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+		inputAssembly.topology = (VkPrimitiveTopology)_desc.topology;
+		inputAssembly.primitiveRestartEnable = _desc.primitiveRestart;
+
+		// Viewport and scissor are always dynamic so resizing never invalidates pipelines
+		VkPipelineViewportStateCreateInfo viewportState = {};
+		viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+		viewportState.viewportCount = 1;
+		viewportState.scissorCount = 1;
+
+		VkPipelineRasterizationStateCreateInfo rasterizer = {};
+		rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+		rasterizer.polygonMode = (VkPolygonMode)_desc.polygonMode;
+		rasterizer.cullMode = _desc.cullMode;
+		rasterizer.frontFace = (VkFrontFace)_desc.frontFace;
+		rasterizer.depthBiasEnable = _desc.depthBiasEnable;
+		rasterizer.lineWidth = 1.0f;
+
+		VkPipelineMultisampleStateCreateInfo multisampling = {};
+		multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+		multisampling.rasterizationSamples = (VkSampleCountFlagBits)_desc.samples;
+
+		VkPipelineDepthStencilStateCreateInfo depthStencil = {};
+		depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+		depthStencil.depthTestEnable = _desc.depthTestEnable;
+		depthStencil.depthWriteEnable = _desc.depthWriteEnable;
+		depthStencil.depthCompareOp = (VkCompareOp)_desc.depthCompareOp;
+
+		VkPipelineColorBlendAttachmentState blendAttachments[PipelineDesc::MAX_COLOR_TARGETS];
+		for (uint32_t i = 0; i < _desc.colorTargetCount; i++)
+		{
+			const auto& it = _desc.blend[i];
+			blendAttachments[i] = {};
+			blendAttachments[i].blendEnable = it.blendEnable;
+			blendAttachments[i].srcColorBlendFactor = (VkBlendFactor)it.srcColorFactor;
+			blendAttachments[i].dstColorBlendFactor = (VkBlendFactor)it.dstColorFactor;
+			blendAttachments[i].colorBlendOp = (VkBlendOp)it.colorOp;
+			blendAttachments[i].srcAlphaBlendFactor = (VkBlendFactor)it.srcAlphaFactor;
+			blendAttachments[i].dstAlphaBlendFactor = (VkBlendFactor)it.dstAlphaFactor;
+			blendAttachments[i].alphaBlendOp = (VkBlendOp)it.alphaOp;
+			blendAttachments[i].colorWriteMask = it.writeMask;
+		}
+		VkPipelineColorBlendStateCreateInfo colorBlending = {};
+		colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+		colorBlending.attachmentCount = _desc.colorTargetCount;
+		colorBlending.pAttachments = blendAttachments;
+
+		VkDynamicState dynamicStates[MAX_PIPELINE_DYNAMIC_STATES];
+		VkPipelineDynamicStateCreateInfo dynamicState = {};
+		dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+		dynamicState.dynamicStateCount = getVkDynamicStates(m_dynamicStates, dynamicStates);
+		dynamicState.pDynamicStates = dynamicStates;
+
+		VkGraphicsPipelineCreateInfo pipelineInfo = {};
+		pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+		pipelineInfo.stageCount = _desc.shaderCount;
+		pipelineInfo.pStages = stages;
+		pipelineInfo.pVertexInputState = &vertexInput;
+		pipelineInfo.pInputAssemblyState = &inputAssembly;
+		pipelineInfo.pViewportState = &viewportState;
+		pipelineInfo.pRasterizationState = &rasterizer;
+		pipelineInfo.pMultisampleState = &multisampling;
+		pipelineInfo.pDepthStencilState = _desc.depthFormat != VK_FORMAT_UNDEFINED ? &depthStencil : nullptr;
+		pipelineInfo.pColorBlendState = &colorBlending;
+		pipelineInfo.pDynamicState = &dynamicState;
+		pipelineInfo.layout = (VkPipelineLayout)_desc.layout;
+		pipelineInfo.renderPass = getCompatibleRenderPass(_desc);
+		pipelineInfo.subpass = 0;
+
+		VkPipeline pipeline;
+		VkResult result = vkCreateGraphicsPipelines(m_device, m_vkPipelineCache, 1, &pipelineInfo, nullptr, &pipeline);
+		if (result != VK_SUCCESS)
+		{
+			CLog(2, "Failed to create graphics pipeline {:016x}. Result: {}", _desc.hash(), result);
+			return VK_NULL_HANDLE;
+		}
+
+		const uint64_t microseconds = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+		m_pipelinesCreated++;
+		m_totalCreateMicroseconds += microseconds;
+		uint64_t previousMax = m_maxCreateMicroseconds;
+		while (microseconds > previousMax && !m_maxCreateMicroseconds.compare_exchange_weak(previousMax, microseconds)) {}
+		if (_desc.specializationCount > 0)
+		{
+			m_permutationsCreated++;
+			m_permutationCreateMicroseconds += microseconds;
+		}
+
+		CLog(0, "Pipeline {:016x} created in {:.2f} ms.", _desc.hash(), microseconds / 1000.0);
+		return pipeline;
+	}
+
+	VkDevice m_device = VK_NULL_HANDLE;
+	VkPipelineCache m_vkPipelineCache = VK_NULL_HANDLE;
+	uint32_t m_dynamicStates = 0;
+
+	std::shared_mutex m_pipelineMutex;
+	std::unordered_map<PipelineDesc, PipelineEntry, PipelineDescHasher> m_pipelines;
+	std::mutex m_usageMutex;
+	std::unordered_set<uint64_t> m_usedHashes;
+	std::vector<PipelineDesc> m_usedPipelines;		// first use order
+	std::shared_mutex m_variantMutex;
+	std::unordered_set<uint64_t> m_variants;		// hashes of the descriptions requested before normalization
+
+	// Shared objects pipelines are built from, rarely touched after load
+	std::mutex m_objectMutex;
+	std::unordered_map<uint64_t, VkShaderModule> m_shaderModules;
+	std::unordered_map<uint64_t, ShaderReflection> m_reflections;
+	std::unordered_map<uint64_t, uint64_t> m_shaderVersions;	// keys replaceShader() has touched
+	uint64_t m_lastShaderVersion = 0;
+	std::unordered_map<SetLayoutKey, VkDescriptorSetLayout, SetLayoutKeyHasher> m_setLayouts;
+	std::unordered_map<LayoutKey, VkPipelineLayout, LayoutKeyHasher> m_layouts;
+	std::unordered_map<RenderPassKey, VkRenderPass, RenderPassKeyHasher> m_renderPasses;
+	std::unordered_map<uint64_t, VkDescriptorSetLayout> m_externalSetLayouts;
+	std::unordered_map<uint64_t, VkPipelineLayout> m_externalLayouts;
+	uint64_t m_shaderDedupes = 0;
+	uint64_t m_layoutDedupes = 0;
+	uint64_t m_setLayoutDedupes = 0;
+
+	std::atomic<uint64_t> m_requests{ 0 };
+	std::atomic<uint64_t> m_hits{ 0 };
+	std::atomic<uint64_t> m_pipelinesCreated{ 0 };
+	std::atomic<uint64_t> m_duplicateCompiles{ 0 };
+	std::atomic<uint64_t> m_totalCreateMicroseconds{ 0 };
+	std::atomic<uint64_t> m_maxCreateMicroseconds{ 0 };
+	std::atomic<uint64_t> m_permutationsCreated{ 0 };
+	std::atomic<uint64_t> m_permutationCreateMicroseconds{ 0 };
+};
@@ -0,0 +1,269 @@
+#pragma once
+#include "Core.h"
+#include "PipelineCache.h"
+
+#include <vector>
+#include <deque>
+#include <functional>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cstdint>
+
+struct PipelineCompilerStats
+{
+	uint64_t queued = 0;			// descriptions sent to the workers
+	uint64_t prewarmed = 0;			// of which came from prewarm()
+	uint64_t compiled = 0;			// finished by the workers
+	uint32_t pending = 0;			// queued or compiling right now
+	uint64_t fallbackDraws = 0;		// requests answered with the fallback pipeline
+	uint64_t skippedDraws = 0;		// requests answered with nothing
+	uint64_t hitchFrames = 0;		// frames where the render thread blocked on a compile
+	uint64_t totalWaitMicroseconds = 0;
+};
+
+// Builds pipelines requested from the frame loop on worker threads so the render thread never compiles. request()
+// returns the pipeline if the cache has it and otherwise queues it and returns VK_NULL_HANDLE straight away; the caller
+// draws with a fallback (requestOrFallback(), the fallback must already be built) or skips the draw until it's ready.
+// waitFor() is the blocking escape hatch, every frame that uses it is counted as a hitch. Other background work that
+// builds pipelines (shader reloads) can run on the same workers through submit().
+//
+// The workers are threads of their own rather than jobs: a compile blocks inside the driver for milliseconds, which
+// would hold up the frame's jobs, and needs more stack than a job fiber has. Their count is taken out of the hardware
+// threads before the job system is sized, see getWorkerCount().
+class PipelineCompiler
+{
+public:
+	// Compiler threads for a machine with _hardwareThreads, the job system gets the rest.
+	static uint32_t getWorkerCount(uint32_t _hardwareThreads)
+	{
+		return std::max(1u, std::min(4u, _hardwareThreads / 4));
+	}
+
+	void init(PipelineCache& _cache, uint32_t _workerCount = 0)
+	{
+		m_cache = &_cache;
+		m_renderThread = std::this_thread::get_id();
+		m_running = true;
+
+		if (_workerCount == 0)
+			_workerCount = getWorkerCount(std::thread::hardware_concurrency());
+		for (uint32_t i = 0; i < _workerCount; i++)
+		{
+			m_workers.emplace_back([this]() { workerLoop(); });
+		}
+		CLog(0, "Pipeline compiler: {} worker threads.", _workerCount);
+	}
+
+	// Drops anything still queued and joins the workers.
+	void shutdown()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_running = false;
+			m_queue.clear();
+		}
+		m_wake.notify_all();
+		for (auto& it : m_workers)
+		{
+			it.join();
+		}
+		m_workers.clear();
+	}
+
+	// Runs _task on a worker thread. Tasks still queued at shutdown() are dropped.
+	void submit(std::function<void()> _task)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (!m_running)
+				return;
+			m_queue.push_back(std::move(_task));
+		}
+		m_wake.notify_one();
+	}
+
+	// Queues descriptions that are likely to be needed soon (the warm-up manifest) in the given order. They don't count
+	// as used until the game asks for them.
+	void prewarm(const std::vector<PipelineDesc>& _descs)
+	{
+		for (const auto& it : _descs)
+		{
+			enqueue(it);
+		}
+		m_prewarmed += _descs.size();
+	}
+
+	VkPipeline request(const PipelineDesc& _desc)
+	{
+		VkPipeline pipeline = m_cache->findPipeline(_desc);
+		if (pipeline != VK_NULL_HANDLE)
+			return pipeline;
+
+		enqueue(_desc);
+		return VK_NULL_HANDLE;
+	}
+
+	VkPipeline requestOrFallback(const PipelineDesc& _desc, VkPipeline _fallback)
+	{
+		VkPipeline pipeline = request(_desc);
+		if (pipeline != VK_NULL_HANDLE)
+			return pipeline;
+
+		if (_fallback != VK_NULL_HANDLE)
+			m_fallbackDraws++;
+		else
+			m_skippedDraws++;
+		return _fallback;
+	}
+
+	// Blocks until the pipeline exists. Waits for the worker if one is compiling it, otherwise compiles it on the
+	// calling thread and the queued compile, if any, is dropped.
+	VkPipeline waitFor(const PipelineDesc& _desc)
+	{
+		VkPipeline pipeline = m_cache->findPipeline(_desc);
+		if (pipeline != VK_NULL_HANDLE)
+			return pipeline;
+
+		const auto start = std::chrono::steady_clock::now();
+		const PipelineDesc desc = m_cache->normalize(_desc);
+		std::unique_lock<std::mutex> lock(m_mutex);
+		auto it = m_pending.find(desc);
+		if (it != m_pending.end() && it->second)
+		{
+			m_compiledSignal.wait(lock, [this, &desc]() { return m_pending.count(desc) == 0; });
+			lock.unlock();
+			pipeline = m_cache->findPipeline(_desc);
+		}
+		else
+		{
+			// Marked as compiling so the queued task skips it and nothing queues it again meanwhile
+			m_pending[desc] = true;
+			lock.unlock();
+			pipeline = m_cache->getPipeline(_desc);
+			lock.lock();
+			m_pending.erase(desc);
+			lock.unlock();
+			m_compiledSignal.notify_all();
+		}
+		if (pipeline == VK_NULL_HANDLE)
+			pipeline = m_cache->getPipeline(_desc);
+		const uint64_t microseconds = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+		if (std::this_thread::get_id() == m_renderThread)
+		{
+			m_frameWaitMicroseconds += microseconds;
+			m_totalWaitMicroseconds += microseconds;
+		}
+		return pipeline;
+	}
+
+	// Render thread only. Closes the frame's hitch accounting.
+	void endFrame(uint64_t _frameNumber)
+	{
+		if (m_frameWaitMicroseconds > 0)
+		{
+			m_hitchFrames++;
+			CLog(1, "Frame {} waited {:.2f} ms on pipeline compilation.", _frameNumber, m_frameWaitMicroseconds / 1000.0);
+			m_frameWaitMicroseconds = 0;
+		}
+	}
+
+	PipelineCompilerStats getStats()
+	{
+		PipelineCompilerStats stats;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			stats.pending = static_cast<uint32_t>(m_pending.size());
+		}
+		stats.queued = m_queued;
+		stats.prewarmed = m_prewarmed;
+		stats.compiled = m_compiled;
+		stats.fallbackDraws = m_fallbackDraws;
+		stats.skippedDraws = m_skippedDraws;
+		stats.hitchFrames = m_hitchFrames;
+		stats.totalWaitMicroseconds = m_totalWaitMicroseconds;
+		return stats;
+	}
+
+	void logStats()
+	{
+		const PipelineCompilerStats stats = getStats();
+		CLog(0, "Pipeline compiler: {} queued ({} prewarmed), {} compiled, {} pending, {} fallback draws, {} skipped draws, {} hitch frames ({:.2f} ms waited).",
+			stats.queued, stats.prewarmed, stats.compiled, stats.pending, stats.fallbackDraws, stats.skippedDraws, stats.hitchFrames, stats.totalWaitMicroseconds / 1000.0);
+	}
+
+private:
+	void enqueue(const PipelineDesc& _desc)
+	{
+		// Variants that only differ in dynamic state are one compile
+		const PipelineDesc desc = m_cache->normalize(_desc);
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (!m_running || !m_pending.emplace(desc, false).second)
+				return;
+			m_queue.push_back([this, desc]()
+			{
+				{
+					// Already compiling means waitFor() took it over
+					std::lock_guard<std::mutex> lock(m_mutex);
+					auto it = m_pending.find(desc);
+					if (it == m_pending.end() || it->second)
+						return;
+					it->second = true;
+				}
+				m_cache->compilePipeline(desc);
+				m_compiled++;
+				{
+					std::lock_guard<std::mutex> lock(m_mutex);
+					m_pending.erase(desc);
+				}
+				m_compiledSignal.notify_all();
+			});
+		}
+		m_queued++;
+		m_wake.notify_one();
+	}
+
+	void workerLoop()
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		while (true)
+		{
+			m_wake.wait(lock, [this]() { return !m_running || !m_queue.empty(); });
+			if (!m_running)
+				return;
+
+			std::function<void()> task = std::move(m_queue.front());
+			m_queue.pop_front();
+			lock.unlock();
+
+			task();
+
+			lock.lock();
+		}
+	}
+
+	PipelineCache* m_cache = nullptr;
+	std::thread::id m_renderThread;
+
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	std::deque<std::function<void()>> m_queue;
+	std::unordered_map<PipelineDesc, bool, PipelineDescHasher> m_pending;	// queued (false) or compiling (true), requests for these aren't queued again
+	std::condition_variable m_compiledSignal;	// a pending description finished
+	std::vector<std::thread> m_workers;
+	bool m_running = false;
+
+	std::atomic<uint64_t> m_queued{ 0 };
+	uint64_t m_prewarmed = 0;
+	std::atomic<uint64_t> m_compiled{ 0 };
+	std::atomic<uint64_t> m_fallbackDraws{ 0 };
+	std::atomic<uint64_t> m_skippedDraws{ 0 };
+	uint64_t m_hitchFrames = 0;
+	uint64_t m_frameWaitMicroseconds = 0;
+	uint64_t m_totalWaitMicroseconds = 0;
+};
@@ -0,0 +1,141 @@
+#pragma once
+#include "Core.h"
+#include "Hash.h"
+#include <vulkan/vulkan.h>
+
+#include <type_traits>
+#include <cstring>
+#include <cstdint>
+
+// Everything that goes into a graphics pipeline, as plain 32/64 bit values with no padding so the whole struct can be
+// hashed and compared as bytes. Shaders are referred to by the key PipelineCache::registerShader() returned, which keeps
+// descriptions stable across runs; enums are stored as uint32_t for the same reason.
+struct PipelineDesc
+{
+	static constexpr uint32_t MAX_SHADER_STAGES = 5;
+	static constexpr uint32_t MAX_VERTEX_BINDINGS = 4;
+	static constexpr uint32_t MAX_VERTEX_ATTRIBUTES = 16;
+	static constexpr uint32_t MAX_COLOR_TARGETS = 8;
+
+	struct VertexBinding
+	{
+		uint32_t binding;
+		uint32_t stride;
+		uint32_t inputRate;		// VkVertexInputRate
+	};
+	struct VertexAttribute
+	{
+		uint32_t location;
+		uint32_t binding;
+		uint32_t format;		// VkFormat
+		uint32_t offset;
+	};
+	struct BlendAttachment
+	{
+		uint32_t blendEnable;
+		uint32_t srcColorFactor;	// VkBlendFactor
+		uint32_t dstColorFactor;
+		uint32_t colorOp;			// VkBlendOp
+		uint32_t srcAlphaFactor;
+		uint32_t dstAlphaFactor;
+		uint32_t alphaOp;
+		uint32_t writeMask;			// VkColorComponentFlags
+	};
+
+	// Shaders
+	uint64_t shaderKeys[MAX_SHADER_STAGES] = {};
+	uint64_t layout = 0;				// VkPipelineLayout from PipelineCache::getPipelineLayout()
+	uint32_t shaderStages[MAX_SHADER_STAGES] = {};	// VkShaderStageFlagBits
+	uint32_t shaderCount = 0;
+	uint32_t specializationBits = 0;	// VkBool32 specialization constant i = bit i, the same values for every stage
+	uint32_t specializationCount = 0;	// constants 0..count-1 are set, see ShaderPermutations
+
+	// Vertex input
+	VertexBinding vertexBindings[MAX_VERTEX_BINDINGS] = {};
+	VertexAttribute vertexAttributes[MAX_VERTEX_ATTRIBUTES] = {};
+	uint32_t vertexBindingCount = 0;
+	uint32_t vertexAttributeCount = 0;
+
+	// Input assembly and rasterization
+	uint32_t topology = 0;				// VkPrimitiveTopology
+	uint32_t primitiveRestart = 0;
+	uint32_t polygonMode = 0;			// VkPolygonMode
+	uint32_t cullMode = 0;				// VkCullModeFlags
+	uint32_t frontFace = 0;				// VkFrontFace
+	uint32_t depthBiasEnable = 0;
+
+	// Depth
+	uint32_t depthTestEnable = 0;
+	uint32_t depthWriteEnable = 0;
+	uint32_t depthCompareOp = 0;		// VkCompareOp
+
+	// Render targets, the pipeline is built against a compatible render pass made from these
+	BlendAttachment blend[MAX_COLOR_TARGETS] = {};
+	uint32_t colorFormats[MAX_COLOR_TARGETS] = {};	// VkFormat
+	uint32_t colorTargetCount = 0;
+	uint32_t depthFormat = 0;			// VkFormat, VK_FORMAT_UNDEFINED for none
+	uint32_t samples = 0;				// VkSampleCountFlagBits
+
+	// Opaque triangles, back face culling, depth test and write, no blending, no targets.
+	PipelineDesc()
+	{
+		topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+		polygonMode = VK_POLYGON_MODE_FILL;
+		cullMode = VK_CULL_MODE_BACK_BIT;
+		frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+		depthTestEnable = VK_TRUE;
+		depthWriteEnable = VK_TRUE;
+		depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+		samples = VK_SAMPLE_COUNT_1_BIT;
+		for (auto& it : blend)
+		{
+			it.srcColorFactor = VK_BLEND_FACTOR_ONE;
+			it.srcAlphaFactor = VK_BLEND_FACTOR_ONE;
+			it.colorOp = VK_BLEND_OP_ADD;
+			it.alphaOp = VK_BLEND_OP_ADD;
+			it.writeMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+		}
+	}
+
+	void addShader(VkShaderStageFlagBits _stage, uint64_t _shaderKey)
+	{
+		CVerifyCrash(shaderCount < MAX_SHADER_STAGES, "PipelineDesc: more than {} shader stages.", MAX_SHADER_STAGES);
+		shaderStages[shaderCount] = _stage;
+		shaderKeys[shaderCount] = _shaderKey;
+		shaderCount++;
+	}
+	void addVertexBinding(uint32_t _binding, uint32_t _stride, VkVertexInputRate _inputRate = VK_VERTEX_INPUT_RATE_VERTEX)
+	{
+		CVerifyCrash(vertexBindingCount < MAX_VERTEX_BINDINGS, "PipelineDesc: more than {} vertex bindings.", MAX_VERTEX_BINDINGS);
+		vertexBindings[vertexBindingCount++] = { _binding, _stride, (uint32_t)_inputRate };
+	}
+	void addVertexAttribute(uint32_t _location, uint32_t _binding, VkFormat _format, uint32_t _offset)
+	{
+		CVerifyCrash(vertexAttributeCount < MAX_VERTEX_ATTRIBUTES, "PipelineDesc: more than {} vertex attributes.", MAX_VERTEX_ATTRIBUTES);
+		vertexAttributes[vertexAttributeCount++] = { _location, _binding, (uint32_t)_format, _offset };
+	}
+	void addColorTarget(VkFormat _format)
+	{
+		CVerifyCrash(colorTargetCount < MAX_COLOR_TARGETS, "PipelineDesc: more than {} color targets.", MAX_COLOR_TARGETS);
+		colorFormats[colorTargetCount++] = _format;
+	}
+	void setAlphaBlend(uint32_t _target)
+	{
+		CVerifyCrash(_target < MAX_COLOR_TARGETS, "PipelineDesc: color target {} out of range.", _target);
+		blend[_target].blendEnable = VK_TRUE;
+		blend[_target].srcColorFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+		blend[_target].dstColorFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+		blend[_target].srcAlphaFactor = VK_BLEND_FACTOR_ONE;
+		blend[_target].dstAlphaFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+	}
+
+	uint64_t hash() const { return hashBytes(this, sizeof(*this)); }
+	bool operator==(const PipelineDesc& _other) const { return memcmp(this, &_other, sizeof(*this)) == 0; }
+	bool operator!=(const PipelineDesc& _other) const { return !(*this == _other); }
+};
+static_assert(std::has_unique_object_representations_v<PipelineDesc>, "PipelineDesc must not contain padding, it is hashed as bytes");
+
+struct PipelineDescHasher
+{
+	size_t operator()(const PipelineDesc& _desc) const { return static_cast<size_t>(_desc.hash()); }
+};
@@ -0,0 +1,243 @@
+#pragma once
+#include "Core.h"
+#include "PipelineDesc.h"
+#include "PipelineCache.h"
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <fstream>
+#include <cstring>
+#include <cstdint>
+
+// The pipelines a previous session used, in the order it first used them, so the next one can build them on the
+// compiler workers before they're asked for. Descriptions are stored as bytes with the layout handle replaced by an
+// index into a table of layout records; entries whose shaders or layouts don't exist in this run are dropped on load.
+// The file is tied to the PipelineDesc layout, a mismatching version or size throws it away.
+class PipelineManifest
+{
+public:
+	static std::vector<PipelineDesc> load(const std::string& _path, PipelineCache& _cache)
+	{
+		std::vector<PipelineDesc> result;
+		std::ifstream file(_path, std::ios::binary);
+		if (!file)
+			return result;
+		std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		Reader reader{ data.data(), data.size() };
+
+		Header header = {};
+		if (!reader.read(header) || header.magic != MAGIC || header.version != VERSION || header.descSize != sizeof(PipelineDesc))
+		{
+			CLog(1, "Pipeline manifest {:s} is from another version, ignoring it.", _path);
+			return result;
+		}
+
+		if (!reader.fits(header.layoutCount, MIN_LAYOUT_SIZE))
+		{
+			CLog(1, "Pipeline manifest {:s} is truncated, ignoring it.", _path);
+			return result;
+		}
+		std::vector<VkPipelineLayout> layouts(header.layoutCount, VK_NULL_HANDLE);
+		for (uint32_t i = 0; i < header.layoutCount; i++)
+		{
+			PipelineCache::LayoutRecord record;
+			if (!readLayout(reader, record))
+			{
+				CLog(1, "Pipeline manifest {:s} is truncated, ignoring it.", _path);
+				return result;
+			}
+			layouts[i] = _cache.restoreLayout(record);
+		}
+
+		if (!reader.fits(header.entryCount, sizeof(PipelineDesc)))
+		{
+			CLog(1, "Pipeline manifest {:s} is truncated, ignoring it.", _path);
+			return result;
+		}
+		uint32_t stale = 0;
+		result.reserve(header.entryCount);
+		for (uint32_t i = 0; i < header.entryCount; i++)
+		{
+			PipelineDesc desc;
+			if (!reader.read(desc))
+			{
+				CLog(1, "Pipeline manifest {:s} is truncated, ignoring it.", _path);
+				return {};
+			}
+			if (!isUsable(desc, layouts, _cache))
+			{
+				stale++;
+				continue;
+			}
+			desc.layout = (uint64_t)layouts[desc.layout];
+			result.push_back(desc);
+		}
+		CLog(0, "Pipeline manifest {:s}: {} pipelines to prewarm, {} stale entries dropped.", _path, result.size(), stale);
+		return result;
+	}
+
+	// This session's pipelines in first use order, then whatever of _previous wasn't used this time.
+	static bool save(const std::string& _path, PipelineCache& _cache, const std::vector<PipelineDesc>& _previous)
+	{
+		std::vector<PipelineDesc> entries = _cache.getUsedPipelines();
+		std::unordered_set<uint64_t> known;
+		for (const auto& it : entries)
+		{
+			known.insert(it.hash());
+		}
+		for (const auto& it : _previous)
+		{
+			if (known.insert(it.hash()).second)
+				entries.push_back(it);
+		}
+
+		std::vector<uint8_t> layoutData;
+		std::unordered_map<uint64_t, uint32_t> layoutIndices;	// VkPipelineLayout -> index in the file
+		std::vector<uint8_t> entryData;
+		uint32_t entryCount = 0;
+		for (PipelineDesc desc : entries)
+		{
+			auto layout = layoutIndices.find(desc.layout);
+			if (layout == layoutIndices.end())
+			{
+				PipelineCache::LayoutRecord record;
+				if (!_cache.describeLayout((VkPipelineLayout)desc.layout, record))
+					continue;	// made outside the cache and never registered
+				layout = layoutIndices.emplace(desc.layout, static_cast<uint32_t>(layoutIndices.size())).first;
+				writeLayout(layoutData, record);
+			}
+			desc.layout = layout->second;
+			write(entryData, desc);
+			entryCount++;
+		}
+
+		Header header = { MAGIC, VERSION, static_cast<uint32_t>(sizeof(PipelineDesc)), static_cast<uint32_t>(layoutIndices.size()), entryCount, 0 };
+		std::ofstream file(_path, std::ios::binary | std::ios::trunc);
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(reinterpret_cast<const char*>(layoutData.data()), layoutData.size());
+		file.write(reinterpret_cast<const char*>(entryData.data()), entryData.size());
+		if (!file)
+		{
+			CLog(2, "Failed to write pipeline manifest {:s}.", _path);
+			return false;
+		}
+		CLog(0, "Pipeline manifest {:s}: saved {} pipelines.", _path, entryCount);
+		return true;
+	}
+
+private:
+	static constexpr uint32_t MAGIC = 0x4E414D50;	// "PMAN"
+	static constexpr uint32_t VERSION = 1;
+	static constexpr size_t MIN_LAYOUT_SIZE = sizeof(uint64_t) + 2 * sizeof(uint32_t);	// a layout without sets or push constants
+	static constexpr size_t MIN_SET_SIZE = sizeof(uint64_t) + sizeof(uint32_t);
+	static constexpr uint32_t MAX_SPECIALIZATION_CONSTANTS = 32;	// what PipelineCache supports
+
+	struct Header
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint32_t descSize;
+		uint32_t layoutCount;
+		uint32_t entryCount;
+		uint32_t reserved;
+	};
+
+	struct Reader
+	{
+		const uint8_t* data;
+		size_t size;
+		size_t offset = 0;
+
+		template<typename T>
+		bool read(T& _value)
+		{
+			if (offset + sizeof(T) > size)
+				return false;
+			memcpy(&_value, data + offset, sizeof(T));
+			offset += sizeof(T);
+			return true;
+		}
+
+		// _count elements of _elementSize bytes can still be read, checked before sizing anything from a count in the file.
+		bool fits(uint64_t _count, size_t _elementSize) const
+		{
+			return _count <= (size - offset) / _elementSize;
+		}
+	};
+
+	template<typename T>
+	static void write(std::vector<uint8_t>& _data, const T& _value)
+	{
+		const size_t offset = _data.size();
+		_data.resize(offset + sizeof(T));
+		memcpy(_data.data() + offset, &_value, sizeof(T));
+	}
+
+	// externalId, push constant count, set count, then each set as externalId, binding count, bindings.
+	static void writeLayout(std::vector<uint8_t>& _data, const PipelineCache::LayoutRecord& _record)
+	{
+		write(_data, _record.externalId);
+		write(_data, static_cast<uint32_t>(_record.pushConstants.size()));
+		write(_data, static_cast<uint32_t>(_record.sets.size()));
+		for (const auto& it : _record.pushConstants)
+		{
+			write(_data, it);
+		}
+		for (const auto& set : _record.sets)
+		{
+			write(_data, set.externalId);
+			write(_data, static_cast<uint32_t>(set.bindings.size()));
+			for (const auto& it : set.bindings)
+			{
+				write(_data, it);
+			}
+		}
+	}
+
+	static bool readLayout(Reader& _reader, PipelineCache::LayoutRecord& _record)
+	{
+		uint32_t pushConstantCount = 0, setCount = 0;
+		if (!_reader.read(_record.externalId) || !_reader.read(pushConstantCount) || !_reader.read(setCount) ||
+			!_reader.fits(pushConstantCount, sizeof(VkPushConstantRange)) || !_reader.fits(setCount, MIN_SET_SIZE))
+			return false;
+		_record.pushConstants.resize(pushConstantCount);
+		for (auto& it : _record.pushConstants)
+		{
+			if (!_reader.read(it))
+				return false;
+		}
+		_record.sets.resize(setCount);
+		for (auto& set : _record.sets)
+		{
+			uint32_t bindingCount = 0;
+			if (!_reader.read(set.externalId) || !_reader.read(bindingCount) || !_reader.fits(bindingCount, sizeof(SetLayoutBinding)))
+				return false;
+			set.bindings.resize(bindingCount);
+			for (auto& it : set.bindings)
+			{
+				if (!_reader.read(it))
+					return false;
+			}
+		}
+		return true;
+	}
+
+	// Counts are checked too, a damaged entry would index past the description's arrays or fail pipeline creation.
+	static bool isUsable(const PipelineDesc& _desc, const std::vector<VkPipelineLayout>& _layouts, PipelineCache& _cache)
+	{
+		if (_desc.layout >= _layouts.size() || _layouts[_desc.layout] == VK_NULL_HANDLE)
+			return false;
+		if (_desc.shaderCount == 0 || _desc.shaderCount > PipelineDesc::MAX_SHADER_STAGES || _desc.specializationCount > MAX_SPECIALIZATION_CONSTANTS ||
+			_desc.vertexBindingCount > PipelineDesc::MAX_VERTEX_BINDINGS || _desc.vertexAttributeCount > PipelineDesc::MAX_VERTEX_ATTRIBUTES ||
+			_desc.colorTargetCount > PipelineDesc::MAX_COLOR_TARGETS)
+			return false;
+		for (uint32_t i = 0; i < _desc.shaderCount; i++)
+		{
+			if (_cache.getShaderModule(_desc.shaderKeys[i]) == VK_NULL_HANDLE)
+				return false;
+		}
+		return true;
+	}
+};
@@ -0,0 +1,1719 @@
+#pragma once
+#include "Core.h"
+#include "Hash.h"
+#include "BarrierBatcher.h"
+#include "GpuProfiler.h"
+#include "TransientAttachments.h"
+#include <vulkan/vulkan.h>
+
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cstdint>
+
+// How a pass touches a resource. Each usage maps to the pipeline stages, access flags and image layout it needs.
+enum class ResourceUsage : uint32_t
+{
+	ColorAttachment,
+	DepthAttachment,		// depth test and write
+	DepthReadOnly,			// depth test without writes, the image can be sampled in the same pass
+	InputAttachment,
+	SampledFragment,
+	SampledCompute,
+	StorageRead,			// compute shader storage image or buffer
+	StorageWrite,
+	UniformBuffer,			// any shader stage
+	VertexBuffer,
+	IndexBuffer,
+	IndirectBuffer,
+	TransferSrc,
+	TransferDst,
+};
+
+struct RenderGraphStats
+{
+	uint32_t passes = 0;
+	uint32_t imageBarriers = 0;
+	uint32_t bufferBarriers = 0;
+	uint32_t layoutTransitions = 0;		// image barriers that change the layout
+	uint32_t barrierBatches = 0;		// barrier commands
+	uint32_t mergedBarriers = 0;		// folded into another one of the same batch by the BarrierBatcher, known after execute()
+	uint64_t compileMicroseconds = 0;
+
+	// Against running every declared pass as its own render pass that loads and stores all its attachments
+	uint32_t culledPasses = 0;			// nothing live consumed their outputs
+	uint32_t mergedPasses = 0;			// passes that became a later subpass of another pass's render pass
+	uint32_t renderPasses = 0;			// vkCmdBeginRenderPass calls
+	uint32_t loadsAvoided = 0;
+	uint32_t storesAvoided = 0;
+	uint64_t bytesSaved = 0;			// attachment memory traffic of the avoided loads and stores
+
+	uint32_t asyncPasses = 0;			// passes moved to the async compute or transfer queue
+	uint32_t submissions = 0;			// command buffers the frame is split into
+	uint32_t queueWaits = 0;			// waits between submissions of different queues
+	uint32_t ownershipTransfers = 0;	// release / acquire barrier pairs between queue families
+};
+
+// Frame graph rebuilt every frame. Resources are imported (swapchain image, transient attachments, buffers), passes
+// declare what they read and write, and compile() walks the passes in declaration order tracking the last access to
+// every resource to emit only the barriers needed: one BarrierBatcher flush per render pass or pass without
+// attachments, with the exact stages and accesses on both sides, layout transitions folded in, reads after a read or
+// reads already made visible skipped. Declaration order is the execution order; every dependency points at an earlier
+// pass so it's always a valid one.
+//
+// Before that, passes nothing live consumes are culled (a pass is live if it writes an imported image or buffer, is
+// marked sideEffects(), or produces something a live pass reads), and consecutive passes that only share attachments
+// as attachments are merged into subpasses of one render pass the graph creates. Attachments then move between
+// subpasses through by-region subpass dependencies so a tiler keeps them on chip, and transient attachments nothing
+// reads after the render pass aren't stored at all.
+//
+// Passes without attachments that only touch resources from compute shaders run on the async compute queue, and ones
+// that only copy on the transfer queue, when the device has separate families for them. The frame is then split into
+// submissions: a pass that needs the result of a pass on another queue starts a new submission that waits for the other
+// one to complete (GpuSync points, see Application::submitFrame()), everything else on the two queues overlaps.
+// Resources change queue family with a release barrier at the end of the producing submission and an acquire barrier in
+// front of the consumer, imported ones are owned by the graphics queue between frames. The last submission is always on
+// the graphics queue and waits for the other queues, so its completion covers all of them.
+class RenderGraph
+{
+public:
+	struct ImageHandle { uint32_t index = ~0u; };
+	struct BufferHandle { uint32_t index = ~0u; };
+
+	// Adds resources to the pass addPass() just returned it for. Each pass must be fully declared before the next one.
+	class PassBuilder
+	{
+	public:
+		PassBuilder& color(ImageHandle _image) { m_graph->addAttachment(m_pass, _image.index, ResourceUsage::ColorAttachment, nullptr); return *this; }
+		PassBuilder& color(ImageHandle _image, const VkClearColorValue& _clear)
+		{
+			VkClearValue value;
+			value.color = _clear;
+			m_graph->addAttachment(m_pass, _image.index, ResourceUsage::ColorAttachment, &value);
+			return *this;
+		}
+		PassBuilder& depth(ImageHandle _image) { m_graph->addAttachment(m_pass, _image.index, ResourceUsage::DepthAttachment, nullptr); return *this; }
+		PassBuilder& depth(ImageHandle _image, const VkClearDepthStencilValue& _clear)
+		{
+			VkClearValue value;
+			value.depthStencil = _clear;
+			m_graph->addAttachment(m_pass, _image.index, ResourceUsage::DepthAttachment, &value);
+			return *this;
+		}
+		PassBuilder& depthReadOnly(ImageHandle _image) { m_graph->addAttachment(m_pass, _image.index, ResourceUsage::DepthReadOnly, nullptr); return *this; }
+		PassBuilder& input(ImageHandle _image) { m_graph->addAttachment(m_pass, _image.index, ResourceUsage::InputAttachment, nullptr); return *this; }
+
+		PassBuilder& read(ImageHandle _image, ResourceUsage _usage) { m_graph->addAccess(m_pass, _image.index, _usage); return *this; }
+		PassBuilder& write(ImageHandle _image, ResourceUsage _usage) { m_graph->addAccess(m_pass, _image.index, _usage); return *this; }
+		PassBuilder& read(BufferHandle _buffer, ResourceUsage _usage) { m_graph->addAccess(m_pass, _buffer.index, _usage); return *this; }
+		PassBuilder& write(BufferHandle _buffer, ResourceUsage _usage) { m_graph->addAccess(m_pass, _buffer.index, _usage); return *this; }
+
+		// Never culled, for passes whose effect isn't a declared resource (readbacks, queries, debug output).
+		PassBuilder& sideEffects() { m_graph->m_passes[m_pass].sideEffects = true; return *this; }
+		// Keeps a pass without attachments on the graphics queue, for commands the other queues lack (blits, clears of images).
+		PassBuilder& graphicsQueue() { m_graph->m_passes[m_pass].graphicsQueue = true; return *this; }
+		// The pass only executes secondary command buffers into its subpass, recorded against getInheritance().
+		PassBuilder& secondaryCommandBuffers() { m_graph->m_passes[m_pass].secondaryCommandBuffers = true; return *this; }
+
+	private:
+		friend class RenderGraph;
+		PassBuilder(RenderGraph& _graph, uint32_t _pass) : m_graph(&_graph), m_pass(_pass) {}
+
+		RenderGraph* m_graph;
+		uint32_t m_pass;
+	};
+
+	// One command buffer of the frame and the earlier submissions it has to wait for, in the stages given.
+	struct Submission
+	{
+		QueueType queue;
+		uint32_t waitCount;
+		const uint32_t* waitSubmissions;
+		const VkPipelineStageFlags* waitStages;
+	};
+
+	void init(VkDevice _device, const DeviceFeatures& _features)
+	{
+		m_device = _device;
+		m_barrierBatcher.init(_device, _features);
+		std::copy(_features.queueFamilies, _features.queueFamilies + QUEUE_TYPE_COUNT, m_queueFamilies);
+	}
+
+	void destroy()
+	{
+		for (auto& it : m_framebuffers)
+		{
+			vkDestroyFramebuffer(m_device, it.second, nullptr);
+		}
+		m_framebuffers.clear();
+		for (auto& it : m_renderPasses)
+		{
+			vkDestroyRenderPass(m_device, it.second, nullptr);
+		}
+		m_renderPasses.clear();
+	}
+
+	// Off runs every live pass as its own render pass, for comparing against the merged frame.
+	void setSubpassMerging(bool _enabled) { m_subpassMerging = _enabled; }
+	// Off keeps every pass on the graphics queue.
+	void setAsyncQueues(bool _enabled) { m_asyncQueues = _enabled; }
+	// Timestamps around every pass on the queue it runs on.
+	void setProfiler(GpuProfiler* _profiler) { m_profiler = _profiler; }
+
+	// Forgets the previous frame's passes and resources, storage is kept so steady state frames don't allocate.
+	void beginFrame()
+	{
+		m_passCount = 0;
+		m_resourceCount = 0;
+		m_compiled = false;
+	}
+
+	// _initialStages are the stages whatever happened to the image before this frame must finish in, e.g. the stage the
+	// acquire semaphore is waited on for a swapchain image. _finalLayout is applied after the last pass, UNDEFINED leaves
+	// the image as the last pass had it.
+	ImageHandle importImage(const char* _name, VkImage _image, VkImageView _view, VkFormat _format, VkExtent2D _extent, VkImageAspectFlags _aspect,
+		VkImageLayout _initialLayout, VkImageLayout _finalLayout, VkPipelineStageFlags _initialStages = 0)
+	{
+		Resource& resource = addResource(_name);
+		resource.isImage = true;
+		resource.image = _image;
+		resource.view = _view;
+		resource.format = _format;
+		resource.extent = _extent;
+		resource.aspect = _aspect;
+		resource.initialLayout = _initialLayout;
+		resource.finalLayout = _finalLayout;
+		resource.initialStages = _initialStages;
+		return { m_resourceCount - 1 };
+	}
+
+	// Transient attachments start every frame undefined and aren't kept past it. Their first use also waits for
+	// everything that touched memory they alias, earlier in this frame or in the previous one.
+	ImageHandle importTransient(const TransientAttachmentAllocator& _allocator, TransientAttachmentAllocator::Handle _handle)
+	{
+		const TransientAttachmentDesc& desc = _allocator.getDesc(_handle);
+		const ImageHandle handle = importImage(desc.name, _allocator.getImage(_handle), _allocator.getImageView(_handle), desc.format, desc.extent, desc.aspect,
+			VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_UNDEFINED);
+		Resource& resource = m_resources[handle.index];
+		resource.memory = _allocator.getMemory(_handle);
+		resource.memoryBegin = _allocator.getMemoryOffset(_handle);
+		resource.memoryEnd = resource.memoryBegin + _allocator.getMemorySize(_handle);
+		return handle;
+	}
+
+	BufferHandle importBuffer(const char* _name, VkBuffer _buffer, VkDeviceSize _offset = 0, VkDeviceSize _size = VK_WHOLE_SIZE, VkPipelineStageFlags _initialStages = 0)
+	{
+		Resource& resource = addResource(_name);
+		resource.buffer = _buffer;
+		resource.offset = _offset;
+		resource.size = _size;
+		resource.initialStages = _initialStages;
+		return { m_resourceCount - 1 };
+	}
+
+	PassBuilder addPass(const char* _name, std::function<void(VkCommandBuffer)> _execute)
+	{
+		CVerifyCrash(!m_compiled, "RenderGraph: pass {:s} added after compile()!", _name);
+		if (m_passCount == m_passes.size())
+			m_passes.emplace_back();
+		Pass& pass = m_passes[m_passCount];
+		pass.name = _name;
+		pass.execute = std::move(_execute);
+		pass.accesses.clear();
+		pass.attachments.clear();
+		pass.colors.clear();
+		pass.inputs.clear();
+		pass.dependencies.clear();
+		pass.producers.clear();
+		pass.depthIndex = NONE;
+		pass.sideEffects = false;
+		pass.graphicsQueue = false;
+		pass.secondaryCommandBuffers = false;
+		pass.renderPass = VK_NULL_HANDLE;
+		pass.framebuffer = VK_NULL_HANDLE;
+		return PassBuilder(*this, m_passCount++);
+	}
+
+	void compile()
+	{
+		const auto start = std::chrono::steady_clock::now();
+		m_imageBarriers.clear();
+		m_bufferBarriers.clear();
+		m_batches.clear();
+		m_frameStats = {};
+		m_frameStats.passes = m_passCount;
+
+		cullPasses();
+		assignQueues();
+		mergePasses();
+		scheduleQueues();
+		for (uint32_t i = 0; i < m_resourceCount; i++)
+		{
+			Resource& resource = m_resources[i];
+			resource.layout = resource.initialLayout;
+			resource.writeStages = resource.initialStages;
+			resource.writeAccess = 0;
+			resource.readStages = 0;
+			resource.visibleStages = 0;
+			resource.visibleAccess = 0;
+			resource.lastWriter = NONE;
+			resource.readers.clear();
+			resource.used = false;
+			resource.queue = getInitialQueue(resource);
+			resource.lastAccess = NONE;
+		}
+
+		for (uint32_t i = 0; i < m_passCount; i++)
+		{
+			Pass& pass = m_passes[i];
+			if (pass.culled)
+				continue;
+			Pass& head = m_passes[pass.group];
+			if (pass.subpass == 0)
+			{
+				head.batch = static_cast<uint32_t>(m_batches.size());
+				m_batches.push_back(beginBatch());
+			}
+			for (const Access& access : pass.accesses)
+			{
+				Resource& resource = m_resources[access.resource];
+				GroupAttachment* attachment = findGroupAttachment(head, access.resource);
+				// Attachments an earlier subpass already used are synchronized by the render pass itself
+				const bool insideRenderPass = attachment != nullptr && attachment->firstSubpass < pass.subpass;
+				const uint32_t srcSubpasses = insideRenderPass ? getSourceSubpasses(pass, resource, access) : 0;
+
+				addDependencies(pass, i, resource, access);
+				if (!resource.used)
+					beginAliasedUse(resource, access.resource, pass.queue);
+				if (attachment != nullptr && attachment->firstSubpass == pass.subpass)
+					resolveLoadOp(pass, *attachment, resource);
+				if (insideRenderPass)
+					addSubpassDependency(head, srcSubpasses, pass.subpass, resource, access);
+				else if (resource.queue != NONE && resource.queue != static_cast<uint32_t>(pass.queue))
+					transferOwnership(resource, access, pass.queue, m_batches[head.batch]);
+				else
+					addBarrier(resource, access, m_batches[head.batch]);
+				resource.queue = static_cast<uint32_t>(pass.queue);
+				resource.lastAccess = i;
+			}
+			if (!head.groupAttachments.empty() && pass.subpass + 1 == head.subpassCount)
+				prepareRenderPass(pass.group);
+		}
+
+		// Imported resources go back to the graphics queue, images that have to be left in a given layout (e.g. the
+		// swapchain image for presentation) get it
+		m_finalBatch = static_cast<uint32_t>(m_batches.size());
+		m_batches.push_back(beginBatch());
+		for (uint32_t i = 0; i < m_resourceCount; i++)
+		{
+			Resource& resource = m_resources[i];
+			const bool returned = resource.memory == VK_NULL_HANDLE && resource.queue != NONE && resource.queue != static_cast<uint32_t>(QueueType::Graphics);
+			if (returned)
+			{
+				const VkImageLayout layout = resource.isImage && resource.finalLayout != VK_IMAGE_LAYOUT_UNDEFINED ? resource.finalLayout : resource.layout;
+				const Access access = { i, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, layout, false };
+				transferOwnership(resource, access, QueueType::Graphics, m_batches[m_finalBatch]);
+			}
+			if (resource.isImage && resource.finalLayout != VK_IMAGE_LAYOUT_UNDEFINED && resource.finalLayout != resource.layout)
+			{
+				const Access access = { i, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, resource.finalLayout, false };
+				addBarrier(resource, access, m_batches[m_finalBatch]);
+			}
+		}
+		endAliasedFrame();
+
+		for (const Batch& it : m_batches)
+		{
+			if (it.imageCount + it.bufferCount > 0)
+				m_frameStats.barrierBatches++;
+		}
+		m_frameStats.imageBarriers = static_cast<uint32_t>(m_imageBarriers.size());
+		m_frameStats.bufferBarriers = static_cast<uint32_t>(m_bufferBarriers.size());
+		for (uint32_t i = 0; i < m_segmentCount; i++)
+		{
+			const Segment& segment = m_segments[i];
+			m_frameStats.imageBarriers += static_cast<uint32_t>(segment.releaseImages.size());
+			m_frameStats.bufferBarriers += static_cast<uint32_t>(segment.releaseBuffers.size());
+			if (!segment.releaseImages.empty() || !segment.releaseBuffers.empty())
+				m_frameStats.barrierBatches++;
+		}
+		m_frameStats.compileMicroseconds = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+		m_compiled = true;
+
+		m_totals.frames++;
+		m_totals.barriers += m_frameStats.imageBarriers + m_frameStats.bufferBarriers;
+		m_totals.maxBarriers = std::max(m_totals.maxBarriers, m_frameStats.imageBarriers + m_frameStats.bufferBarriers);
+		m_totals.compileMicroseconds += m_frameStats.compileMicroseconds;
+		m_totals.maxCompileMicroseconds = std::max(m_totals.maxCompileMicroseconds, m_frameStats.compileMicroseconds);
+		m_totals.culledPasses += m_frameStats.culledPasses;
+		m_totals.mergedPasses += m_frameStats.mergedPasses;
+		m_totals.bytesSaved += m_frameStats.bytesSaved;
+		m_totals.asyncPasses += m_frameStats.asyncPasses;
+		m_totals.submissions += m_frameStats.submissions;
+		m_totals.queueWaits += m_frameStats.queueWaits;
+		m_totals.ownershipTransfers += m_frameStats.ownershipTransfers;
+	}
+
+	// Submissions in the order they have to be submitted, each waits only on earlier ones. Valid
+	// until the next compile().
+	uint32_t getSubmissionCount() const { return m_segmentCount; }
+	Submission getSubmission(uint32_t _submission) const
+	{
+		const Segment& segment = m_segments[_submission];
+		Submission submission;
+		submission.queue = segment.queue;
+		submission.waitCount = segment.waitCount;
+		submission.waitSubmissions = m_waitSubmissions.data() + segment.waitOffset;
+		submission.waitStages = m_waitStages.data() + segment.waitOffset;
+		return submission;
+	}
+
+	// Records one submission into a command buffer of its queue.
+	void execute(uint32_t _submission, VkCommandBuffer _commandBuffer)
+	{
+		CVerifyCrash(m_compiled, "RenderGraph: execute() without compile()!");
+		const Segment& segment = m_segments[_submission];
+		const uint64_t mergedBefore = m_barrierBatcher.getStats().merged;
+		if (m_profiler != nullptr)
+			m_profiler->beginCommandBuffer(_commandBuffer, segment.queue);
+		uint32_t renderPassScope = GpuProfiler::NONE;
+		for (uint32_t i = segment.firstPass; i <= segment.lastPass && i < m_passCount; i++)
+		{
+			const Pass& pass = m_passes[i];
+			if (pass.culled || pass.segment != _submission)
+				continue;
+			const Pass& head = m_passes[pass.group];
+			const VkSubpassContents contents = pass.secondaryCommandBuffers ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS : VK_SUBPASS_CONTENTS_INLINE;
+			// A subpass with secondary command buffers takes nothing but vkCmdExecuteCommands, so no timestamps either:
+			// a render pass with one gets a single scope around all of it, named after its first pass.
+			const bool wholeRenderPass = head.groupSecondaries;
+			uint32_t scope = renderPassScope;
+			if (m_profiler != nullptr && (!wholeRenderPass || pass.subpass == 0))
+				scope = m_profiler->beginScope(_commandBuffer, segment.queue, pass.name);
+			if (wholeRenderPass)
+				renderPassScope = scope;
+			if (pass.subpass == 0)
+			{
+				emitBarriers(_commandBuffer, m_batches[head.batch]);
+				if (head.renderPass != VK_NULL_HANDLE)
+				{
+					VkClearValue clearValues[MAX_ATTACHMENTS];
+					for (size_t a = 0; a < head.groupAttachments.size(); a++)
+					{
+						clearValues[a] = head.groupAttachments[a].clearValue;
+					}
+					VkRenderPassBeginInfo beginInfo = {};
+					beginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+					beginInfo.renderPass = head.renderPass;
+					beginInfo.framebuffer = head.framebuffer;
+					beginInfo.renderArea.extent = head.extent;
+					beginInfo.clearValueCount = static_cast<uint32_t>(head.groupAttachments.size());
+					beginInfo.pClearValues = clearValues;
+					vkCmdBeginRenderPass(_commandBuffer, &beginInfo, contents);
+				}
+			}
+			else
+			{
+				vkCmdNextSubpass(_commandBuffer, contents);
+			}
+			m_inheritance.renderPass = head.renderPass;
+			m_inheritance.subpass = pass.subpass;
+			m_inheritance.framebuffer = head.framebuffer;
+			if (pass.execute)
+				pass.execute(_commandBuffer);
+			if (head.renderPass != VK_NULL_HANDLE && pass.subpass + 1 == head.subpassCount)
+				vkCmdEndRenderPass(_commandBuffer);
+			if (m_profiler != nullptr && (!wholeRenderPass || pass.subpass + 1 == head.subpassCount))
+				m_profiler->endScope(_commandBuffer, segment.queue, scope);
+		}
+
+		// Queue family releases of what later submissions on other queues use
+		for (const BarrierBatcher::ImageBarrier& it : segment.releaseImages)
+		{
+			m_barrierBatcher.add(it);
+		}
+		for (const BarrierBatcher::BufferBarrier& it : segment.releaseBuffers)
+		{
+			m_barrierBatcher.add(it);
+		}
+		m_barrierBatcher.flush(_commandBuffer);
+		if (_submission == m_finalSegment)
+			emitBarriers(_commandBuffer, m_batches[m_finalBatch]);
+		m_frameStats.mergedBarriers += static_cast<uint32_t>(m_barrierBatcher.getStats().merged - mergedBefore);
+	}
+
+	// The render pass and subpass a pass's pipelines have to be compatible with, valid once compile() has run.
+	VkRenderPass getRenderPass(uint32_t _pass) const { return m_passes[m_passes[_pass].group].renderPass; }
+	uint32_t getSubpass(uint32_t _pass) const { return m_passes[_pass].subpass; }
+	bool isCulled(uint32_t _pass) const { return m_passes[_pass].culled; }
+	// What the secondary command buffers of the pass execute() is in have to inherit, only valid inside the pass's callback.
+	const VkCommandBufferInheritanceInfo& getInheritance() const { return m_inheritance; }
+	QueueType getQueue(uint32_t _pass) const { return m_passes[_pass].queue; }
+	const RenderGraphStats& getFrameStats() const { return m_frameStats; }
+
+	void logStats() const
+	{
+		const double frames = m_totals.frames > 0 ? static_cast<double>(m_totals.frames) : 1.0;
+		CLog(0, "Render graph: {} frames, {:.1f} barriers per frame (max {}), compile {:.1f} us per frame (max {} us). {} render passes, {} framebuffers.",
+			m_totals.frames, m_totals.barriers / frames, m_totals.maxBarriers, m_totals.compileMicroseconds / frames, m_totals.maxCompileMicroseconds,
+			m_renderPasses.size(), m_framebuffers.size());
+		CLog(0, "Render graph: subpass merging {:s}, {:.1f} passes culled and {:.1f} merged per frame, {:.2f} MiB of attachment loads and stores avoided per frame.",
+			m_subpassMerging ? "on" : "off", m_totals.culledPasses / frames, m_totals.mergedPasses / frames, m_totals.bytesSaved / frames / (1024.0 * 1024.0));
+		CLog(0, "Render graph: async queues {:s}, {:.1f} passes on async compute or transfer, {:.1f} submissions, {:.1f} queue waits and {:.1f} ownership transfers per frame.",
+			m_asyncQueues ? "on" : "off", m_totals.asyncPasses / frames, m_totals.submissions / frames, m_totals.queueWaits / frames, m_totals.ownershipTransfers / frames);
+		m_barrierBatcher.logStats();
+	}
+
+private:
+	static constexpr uint32_t NONE = ~0u;
+	static constexpr uint32_t PROLOGUE = NONE - 1;		// stands for the prologue submission in Pass::waits
+	static constexpr uint32_t MAX_ATTACHMENTS = 16;
+	static constexpr uint32_t MAX_SUBPASSES = 8;
+	static constexpr uint32_t MAX_SUBPASS_DEPENDENCIES = 32;
+	static constexpr VkAccessFlags WRITE_ACCESS = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |
+		VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+
+	struct Resource
+	{
+		const char* name = nullptr;
+		bool isImage = false;
+		VkImage image = VK_NULL_HANDLE;
+		VkImageView view = VK_NULL_HANDLE;
+		VkFormat format = VK_FORMAT_UNDEFINED;
+		VkExtent2D extent = {};
+		VkImageAspectFlags aspect = 0;
+		VkImageLayout initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		VkImageLayout finalLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		VkBuffer buffer = VK_NULL_HANDLE;
+		VkDeviceSize offset = 0;
+		VkDeviceSize size = 0;
+		VkPipelineStageFlags initialStages = 0;
+		VkDeviceMemory memory = VK_NULL_HANDLE;		// transient attachments only
+		VkDeviceSize memoryBegin = 0;
+		VkDeviceSize memoryEnd = 0;
+
+		// Tracked by compile()
+		VkImageLayout layout;
+		VkPipelineStageFlags writeStages;		// last write, or the layout transition reads are ordered after
+		VkAccessFlags writeAccess;
+		VkPipelineStageFlags readStages;		// reads since the last write
+		VkPipelineStageFlags visibleStages;		// stages and accesses the last write has been made visible to
+		VkAccessFlags visibleAccess;
+		uint32_t lastWriter;
+		std::vector<uint32_t> readers;			// passes that read since the last write
+		uint32_t lastUse;						// last live pass touching it
+		bool used;
+		uint32_t queue;							// QueueType owning it, NONE while its contents don't matter
+		uint32_t lastAccess;					// last pass touching it so far
+	};
+
+	struct Access
+	{
+		uint32_t resource;
+		VkPipelineStageFlags stages;
+		VkAccessFlags access;
+		VkImageLayout layout;
+		bool write;
+	};
+
+	struct Attachment
+	{
+		uint32_t resource;
+		VkImageLayout layout;
+		bool clear;
+		VkClearValue clearValue;
+	};
+
+	// An attachment of a whole render pass, shared by the subpasses that reference it.
+	struct GroupAttachment
+	{
+		uint32_t resource;
+		uint32_t firstSubpass;
+		uint32_t subpassMask;
+		VkAttachmentLoadOp loadOp;
+		VkAttachmentStoreOp storeOp;
+		VkImageLayout initialLayout;			// of the first subpass using it, the barriers in front of the render pass transition it
+		VkImageLayout finalLayout;				// of the last one
+		VkClearValue clearValue;
+	};
+
+	struct Pass
+	{
+		const char* name = nullptr;
+		std::function<void(VkCommandBuffer)> execute;
+		std::vector<Access> accesses;
+		std::vector<Attachment> attachments;	// each image once, in declaration order
+		std::vector<uint32_t> colors;			// indices into attachments
+		std::vector<uint32_t> inputs;
+		uint32_t depthIndex = NONE;
+		bool sideEffects = false;
+		std::vector<uint32_t> dependencies;		// earlier passes this one has to run after
+		std::vector<uint32_t> producers;		// earlier passes whose output this one uses
+		bool culled = false;
+		bool graphicsQueue = false;
+		bool secondaryCommandBuffers = false;
+		QueueType queue = QueueType::Graphics;
+		std::vector<uint32_t> waits;			// passes on other queues, or PROLOGUE, this one's submission waits for
+		VkPipelineStageFlags waitStages = 0;
+		bool waitedOn = false;					// some pass on another queue waits for it, its submission ends after it
+		uint32_t segment = 0;
+		uint32_t group = 0;						// first pass of the render pass this one is a subpass of
+		uint32_t subpass = 0;
+
+		// Only used on the first pass of a group
+		uint32_t subpassCount = 1;
+		bool groupSecondaries = false;			// some subpass records into secondary command buffers
+		std::vector<GroupAttachment> groupAttachments;
+		std::vector<VkSubpassDependency> subpassDependencies;
+		uint32_t batch = 0;
+		VkRenderPass renderPass = VK_NULL_HANDLE;
+		VkFramebuffer framebuffer = VK_NULL_HANDLE;
+		VkExtent2D extent = {};
+	};
+
+	// The barriers in front of one render pass or pass without attachments, a range of m_imageBarriers / m_bufferBarriers.
+	struct Batch
+	{
+		uint32_t imageOffset;
+		uint32_t imageCount;
+		uint32_t bufferOffset;
+		uint32_t bufferCount;
+	};
+
+	// One submission: the passes of one queue between two cross queue waits or signals.
+	struct Segment
+	{
+		QueueType queue;
+		uint32_t firstPass;						// its passes are in [firstPass, lastPass], passes of other segments in between are skipped
+		uint32_t lastPass;
+		uint32_t waitOffset, waitCount;			// into m_waitSubmissions / m_waitStages
+		std::vector<BarrierBatcher::ImageBarrier> releaseImages;	// recorded at its end
+		std::vector<BarrierBatcher::BufferBarrier> releaseBuffers;
+	};
+
+	struct QueueEdge
+	{
+		uint32_t src;
+		uint32_t dst;
+		VkPipelineStageFlags stages;
+	};
+
+	struct MemoryUse
+	{
+		VkPipelineStageFlags stages = 0;
+		VkAccessFlags access = 0;
+	};
+
+	// Everything VkRenderPassCreateInfo points at, zero filled so it can be hashed and compared as bytes.
+	struct RenderPassKey
+	{
+		struct Subpass
+		{
+			uint32_t colorCount;
+			uint32_t inputCount;
+			uint32_t preserveCount;
+			uint32_t hasDepth;
+			VkAttachmentReference colors[MAX_ATTACHMENTS];
+			VkAttachmentReference inputs[MAX_ATTACHMENTS];
+			VkAttachmentReference depth;
+			uint32_t preserve[MAX_ATTACHMENTS];
+		};
+		uint32_t attachmentCount;
+		uint32_t subpassCount;
+		uint32_t dependencyCount;
+		VkAttachmentDescription attachments[MAX_ATTACHMENTS];
+		Subpass subpasses[MAX_SUBPASSES];
+		VkSubpassDependency dependencies[MAX_SUBPASS_DEPENDENCIES];
+		bool operator==(const RenderPassKey& _other) const { return memcmp(this, &_other, sizeof(*this)) == 0; }
+	};
+	struct FramebufferKey
+	{
+		VkRenderPass renderPass;
+		VkImageView views[MAX_ATTACHMENTS];
+		uint32_t attachmentCount;
+		uint32_t width;
+		uint32_t height;
+		bool operator==(const FramebufferKey& _other) const { return memcmp(this, &_other, sizeof(*this)) == 0; }
+	};
+	struct KeyHasher
+	{
+		size_t operator()(const RenderPassKey& _key) const { return static_cast<size_t>(hashBytes(&_key, sizeof(_key))); }
+		size_t operator()(const FramebufferKey& _key) const { return static_cast<size_t>(hashBytes(&_key, sizeof(_key))); }
+	};
+
+	struct UsageInfo
+	{
+		VkPipelineStageFlags stages;
+		VkAccessFlags access;
+		VkImageLayout layout;
+		bool write;
+	};
+
+	static UsageInfo getUsageInfo(ResourceUsage _usage, VkImageAspectFlags _aspect)
+	{
+		const bool depth = (_aspect & (VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT)) != 0;
+		const VkImageLayout readOnly = depth ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		const VkPipelineStageFlags fragmentTests = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+		const VkPipelineStageFlags allShaders = VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+		switch (_usage)
+		{
+		case ResourceUsage::ColorAttachment:	return { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, true };
+		case ResourceUsage::DepthAttachment:	return { fragmentTests, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, true };
+		case ResourceUsage::DepthReadOnly:		return { fragmentTests, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, false };
+		case ResourceUsage::InputAttachment:	return { VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_INPUT_ATTACHMENT_READ_BIT, readOnly, false };
+		case ResourceUsage::SampledFragment:	return { VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, readOnly, false };
+		case ResourceUsage::SampledCompute:		return { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, readOnly, false };
+		case ResourceUsage::StorageRead:		return { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL, false };
+		case ResourceUsage::StorageWrite:		return { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL, true };
+		case ResourceUsage::UniformBuffer:		return { allShaders, VK_ACCESS_UNIFORM_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED, false };
+		case ResourceUsage::VertexBuffer:		return { VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED, false };
+		case ResourceUsage::IndexBuffer:		return { VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_INDEX_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED, false };
+		case ResourceUsage::IndirectBuffer:		return { VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED, false };
+		case ResourceUsage::TransferSrc:		return { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, false };
+		case ResourceUsage::TransferDst:		return { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, true };
+		}
+		return {};
+	}
+
+	// Bytes per pixel of the attachment formats the engine uses, for the bandwidth estimate.
+	static uint32_t getFormatSize(VkFormat _format)
+	{
+		switch (_format)
+		{
+		case VK_FORMAT_R8_UNORM:
+			return 1;
+		case VK_FORMAT_R8G8_UNORM:
+		case VK_FORMAT_R16_SFLOAT:
+		case VK_FORMAT_D16_UNORM:
+			return 2;
+		case VK_FORMAT_R16G16B16A16_SFLOAT:
+		case VK_FORMAT_R32G32_SFLOAT:
+		case VK_FORMAT_D32_SFLOAT_S8_UINT:
+			return 8;
+		case VK_FORMAT_R32G32B32A32_SFLOAT:
+			return 16;
+		default:
+			return 4;
+		}
+	}
+
+	uint64_t getAttachmentBytes(uint32_t _resource) const
+	{
+		const Resource& resource = m_resources[_resource];
+		return static_cast<uint64_t>(resource.extent.width) * resource.extent.height * getFormatSize(resource.format);
+	}
+
+	Resource& addResource(const char* _name)
+	{
+		if (m_resourceCount == m_resources.size())
+			m_resources.emplace_back();
+		Resource& resource = m_resources[m_resourceCount++];
+		std::vector<uint32_t> readers = std::move(resource.readers);
+		resource = Resource();
+		resource.readers = std::move(readers);
+		resource.name = _name;
+		return resource;
+	}
+
+	// A resource used twice in one pass gets one access with both usages, their layouts have to agree.
+	void addAccess(uint32_t _pass, uint32_t _resource, ResourceUsage _usage)
+	{
+		CVerifyCrash(_resource < m_resourceCount, "RenderGraph: pass {:s} uses a resource that wasn't imported this frame!", m_passes[_pass].name);
+		const Resource& resource = m_resources[_resource];
+		const UsageInfo info = getUsageInfo(_usage, resource.aspect);
+		const VkImageLayout layout = resource.isImage ? info.layout : VK_IMAGE_LAYOUT_UNDEFINED;
+		for (Access& it : m_passes[_pass].accesses)
+		{
+			if (it.resource == _resource)
+			{
+				CVerifyCrash(it.layout == layout, "RenderGraph: pass {:s} uses {:s} in two layouts!", m_passes[_pass].name, resource.name);
+				it.stages |= info.stages;
+				it.access |= info.access;
+				it.write = it.write || info.write;
+				return;
+			}
+		}
+		m_passes[_pass].accesses.push_back({ _resource, info.stages, info.access, layout, info.write });
+	}
+
+	// An image that's both the depth attachment and an input attachment of the pass is one attachment referenced twice.
+	void addAttachment(uint32_t _pass, uint32_t _resource, ResourceUsage _usage, const VkClearValue* _clear)
+	{
+		addAccess(_pass, _resource, _usage);
+		Pass& pass = m_passes[_pass];
+
+		uint32_t index = 0;
+		while (index < pass.attachments.size() && pass.attachments[index].resource != _resource)
+		{
+			index++;
+		}
+		if (index == pass.attachments.size())
+		{
+			CVerifyCrash(pass.attachments.size() < MAX_ATTACHMENTS, "RenderGraph: pass {:s} has too many attachments!", pass.name);
+			Attachment attachment = {};
+			attachment.resource = _resource;
+			attachment.layout = getUsageInfo(_usage, m_resources[_resource].aspect).layout;
+			pass.attachments.push_back(attachment);
+		}
+		Attachment& attachment = pass.attachments[index];
+		if (_clear != nullptr)
+		{
+			attachment.clear = true;
+			attachment.clearValue = *_clear;
+		}
+
+		if (_usage == ResourceUsage::ColorAttachment)
+		{
+			pass.colors.push_back(index);
+		}
+		else if (_usage == ResourceUsage::DepthAttachment || _usage == ResourceUsage::DepthReadOnly)
+		{
+			CVerifyCrash(pass.depthIndex == NONE, "RenderGraph: pass {:s} has two depth attachments!", pass.name);
+			pass.depthIndex = index;
+		}
+		else
+		{
+			pass.inputs.push_back(index);
+		}
+	}
+
+	static const Attachment* findAttachment(const Pass& _pass, uint32_t _resource)
+	{
+		for (const Attachment& it : _pass.attachments)
+		{
+			if (it.resource == _resource)
+				return &it;
+		}
+		return nullptr;
+	}
+
+	static uint32_t getGroupIndex(const Pass& _head, uint32_t _resource)
+	{
+		for (uint32_t i = 0; i < _head.groupAttachments.size(); i++)
+		{
+			if (_head.groupAttachments[i].resource == _resource)
+				return i;
+		}
+		return VK_ATTACHMENT_UNUSED;
+	}
+
+	static GroupAttachment* findGroupAttachment(Pass& _head, uint32_t _resource)
+	{
+		const uint32_t index = getGroupIndex(_head, _resource);
+		return index != VK_ATTACHMENT_UNUSED ? &_head.groupAttachments[index] : nullptr;
+	}
+
+	static void addUnique(std::vector<uint32_t>& _list, uint32_t _value)
+	{
+		for (uint32_t it : _list)
+		{
+			if (it == _value)
+				return;
+		}
+		_list.push_back(_value);
+	}
+
+	// Walks the passes backwards from the ones with visible effects, anything not reached is dropped. A write that
+	// doesn't clear may keep earlier contents, so it also needs the previous writer.
+	void cullPasses()
+	{
+		for (uint32_t i = 0; i < m_resourceCount; i++)
+		{
+			m_resources[i].lastWriter = NONE;
+			m_resources[i].lastUse = NONE;
+		}
+		for (uint32_t i = 0; i < m_passCount; i++)
+		{
+			Pass& pass = m_passes[i];
+			pass.culled = !pass.sideEffects;
+			for (const Access& access : pass.accesses)
+			{
+				Resource& resource = m_resources[access.resource];
+				const Attachment* attachment = findAttachment(pass, access.resource);
+				const bool overwrites = attachment != nullptr && attachment->clear;
+				if (resource.lastWriter != NONE && !overwrites)
+					addUnique(pass.producers, resource.lastWriter);
+				if (access.write)
+				{
+					resource.lastWriter = i;
+					if (resource.memory == VK_NULL_HANDLE)
+						pass.culled = false;	// imported, outlives the frame
+				}
+			}
+		}
+		for (uint32_t i = m_passCount; i-- > 0;)
+		{
+			const Pass& pass = m_passes[i];
+			if (pass.culled)
+				continue;
+			for (uint32_t it : pass.producers)
+			{
+				m_passes[it].culled = false;
+			}
+			for (const Access& access : pass.accesses)
+			{
+				Resource& resource = m_resources[access.resource];
+				if (resource.lastUse == NONE)
+					resource.lastUse = i;
+			}
+		}
+
+		for (uint32_t i = 0; i < m_passCount; i++)
+		{
+			const Pass& pass = m_passes[i];
+			if (!pass.culled)
+				continue;
+			m_frameStats.culledPasses++;
+			for (const Attachment& it : pass.attachments)
+			{
+				const uint32_t loads = it.clear ? 0 : 1;
+				m_frameStats.loadsAvoided += loads;
+				m_frameStats.storesAvoided++;
+				m_frameStats.bytesSaved += (loads + 1) * getAttachmentBytes(it.resource);
+			}
+		}
+	}
+
+	// Groups consecutive live passes into render passes, see canMerge().
+	void mergePasses()
+	{
+		uint32_t head = NONE;
+		for (uint32_t i = 0; i < m_passCount; i++)
+		{
+			Pass& pass = m_passes[i];
+			if (pass.culled)
+				continue;
+			if (head != NONE && canMerge(m_passes[head], i))
+			{
+				Pass& group = m_passes[head];
+				pass.group = head;
+				pass.subpass = group.subpassCount++;
+				group.groupSecondaries |= pass.secondaryCommandBuffers;
+				addGroupAttachments(group, pass);
+				m_frameStats.mergedPasses++;
+				continue;
+			}
+			pass.group = i;
+			pass.subpass = 0;
+			pass.subpassCount = 1;
+			pass.groupSecondaries = pass.secondaryCommandBuffers;
+			pass.groupAttachments.clear();
+			pass.subpassDependencies.clear();
+			pass.extent = pass.attachments.empty() ? VkExtent2D{} : m_resources[pass.attachments[0].resource].extent;
+			addGroupAttachments(pass, pass);
+			head = pass.attachments.empty() ? NONE : i;
+		}
+	}
+
+	// A pass can become the next subpass if its attachments have the render pass's size and whatever it shares with
+	// the passes already in it needs nothing a subpass dependency can't do: their attachments it only uses as
+	// attachments without clearing them, anything else only read on both sides.
+	bool canMerge(const Pass& _head, uint32_t _pass) const
+	{
+		const Pass& pass = m_passes[_pass];
+		if (!m_subpassMerging || pass.attachments.empty() || _head.subpassCount == MAX_SUBPASSES)
+			return false;
+
+		uint32_t newAttachments = 0;
+		for (const Attachment& it : pass.attachments)
+		{
+			const Resource& resource = m_resources[it.resource];
+			if (resource.extent.width != _head.extent.width || resource.extent.height != _head.extent.height)
+				return false;
+			if (getGroupIndex(_head, it.resource) == VK_ATTACHMENT_UNUSED)
+				newAttachments++;
+			else if (it.clear)
+				return false;
+		}
+		if (_head.groupAttachments.size() + newAttachments > MAX_ATTACHMENTS)
+			return false;
+
+		const uint32_t first = _head.group;
+		for (const Access& access : pass.accesses)
+		{
+			const bool groupAttachment = getGroupIndex(_head, access.resource) != VK_ATTACHMENT_UNUSED;
+			const bool attachment = findAttachment(pass, access.resource) != nullptr;
+			if (groupAttachment)
+			{
+				if (!attachment)
+					return false;
+				continue;
+			}
+			for (uint32_t i = first; i < _pass; i++)
+			{
+				if (m_passes[i].culled)
+					continue;
+				for (const Access& other : m_passes[i].accesses)
+				{
+					if (other.resource == access.resource && (attachment || access.write || other.write))
+						return false;
+				}
+			}
+		}
+		return true;
+	}
+
+	void addGroupAttachments(Pass& _head, const Pass& _pass)
+	{
+		for (const Attachment& it : _pass.attachments)
+		{
+			GroupAttachment* attachment = findGroupAttachment(_head, it.resource);
+			if (attachment == nullptr)
+			{
+				GroupAttachment added = {};
+				added.resource = it.resource;
+				added.firstSubpass = _pass.subpass;
+				added.initialLayout = it.layout;
+				added.clearValue = it.clearValue;
+				_head.groupAttachments.push_back(added);
+				attachment = &_head.groupAttachments.back();
+			}
+			attachment->subpassMask |= 1u << _pass.subpass;
+			attachment->finalLayout = it.layout;
+		}
+	}
+
+	// Imported resources belong to the graphics queue between frames, unless their contents don't matter.
+	static uint32_t getInitialQueue(const Resource& _resource)
+	{
+		const bool undefined = _resource.memory != VK_NULL_HANDLE || (_resource.isImage && _resource.initialLayout == VK_IMAGE_LAYOUT_UNDEFINED);
+		return undefined ? NONE : static_cast<uint32_t>(QueueType::Graphics);
+	}
+
+	// Passes without attachments go to the async compute queue if everything they touch is touched by compute shaders
+	// (or read as dispatch indirect arguments), to the transfer queue if they only copy. Ones touching a resource
+	// that has to wait for initial stages stay, only the graphics queue waits for those.
+	void assignQueues()
+	{
+		const bool compute = m_asyncQueues && m_queueFamilies[static_cast<uint32_t>(QueueType::Compute)] != m_queueFamilies[static_cast<uint32_t>(QueueType::Graphics)];
+		const bool transfer = m_asyncQueues && m_queueFamilies[static_cast<uint32_t>(QueueType::Transfer)] != m_queueFamilies[static_cast<uint32_t>(QueueType::Graphics)];
+		for (uint32_t i = 0; i < m_passCount; i++)
+		{
+			Pass& pass = m_passes[i];
+			pass.queue = QueueType::Graphics;
+			if (pass.culled || pass.graphicsQueue || !pass.attachments.empty() || pass.accesses.empty())
+				continue;
+
+			bool computeOnly = true;
+			bool transferOnly = true;
+			for (const Access& access : pass.accesses)
+			{
+				const bool computeAccess = (access.stages & VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT) != 0 || access.stages == VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT;
+				computeOnly = computeOnly && computeAccess && m_resources[access.resource].initialStages == 0;
+				transferOnly = transferOnly && access.stages == VK_PIPELINE_STAGE_TRANSFER_BIT && m_resources[access.resource].initialStages == 0;
+			}
+			if (transfer && transferOnly)
+			{
+				pass.queue = QueueType::Transfer;
+			}
+			else if (compute && computeOnly)
+			{
+				// Shader stages the compute queue doesn't have, e.g. of a uniform buffer read
+				pass.queue = QueueType::Compute;
+				for (Access& access : pass.accesses)
+				{
+					access.stages &= VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT;
+				}
+			}
+			if (pass.queue != QueueType::Graphics)
+				m_frameStats.asyncPasses++;
+		}
+	}
+
+	// Finds what every pass waits for on other queues and splits the passes into segments: a pass with such waits starts
+	// a new segment of its queue, a pass others wait for ends its segment. Ownership of a resource whose contents
+	// matter moves with a release on the queue that had it, so its next user waits for the last pass touching it
+	// there; resources the graphics queue owns from before the frame are released in a prologue segment. So is the
+	// memory of transient attachments a non graphics queue uses first, the prologue comes after the previous frame's
+	// graphics work in submission order.
+	void scheduleQueues()
+	{
+		for (uint32_t i = 0; i < m_resourceCount; i++)
+		{
+			Resource& resource = m_resources[i];
+			resource.lastWriter = NONE;
+			resource.readers.clear();
+			resource.used = false;
+			resource.queue = getInitialQueue(resource);
+			resource.lastAccess = NONE;
+		}
+		bool prologue = false;
+		for (uint32_t i = 0; i < m_passCount; i++)
+		{
+			Pass& pass = m_passes[i];
+			pass.waits.clear();
+			pass.waitStages = 0;
+			pass.waitedOn = false;
+			if (pass.culled)
+				continue;
+			const uint32_t queue = static_cast<uint32_t>(pass.queue);
+			for (const Access& access : pass.accesses)
+			{
+				Resource& resource = m_resources[access.resource];
+				const size_t waitCount = pass.waits.size();
+				if (resource.lastWriter != NONE && m_passes[resource.lastWriter].queue != pass.queue)
+					addUnique(pass.waits, resource.lastWriter);
+				if (access.write)
+				{
+					for (uint32_t it : resource.readers)
+					{
+						if (m_passes[it].queue != pass.queue)
+							addUnique(pass.waits, it);
+					}
+				}
+				if (resource.queue != NONE && resource.queue != queue)
+					addUnique(pass.waits, resource.lastAccess != NONE ? resource.lastAccess : PROLOGUE);
+				if (!resource.used && resource.memory != VK_NULL_HANDLE)
+				{
+					if (pass.queue != QueueType::Graphics)
+						addUnique(pass.waits, PROLOGUE);
+					for (uint32_t r = 0; r < m_resourceCount; r++)
+					{
+						const Resource& other = m_resources[r];
+						if (aliases(resource, access.resource, other, r) && other.queue != NONE && other.queue != queue)
+							addUnique(pass.waits, other.lastAccess);
+					}
+				}
+				if (pass.waits.size() != waitCount)
+					pass.waitStages |= access.stages;
+
+				resource.used = true;
+				resource.queue = queue;
+				resource.lastAccess = i;
+				if (access.write)
+				{
+					resource.readers.clear();
+					resource.lastWriter = i;
+				}
+				else
+				{
+					addUnique(resource.readers, i);
+				}
+			}
+
+			// A render pass can't be split, its subpasses wait in front of it
+			if (pass.subpass != 0 && !pass.waits.empty())
+			{
+				Pass& head = m_passes[pass.group];
+				for (uint32_t it : pass.waits)
+				{
+					addUnique(head.waits, it);
+				}
+				head.waitStages |= pass.waitStages;
+				pass.waits.clear();
+			}
+		}
+		for (uint32_t i = 0; i < m_passCount; i++)
+		{
+			for (uint32_t it : m_passes[i].waits)
+			{
+				if (it == PROLOGUE)
+					prologue = true;
+				else
+					m_passes[m_passes[it].group].waitedOn = true;
+			}
+		}
+
+		m_segmentCount = 0;
+		m_queueEdges.clear();
+		if (prologue)
+			addSegment(QueueType::Graphics, m_passCount);
+		uint32_t open[QUEUE_TYPE_COUNT] = { NONE, NONE, NONE };
+		uint32_t last[QUEUE_TYPE_COUNT] = { NONE, NONE, NONE };
+		for (uint32_t i = 0; i < m_passCount; i++)
+		{
+			Pass& pass = m_passes[i];
+			if (pass.culled)
+				continue;
+			if (pass.subpass != 0)
+			{
+				pass.segment = m_passes[pass.group].segment;
+				m_segments[pass.segment].lastPass = i;
+				continue;
+			}
+			const uint32_t queue = static_cast<uint32_t>(pass.queue);
+			if (open[queue] == NONE || !pass.waits.empty())
+				open[queue] = addSegment(pass.queue, i);
+			pass.segment = open[queue];
+			m_segments[pass.segment].lastPass = i;
+			last[queue] = pass.segment;
+			if (pass.waitedOn)
+				open[queue] = NONE;
+		}
+
+		const bool multiQueue = last[static_cast<uint32_t>(QueueType::Compute)] != NONE || last[static_cast<uint32_t>(QueueType::Transfer)] != NONE;
+		if (multiQueue || m_segmentCount == 0)
+			addSegment(QueueType::Graphics, m_passCount);
+		m_finalSegment = m_segmentCount - 1;
+
+		for (uint32_t i = 0; i < m_passCount; i++)
+		{
+			const Pass& pass = m_passes[i];
+			for (uint32_t it : pass.waits)
+			{
+				addQueueEdge(it == PROLOGUE ? 0 : m_passes[it].segment, pass.segment, pass.waitStages);
+			}
+		}
+		if (multiQueue)
+		{
+			for (uint32_t q = 1; q < QUEUE_TYPE_COUNT; q++)
+			{
+				if (last[q] != NONE)
+					addQueueEdge(last[q], m_finalSegment, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+			}
+		}
+
+		m_waitSubmissions.clear();
+		m_waitStages.clear();
+		for (uint32_t s = 0; s < m_segmentCount; s++)
+		{
+			Segment& segment = m_segments[s];
+			segment.waitOffset = static_cast<uint32_t>(m_waitSubmissions.size());
+			for (const QueueEdge& it : m_queueEdges)
+			{
+				if (it.dst != s)
+					continue;
+				m_waitSubmissions.push_back(it.src);
+				m_waitStages.push_back(it.stages);
+			}
+			segment.waitCount = static_cast<uint32_t>(m_waitSubmissions.size()) - segment.waitOffset;
+		}
+		m_frameStats.submissions = m_segmentCount;
+		m_frameStats.queueWaits = static_cast<uint32_t>(m_queueEdges.size());
+	}
+
+	uint32_t addSegment(QueueType _queue, uint32_t _firstPass)
+	{
+		if (m_segmentCount == m_segments.size())
+			m_segments.emplace_back();
+		Segment& segment = m_segments[m_segmentCount];
+		segment.queue = _queue;
+		segment.firstPass = _firstPass;
+		segment.lastPass = 0;
+		segment.waitOffset = segment.waitCount = 0;
+		segment.releaseImages.clear();
+		segment.releaseBuffers.clear();
+		return m_segmentCount++;
+	}
+
+	// Waits are always on earlier segments, so submitting in segment order never waits on a signal not yet submitted.
+	void addQueueEdge(uint32_t _src, uint32_t _dst, VkPipelineStageFlags _stages)
+	{
+		CVerifyCrash(_src < _dst, "RenderGraph: submission {} waits on the later submission {}!", _dst, _src);
+		for (QueueEdge& it : m_queueEdges)
+		{
+			if (it.src == _src && it.dst == _dst)
+			{
+				it.stages |= _stages;
+				return;
+			}
+		}
+		m_queueEdges.push_back({ _src, _dst, _stages });
+	}
+
+	// Reads depend on the last writer, writes also on every read since it.
+	void addDependencies(Pass& _pass, uint32_t _passIndex, Resource& _resource, const Access& _access)
+	{
+		if (_resource.lastWriter != NONE)
+			addUnique(_pass.dependencies, _resource.lastWriter);
+		if (_access.write)
+		{
+			for (uint32_t it : _resource.readers)
+			{
+				addUnique(_pass.dependencies, it);
+			}
+			_resource.readers.clear();
+			_resource.lastWriter = _passIndex;
+		}
+		else
+		{
+			addUnique(_resource.readers, _passIndex);
+		}
+	}
+
+	// Earlier subpasses of the same render pass an access has to wait for, as a mask.
+	uint32_t getSourceSubpasses(const Pass& _pass, const Resource& _resource, const Access& _access) const
+	{
+		uint32_t mask = 0;
+		if (_resource.lastWriter != NONE && m_passes[_resource.lastWriter].group == _pass.group)
+			mask |= 1u << m_passes[_resource.lastWriter].subpass;
+		if (_access.write || _access.layout != _resource.layout)
+		{
+			for (uint32_t it : _resource.readers)
+			{
+				if (m_passes[it].group == _pass.group)
+					mask |= 1u << m_passes[it].subpass;
+			}
+		}
+		return mask;
+	}
+
+	// First use of a transient attachment: whatever else used the same memory, earlier this frame or last frame, has
+	// to be finished with it. Uses on other queues are covered by the queue waits scheduleQueues() added instead.
+	void beginAliasedUse(Resource& _resource, uint32_t _index, QueueType _queue)
+	{
+		_resource.used = true;
+		if (_resource.memory == VK_NULL_HANDLE)
+			return;
+
+		auto previous = m_aliasedMemory.find((uint64_t)_resource.memory);
+		if (previous != m_aliasedMemory.end() && _queue == QueueType::Graphics)
+		{
+			_resource.writeStages |= previous->second.stages;
+			_resource.writeAccess |= previous->second.access;
+		}
+		for (uint32_t i = 0; i < m_resourceCount; i++)
+		{
+			const Resource& other = m_resources[i];
+			if (aliases(_resource, _index, other, i) && other.queue == static_cast<uint32_t>(_queue))
+			{
+				_resource.writeStages |= other.writeStages | other.readStages;
+				_resource.writeAccess |= other.writeAccess;
+			}
+		}
+	}
+
+	bool aliases(const Resource& _resource, uint32_t _index, const Resource& _other, uint32_t _otherIndex) const
+	{
+		return _otherIndex != _index && _other.used && _other.memory == _resource.memory &&
+			_other.memoryBegin < _resource.memoryEnd && _resource.memoryBegin < _other.memoryEnd;
+	}
+
+	// The last frame's uses are only needed until this frame's have been recorded over them.
+	void endAliasedFrame()
+	{
+		for (auto& it : m_aliasedMemory)
+		{
+			it.second = {};
+		}
+		for (uint32_t i = 0; i < m_resourceCount; i++)
+		{
+			const Resource& resource = m_resources[i];
+			if (resource.memory != VK_NULL_HANDLE && resource.used && resource.queue == static_cast<uint32_t>(QueueType::Graphics))
+			{
+				MemoryUse& use = m_aliasedMemory[(uint64_t)resource.memory];
+				use.stages |= resource.writeStages | resource.readStages;
+				use.access |= resource.writeAccess;
+			}
+		}
+	}
+
+	// Attachments whose contents were undefined before the render pass don't need loading, transient ones no later
+	// pass uses don't need storing.
+	void resolveLoadOp(const Pass& _pass, GroupAttachment& _attachment, const Resource& _resource) const
+	{
+		if (findAttachment(_pass, _attachment.resource)->clear)
+			_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+		else
+			_attachment.loadOp = _resource.layout == VK_IMAGE_LAYOUT_UNDEFINED ? VK_ATTACHMENT_LOAD_OP_DONT_CARE : VK_ATTACHMENT_LOAD_OP_LOAD;
+
+		uint32_t lastPass = _pass.group;
+		for (uint32_t i = _pass.group + 1; i < m_passCount && (m_passes[i].culled || m_passes[i].group == _pass.group); i++)
+		{
+			if (!m_passes[i].culled)
+				lastPass = i;
+		}
+		const bool keep = _resource.memory == VK_NULL_HANDLE || _resource.lastUse > lastPass;
+		_attachment.storeOp = keep ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	}
+
+	Batch beginBatch() const
+	{
+		return { static_cast<uint32_t>(m_imageBarriers.size()), 0, static_cast<uint32_t>(m_bufferBarriers.size()), 0 };
+	}
+
+	// Updates the tracked state of the resource for _access, returns whether it has to wait for anything first.
+	static bool transition(Resource& _resource, const Access& _access, VkPipelineStageFlags& _srcStages, VkAccessFlags& _srcAccess)
+	{
+		const bool layoutChange = _resource.isImage && _access.layout != _resource.layout;
+		_srcStages = 0;
+		_srcAccess = 0;
+		bool needed = false;
+
+		if (_access.write || layoutChange)
+		{
+			// Writes and layout transitions wait for every access since the last write
+			_srcStages = _resource.writeStages | _resource.readStages;
+			_srcAccess = _resource.writeAccess;
+			needed = _srcStages != 0 || layoutChange;
+
+			_resource.writeStages = _access.stages;
+			_resource.writeAccess = _access.write ? (_access.access & WRITE_ACCESS) : 0;
+			_resource.readStages = 0;
+			_resource.visibleStages = _access.write ? 0 : _access.stages;
+			_resource.visibleAccess = _access.write ? 0 : _access.access;
+		}
+		else
+		{
+			const bool visible = (_resource.visibleStages & _access.stages) == _access.stages && (_resource.visibleAccess & _access.access) == _access.access;
+			if (_resource.writeStages != 0 && !visible)
+			{
+				_srcStages = _resource.writeStages;
+				_srcAccess = _resource.writeAccess;
+				needed = true;
+				_resource.visibleStages |= _access.stages;
+				_resource.visibleAccess |= _access.access;
+			}
+			_resource.readStages |= _access.stages;
+		}
+		return needed;
+	}
+
+	void addBarrier(Resource& _resource, const Access& _access, Batch& _batch)
+	{
+		VkPipelineStageFlags srcStages;
+		VkAccessFlags srcAccess;
+		if (!transition(_resource, _access, srcStages, srcAccess))
+			return;
+
+		if (_resource.isImage)
+		{
+			BarrierBatcher::ImageBarrier barrier = {};
+			barrier.image = _resource.image;
+			barrier.range = { _resource.aspect, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS };
+			barrier.srcStages = srcStages;
+			barrier.srcAccess = srcAccess;
+			barrier.dstStages = _access.stages;
+			barrier.dstAccess = _access.access;
+			barrier.oldLayout = _resource.layout;
+			barrier.newLayout = _access.layout;
+			barrier.srcQueueFamily = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamily = VK_QUEUE_FAMILY_IGNORED;
+			m_imageBarriers.push_back(barrier);
+			_batch.imageCount++;
+			if (_resource.layout != _access.layout)
+				m_frameStats.layoutTransitions++;
+			_resource.layout = _access.layout;
+		}
+		else
+		{
+			BarrierBatcher::BufferBarrier barrier = {};
+			barrier.buffer = _resource.buffer;
+			barrier.offset = _resource.offset;
+			barrier.size = _resource.size;
+			barrier.srcStages = srcStages;
+			barrier.srcAccess = srcAccess;
+			barrier.dstStages = _access.stages;
+			barrier.dstAccess = _access.access;
+			barrier.srcQueueFamily = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamily = VK_QUEUE_FAMILY_IGNORED;
+			m_bufferBarriers.push_back(barrier);
+			_batch.bufferCount++;
+		}
+	}
+
+	// Moves the resource to another queue family: the release waits for its uses on the old queue at the end of the
+	// segment of the last one, the acquire makes it available to _access on the new queue after the queue wait. Both
+	// carry the same layout transition, it happens once between them.
+	void transferOwnership(Resource& _resource, const Access& _access, QueueType _queue, Batch& _batch)
+	{
+		Segment& src = m_segments[_resource.lastAccess != NONE ? m_passes[_resource.lastAccess].segment : 0];
+		const uint32_t srcFamily = m_queueFamilies[_resource.queue];
+		const uint32_t dstFamily = m_queueFamilies[static_cast<uint32_t>(_queue)];
+		// The prologue doesn't know what the previous frame did with it
+		const bool prologue = _resource.lastAccess == NONE;
+		const VkPipelineStageFlags srcStages = prologue ? VK_PIPELINE_STAGE_ALL_COMMANDS_BIT : _resource.writeStages | _resource.readStages;
+		const VkAccessFlags srcAccess = prologue ? VK_ACCESS_MEMORY_WRITE_BIT : _resource.writeAccess;
+		if (_resource.isImage)
+		{
+			BarrierBatcher::ImageBarrier barrier = {};
+			barrier.image = _resource.image;
+			barrier.range = { _resource.aspect, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS };
+			barrier.srcStages = srcStages;
+			barrier.srcAccess = srcAccess;
+			barrier.oldLayout = _resource.layout;
+			barrier.newLayout = _access.layout;
+			barrier.srcQueueFamily = srcFamily;
+			barrier.dstQueueFamily = dstFamily;
+			src.releaseImages.push_back(barrier);
+
+			barrier.srcStages = _access.stages;
+			barrier.srcAccess = 0;
+			barrier.dstStages = _access.stages;
+			barrier.dstAccess = _access.access;
+			m_imageBarriers.push_back(barrier);
+			_batch.imageCount++;
+			if (_resource.layout != _access.layout)
+				m_frameStats.layoutTransitions++;
+			_resource.layout = _access.layout;
+		}
+		else
+		{
+			BarrierBatcher::BufferBarrier barrier = {};
+			barrier.buffer = _resource.buffer;
+			barrier.offset = _resource.offset;
+			barrier.size = _resource.size;
+			barrier.srcStages = srcStages;
+			barrier.srcAccess = srcAccess;
+			barrier.srcQueueFamily = srcFamily;
+			barrier.dstQueueFamily = dstFamily;
+			src.releaseBuffers.push_back(barrier);
+
+			barrier.srcStages = _access.stages;
+			barrier.srcAccess = 0;
+			barrier.dstStages = _access.stages;
+			barrier.dstAccess = _access.access;
+			m_bufferBarriers.push_back(barrier);
+			_batch.bufferCount++;
+		}
+		m_frameStats.ownershipTransfers++;
+
+		// The access is now ordered after everything before it, as after a layout transition
+		_resource.writeStages = _access.stages;
+		_resource.writeAccess = _access.write ? (_access.access & WRITE_ACCESS) : 0;
+		_resource.readStages = 0;
+		_resource.visibleStages = _access.write ? 0 : _access.stages;
+		_resource.visibleAccess = _access.write ? 0 : _access.access;
+	}
+
+	// The same wait between subpasses, the layout change is done by the attachment references. Without an earlier
+	// subpass to wait for (a read the barrier in front of the render pass didn't cover) it waits on the outside.
+	void addSubpassDependency(Pass& _head, uint32_t _srcSubpasses, uint32_t _dstSubpass, Resource& _resource, const Access& _access)
+	{
+		VkPipelineStageFlags srcStages;
+		VkAccessFlags srcAccess;
+		const bool needed = transition(_resource, _access, srcStages, srcAccess);
+		_resource.layout = _access.layout;
+		if (!needed)
+			return;
+
+		for (uint32_t subpass = 0; subpass <= _dstSubpass; subpass++)
+		{
+			uint32_t src = subpass;
+			if (subpass == _dstSubpass)
+			{
+				if (_srcSubpasses != 0)
+					break;
+				src = VK_SUBPASS_EXTERNAL;
+			}
+			else if ((_srcSubpasses & (1u << subpass)) == 0)
+			{
+				continue;
+			}
+
+			VkSubpassDependency* dependency = nullptr;
+			for (VkSubpassDependency& it : _head.subpassDependencies)
+			{
+				if (it.srcSubpass == src && it.dstSubpass == _dstSubpass)
+					dependency = &it;
+			}
+			if (dependency == nullptr)
+			{
+				CVerifyCrash(_head.subpassDependencies.size() < MAX_SUBPASS_DEPENDENCIES, "RenderGraph: render pass of {:s} has too many subpass dependencies!", _head.name);
+				const VkDependencyFlags flags = src != VK_SUBPASS_EXTERNAL ? VK_DEPENDENCY_BY_REGION_BIT : 0;
+				_head.subpassDependencies.push_back({ src, _dstSubpass, 0, 0, 0, 0, flags });
+				dependency = &_head.subpassDependencies.back();
+			}
+			dependency->srcStageMask |= srcStages != 0 ? srcStages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+			dependency->dstStageMask |= _access.stages;
+			dependency->srcAccessMask |= srcAccess;
+			dependency->dstAccessMask |= _access.access;
+		}
+	}
+
+	void emitBarriers(VkCommandBuffer _commandBuffer, const Batch& _batch)
+	{
+		for (uint32_t i = 0; i < _batch.imageCount; i++)
+		{
+			m_barrierBatcher.add(m_imageBarriers[_batch.imageOffset + i]);
+		}
+		for (uint32_t i = 0; i < _batch.bufferCount; i++)
+		{
+			m_barrierBatcher.add(m_bufferBarriers[_batch.bufferOffset + i]);
+		}
+		m_barrierBatcher.flush(_commandBuffer);
+	}
+
+	// Barriers in front of the render pass do the transitions into it, attachments start in the layout of the first
+	// subpass using them and are left in the layout of the last one.
+	void prepareRenderPass(uint32_t _head)
+	{
+		Pass& head = m_passes[_head];
+		RenderPassKey key;
+		memset(&key, 0, sizeof(key));
+		key.attachmentCount = static_cast<uint32_t>(head.groupAttachments.size());
+		key.subpassCount = head.subpassCount;
+		key.dependencyCount = static_cast<uint32_t>(head.subpassDependencies.size());
+		std::copy(head.subpassDependencies.begin(), head.subpassDependencies.end(), key.dependencies);
+
+		FramebufferKey framebufferKey;
+		memset(&framebufferKey, 0, sizeof(framebufferKey));
+		framebufferKey.attachmentCount = key.attachmentCount;
+		framebufferKey.width = head.extent.width;
+		framebufferKey.height = head.extent.height;
+
+		for (uint32_t i = 0; i < key.attachmentCount; i++)
+		{
+			const GroupAttachment& attachment = head.groupAttachments[i];
+			const Resource& resource = m_resources[attachment.resource];
+			CVerifyCrash(resource.extent.width == head.extent.width && resource.extent.height == head.extent.height,
+				"RenderGraph: attachment {:s} of pass {:s} has a different size!", resource.name, head.name);
+
+			VkAttachmentDescription& description = key.attachments[i];
+			description.format = resource.format;
+			description.samples = VK_SAMPLE_COUNT_1_BIT;
+			description.loadOp = attachment.loadOp;
+			description.storeOp = attachment.storeOp;
+			description.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+			description.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+			description.initialLayout = attachment.initialLayout;
+			description.finalLayout = attachment.finalLayout;
+			framebufferKey.views[i] = resource.view;
+
+			// Separate render passes would store it after every subpass and load it again in every later one
+			uint32_t uses = 0;
+			for (uint32_t mask = attachment.subpassMask; mask != 0; mask &= mask - 1)
+			{
+				uses++;
+			}
+			const uint32_t loads = uses - 1;
+			const uint32_t stores = uses - (attachment.storeOp == VK_ATTACHMENT_STORE_OP_STORE ? 1 : 0);
+			m_frameStats.loadsAvoided += loads;
+			m_frameStats.storesAvoided += stores;
+			m_frameStats.bytesSaved += (loads + stores) * getAttachmentBytes(attachment.resource);
+		}
+
+		for (uint32_t i = _head; i < m_passCount; i++)
+		{
+			const Pass& pass = m_passes[i];
+			if (pass.culled)
+				continue;
+			if (pass.group != _head)
+				break;
+			RenderPassKey::Subpass& subpass = key.subpasses[pass.subpass];
+			for (uint32_t it : pass.colors)
+			{
+				subpass.colors[subpass.colorCount++] = { getGroupIndex(head, pass.attachments[it].resource), pass.attachments[it].layout };
+			}
+			for (uint32_t it : pass.inputs)
+			{
+				subpass.inputs[subpass.inputCount++] = { getGroupIndex(head, pass.attachments[it].resource), pass.attachments[it].layout };
+			}
+			if (pass.depthIndex != NONE)
+			{
+				subpass.hasDepth = 1;
+				subpass.depth = { getGroupIndex(head, pass.attachments[pass.depthIndex].resource), pass.attachments[pass.depthIndex].layout };
+			}
+			// Attachments an earlier and a later subpass use but this one doesn't
+			for (uint32_t a = 0; a < key.attachmentCount; a++)
+			{
+				const uint32_t mask = head.groupAttachments[a].subpassMask;
+				const bool before = (mask & ((1u << pass.subpass) - 1)) != 0;
+				const bool after = (mask >> pass.subpass) > 1;
+				if (before && after && ((mask >> pass.subpass) & 1u) == 0)
+					subpass.preserve[subpass.preserveCount++] = a;
+			}
+		}
+
+		auto renderPass = m_renderPasses.find(key);
+		if (renderPass == m_renderPasses.end())
+			renderPass = m_renderPasses.emplace(key, createRenderPass(key, head.name)).first;
+		head.renderPass = renderPass->second;
+		m_frameStats.renderPasses++;
+
+		framebufferKey.renderPass = head.renderPass;
+		auto framebuffer = m_framebuffers.find(framebufferKey);
+		if (framebuffer == m_framebuffers.end())
+			framebuffer = m_framebuffers.emplace(framebufferKey, createFramebuffer(framebufferKey)).first;
+		head.framebuffer = framebuffer->second;
+	}
+
+	VkRenderPass createRenderPass(const RenderPassKey& _key, const char* _name) const
+	{
+		VkSubpassDescription subpasses[MAX_SUBPASSES] = {};
+		for (uint32_t i = 0; i < _key.subpassCount; i++)
+		{
+			const RenderPassKey::Subpass& subpass = _key.subpasses[i];
+			subpasses[i].pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+			subpasses[i].colorAttachmentCount = subpass.colorCount;
+			subpasses[i].pColorAttachments = subpass.colors;
+			subpasses[i].inputAttachmentCount = subpass.inputCount;
+			subpasses[i].pInputAttachments = subpass.inputs;
+			subpasses[i].pDepthStencilAttachment = subpass.hasDepth ? &subpass.depth : nullptr;
+			subpasses[i].preserveAttachmentCount = subpass.preserveCount;
+			subpasses[i].pPreserveAttachments = subpass.preserve;
+		}
+
+		VkRenderPassCreateInfo createInfo = {};
+		createInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+		createInfo.attachmentCount = _key.attachmentCount;
+		createInfo.pAttachments = _key.attachments;
+		createInfo.subpassCount = _key.subpassCount;
+		createInfo.pSubpasses = subpasses;
+		createInfo.dependencyCount = _key.dependencyCount;
+		createInfo.pDependencies = _key.dependencies;
+
+		VkRenderPass renderPass;
+		VkResult result = vkCreateRenderPass(m_device, &createInfo, nullptr, &renderPass);
+		CVerifyCrash(result == VK_SUCCESS, "RenderGraph: failed to create render pass for {:s}. Result: {}", _name, result);
+		return renderPass;
+	}
+
+	VkFramebuffer createFramebuffer(const FramebufferKey& _key) const
+	{
+		VkFramebufferCreateInfo createInfo = {};
+		createInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+		createInfo.renderPass = _key.renderPass;
+		createInfo.attachmentCount = _key.attachmentCount;
+		createInfo.pAttachments = _key.views;
+		createInfo.width = _key.width;
+		createInfo.height = _key.height;
+		createInfo.layers = 1;
+
+		VkFramebuffer framebuffer;
+		VkResult result = vkCreateFramebuffer(m_device, &createInfo, nullptr, &framebuffer);
+		CVerifyCrash(result == VK_SUCCESS, "RenderGraph: failed to create framebuffer. Result: {}", result);
+		return framebuffer;
+	}
+
+	struct Totals
+	{
+		uint64_t frames = 0;
+		uint64_t barriers = 0;
+		uint32_t maxBarriers = 0;
+		uint64_t compileMicroseconds = 0;
+		uint64_t maxCompileMicroseconds = 0;
+		uint64_t culledPasses = 0;
+		uint64_t mergedPasses = 0;
+		uint64_t bytesSaved = 0;
+		uint64_t asyncPasses = 0;
+		uint64_t submissions = 0;
+		uint64_t queueWaits = 0;
+		uint64_t ownershipTransfers = 0;
+	};
+
+	VkDevice m_device = VK_NULL_HANDLE;
+	bool m_subpassMerging = true;
+	bool m_asyncQueues = true;
+	uint32_t m_queueFamilies[QUEUE_TYPE_COUNT] = {};
+	GpuProfiler* m_profiler = nullptr;
+	std::vector<Resource> m_resources;
+	uint32_t m_resourceCount = 0;
+	std::vector<Pass> m_passes;
+	uint32_t m_passCount = 0;
+	bool m_compiled = false;
+
+	std::vector<BarrierBatcher::ImageBarrier> m_imageBarriers;
+	std::vector<BarrierBatcher::BufferBarrier> m_bufferBarriers;
+	BarrierBatcher m_barrierBatcher;
+	std::vector<Batch> m_batches;				// one per render pass or pass without attachments, then the final transitions
+	uint32_t m_finalBatch = 0;
+	std::unordered_map<uint64_t, MemoryUse> m_aliasedMemory;	// VkDeviceMemory -> last frame's uses of transient attachments in it
+
+	std::vector<Segment> m_segments;			// in submission order, the prologue first if there is one
+	uint32_t m_segmentCount = 0;
+	uint32_t m_finalSegment = 0;				// records the final batch
+	std::vector<QueueEdge> m_queueEdges;
+	std::vector<uint32_t> m_waitSubmissions;
+	std::vector<VkPipelineStageFlags> m_waitStages;
+	VkCommandBufferInheritanceInfo m_inheritance = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO };
+
+	std::unordered_map<RenderPassKey, VkRenderPass, KeyHasher> m_renderPasses;
+	std::unordered_map<FramebufferKey, VkFramebuffer, KeyHasher> m_framebuffers;
+
+	RenderGraphStats m_frameStats;
+	Totals m_totals;
+};
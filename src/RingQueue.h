@@ -0,0 +1,199 @@
+#pragma once
+#include "Core.h"
+
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <utility>
+#include <cstdint>
+
+// Bounded lock-free FIFO queues for handing messages between threads: SpscRingQueue for one producer and one consumer,
+// MpscRingQueue for any number of producers and one consumer. The capacity is fixed and a power of two, a push into a
+// full queue fails instead of waiting or growing. The batch functions move as many elements as fit in one go: SPSC
+// publishes a batch with a single index store, MPSC claims all its slots with one compare and swap but still publishes
+// each element with its own sequence store. Fewer atomic operations on the shared indices are where most of the
+// throughput under contention comes from.
+//
+// The producer and consumer indices live on cache lines of their own so the two sides don't keep stealing each
+// other's line. Elements are moved out by pop, what stays behind in the slot is a moved-from T.
+
+// One producer thread, one consumer thread. Each side keeps a copy of the other side's index and only reads the shared
+// one when the copy says the queue is full (or empty).
+template<typename T>
+class SpscRingQueue
+{
+public:
+	explicit SpscRingQueue(uint32_t _capacity) : m_mask(_capacity - 1), m_slots(_capacity)
+	{
+		CVerifyCrash(_capacity > 0 && (_capacity & m_mask) == 0, "SpscRingQueue: capacity {} is not a power of two.", _capacity);
+	}
+	SpscRingQueue(const SpscRingQueue&) = delete;
+	SpscRingQueue& operator=(const SpscRingQueue&) = delete;
+
+	// Producer only, false when full.
+	bool push(T _value)
+	{
+		const uint64_t tail = m_tail.load(std::memory_order_relaxed);
+		if (tail - m_cachedHead > m_mask)
+		{
+			m_cachedHead = m_head.load(std::memory_order_acquire);
+			if (tail - m_cachedHead > m_mask)
+				return false;
+		}
+		m_slots[tail & m_mask] = std::move(_value);
+		m_tail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Producer only. Copies the first elements of _values that fit and returns how many.
+	uint32_t pushBatch(const T* _values, uint32_t _count)
+	{
+		const uint64_t tail = m_tail.load(std::memory_order_relaxed);
+		if (tail + _count - m_cachedHead > m_mask + 1)
+			m_cachedHead = m_head.load(std::memory_order_acquire);
+		const uint32_t count = static_cast<uint32_t>(std::min<uint64_t>(_count, m_mask + 1 - (tail - m_cachedHead)));
+		for (uint32_t i = 0; i < count; i++)
+		{
+			m_slots[(tail + i) & m_mask] = _values[i];
+		}
+		if (count > 0)
+			m_tail.store(tail + count, std::memory_order_release);
+		return count;
+	}
+
+	// Consumer only, false when empty.
+	bool pop(T& _value)
+	{
+		return popBatch(&_value, 1) == 1;
+	}
+
+	// Consumer only. Moves up to _max elements into _values and returns how many.
+	uint32_t popBatch(T* _values, uint32_t _max)
+	{
+		const uint64_t head = m_head.load(std::memory_order_relaxed);
+		if (m_cachedTail - head < _max)
+			m_cachedTail = m_tail.load(std::memory_order_acquire);
+		const uint32_t count = static_cast<uint32_t>(std::min<uint64_t>(_max, m_cachedTail - head));
+		for (uint32_t i = 0; i < count; i++)
+		{
+			_values[i] = std::move(m_slots[(head + i) & m_mask]);
+		}
+		if (count > 0)
+			m_head.store(head + count, std::memory_order_release);
+		return count;
+	}
+
+	uint32_t getCapacity() const { return static_cast<uint32_t>(m_mask + 1); }
+	// Only a snapshot while the other side is running.
+	uint32_t getSize() const { return static_cast<uint32_t>(m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire)); }
+
+private:
+	alignas(64) std::atomic<uint64_t> m_tail{ 0 };	// producer's line
+	uint64_t m_cachedHead = 0;
+	alignas(64) std::atomic<uint64_t> m_head{ 0 };	// consumer's line
+	uint64_t m_cachedTail = 0;
+	alignas(64) const uint64_t m_mask;
+	std::vector<T> m_slots;
+};
+
+// Any number of producer threads, one consumer thread. Producers claim slots by moving the tail with a compare and
+// swap, a batch claims all its slots at once, and mark each slot published with a per slot sequence number once it
+// is written. The consumer takes published slots in order and stops at the first one still being written, so the
+// elements of each producer come out in the order it pushed them. A slot is free again once the head has passed it.
+template<typename T>
+class MpscRingQueue
+{
+public:
+	explicit MpscRingQueue(uint32_t _capacity) : m_mask(_capacity - 1), m_slots(_capacity)
+	{
+		CVerifyCrash(_capacity > 0 && (_capacity & m_mask) == 0, "MpscRingQueue: capacity {} is not a power of two.", _capacity);
+	}
+	MpscRingQueue(const MpscRingQueue&) = delete;
+	MpscRingQueue& operator=(const MpscRingQueue&) = delete;
+
+	// Any thread, false when full.
+	bool push(T _value)
+	{
+		uint64_t tail;
+		if (claim(1, tail) == 0)
+			return false;
+		publish(tail, std::move(_value));
+		return true;
+	}
+
+	// Any thread. Copies the first elements of _values that fit and returns how many.
+	uint32_t pushBatch(const T* _values, uint32_t _count)
+	{
+		uint64_t tail;
+		const uint32_t count = claim(_count, tail);
+		for (uint32_t i = 0; i < count; i++)
+		{
+			publish(tail + i, _values[i]);
+		}
+		return count;
+	}
+
+	// Consumer only, false when empty or the oldest element is still being written.
+	bool pop(T& _value)
+	{
+		return popBatch(&_value, 1) == 1;
+	}
+
+	// Consumer only. Moves up to _max elements into _values and returns how many.
+	uint32_t popBatch(T* _values, uint32_t _max)
+	{
+		const uint64_t head = m_head.load(std::memory_order_relaxed);
+		uint32_t count = 0;
+		while (count < _max)
+		{
+			Slot& slot = m_slots[(head + count) & m_mask];
+			if (slot.sequence.load(std::memory_order_acquire) != head + count + 1)
+				break;
+			_values[count++] = std::move(slot.value);
+		}
+		if (count > 0)
+			m_head.store(head + count, std::memory_order_release);
+		return count;
+	}
+
+	uint32_t getCapacity() const { return static_cast<uint32_t>(m_mask + 1); }
+	// Only a snapshot, includes claimed slots that aren't written yet.
+	uint32_t getSize() const { return static_cast<uint32_t>(m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire)); }
+
+private:
+	struct Slot
+	{
+		std::atomic<uint64_t> sequence{ 0 };	// position + 1 once the element at that position is written
+		T value;
+	};
+
+	// Reserves up to _count slots starting at _tail, returns how many. The head is read with acquire, so the
+	// consumer is done with every slot behind it.
+	uint32_t claim(uint32_t _count, uint64_t& _tail)
+	{
+		_tail = m_tail.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			const uint64_t head = m_head.load(std::memory_order_acquire);
+			const int64_t used = static_cast<int64_t>(_tail - head);
+			const uint32_t count = used > static_cast<int64_t>(m_mask) ? 0 : static_cast<uint32_t>(std::min<uint64_t>(_count, m_mask + 1 - std::max<int64_t>(used, 0)));
+			if (count == 0)
+				return 0;
+			if (m_tail.compare_exchange_weak(_tail, _tail + count, std::memory_order_relaxed, std::memory_order_relaxed))
+				return count;
+		}
+	}
+
+	template<typename V>
+	void publish(uint64_t _position, V&& _value)
+	{
+		Slot& slot = m_slots[_position & m_mask];
+		slot.value = std::forward<V>(_value);
+		slot.sequence.store(_position + 1, std::memory_order_release);
+	}
+
+	alignas(64) std::atomic<uint64_t> m_tail{ 0 };	// producers' line
+	alignas(64) std::atomic<uint64_t> m_head{ 0 };	// consumer's line
+	alignas(64) const uint64_t m_mask;
+	std::vector<Slot> m_slots;
+};
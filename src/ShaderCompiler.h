@@ -0,0 +1,124 @@
+#pragma once
+#include "Core.h"
+#include <shaderc/shaderc.h>
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <cstdint>
+
+// GLSL/HLSL to SPIR-V through shaderc (the C API of shaderc_shared from the Vulkan SDK, which avoids CRT mismatches
+// with the static library). The stage comes from the file name: foo.vert / foo.frag / foo.comp / foo.geom / foo.tesc /
+// foo.tese for GLSL, foo.vs.hlsl / foo.ps.hlsl / foo.cs.hlsl / foo.gs.hlsl / foo.hs.hlsl / foo.ds.hlsl for HLSL.
+// compile() may be called from several threads at once.
+class ShaderCompiler
+{
+public:
+	ShaderCompiler()
+		: m_compiler(shaderc_compiler_initialize())
+	{}
+	~ShaderCompiler()
+	{
+		shaderc_compiler_release(m_compiler);
+	}
+	ShaderCompiler(const ShaderCompiler&) = delete;
+	ShaderCompiler& operator=(const ShaderCompiler&) = delete;
+
+	static bool isShaderSource(const std::string& _path)
+	{
+		shaderc_shader_kind kind;
+		bool hlsl;
+		return stageFromPath(_path, kind, hlsl);
+	}
+
+	// On failure _errors holds the compiler output and _spirv is left untouched.
+	bool compile(const std::string& _path, std::vector<uint32_t>& _spirv, std::string& _errors)
+	{
+		std::ifstream file(_path, std::ios::binary);
+		if (!file)
+		{
+			_errors = "Can't open " + _path;
+			return false;
+		}
+		std::stringstream source;
+		source << file.rdbuf();
+		return compileSource(_path, source.str(), _spirv, _errors);
+	}
+
+	// Source that isn't in a file, _name picks the stage the same way a path does.
+	bool compileSource(const std::string& _name, const std::string& _text, std::vector<uint32_t>& _spirv, std::string& _errors)
+	{
+		shaderc_shader_kind kind;
+		bool hlsl;
+		if (!stageFromPath(_name, kind, hlsl))
+		{
+			_errors = "Unknown shader stage for " + _name;
+			return false;
+		}
+
+		shaderc_compile_options_t options = shaderc_compile_options_initialize();
+		shaderc_compile_options_set_source_language(options, hlsl ? shaderc_source_language_hlsl : shaderc_source_language_glsl);
+		shaderc_compile_options_set_target_env(options, shaderc_target_env_vulkan, shaderc_env_version_vulkan_1_0);
+#if _DEBUG
+		shaderc_compile_options_set_generate_debug_info(options);
+#else
+		shaderc_compile_options_set_optimization_level(options, shaderc_optimization_level_performance);
+#endif
+		shaderc_compilation_result_t result = shaderc_compile_into_spv(m_compiler, _text.data(), _text.size(), kind, _name.c_str(), "main", options);
+
+		const bool success = shaderc_result_get_compilation_status(result) == shaderc_compilation_status_success;
+		if (success)
+		{
+			const size_t length = shaderc_result_get_length(result);
+			_spirv.resize(length / sizeof(uint32_t));
+			memcpy(_spirv.data(), shaderc_result_get_bytes(result), length);
+		}
+		else
+		{
+			_errors = shaderc_result_get_error_message(result);
+		}
+		shaderc_result_release(result);
+		shaderc_compile_options_release(options);
+		return success;
+	}
+
+private:
+	static bool endsWith(const std::string& _value, const char* _suffix)
+	{
+		const size_t length = strlen(_suffix);
+		return _value.size() >= length && _value.compare(_value.size() - length, length, _suffix) == 0;
+	}
+
+	static bool stageFromPath(const std::string& _path, shaderc_shader_kind& _kind, bool& _hlsl)
+	{
+		static const struct { const char* suffix; shaderc_shader_kind kind; bool hlsl; } stages[] =
+		{
+			{ ".vert", shaderc_glsl_vertex_shader, false },
+			{ ".frag", shaderc_glsl_fragment_shader, false },
+			{ ".comp", shaderc_glsl_compute_shader, false },
+			{ ".geom", shaderc_glsl_geometry_shader, false },
+			{ ".tesc", shaderc_glsl_tess_control_shader, false },
+			{ ".tese", shaderc_glsl_tess_evaluation_shader, false },
+			{ ".vs.hlsl", shaderc_vertex_shader, true },
+			{ ".ps.hlsl", shaderc_fragment_shader, true },
+			{ ".cs.hlsl", shaderc_compute_shader, true },
+			{ ".gs.hlsl", shaderc_geometry_shader, true },
+			{ ".hs.hlsl", shaderc_tess_control_shader, true },
+			{ ".ds.hlsl", shaderc_tess_evaluation_shader, true },
+		};
+		for (const auto& it : stages)
+		{
+			if (endsWith(_path, it.suffix))
+			{
+				_kind = it.kind;
+				_hlsl = it.hlsl;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	shaderc_compiler_t m_compiler;
+};
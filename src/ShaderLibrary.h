@@ -0,0 +1,339 @@
+#pragma once
+#include "Core.h"
+#include "FileWatcher.h"
+#include "ShaderCompiler.h"
+#include "ShaderPack.h"
+#include "PipelineCache.h"
+#include "PipelineCompiler.h"
+#include "DeferredDeletionQueue.h"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <filesystem>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// Shaders loaded at startup, from the shader pack or compiled from source, and hot reloaded when their files change.
+// Each shader is registered with the pipeline cache under a key derived from its path, so pipeline descriptions keep
+// pointing at it across edits.
+//
+// A reload compiles only the changed file on a compiler worker, points its key at the new module and rebuilds, also on
+// the workers, just the pipelines that use it. The new pipelines are published by update() at the next frame boundary
+// and the old pipelines and module go through the deletion queue. Pipelines remember the shader versions they were
+// built from, so any built from the old module while the reload ran are found and rebuilt before it finishes.
+// A file that fails to compile keeps its last good code, and so does one whose pipelines fail to build: the old module
+// is put back and the old pipelines stay. Reloads keep each pipeline's layout, edits that change a shader's interface
+// need a restart.
+class ShaderLibrary
+{
+public:
+	// Shaders come from _packPath when it exists, sources under _directory that aren't in the pack or were edited after
+	// it was built are compiled. _directory is watched for changes either way.
+	void init(PipelineCache& _cache, PipelineCompiler& _compiler, DeferredDeletionQueue& _deletionQueue, const std::string& _directory, const std::string& _packPath)
+	{
+		m_cache = &_cache;
+		m_compiler = &_compiler;
+		m_deletionQueue = &_deletionQueue;
+		m_directory = _directory;
+
+		const auto start = std::chrono::steady_clock::now();
+		std::error_code error;
+		ShaderPack pack;
+		const bool hasPack = pack.open(_packPath);
+		const auto packTime = std::filesystem::last_write_time(_packPath, error);
+		const bool hasSources = std::filesystem::is_directory(_directory, error);
+
+		uint32_t compiled = 0;
+		if (hasSources)
+		{
+			for (const auto& entry : std::filesystem::recursive_directory_iterator(_directory, error))
+			{
+				const std::string path = std::filesystem::relative(entry.path(), _directory, error).generic_string();
+				if (!entry.is_regular_file(error) || !ShaderCompiler::isShaderSource(path))
+					continue;
+				if (hasPack && pack.find(ShaderPack::makeKey(path)) != nullptr && entry.last_write_time(error) <= packTime)
+					continue;
+				if (load(path) != 0)
+					compiled++;
+			}
+		}
+		const double compileMs = elapsedMs(start);
+
+		uint32_t packed = 0;
+		if (hasPack)
+		{
+			for (uint32_t i = 0; i < pack.getEntryCount(); i++)
+			{
+				const ShaderPackEntry& entry = pack.getEntry(i);
+				const std::string name = pack.getName(entry);
+				if (m_shaders.count(name) != 0)
+					continue;	// edited since the pack was built
+				const ShaderReflection reflection = pack.getReflection(entry);
+				m_shaders[name] = m_cache->registerShader(pack.getCode(entry), entry.codeSize, entry.key, &reflection);
+				packed++;
+			}
+		}
+		CLog(0, "Shader startup: {:.2f} ms, {} from {:s} ({} KB mapped), {} compiled from source in {:.2f} ms.",
+			elapsedMs(start), packed, hasPack ? _packPath : std::string("no pack"), pack.getSize() / 1024, compiled, compileMs);
+
+		if (!hasSources)
+		{
+			CLog(hasPack ? 0 : 1, "Shader directory {:s} not found, shader hot reload disabled.", _directory);
+			return;
+		}
+		if (m_watcher.start(_directory))
+			CLog(0, "Watching {:s} for shader changes.", _directory);
+		else
+			CLog(1, "Can't watch {:s}, shader hot reload disabled.", _directory);
+	}
+
+	// Call once the compiler workers are joined. Whatever unfinished reloads already created goes to the deletion queue.
+	void shutdown()
+	{
+		m_watcher.stop();
+		for (const auto& reload : m_reloads)
+		{
+			for (const PipelineCache::BuiltPipeline& built : reload->pipelines)
+			{
+				m_deletionQueue->push(built.pipeline, 0);
+			}
+			m_deletionQueue->push(reload->previous.module, 0);
+		}
+		m_reloads.clear();
+		m_pendingChanges.clear();
+	}
+
+	// Compiles and registers a shader, returns its pipeline cache key or 0 if it didn't compile.
+	uint64_t load(const std::string& _relativePath)
+	{
+		std::vector<uint32_t> spirv;
+		std::string errors;
+		if (!m_shaderCompiler.compile(fullPath(_relativePath), spirv, errors))
+		{
+			CLog(2, "Shader {:s} failed to compile:\n{:s}", _relativePath, errors);
+			return 0;
+		}
+		const uint64_t key = m_cache->registerShader(spirv.data(), spirv.size() * sizeof(uint32_t), ShaderPack::makeKey(_relativePath));
+		m_shaders[_relativePath] = key;
+		return key;
+	}
+
+	uint64_t getKey(const std::string& _relativePath) const
+	{
+		auto it = m_shaders.find(_relativePath);
+		return it != m_shaders.end() ? it->second : 0;
+	}
+
+	// Render thread, at the frame boundary before any recording. Starts reloads for changed files and publishes the
+	// ones that finished; replaced objects are retired once _frameNumber has completed.
+	void update(uint64_t _frameNumber)
+	{
+		for (auto& change : m_watcher.poll())
+		{
+			if (m_shaders.count(change.path) != 0)
+				m_pendingChanges.push_back(std::move(change));
+		}
+
+		// One reload per shader at a time, a change that lands mid reload waits for it
+		size_t kept = 0;
+		for (size_t i = 0; i < m_pendingChanges.size(); i++)
+		{
+			if (isReloading(m_pendingChanges[i].path))
+				m_pendingChanges[kept++] = std::move(m_pendingChanges[i]);
+			else
+				startReload(m_pendingChanges[i]);
+		}
+		m_pendingChanges.resize(kept);
+
+		kept = 0;
+		for (size_t i = 0; i < m_reloads.size(); i++)
+		{
+			if (!m_reloads[i]->done || !finishReload(m_reloads[i], _frameNumber))
+				m_reloads[kept++] = std::move(m_reloads[i]);
+		}
+		m_reloads.resize(kept);
+	}
+
+	void logStats() const
+	{
+		if (m_reloadCount == 0)
+			return;
+		CLog(0, "Shader hot reload: {} reloads ({} failed), {} pipelines rebuilt, average latency {:.2f} ms, max {:.2f} ms.",
+			m_reloadCount, m_failedReloads, m_rebuiltPipelines, m_totalLatencyMs / m_reloadCount, m_maxLatencyMs);
+	}
+
+private:
+	struct Reload
+	{
+		std::string path;
+		uint64_t key;
+		std::chrono::steady_clock::time_point changeTime;	// last write seen by the watcher
+		double compileMs = 0.0;
+		bool compiled = false;
+		bool rolledBack = false;							// pipelines failed to build, the old module is back
+		PipelineCache::ShaderState previous;				// the module to retire once done
+		uint32_t failedPipelines = 0;
+		uint64_t rebuilt = 0;
+		// The round of builds in flight
+		std::vector<PipelineDesc> descs;
+		std::vector<PipelineCache::BuiltPipeline> pipelines;
+		std::atomic<uint32_t> remaining{ 0 };
+		std::atomic<bool> done{ false };
+	};
+
+	static double elapsedMs(std::chrono::steady_clock::time_point _start)
+	{
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - _start).count();
+	}
+	std::string fullPath(const std::string& _relativePath) const
+	{
+		return m_directory + "/" + _relativePath;
+	}
+	bool isReloading(const std::string& _path) const
+	{
+		for (const auto& it : m_reloads)
+		{
+			if (it->path == _path)
+				return true;
+		}
+		return false;
+	}
+
+	void startReload(const FileWatcher::Change& _change)
+	{
+		std::shared_ptr<Reload> reload = std::make_shared<Reload>();
+		reload->path = _change.path;
+		reload->key = m_shaders[_change.path];
+		reload->changeTime = _change.time;
+		m_reloads.push_back(reload);
+
+		m_compiler->submit([this, reload]()
+		{
+			const auto start = std::chrono::steady_clock::now();
+			std::vector<uint32_t> spirv;
+			std::string errors;
+			if (!m_shaderCompiler.compile(fullPath(reload->path), spirv, errors))
+			{
+				CLog(2, "Shader {:s} failed to compile, keeping the previous version:\n{:s}", reload->path, errors);
+				reload->done = true;
+				return;
+			}
+			reload->compileMs = elapsedMs(start);
+			reload->compiled = true;
+			reload->previous = m_cache->replaceShader(reload->key, spirv.data(), spirv.size() * sizeof(uint32_t));
+			buildStalePipelines(reload);
+		});
+	}
+
+	// Rebuilds on the workers every pipeline built from another version of the shader than the current one. Marks the
+	// reload done and returns false if there are none.
+	bool buildStalePipelines(const std::shared_ptr<Reload>& _reload)
+	{
+		_reload->descs = m_cache->getStalePipelines(_reload->key);
+		_reload->pipelines.assign(_reload->descs.size(), PipelineCache::BuiltPipeline());
+		_reload->remaining = static_cast<uint32_t>(_reload->descs.size());
+		if (_reload->descs.empty())
+		{
+			_reload->done = true;
+			return false;
+		}
+		_reload->done = false;
+		for (size_t i = 0; i < _reload->descs.size(); i++)
+		{
+			m_compiler->submit([this, _reload, i]()
+			{
+				_reload->pipelines[i] = m_cache->buildPipeline(_reload->descs[i]);
+				if (--_reload->remaining == 0)
+					_reload->done = true;
+			});
+		}
+		return true;
+	}
+
+	// Publishes a finished round of builds. If one failed the round is thrown away and the old module put back, which
+	// makes whatever an earlier round published stale again. Returns false while another round is needed.
+	bool finishReload(const std::shared_ptr<Reload>& _reload, uint64_t _frameNumber)
+	{
+		Reload& reload = *_reload;
+		if (!reload.compiled)
+		{
+			m_reloadCount++;
+			m_failedReloads++;
+			return true;
+		}
+
+		uint32_t failed = 0;
+		for (const PipelineCache::BuiltPipeline& it : reload.pipelines)
+		{
+			if (it.pipeline == VK_NULL_HANDLE)
+				failed++;
+		}
+		const bool wasRolledBack = reload.rolledBack;
+		if (failed > 0)
+		{
+			for (const PipelineCache::BuiltPipeline& it : reload.pipelines)
+			{
+				m_deletionQueue->push(it.pipeline, _frameNumber);
+			}
+			reload.failedPipelines += failed;
+			if (!reload.rolledBack)
+			{
+				m_cache->swapShader(reload.key, reload.previous);
+				reload.rolledBack = true;
+			}
+		}
+		else
+		{
+			for (size_t i = 0; i < reload.descs.size(); i++)
+			{
+				const VkPipeline retired = m_cache->replacePipeline(reload.descs[i], reload.pipelines[i]);
+				m_deletionQueue->push(retired, _frameNumber);
+				if (retired != reload.pipelines[i].pipeline)
+					reload.rebuilt++;
+			}
+		}
+		reload.pipelines.clear();
+		// Pipelines built from the old version meanwhile, or after a rollback from the new one. Failing again once rolled
+		// back leaves them be, it would fail every round.
+		if (!(failed > 0 && wasRolledBack) && buildStalePipelines(_reload))
+			return false;
+
+		m_reloadCount++;
+		m_rebuiltPipelines += reload.rebuilt;
+		m_deletionQueue->push(reload.previous.module, _frameNumber);
+		reload.previous.module = VK_NULL_HANDLE;
+		if (reload.rolledBack)
+		{
+			m_failedReloads++;
+			CLog(2, "Shader {:s} compiled but {} pipelines failed to build with it, keeping the previous version.", reload.path, reload.failedPipelines);
+			return true;
+		}
+
+		const double latencyMs = elapsedMs(reload.changeTime);
+		m_totalLatencyMs += latencyMs;
+		m_maxLatencyMs = std::max(m_maxLatencyMs, latencyMs);
+		CLog(0, "Reloaded {:s}: compiled in {:.2f} ms, {} pipelines rebuilt, live {:.2f} ms after the save.",
+			reload.path, reload.compileMs, reload.rebuilt, latencyMs);
+		return true;
+	}
+
+	PipelineCache* m_cache = nullptr;
+	PipelineCompiler* m_compiler = nullptr;
+	DeferredDeletionQueue* m_deletionQueue = nullptr;
+	std::string m_directory;
+
+	ShaderCompiler m_shaderCompiler;
+	FileWatcher m_watcher;
+	std::unordered_map<std::string, uint64_t> m_shaders;	// relative path -> pipeline cache key
+	std::vector<FileWatcher::Change> m_pendingChanges;
+	std::vector<std::shared_ptr<Reload>> m_reloads;			// in flight on the compiler workers
+
+	uint32_t m_reloadCount = 0;
+	uint32_t m_failedReloads = 0;
+	uint64_t m_rebuiltPipelines = 0;
+	double m_totalLatencyMs = 0.0;
+	double m_maxLatencyMs = 0.0;
+};
@@ -0,0 +1,341 @@
+#pragma once
+#include "Core.h"
+#include "Hash.h"
+#include "ShaderReflection.h"
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Every shader of the game in one file, built offline by ShaderPacker. Layout:
+//
+//   ShaderPackHeader
+//   SPIR-V blobs, 16 byte aligned
+//   reflection records (PackedBinding[] then PackedVertexInput[] per shader)
+//   names, '/' separated paths relative to the shader directory
+//   ShaderPackEntry[entryCount], sorted by key
+//
+// Keys are ShaderPack::makeKey() of the name, the same key ShaderLibrary gives the source file, so a pipeline
+// description doesn't care where its shaders came from. The file is memory mapped and vkCreateShaderModule reads the
+// code straight from the mapping, reflection comes from the stored records instead of parsing the SPIR-V again.
+struct ShaderPackHeader
+{
+	static constexpr uint32_t MAGIC = 0x4B415053;	// "SPAK"
+	static constexpr uint32_t VERSION = 1;
+
+	uint32_t magic;
+	uint32_t version;
+	uint32_t entryCount;
+	uint32_t reserved;
+	uint64_t indexOffset;
+	uint64_t fileSize;
+};
+
+struct ShaderPackEntry
+{
+	uint64_t key;
+	uint64_t contentHash;			// hash of the SPIR-V, lets tools skip unchanged shaders
+	uint64_t codeOffset;
+	uint64_t reflectionOffset;
+	uint32_t codeSize;				// bytes
+	uint32_t nameOffset;
+	uint32_t nameLength;
+	uint32_t stages;				// VkShaderStageFlags
+	uint32_t bindingCount;
+	uint32_t vertexInputCount;
+	uint32_t pushConstantSize;
+	uint32_t pushConstantStages;	// VkShaderStageFlags
+};
+
+struct PackedBinding
+{
+	uint32_t set;
+	uint32_t binding;
+	uint32_t type;					// VkDescriptorType
+	uint32_t count;
+	uint32_t stages;				// VkShaderStageFlags
+};
+
+struct PackedVertexInput
+{
+	uint32_t location;
+	uint32_t format;				// VkFormat
+	uint32_t size;
+};
+
+// Read only view of a pack file.
+class ShaderPack
+{
+public:
+	static uint64_t makeKey(const std::string& _name)
+	{
+		return Hasher().bytes("shader:", 7).bytes(_name.data(), _name.size()).get();
+	}
+
+	~ShaderPack()
+	{
+		close();
+	}
+
+	// Fails without logging if the file doesn't exist, a pack that exists but is malformed is reported.
+	bool open(const std::string& _path)
+	{
+		close();
+		if (!map(_path))
+			return false;
+
+		const ShaderPackHeader* header = reinterpret_cast<const ShaderPackHeader*>(m_data);
+		bool valid = m_size >= sizeof(ShaderPackHeader) && header->magic == ShaderPackHeader::MAGIC && header->version == ShaderPackHeader::VERSION &&
+			header->fileSize == m_size && header->indexOffset % alignof(ShaderPackEntry) == 0 &&
+			fits(header->indexOffset, static_cast<uint64_t>(header->entryCount) * sizeof(ShaderPackEntry));
+		if (valid)
+		{
+			m_entries = reinterpret_cast<const ShaderPackEntry*>(m_data + header->indexOffset);
+			m_entryCount = header->entryCount;
+			for (uint32_t i = 0; i < m_entryCount && valid; i++)
+			{
+				valid = isValid(m_entries[i]) && (i == 0 || m_entries[i - 1].key < m_entries[i].key);
+			}
+		}
+		if (!valid)
+		{
+			CLog(2, "Shader pack {:s} is invalid or from another version, ignoring it.", _path);
+			close();
+			return false;
+		}
+		return true;
+	}
+
+	void close()
+	{
+		if (m_data == nullptr)
+			return;
+#if defined(_WIN32)
+		UnmapViewOfFile(m_data);
+		CloseHandle(m_mapping);
+		CloseHandle(m_file);
+		m_mapping = nullptr;
+		m_file = INVALID_HANDLE_VALUE;
+#else
+		munmap(const_cast<uint8_t*>(m_data), m_size);
+#endif
+		m_data = nullptr;
+		m_size = 0;
+		m_entries = nullptr;
+		m_entryCount = 0;
+	}
+
+	bool isOpen() const { return m_data != nullptr; }
+	uint32_t getEntryCount() const { return m_entryCount; }
+	const ShaderPackEntry& getEntry(uint32_t _index) const { return m_entries[_index]; }
+	uint64_t getSize() const { return m_size; }
+
+	const ShaderPackEntry* find(uint64_t _key) const
+	{
+		const ShaderPackEntry* end = m_entries + m_entryCount;
+		const ShaderPackEntry* it = std::lower_bound(m_entries, end, _key, [](const ShaderPackEntry& _entry, uint64_t _value) { return _entry.key < _value; });
+		return it != end && it->key == _key ? it : nullptr;
+	}
+
+	// Points into the mapping, valid until close().
+	const uint32_t* getCode(const ShaderPackEntry& _entry) const
+	{
+		return reinterpret_cast<const uint32_t*>(m_data + _entry.codeOffset);
+	}
+	std::string getName(const ShaderPackEntry& _entry) const
+	{
+		return std::string(reinterpret_cast<const char*>(m_data + _entry.nameOffset), _entry.nameLength);
+	}
+
+	ShaderReflection getReflection(const ShaderPackEntry& _entry) const
+	{
+		ShaderReflection reflection;
+		reflection.stages = _entry.stages;
+		reflection.pushConstantSize = _entry.pushConstantSize;
+		reflection.pushConstantStages = _entry.pushConstantStages;
+
+		const PackedBinding* bindings = reinterpret_cast<const PackedBinding*>(m_data + _entry.reflectionOffset);
+		reflection.bindings.reserve(_entry.bindingCount);
+		for (uint32_t i = 0; i < _entry.bindingCount; i++)
+		{
+			reflection.bindings.push_back({ bindings[i].set, bindings[i].binding, (VkDescriptorType)bindings[i].type, bindings[i].count, bindings[i].stages });
+		}
+		const PackedVertexInput* inputs = reinterpret_cast<const PackedVertexInput*>(bindings + _entry.bindingCount);
+		reflection.vertexInputs.reserve(_entry.vertexInputCount);
+		for (uint32_t i = 0; i < _entry.vertexInputCount; i++)
+		{
+			reflection.vertexInputs.push_back({ inputs[i].location, (VkFormat)inputs[i].format, inputs[i].size });
+		}
+		return reflection;
+	}
+
+private:
+	// _size bytes at _offset are inside the mapping.
+	bool fits(uint64_t _offset, uint64_t _size) const
+	{
+		return _offset <= m_size && _size <= m_size - _offset;
+	}
+
+	// Everything getCode(), getName() and getReflection() read is inside the mapping and aligned.
+	bool isValid(const ShaderPackEntry& _entry) const
+	{
+		const uint64_t reflectionSize = static_cast<uint64_t>(_entry.bindingCount) * sizeof(PackedBinding) + static_cast<uint64_t>(_entry.vertexInputCount) * sizeof(PackedVertexInput);
+		return _entry.codeSize > 0 && _entry.codeSize % sizeof(uint32_t) == 0 && _entry.codeOffset % sizeof(uint32_t) == 0 && fits(_entry.codeOffset, _entry.codeSize) &&
+			fits(_entry.nameOffset, _entry.nameLength) &&
+			_entry.reflectionOffset % sizeof(uint32_t) == 0 && fits(_entry.reflectionOffset, reflectionSize);
+	}
+
+	bool map(const std::string& _path)
+	{
+#if defined(_WIN32)
+		m_file = CreateFileA(_path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (m_file == INVALID_HANDLE_VALUE)
+			return false;
+		LARGE_INTEGER size;
+		GetFileSizeEx(m_file, &size);
+		m_mapping = size.QuadPart > 0 ? CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+		const void* view = m_mapping != nullptr ? MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+		if (view == nullptr)
+		{
+			if (m_mapping != nullptr)
+				CloseHandle(m_mapping);
+			CloseHandle(m_file);
+			m_mapping = nullptr;
+			m_file = INVALID_HANDLE_VALUE;
+			return false;
+		}
+		m_data = static_cast<const uint8_t*>(view);
+		m_size = static_cast<uint64_t>(size.QuadPart);
+#else
+		const int file = ::open(_path.c_str(), O_RDONLY);
+		if (file < 0)
+			return false;
+		struct stat info;
+		void* view = fstat(file, &info) == 0 && info.st_size > 0 ? mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, file, 0) : MAP_FAILED;
+		::close(file);
+		if (view == MAP_FAILED)
+			return false;
+		m_data = static_cast<const uint8_t*>(view);
+		m_size = static_cast<uint64_t>(info.st_size);
+#endif
+		return true;
+	}
+
+#if defined(_WIN32)
+	HANDLE m_file = INVALID_HANDLE_VALUE;
+	HANDLE m_mapping = nullptr;
+#endif
+	const uint8_t* m_data = nullptr;
+	uint64_t m_size = 0;
+	const ShaderPackEntry* m_entries = nullptr;
+	uint32_t m_entryCount = 0;
+};
+
+// Builds a pack, used by ShaderPacker.
+class ShaderPackWriter
+{
+public:
+	void add(const std::string& _name, const std::vector<uint32_t>& _spirv, const ShaderReflection& _reflection)
+	{
+		m_shaders.push_back({ _name, _spirv, _reflection });
+	}
+
+	bool write(const std::string& _path, std::string& _error) const
+	{
+		std::vector<uint8_t> file(sizeof(ShaderPackHeader));
+		std::vector<ShaderPackEntry> entries;
+		entries.reserve(m_shaders.size());
+
+		for (const auto& it : m_shaders)
+		{
+			ShaderPackEntry entry = {};
+			entry.key = ShaderPack::makeKey(it.name);
+			entry.codeSize = static_cast<uint32_t>(it.spirv.size() * sizeof(uint32_t));
+			entry.contentHash = hashBytes(it.spirv.data(), entry.codeSize);
+			entry.stages = it.reflection.stages;
+			entry.pushConstantSize = it.reflection.pushConstantSize;
+			entry.pushConstantStages = it.reflection.pushConstantStages;
+			entry.bindingCount = static_cast<uint32_t>(it.reflection.bindings.size());
+			entry.vertexInputCount = static_cast<uint32_t>(it.reflection.vertexInputs.size());
+
+			entry.codeOffset = append(file, it.spirv.data(), entry.codeSize, 16);
+			entry.reflectionOffset = file.size();
+			for (const auto& binding : it.reflection.bindings)
+			{
+				const PackedBinding packed = { binding.set, binding.binding, (uint32_t)binding.type, binding.count, binding.stages };
+				append(file, &packed, sizeof(packed), 4);
+			}
+			for (const auto& input : it.reflection.vertexInputs)
+			{
+				const PackedVertexInput packed = { input.location, (uint32_t)input.format, input.size };
+				append(file, &packed, sizeof(packed), 4);
+			}
+			entry.nameOffset = static_cast<uint32_t>(append(file, it.name.data(), it.name.size(), 1));
+			entry.nameLength = static_cast<uint32_t>(it.name.size());
+			entries.push_back(entry);
+		}
+
+		std::sort(entries.begin(), entries.end(), [](const ShaderPackEntry& _a, const ShaderPackEntry& _b) { return _a.key < _b.key; });
+		for (size_t i = 1; i < entries.size(); i++)
+		{
+			if (entries[i].key == entries[i - 1].key)
+			{
+				_error = "Two shaders hash to the same key, rename one of them";
+				return false;
+			}
+		}
+
+		ShaderPackHeader header = {};
+		header.magic = ShaderPackHeader::MAGIC;
+		header.version = ShaderPackHeader::VERSION;
+		header.entryCount = static_cast<uint32_t>(entries.size());
+		header.indexOffset = append(file, entries.data(), entries.size() * sizeof(ShaderPackEntry), 8);
+		header.fileSize = file.size();
+		memcpy(file.data(), &header, sizeof(header));
+
+		std::ofstream out(_path, std::ios::binary | std::ios::trunc);
+		out.write(reinterpret_cast<const char*>(file.data()), file.size());
+		if (!out)
+		{
+			_error = "Can't write " + _path;
+			return false;
+		}
+		return true;
+	}
+
+	size_t getShaderCount() const { return m_shaders.size(); }
+
+private:
+	struct Shader
+	{
+		std::string name;
+		std::vector<uint32_t> spirv;
+		ShaderReflection reflection;
+	};
+
+	static uint64_t append(std::vector<uint8_t>& _file, const void* _data, size_t _size, size_t _alignment)
+	{
+		const size_t offset = (_file.size() + _alignment - 1) & ~(_alignment - 1);
+		_file.resize(offset + _size);
+		if (_size > 0)
+			memcpy(_file.data() + offset, _data, _size);
+		return offset;
+	}
+
+	std::vector<Shader> m_shaders;
+};
@@ -0,0 +1,105 @@
+#pragma once
+#include "Core.h"
+#include "PipelineDesc.h"
+#include "PipelineCache.h"
+#include "PipelineCompiler.h"
+
+#include <type_traits>
+#include <cstdint>
+
+// Compile time key for one permutation of a shader. Features is an enum class listing the shader's feature switches
+// in specialization constant id order and ending with Count, e.g.
+//
+//   enum class ForwardFeature : uint32_t { AlphaTest, NormalMap, Skinning, Count };
+//   // layout(constant_id = 0) const bool ALPHA_TEST = false; ... in the shader
+//   constexpr auto key = makePermutation<ForwardFeature::AlphaTest, ForwardFeature::Skinning>();
+//
+// Keys of different shaders are different types, so a key can't be used with the wrong shader.
+template<typename Features>
+class PermutationKey
+{
+	static_assert(std::is_enum<Features>::value, "Permutation features must be an enum");
+	static_assert(static_cast<uint32_t>(Features::Count) <= 32, "A shader can have at most 32 permutation features");
+
+public:
+	static constexpr uint32_t FEATURE_COUNT = static_cast<uint32_t>(Features::Count);
+
+	constexpr PermutationKey() = default;
+
+	template<typename... Enabled>
+	static constexpr PermutationKey of(Enabled... _features)
+	{
+		PermutationKey key;
+		((key = key.with(_features)), ...);
+		return key;
+	}
+
+	constexpr PermutationKey with(Features _feature, bool _enabled = true) const
+	{
+		const uint32_t bit = 1u << static_cast<uint32_t>(_feature);
+		return PermutationKey(_enabled ? (m_bits | bit) : (m_bits & ~bit));
+	}
+	constexpr bool has(Features _feature) const { return (m_bits >> static_cast<uint32_t>(_feature)) & 1u; }
+	constexpr uint32_t getBits() const { return m_bits; }
+
+	constexpr bool operator==(PermutationKey _other) const { return m_bits == _other.m_bits; }
+	constexpr bool operator!=(PermutationKey _other) const { return m_bits != _other.m_bits; }
+
+private:
+	explicit constexpr PermutationKey(uint32_t _bits) : m_bits(_bits) {}
+
+	uint32_t m_bits = 0;
+};
+
+template<auto First, auto... Rest>
+constexpr PermutationKey<decltype(First)> makePermutation()
+{
+	return PermutationKey<decltype(First)>::of(First, Rest...);
+}
+
+// The permutations of one pipeline. Each key maps to the base description with its feature bits as specialization
+// constants, so permutations are pipelines like any other: built on first request, cached and shared by everyone
+// asking for the same key. Nothing is compiled for combinations that are never requested.
+template<typename Features>
+class ShaderPermutations
+{
+public:
+	using Key = PermutationKey<Features>;
+
+	ShaderPermutations() = default;
+	explicit ShaderPermutations(const PipelineDesc& _base)
+	{
+		setBase(_base);
+	}
+
+	void setBase(const PipelineDesc& _base)
+	{
+		m_base = _base;
+		m_base.specializationBits = 0;
+		m_base.specializationCount = Key::FEATURE_COUNT;
+	}
+
+	PipelineDesc getDesc(Key _key) const
+	{
+		PipelineDesc desc = m_base;
+		desc.specializationBits = _key.getBits();
+		return desc;
+	}
+
+	// Blocking, builds the permutation on the calling thread if needed.
+	VkPipeline get(PipelineCache& _cache, Key _key) const
+	{
+		return _cache.getPipeline(getDesc(_key));
+	}
+
+	// Non blocking, queues the permutation on the compiler workers and returns _fallback until it's ready.
+	VkPipeline request(PipelineCompiler& _compiler, Key _key, VkPipeline _fallback = VK_NULL_HANDLE) const
+	{
+		return _compiler.requestOrFallback(getDesc(_key), _fallback);
+	}
+
+	const PipelineDesc& getBase() const { return m_base; }
+
+private:
+	PipelineDesc m_base;
+};
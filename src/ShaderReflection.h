@@ -0,0 +1,475 @@
+#pragma once
+#include "Core.h"
+#include <vulkan/vulkan.h>
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdint>
+
+struct ReflectedBinding
+{
+	uint32_t set;
+	uint32_t binding;
+	VkDescriptorType type;
+	uint32_t count;					// 0 for runtime sized arrays
+	VkShaderStageFlags stages;
+};
+
+struct ReflectedVertexInput
+{
+	uint32_t location;
+	VkFormat format;
+	uint32_t size;
+};
+
+// What a SPIR-V module (or several merged stages) needs from its pipeline layout and vertex input.
+struct ShaderReflection
+{
+	VkShaderStageFlags stages = 0;
+	std::vector<ReflectedBinding> bindings;			// sorted by set then binding
+	uint32_t pushConstantSize = 0;
+	VkShaderStageFlags pushConstantStages = 0;
+	std::vector<ReflectedVertexInput> vertexInputs;	// vertex stage only, sorted by location
+
+	uint32_t getSetCount() const { return bindings.empty() ? 0 : bindings.back().set + 1; }
+
+	// Combines the interfaces of several stages. False if the same set/binding has a different type in two stages,
+	// the merged interface is incomplete then.
+	bool merge(const ShaderReflection& _other)
+	{
+		stages |= _other.stages;
+		for (const auto& it : _other.bindings)
+		{
+			auto existing = std::find_if(bindings.begin(), bindings.end(), [&it](const ReflectedBinding& _b) { return _b.set == it.set && _b.binding == it.binding; });
+			if (existing == bindings.end())
+			{
+				bindings.push_back(it);
+				continue;
+			}
+			if (existing->type != it.type)
+			{
+				CLog(2, "Shader reflection: stages disagree on the type of set {} binding {}.", it.set, it.binding);
+				return false;
+			}
+			existing->stages |= it.stages;
+			existing->count = std::max(existing->count, it.count);
+		}
+		std::sort(bindings.begin(), bindings.end(), [](const ReflectedBinding& _a, const ReflectedBinding& _b)
+		{
+			return _a.set != _b.set ? _a.set < _b.set : _a.binding < _b.binding;
+		});
+
+		pushConstantSize = std::max(pushConstantSize, _other.pushConstantSize);
+		pushConstantStages |= _other.pushConstantStages;
+		if (!_other.vertexInputs.empty())
+			vertexInputs = _other.vertexInputs;
+		return true;
+	}
+};
+
+// Minimal SPIR-V parser: walks the instruction stream once, keeping the decorations, types and variables that describe
+// the shader's interface. Only what layout and vertex input generation needs is understood, everything else is skipped.
+// An interface it can't describe (a descriptor type it doesn't know, a 64 bit vertex input...) or a malformed module is
+// logged and reflect() fails, the caller then has to set up the layout and vertex input itself. Every id and operand
+// is checked before it is used, and types have to be defined once and before use as SPIR-V requires, so the type graph
+// it follows has no cycles.
+class SpirvReflector
+{
+public:
+	static bool reflect(const uint32_t* _code, size_t _codeSize, ShaderReflection& _reflection)
+	{
+		SpirvReflector reflector;
+		_reflection = ShaderReflection();
+		return reflector.parse(_code, _codeSize / sizeof(uint32_t)) && reflector.build(_reflection);
+	}
+
+private:
+	// Opcodes
+	enum : uint32_t
+	{
+		OpEntryPoint = 15, OpTypeBool = 20, OpTypeInt = 21, OpTypeFloat = 22, OpTypeVector = 23, OpTypeMatrix = 24,
+		OpTypeImage = 25, OpTypeSampler = 26, OpTypeSampledImage = 27, OpTypeArray = 28, OpTypeRuntimeArray = 29,
+		OpTypeStruct = 30, OpTypePointer = 32, OpConstant = 43, OpSpecConstant = 50, OpVariable = 59,
+		OpDecorate = 71, OpMemberDecorate = 72
+	};
+	// Decorations
+	enum : uint32_t
+	{
+		DecorationBlock = 2, DecorationBufferBlock = 3, DecorationArrayStride = 6, DecorationMatrixStride = 7,
+		DecorationBuiltIn = 11, DecorationLocation = 30, DecorationBinding = 33, DecorationDescriptorSet = 34, DecorationOffset = 35
+	};
+	// Storage classes
+	enum : uint32_t
+	{
+		StorageUniformConstant = 0, StorageInput = 1, StorageUniform = 2, StoragePushConstant = 9, StorageStorageBuffer = 12
+	};
+	static constexpr uint32_t SPIRV_MAGIC = 0x07230203;
+	static constexpr uint32_t MAX_ID_BOUND = 0x3fffff;		// SPIR-V's universal limit
+	static constexpr uint32_t MAX_STRUCT_MEMBERS = 16383;
+	static constexpr uint32_t UNSET = UINT32_MAX;
+
+	struct Id
+	{
+		uint32_t opcode = 0;
+		// Type operands, meaning depends on opcode
+		uint32_t elementType = 0;	// vector/matrix/array/pointer element, image sampled type
+		uint32_t elementCount = 0;	// vector/matrix size, array length id, int/float width
+		uint32_t extra = 0;			// int signedness, image dim, pointer/variable storage class
+		uint32_t imageSampled = 0;
+		std::vector<uint32_t> members;
+		uint64_t constant = 0;
+		// Decorations
+		uint32_t set = UNSET, binding = UNSET, location = UNSET;
+		uint32_t arrayStride = 0;
+		bool block = false, bufferBlock = false, builtIn = false;
+		std::vector<uint32_t> memberOffsets;
+		std::vector<uint32_t> memberMatrixStrides;
+	};
+
+	bool parse(const uint32_t* _words, size_t _wordCount)
+	{
+		if (_wordCount < 5 || _words[0] != SPIRV_MAGIC)
+		{
+			CLog(2, "Shader reflection: not a SPIR-V module.");
+			return false;
+		}
+		if (_words[3] > MAX_ID_BOUND)
+		{
+			CLog(2, "Shader reflection: id bound {} exceeds the SPIR-V limit.", _words[3]);
+			return false;
+		}
+		m_ids.resize(_words[3]);
+
+		size_t offset = 5;
+		while (offset < _wordCount)
+		{
+			const uint32_t wordCount = _words[offset] >> 16;
+			const uint32_t opcode = _words[offset] & 0xffff;
+			if (wordCount == 0 || offset + wordCount > _wordCount)
+			{
+				CLog(2, "Shader reflection: malformed SPIR-V instruction at word {}.", offset);
+				return false;
+			}
+			const uint32_t* op = _words + offset + 1;
+			const uint32_t operands = wordCount - 1;
+
+			bool valid = true;
+			switch (opcode)
+			{
+			case OpEntryPoint:
+				valid = operands >= 1;
+				if (valid)
+					m_stage |= executionModelStage(op[0]);
+				break;
+			case OpDecorate:
+				valid = operands >= 2 && isId(op[0]);
+				if (valid)
+					decorate(m_ids[op[0]], op[1], operands > 2 ? op[2] : 0);
+				break;
+			case OpMemberDecorate:
+				valid = operands >= 3 && isId(op[0]) && op[1] < MAX_STRUCT_MEMBERS;
+				if (valid)
+					memberDecorate(m_ids[op[0]], op[1], op[2], operands > 3 ? op[3] : 0);
+				break;
+			case OpTypeBool:
+			case OpTypeSampler:
+				valid = operands >= 1 && define(op[0], opcode, 0, 0, 0);
+				break;
+			case OpTypeInt:
+				valid = operands >= 3 && define(op[0], opcode, 0, op[1], op[2]);
+				break;
+			case OpTypeFloat:
+				valid = operands >= 2 && define(op[0], opcode, 0, op[1], 0);
+				break;
+			case OpTypeVector:
+			case OpTypeMatrix:
+				valid = operands >= 3 && isDefined(op[1]) && define(op[0], opcode, op[1], op[2], 0);
+				break;
+			case OpTypeImage:
+				valid = operands >= 7 && isDefined(op[1]) && define(op[0], opcode, op[1], 0, op[2]);
+				if (valid)
+					m_ids[op[0]].imageSampled = op[6];
+				break;
+			case OpTypeSampledImage:
+			case OpTypeRuntimeArray:
+				valid = operands >= 2 && isDefined(op[1]) && define(op[0], opcode, op[1], 0, 0);
+				break;
+			case OpTypeArray:
+				valid = operands >= 3 && isDefined(op[1]) && isConstant(op[2]) && define(op[0], opcode, op[1], op[2], 0);
+				break;
+			case OpTypeStruct:
+				valid = operands >= 1 && std::all_of(op + 1, op + operands, [this](uint32_t _member) { return isDefined(_member); }) && define(op[0], opcode, 0, 0, 0);
+				if (valid)
+					m_ids[op[0]].members.assign(op + 1, op + operands);
+				break;
+			case OpTypePointer:
+				// The pointee may be forward declared, pointers aren't followed when sizing types
+				valid = operands >= 3 && isId(op[2]) && define(op[0], opcode, op[2], 0, op[1]);
+				break;
+			case OpConstant:
+			case OpSpecConstant:
+				valid = operands >= 3 && isDefined(op[0]) && define(op[1], opcode, 0, 0, 0);
+				if (valid)
+					m_ids[op[1]].constant = operands > 3 ? (uint64_t)op[2] | ((uint64_t)op[3] << 32) : op[2];
+				break;
+			case OpVariable:
+				valid = operands >= 3 && isDefined(op[0]) && define(op[1], opcode, op[0], 0, op[2]);
+				if (valid)
+					m_variables.push_back(op[1]);
+				break;
+			}
+			if (!valid)
+			{
+				CLog(2, "Shader reflection: malformed SPIR-V instruction (opcode {}) at word {}.", opcode, offset);
+				return false;
+			}
+			offset += wordCount;
+		}
+		return true;
+	}
+
+	bool isId(uint32_t _id) const { return _id != 0 && _id < m_ids.size(); }
+	bool isDefined(uint32_t _id) const { return isId(_id) && m_ids[_id].opcode != 0; }
+	bool isConstant(uint32_t _id) const { return isDefined(_id) && (m_ids[_id].opcode == OpConstant || m_ids[_id].opcode == OpSpecConstant); }
+
+	// False if _id is out of range or already defined.
+	bool define(uint32_t _id, uint32_t _opcode, uint32_t _elementType, uint32_t _elementCount, uint32_t _extra)
+	{
+		if (isDefined(_id) || !isId(_id))
+			return false;
+		Id& id = m_ids[_id];
+		id.opcode = _opcode;
+		id.elementType = _elementType;
+		id.elementCount = _elementCount;
+		id.extra = _extra;
+		return true;
+	}
+
+	static void decorate(Id& _id, uint32_t _decoration, uint32_t _value)
+	{
+		switch (_decoration)
+		{
+		case DecorationBlock:			_id.block = true; break;
+		case DecorationBufferBlock:		_id.bufferBlock = true; break;
+		case DecorationArrayStride:		_id.arrayStride = _value; break;
+		case DecorationBuiltIn:			_id.builtIn = true; break;
+		case DecorationLocation:		_id.location = _value; break;
+		case DecorationBinding:			_id.binding = _value; break;
+		case DecorationDescriptorSet:	_id.set = _value; break;
+		}
+	}
+
+	static void memberDecorate(Id& _id, uint32_t _member, uint32_t _decoration, uint32_t _value)
+	{
+		if (_decoration == DecorationOffset)
+		{
+			_id.memberOffsets.resize(std::max<size_t>(_id.memberOffsets.size(), _member + 1), 0);
+			_id.memberOffsets[_member] = _value;
+		}
+		else if (_decoration == DecorationMatrixStride)
+		{
+			_id.memberMatrixStrides.resize(std::max<size_t>(_id.memberMatrixStrides.size(), _member + 1), 0);
+			_id.memberMatrixStrides[_member] = _value;
+		}
+		else if (_decoration == DecorationBuiltIn)
+		{
+			_id.builtIn = true;		// builtin blocks (gl_PerVertex) carry it on their members
+		}
+	}
+
+	static VkShaderStageFlags executionModelStage(uint32_t _model)
+	{
+		switch (_model)
+		{
+		case 0: return VK_SHADER_STAGE_VERTEX_BIT;
+		case 1: return VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT;
+		case 2: return VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT;
+		case 3: return VK_SHADER_STAGE_GEOMETRY_BIT;
+		case 4: return VK_SHADER_STAGE_FRAGMENT_BIT;
+		case 5: return VK_SHADER_STAGE_COMPUTE_BIT;
+		default: return 0;
+		}
+	}
+
+	bool build(ShaderReflection& _result)
+	{
+		ShaderReflection& result = _result;
+		result.stages = m_stage;
+
+		for (uint32_t variableId : m_variables)
+		{
+			const Id& variable = m_ids[variableId];
+			const uint32_t storage = variable.extra;
+			const Id& pointer = m_ids[variable.elementType];
+			if (pointer.opcode != OpTypePointer)
+			{
+				CLog(2, "Shader reflection: variable {} doesn't have a pointer type.", variableId);
+				return false;
+			}
+
+			if (storage == StoragePushConstant)
+			{
+				result.pushConstantSize = std::max(result.pushConstantSize, sizeOf(pointer.elementType, 0));
+				result.pushConstantStages = m_stage;
+			}
+			else if (storage == StorageInput && (m_stage & VK_SHADER_STAGE_VERTEX_BIT) && variable.location != UNSET && !variable.builtIn)
+			{
+				if (!addVertexInput(variable.location, pointer.elementType, result.vertexInputs))
+					return false;
+			}
+			else if ((storage == StorageUniformConstant || storage == StorageUniform || storage == StorageStorageBuffer) && variable.binding != UNSET)
+			{
+				ReflectedBinding binding;
+				binding.set = variable.set == UNSET ? 0 : variable.set;
+				binding.binding = variable.binding;
+				binding.count = 1;
+				binding.stages = m_stage;
+
+				uint32_t typeId = pointer.elementType;
+				if (m_ids[typeId].opcode == OpTypeArray)
+				{
+					binding.count = static_cast<uint32_t>(m_ids[m_ids[typeId].elementCount].constant);
+					typeId = m_ids[typeId].elementType;
+				}
+				else if (m_ids[typeId].opcode == OpTypeRuntimeArray)
+				{
+					binding.count = 0;
+					typeId = m_ids[typeId].elementType;
+				}
+				binding.type = descriptorType(storage, typeId);
+				if (binding.type == VK_DESCRIPTOR_TYPE_MAX_ENUM)
+				{
+					CLog(2, "Shader reflection: set {} binding {} has a descriptor type reflection doesn't know (opcode {}).", binding.set, binding.binding, m_ids[typeId].opcode);
+					return false;
+				}
+				result.bindings.push_back(binding);
+			}
+		}
+
+		std::sort(result.bindings.begin(), result.bindings.end(), [](const ReflectedBinding& _a, const ReflectedBinding& _b)
+		{
+			return _a.set != _b.set ? _a.set < _b.set : _a.binding < _b.binding;
+		});
+		std::sort(result.vertexInputs.begin(), result.vertexInputs.end(), [](const ReflectedVertexInput& _a, const ReflectedVertexInput& _b)
+		{
+			return _a.location < _b.location;
+		});
+		return true;
+	}
+
+	// VK_DESCRIPTOR_TYPE_MAX_ENUM for types not handled here.
+	VkDescriptorType descriptorType(uint32_t _storage, uint32_t _typeId) const
+	{
+		const Id& type = m_ids[_typeId];
+		if (_storage == StorageStorageBuffer)
+			return VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		if (_storage == StorageUniform)
+			return type.bufferBlock ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+
+		switch (type.opcode)
+		{
+		case OpTypeSampler:			return VK_DESCRIPTOR_TYPE_SAMPLER;
+		case OpTypeSampledImage:	return VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		case OpTypeImage:
+		{
+			const uint32_t dim = type.extra;
+			if (dim == 6)	// SubpassData
+				return VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+			if (dim == 5)	// Buffer
+				return type.imageSampled == 2 ? VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER;
+			return type.imageSampled == 2 ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE : VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+		}
+		default:
+			return VK_DESCRIPTOR_TYPE_MAX_ENUM;
+		}
+	}
+
+	// Byte size of a type laid out with explicit offsets/strides, as push constant and buffer blocks are.
+	uint32_t sizeOf(uint32_t _typeId, uint32_t _matrixStride) const
+	{
+		const Id& type = m_ids[_typeId];
+		switch (type.opcode)
+		{
+		case OpTypeBool:	return 4;
+		case OpTypeInt:
+		case OpTypeFloat:	return type.elementCount / 8;
+		case OpTypeVector:	return type.elementCount * sizeOf(type.elementType, 0);
+		case OpTypeMatrix:	return type.elementCount * (_matrixStride != 0 ? _matrixStride : sizeOf(type.elementType, 0));
+		case OpTypeArray:
+		{
+			const uint32_t stride = type.arrayStride != 0 ? type.arrayStride : sizeOf(type.elementType, _matrixStride);
+			return static_cast<uint32_t>(m_ids[type.elementCount].constant) * stride;
+		}
+		case OpTypeStruct:
+		{
+			uint32_t size = 0;
+			for (uint32_t i = 0; i < type.members.size(); i++)
+			{
+				const uint32_t offset = i < type.memberOffsets.size() ? type.memberOffsets[i] : size;
+				const uint32_t matrixStride = i < type.memberMatrixStrides.size() ? type.memberMatrixStrides[i] : 0;
+				size = std::max(size, offset + sizeOf(type.members[i], matrixStride));
+			}
+			return size;
+		}
+		default:			return 0;
+		}
+	}
+
+	// Appends the inputs of one vertex shader input variable, a matrix takes a location per column. 16 and 32 bit
+	// scalars and vectors have formats, anything else (64 bit, bool, arrays) fails.
+	bool addVertexInput(uint32_t _location, uint32_t _typeId, std::vector<ReflectedVertexInput>& _inputs) const
+	{
+		const Id& type = m_ids[_typeId];
+		if (type.opcode == OpTypeMatrix)
+		{
+			if (type.elementCount < 2 || type.elementCount > 4)
+			{
+				CLog(2, "Shader reflection: vertex input at location {} is a matrix of {} columns.", _location, type.elementCount);
+				return false;
+			}
+			for (uint32_t column = 0; column < type.elementCount; column++)
+			{
+				if (!addVertexInput(_location + column, type.elementType, _inputs))
+					return false;
+			}
+			return true;
+		}
+
+		const uint32_t componentCount = type.opcode == OpTypeVector ? type.elementCount : 1;
+		const Id& component = type.opcode == OpTypeVector ? m_ids[type.elementType] : type;
+		const uint32_t width = component.elementCount;
+		if ((component.opcode != OpTypeFloat && component.opcode != OpTypeInt) || (width != 16 && width != 32) || componentCount < 1 || componentCount > 4)
+		{
+			CLog(2, "Shader reflection: vertex input at location {} has a type without a vertex format (opcode {}, {} bits).", _location, component.opcode, width);
+			return false;
+		}
+
+		// [16 bit][float, sint, uint][components - 1]
+		static const VkFormat formats[2][3][4] =
+		{
+			{
+				{ VK_FORMAT_R32_SFLOAT, VK_FORMAT_R32G32_SFLOAT, VK_FORMAT_R32G32B32_SFLOAT, VK_FORMAT_R32G32B32A32_SFLOAT },
+				{ VK_FORMAT_R32_SINT, VK_FORMAT_R32G32_SINT, VK_FORMAT_R32G32B32_SINT, VK_FORMAT_R32G32B32A32_SINT },
+				{ VK_FORMAT_R32_UINT, VK_FORMAT_R32G32_UINT, VK_FORMAT_R32G32B32_UINT, VK_FORMAT_R32G32B32A32_UINT }
+			},
+			{
+				{ VK_FORMAT_R16_SFLOAT, VK_FORMAT_R16G16_SFLOAT, VK_FORMAT_R16G16B16_SFLOAT, VK_FORMAT_R16G16B16A16_SFLOAT },
+				{ VK_FORMAT_R16_SINT, VK_FORMAT_R16G16_SINT, VK_FORMAT_R16G16B16_SINT, VK_FORMAT_R16G16B16A16_SINT },
+				{ VK_FORMAT_R16_UINT, VK_FORMAT_R16G16_UINT, VK_FORMAT_R16G16B16_UINT, VK_FORMAT_R16G16B16A16_UINT }
+			}
+		};
+		const uint32_t kind = component.opcode == OpTypeFloat ? 0 : (component.extra != 0 ? 1 : 2);
+
+		ReflectedVertexInput input;
+		input.location = _location;
+		input.format = formats[width == 16 ? 1 : 0][kind][componentCount - 1];
+		input.size = componentCount * width / 8;
+		_inputs.push_back(input);
+		return true;
+	}
+
+	std::vector<Id> m_ids;
+	std::vector<uint32_t> m_variables;
+	VkShaderStageFlags m_stage = 0;
+};
@@ -0,0 +1,288 @@
+#pragma once
+#include "Core.h"
+#include "DeferredDeletionQueue.h"
+#include "GpuMemory.h"
+#include "GpuMemoryReport.h"
+#include <vulkan/vulkan.h>
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+
+// Intermediate render targets (depth, G-buffer, post scratch) only live for a few passes of the frame.
+// Attachments are declared up front with the first and last pass that touches them, then build() places them
+// into shared VkDeviceMemory so that attachments whose lifetimes don't overlap alias the same range.
+// Aliased images have undefined contents on first use, every pass must transition them from VK_IMAGE_LAYOUT_UNDEFINED.
+struct TransientAttachmentDesc
+{
+	const char* name;
+	VkFormat format;
+	VkExtent2D extent;
+	VkImageUsageFlags usage;
+	VkImageAspectFlags aspect;
+	uint32_t firstPass;	// inclusive
+	uint32_t lastPass;	// inclusive
+};
+
+struct TransientAttachmentStats
+{
+	uint32_t attachmentCount = 0;
+	uint32_t lazilyAllocatedCount = 0;	// attachments that never need physical backing on tile based GPUs
+	VkDeviceSize unaliasedBytes = 0;	// peak if every attachment had its own memory
+	VkDeviceSize aliasedBytes = 0;		// actual committed size of the shared heaps
+};
+
+class TransientAttachmentAllocator
+{
+public:
+	typedef uint32_t Handle;
+
+	Handle declare(const TransientAttachmentDesc& _desc)
+	{
+		CVerifyCrash(!m_isBuilt, "TransientAttachments: declare({:s}) called after build()!", _desc.name);
+		CVerifyCrash(_desc.firstPass <= _desc.lastPass, "TransientAttachments: {:s} has an inverted lifetime!", _desc.name);
+
+		Attachment attachment = {};
+		attachment.desc = _desc;
+		m_attachments.push_back(attachment);
+		return static_cast<Handle>(m_attachments.size() - 1);
+	}
+
+	void build(VkDevice _device, VkPhysicalDevice _physicalDevice)
+	{
+		m_device = _device;
+		vkGetPhysicalDeviceMemoryProperties(_physicalDevice, &m_memoryProperties);
+
+		m_stats = {};
+		m_stats.attachmentCount = static_cast<uint32_t>(m_attachments.size());
+
+		for (auto& it : m_attachments)
+		{
+			createImage(it);
+		}
+
+		// Place biggest first, it keeps the first fit placement below tight.
+		std::vector<uint32_t> order(m_attachments.size());
+		for (uint32_t i = 0; i < order.size(); i++)
+		{
+			order[i] = i;
+		}
+		std::sort(order.begin(), order.end(), [this](uint32_t _a, uint32_t _b)
+		{
+			return m_attachments[_a].requirements.size > m_attachments[_b].requirements.size;
+		});
+
+		for (uint32_t index : order)
+		{
+			placeAttachment(index);
+		}
+
+		for (auto& heap : m_heaps)
+		{
+			VkMemoryAllocateInfo allocInfo = {};
+			allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+			allocInfo.allocationSize = heap.size;
+			allocInfo.memoryTypeIndex = heap.memoryTypeIndex;
+
+			VkResult result = vkAllocateMemory(m_device, &allocInfo, nullptr, &heap.memory);
+			CVerifyCrash(result == VK_SUCCESS, "TransientAttachments: failed to allocate {} bytes from memory type {}. Result: {}", heap.size, heap.memoryTypeIndex, result);
+			m_stats.aliasedBytes += heap.size;
+			GpuMemoryRegistry::instance().registerBlock(heap.memory, heap.size, heap.memoryTypeIndex, m_memoryProperties, MemoryCategory::RenderTarget, "TransientAttachmentHeap");
+		}
+
+		for (auto& it : m_attachments)
+		{
+			const Heap& heap = m_heaps[it.heapIndex];
+			VkResult result = vkBindImageMemory(m_device, it.image, heap.memory, it.offset);
+			CVerifyCrash(result == VK_SUCCESS, "TransientAttachments: failed to bind {:s}. Result: {}", it.desc.name, result);
+			GpuMemoryRegistry::instance().registerSubAllocation(heap.memory, it.offset, it.requirements.size, MemoryCategory::RenderTarget, it.desc.name);
+			createImageView(it);
+		}
+
+		m_isBuilt = true;
+		CLog(0, "Render targets: {} attachments ({} lazily allocated), peak {:.2f} MiB unaliased, {:.2f} MiB aliased.",
+			m_stats.attachmentCount, m_stats.lazilyAllocatedCount,
+			m_stats.unaliasedBytes / (1024.0 * 1024.0), m_stats.aliasedBytes / (1024.0 * 1024.0));
+	}
+
+	void destroy()
+	{
+		for (auto& it : m_attachments)
+		{
+			vkDestroyImageView(m_device, it.view, nullptr);
+			vkDestroyImage(m_device, it.image, nullptr);
+		}
+		for (auto& heap : m_heaps)
+		{
+			GpuMemoryRegistry::instance().unregisterBlock(heap.memory);
+			vkFreeMemory(m_device, heap.memory, nullptr);
+		}
+		m_attachments.clear();
+		m_heaps.clear();
+		m_isBuilt = false;
+	}
+
+	// Same as destroy() but hands everything to the deletion queue, for rebuilding targets while frames are in flight.
+	void retire(DeferredDeletionQueue& _deletionQueue, uint64_t _retireValue)
+	{
+		for (auto& it : m_attachments)
+		{
+			_deletionQueue.push(it.view, _retireValue);
+			_deletionQueue.push(it.image, _retireValue);
+		}
+		for (auto& heap : m_heaps)
+		{
+			_deletionQueue.push(heap.memory, _retireValue);
+		}
+		m_attachments.clear();
+		m_heaps.clear();
+		m_isBuilt = false;
+	}
+
+	VkImage getImage(Handle _handle) const { return m_attachments[_handle].image; }
+	VkImageView getImageView(Handle _handle) const { return m_attachments[_handle].view; }
+	const TransientAttachmentDesc& getDesc(Handle _handle) const { return m_attachments[_handle].desc; }
+	const TransientAttachmentStats& getStats() const { return m_stats; }
+
+	// Where the attachment lives, attachments with overlapping ranges in the same memory alias each other.
+	VkDeviceMemory getMemory(Handle _handle) const { return m_heaps[m_attachments[_handle].heapIndex].memory; }
+	VkDeviceSize getMemoryOffset(Handle _handle) const { return m_attachments[_handle].offset; }
+	VkDeviceSize getMemorySize(Handle _handle) const { return m_attachments[_handle].requirements.size; }
+
+private:
+	static constexpr VkDeviceSize UNPLACED = ~0ull;
+
+	struct Attachment
+	{
+		TransientAttachmentDesc desc;
+		VkImage image = VK_NULL_HANDLE;
+		VkImageView view = VK_NULL_HANDLE;
+		VkMemoryRequirements requirements;
+		uint32_t memoryTypeIndex;
+		uint32_t heapIndex;
+		VkDeviceSize offset = UNPLACED;
+	};
+	// One shared allocation per memory type, attachments are placed at offsets inside it.
+	struct Heap
+	{
+		uint32_t memoryTypeIndex;
+		VkDeviceSize size = 0;
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+	};
+
+	// Attachments that are only ever read as attachments within a render pass can live entirely in tile memory.
+	static bool isTransientEligible(VkImageUsageFlags _usage)
+	{
+		const VkImageUsageFlags attachmentOnly = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
+		return (_usage & ~attachmentOnly) == 0;
+	}
+
+	void createImage(Attachment& _attachment)
+	{
+		const bool transient = isTransientEligible(_attachment.desc.usage);
+
+		VkImageCreateInfo createInfo = {};
+		createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		createInfo.imageType = VK_IMAGE_TYPE_2D;
+		createInfo.format = _attachment.desc.format;
+		createInfo.extent = { _attachment.desc.extent.width, _attachment.desc.extent.height, 1 };
+		createInfo.mipLevels = 1;
+		createInfo.arrayLayers = 1;
+		createInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+		createInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+		createInfo.usage = _attachment.desc.usage | (transient ? VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT : 0);
+		createInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		createInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+		VkResult result = vkCreateImage(m_device, &createInfo, nullptr, &_attachment.image);
+		CVerifyCrash(result == VK_SUCCESS, "TransientAttachments: failed to create image {:s}. Result: {}", _attachment.desc.name, result);
+
+		vkGetImageMemoryRequirements(m_device, _attachment.image, &_attachment.requirements);
+		m_stats.unaliasedBytes += _attachment.requirements.size;
+
+		// Lazily allocated memory only exists on tilers, everyone else falls back to plain device local.
+		if (transient && findMemoryType(m_memoryProperties, _attachment.requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT, _attachment.memoryTypeIndex))
+		{
+			m_stats.lazilyAllocatedCount++;
+			return;
+		}
+		bool found = findMemoryType(m_memoryProperties, _attachment.requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, _attachment.memoryTypeIndex);
+		CVerifyCrash(found, "TransientAttachments: no device local memory type for {:s}!", _attachment.desc.name);
+	}
+
+	// First fit against every already placed attachment in the same heap whose lifetime overlaps this one.
+	void placeAttachment(uint32_t _index)
+	{
+		Attachment& attachment = m_attachments[_index];
+
+		uint32_t heapIndex = 0;
+		for (; heapIndex < m_heaps.size(); heapIndex++)
+		{
+			if (m_heaps[heapIndex].memoryTypeIndex == attachment.memoryTypeIndex)
+				break;
+		}
+		if (heapIndex == m_heaps.size())
+		{
+			Heap heap;
+			heap.memoryTypeIndex = attachment.memoryTypeIndex;
+			m_heaps.push_back(heap);
+		}
+
+		struct Range { VkDeviceSize begin; VkDeviceSize end; };
+		std::vector<Range> occupied;
+		for (const auto& other : m_attachments)
+		{
+			if (&other == &attachment || other.offset == UNPLACED || other.heapIndex != heapIndex)
+				continue;
+			const bool overlaps = other.desc.firstPass <= attachment.desc.lastPass && attachment.desc.firstPass <= other.desc.lastPass;
+			if (overlaps)
+			{
+				occupied.push_back({ other.offset, other.offset + other.requirements.size });
+			}
+		}
+		std::sort(occupied.begin(), occupied.end(), [](const Range& _a, const Range& _b) { return _a.begin < _b.begin; });
+
+		const VkDeviceSize alignment = attachment.requirements.alignment;
+		VkDeviceSize offset = 0;
+		for (const auto& range : occupied)
+		{
+			if (offset + attachment.requirements.size <= range.begin)
+				break;
+			offset = std::max(offset, (range.end + alignment - 1) / alignment * alignment);
+		}
+
+		attachment.heapIndex = heapIndex;
+		attachment.offset = offset;
+		m_heaps[heapIndex].size = std::max(m_heaps[heapIndex].size, offset + attachment.requirements.size);
+	}
+
+	void createImageView(Attachment& _attachment)
+	{
+		VkImageViewCreateInfo createInfo = {};
+		createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		createInfo.image = _attachment.image;
+		createInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		createInfo.format = _attachment.desc.format;
+
+		createInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+		createInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+		createInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+		createInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+
+		createInfo.subresourceRange.aspectMask = _attachment.desc.aspect;
+		createInfo.subresourceRange.baseMipLevel = 0;
+		createInfo.subresourceRange.levelCount = 1;
+		createInfo.subresourceRange.baseArrayLayer = 0;
+		createInfo.subresourceRange.layerCount = 1;
+
+		VkResult result = vkCreateImageView(m_device, &createInfo, nullptr, &_attachment.view);
+		CVerifyCrash(result == VK_SUCCESS, "TransientAttachments: failed to create image view {:s}. Result: {}", _attachment.desc.name, result);
+	}
+
+	VkDevice m_device = VK_NULL_HANDLE;
+	VkPhysicalDeviceMemoryProperties m_memoryProperties;
+	std::vector<Attachment> m_attachments;
+	std::vector<Heap> m_heaps;
+	TransientAttachmentStats m_stats;
+	bool m_isBuilt = false;
+};
@@ -0,0 +1,251 @@
+#include "Core.h"
+#include "JobSystem.h"
+
+#include <future>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <cstdlib>
+
+// Throughput and latency of the job system against std::async, and of its two ways to wait on a simulated frame.
+//
+//   JobBenchmark [worker count]
+//
+// Throughput runs small and large task counts of short and long tasks, best of a few runs each. Latency is the time
+// from submitting one task to it starting, for a job the caller waits on (it usually runs it itself), a job queued
+// from a thread that isn't a worker (an idle worker has to wake up for it) and std::async.
+//
+// The simulated frames keep a few frames in flight. Every frame is one job going through stages that each fan out
+// tasks, wait for them and do some serial work, the pattern where a waiting worker running other jobs on its own
+// stack hurts: a stage can't continue until whatever job it picked up meanwhile (often a whole later frame) returns.
+// It runs once with the default backend and once with fibers, reporting time per frame and frame latency.
+
+namespace
+{
+	typedef std::chrono::steady_clock Clock;
+
+	double elapsedMs(Clock::time_point _start)
+	{
+		return std::chrono::duration<double, std::milli>(Clock::now() - _start).count();
+	}
+
+	std::atomic<uint64_t> g_sink{ 0 };
+
+	// Stands in for a task's work, _iterations of a dependent chain the compiler can't fold.
+	uint64_t work(uint32_t _iterations)
+	{
+		uint64_t value = _iterations;
+		for (uint32_t i = 0; i < _iterations; i++)
+		{
+			value = value * 6364136223846793005ull + 1442695040888963407ull;
+		}
+		return value;
+	}
+
+	uint32_t calibrateIterationsPerMicrosecond()
+	{
+		const uint32_t iterations = 1 << 22;
+		const auto start = Clock::now();
+		g_sink += work(iterations);
+		const double us = elapsedMs(start) * 1000.0;
+		return std::max(1u, static_cast<uint32_t>(iterations / std::max(us, 1.0)));
+	}
+
+	double runJobs(JobSystem& _jobs, uint32_t _tasks, uint32_t _iterations)
+	{
+		const auto start = Clock::now();
+		_jobs.parallelFor(_tasks, 1, [_iterations](uint32_t _begin, uint32_t _end)
+		{
+			for (uint32_t i = _begin; i < _end; i++)
+			{
+				g_sink.fetch_add(work(_iterations), std::memory_order_relaxed);
+			}
+		});
+		return elapsedMs(start);
+	}
+
+	double runAsync(uint32_t _tasks, uint32_t _iterations)
+	{
+		const auto start = Clock::now();
+		std::vector<std::future<void>> futures;
+		futures.reserve(_tasks);
+		for (uint32_t i = 0; i < _tasks; i++)
+		{
+			futures.push_back(std::async(std::launch::async, [_iterations]() { g_sink.fetch_add(work(_iterations), std::memory_order_relaxed); }));
+		}
+		for (auto& it : futures)
+		{
+			it.get();
+		}
+		return elapsedMs(start);
+	}
+
+	void throughput(JobSystem& _jobs, uint32_t _iterationsPerUs)
+	{
+		const uint32_t taskCounts[] = { 64, 10000 };
+		const double taskMicroseconds[] = { 0.1, 20.0 };
+		const uint32_t runs = 5;
+		for (uint32_t tasks : taskCounts)
+		{
+			for (double us : taskMicroseconds)
+			{
+				const uint32_t iterations = std::max(1u, static_cast<uint32_t>(us * _iterationsPerUs));
+				double jobBest = 1e30, asyncBest = 1e30;
+				for (uint32_t run = 0; run < runs; run++)
+				{
+					jobBest = std::min(jobBest, runJobs(_jobs, tasks, iterations));
+					asyncBest = std::min(asyncBest, runAsync(tasks, iterations));
+				}
+				CLog(0, "{:>6} tasks of {:>5.1f} us: job system {:>9.3f} ms ({:>7.2f} M tasks/s), std::async {:>9.3f} ms ({:>7.2f} M tasks/s), {:.1f}x.",
+					tasks, us, jobBest, tasks / jobBest / 1000.0, asyncBest, tasks / asyncBest / 1000.0, asyncBest / jobBest);
+			}
+		}
+	}
+
+	struct Percentiles
+	{
+		double median, p99;
+	};
+
+	Percentiles percentiles(std::vector<double>& _samples)
+	{
+		std::sort(_samples.begin(), _samples.end());
+		return { _samples[_samples.size() / 2], _samples[_samples.size() * 99 / 100] };
+	}
+
+	double sinceUs(Clock::time_point _start)
+	{
+		return std::chrono::duration<double, std::micro>(Clock::now() - _start).count();
+	}
+
+	struct FrameJob
+	{
+		static constexpr uint32_t STAGES = 4;
+		static constexpr uint32_t TASKS_PER_STAGE = 32;
+
+		JobSystem* jobs;
+		double* latencyMs;
+		Clock::time_point start;
+		uint32_t taskIterations, serialIterations;
+
+		void operator()() const
+		{
+			for (uint32_t stage = 0; stage < STAGES; stage++)
+			{
+				Job* tasks = jobs->create([]() {});
+				for (uint32_t i = 0; i < TASKS_PER_STAGE; i++)
+				{
+					const uint32_t iterations = taskIterations;
+					jobs->run(jobs->create([iterations]() { g_sink.fetch_add(work(iterations), std::memory_order_relaxed); }, tasks));
+				}
+				jobs->run(tasks);
+				jobs->wait(tasks);
+				g_sink.fetch_add(work(serialIterations), std::memory_order_relaxed);
+			}
+			*latencyMs = elapsedMs(start);
+		}
+	};
+
+	void simulateFrames(JobSystem& _jobs, uint32_t _iterationsPerUs, const char* _backend)
+	{
+		const uint32_t frames = 300;
+		const uint32_t inFlight = 3;
+		std::vector<double> latencies(frames);
+		Job* pending[inFlight] = {};
+
+		const auto start = Clock::now();
+		for (uint32_t frame = 0; frame < frames; frame++)
+		{
+			Job*& slot = pending[frame % inFlight];
+			if (slot != nullptr)
+				_jobs.wait(slot);
+			slot = _jobs.create(FrameJob{ &_jobs, &latencies[frame], Clock::now(), 20 * _iterationsPerUs, 50 * _iterationsPerUs });
+			_jobs.run(slot);
+		}
+		for (Job* it : pending)
+		{
+			if (it != nullptr)
+				_jobs.wait(it);
+		}
+		const double totalMs = elapsedMs(start);
+
+		const Percentiles frameLatency = percentiles(latencies);
+		CLog(0, "Simulated frames, {:s}: {:.3f} ms per frame, latency median / p99 {:.2f} / {:.2f} ms.",
+			_backend, totalMs / frames, frameLatency.median, frameLatency.p99);
+	}
+
+	void latency(JobSystem& _jobs)
+	{
+		const uint32_t samples = 2000;
+		std::vector<double> waited, injected, async;
+		waited.reserve(samples);
+		injected.reserve(samples);
+		async.reserve(samples);
+
+		for (uint32_t i = 0; i < samples; i++)
+		{
+			double started = 0.0;
+			const auto start = Clock::now();
+			_jobs.runAndWait([&started, start]() { started = sinceUs(start); });
+			waited.push_back(started);
+		}
+
+		// From a thread outside the job system, with the workers asleep in between
+		std::thread outside([&]()
+		{
+			for (uint32_t i = 0; i < samples; i++)
+			{
+				std::atomic<bool> done{ false };
+				double started = 0.0;
+				const auto start = Clock::now();
+				_jobs.run(_jobs.create([&started, &done, start]() { started = sinceUs(start); done.store(true, std::memory_order_release); }));
+				while (!done.load(std::memory_order_acquire))
+				{
+					std::this_thread::yield();
+				}
+				injected.push_back(started);
+				std::this_thread::sleep_for(std::chrono::microseconds(200));
+			}
+		});
+		outside.join();
+
+		for (uint32_t i = 0; i < samples; i++)
+		{
+			double started = 0.0;
+			const auto start = Clock::now();
+			std::async(std::launch::async, [&started, start]() { started = sinceUs(start); }).get();
+			async.push_back(started);
+		}
+
+		const Percentiles a = percentiles(waited);
+		const Percentiles b = percentiles(injected);
+		const Percentiles c = percentiles(async);
+		CLog(0, "Latency to task start, median / p99: waited job {:.2f} / {:.2f} us, job from another thread {:.2f} / {:.2f} us, std::async {:.2f} / {:.2f} us.",
+			a.median, a.p99, b.median, b.p99, c.median, c.p99);
+	}
+}
+
+int main(int _argc, char** _argv)
+{
+	const uint32_t workers = _argc > 1 ? static_cast<uint32_t>(std::strtoul(_argv[1], nullptr, 10)) : 0;
+	JobSystem jobs;
+	jobs.init(workers);
+
+	const uint32_t iterationsPerUs = calibrateIterationsPerMicrosecond();
+	CLog(0, "{} hardware threads, {} iterations of work per microsecond.", std::thread::hardware_concurrency(), iterationsPerUs);
+	throughput(jobs, iterationsPerUs);
+	latency(jobs);
+	simulateFrames(jobs, iterationsPerUs, "waits run jobs on the waiting stack");
+
+	jobs.logStats();
+	jobs.shutdown();
+
+	JobSystem fiberJobs;
+	fiberJobs.init(workers, true);
+	simulateFrames(fiberJobs, iterationsPerUs, "waits park their fiber");
+	fiberJobs.logStats();
+	fiberJobs.shutdown();
+	return g_sink.load() == 42 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
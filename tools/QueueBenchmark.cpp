@@ -0,0 +1,178 @@
+#include "Core.h"
+#include "RingQueue.h"
+
+#include <thread>
+#include <mutex>
+#include <deque>
+#include <chrono>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <cstdlib>
+
+// Throughput of the lock-free ring queues against a mutex protected std::deque under contention.
+//
+//   QueueBenchmark [items per run]
+//
+// SPSC runs one producer thread against one consumer, MPSC 1, 2, 4 and 8 producers against one consumer, both with
+// single pushes and pops and with batches. Every run is the best of a few, and the consumer checks that each
+// producer's items come out complete and in order.
+
+namespace
+{
+	typedef std::chrono::steady_clock Clock;
+
+	const uint32_t CAPACITY = 4096;
+	const uint32_t BATCH = 32;
+	const uint32_t RUNS = 3;
+
+	// Same interface as the ring queues, for the baseline.
+	template<typename T>
+	class MutexQueue
+	{
+	public:
+		explicit MutexQueue(uint32_t _capacity) : m_capacity(_capacity) {}
+
+		bool push(T _value)
+		{
+			return pushBatch(&_value, 1) == 1;
+		}
+		uint32_t pushBatch(const T* _values, uint32_t _count)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			const uint32_t count = std::min(_count, m_capacity - static_cast<uint32_t>(m_items.size()));
+			m_items.insert(m_items.end(), _values, _values + count);
+			return count;
+		}
+		bool pop(T& _value)
+		{
+			return popBatch(&_value, 1) == 1;
+		}
+		uint32_t popBatch(T* _values, uint32_t _max)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			const uint32_t count = std::min(_max, static_cast<uint32_t>(m_items.size()));
+			std::copy(m_items.begin(), m_items.begin() + count, _values);
+			m_items.erase(m_items.begin(), m_items.begin() + count);
+			return count;
+		}
+
+	private:
+		std::mutex m_mutex;
+		std::deque<T> m_items;
+		const uint32_t m_capacity;
+	};
+
+	// Items are the producer index in the top bits and its running count below.
+	uint64_t makeItem(uint32_t _producer, uint64_t _index)
+	{
+		return (static_cast<uint64_t>(_producer) << 48) | _index;
+	}
+
+	template<typename Queue>
+	void produce(Queue& _queue, uint32_t _producer, uint64_t _count, uint32_t _batch)
+	{
+		uint64_t items[BATCH];
+		uint64_t next = 0;
+		while (next < _count)
+		{
+			const uint32_t count = static_cast<uint32_t>(std::min<uint64_t>(_batch, _count - next));
+			for (uint32_t i = 0; i < count; i++)
+			{
+				items[i] = makeItem(_producer, next + i);
+			}
+			uint32_t pushed = 0;
+			while (pushed < count)
+			{
+				const uint32_t n = _batch == 1 ? (_queue.push(items[0]) ? 1 : 0) : _queue.pushBatch(items + pushed, count - pushed);
+				pushed += n;
+				if (n == 0)
+					std::this_thread::yield();	// full
+			}
+			next += count;
+		}
+	}
+
+	// Items per second moving _items through _queue from _producers threads to this one.
+	template<typename Queue>
+	double run(uint32_t _producers, uint64_t _items, uint32_t _batch)
+	{
+		Queue queue(CAPACITY);
+		const uint64_t perProducer = _items / _producers;
+		std::vector<uint64_t> expected(_producers, 0);
+		std::atomic<bool> go{ false };
+		std::vector<std::thread> threads;
+		for (uint32_t p = 0; p < _producers; p++)
+		{
+			threads.emplace_back([&queue, &go, p, perProducer, _batch]()
+			{
+				while (!go.load(std::memory_order_acquire))
+				{
+					std::this_thread::yield();
+				}
+				produce(queue, p, perProducer, _batch);
+			});
+		}
+
+		const auto start = Clock::now();
+		go.store(true, std::memory_order_release);
+		uint64_t items[BATCH];
+		uint64_t received = 0;
+		while (received < perProducer * _producers)
+		{
+			const uint32_t count = _batch == 1 ? (queue.pop(items[0]) ? 1 : 0) : queue.popBatch(items, _batch);
+			if (count == 0)
+				std::this_thread::yield();	// empty
+			for (uint32_t i = 0; i < count; i++)
+			{
+				const uint32_t producer = static_cast<uint32_t>(items[i] >> 48);
+				const uint64_t index = items[i] & ((1ull << 48) - 1);
+				CVerifyCrash(producer < _producers && index == expected[producer], "QueueBenchmark: item {} of producer {} out of order, expected {}.", index, producer, expected[producer]);
+				expected[producer]++;
+			}
+			received += count;
+		}
+		const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+		for (auto& it : threads)
+		{
+			it.join();
+		}
+		return received / seconds;
+	}
+
+	template<typename Queue>
+	double best(uint32_t _producers, uint64_t _items, uint32_t _batch)
+	{
+		double result = 0.0;
+		for (uint32_t i = 0; i < RUNS; i++)
+		{
+			result = std::max(result, run<Queue>(_producers, _items, _batch));
+		}
+		return result;
+	}
+
+	template<typename Queue>
+	void compare(const char* _name, uint32_t _producers, uint64_t _items)
+	{
+		for (uint32_t batch : { 1u, BATCH })
+		{
+			const double lockFree = best<Queue>(_producers, _items, batch);
+			const double locked = best<MutexQueue<uint64_t>>(_producers, _items, batch);
+			CLog(0, "{:s}, {} producers, batch {:>2}: lock-free {:>7.2f} M items/s, mutex {:>7.2f} M items/s, {:.1f}x.",
+				_name, _producers, batch, lockFree / 1e6, locked / 1e6, lockFree / locked);
+		}
+	}
+}
+
+int main(int _argc, char** _argv)
+{
+	const uint64_t items = _argc > 1 ? std::strtoull(_argv[1], nullptr, 10) : 4000000;
+	CLog(0, "{} hardware threads, {} items per run, queues of {} items, best of {} runs.", std::thread::hardware_concurrency(), items, CAPACITY, RUNS);
+
+	compare<SpscRingQueue<uint64_t>>("SPSC", 1, items);
+	for (uint32_t producers : { 1u, 2u, 4u, 8u })
+	{
+		compare<MpscRingQueue<uint64_t>>("MPSC", producers, items);
+	}
+	return EXIT_SUCCESS;
+}
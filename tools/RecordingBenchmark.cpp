@@ -0,0 +1,639 @@
+#include "Core.h"
+#include "JobSystem.h"
+#include "CommandBufferManager.h"
+#include "ParallelCommandRecorder.h"
+#include "ShaderCompiler.h"
+#include <vulkan/vulkan.h>
+
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <cstdlib>
+
+// Command recording time of one render pass full of draws, on one thread against spread over the job system.
+//
+//   RecordingBenchmark [draw count] [max threads]
+//
+// Runs headless on the first GPU with a graphics queue: one offscreen color target, one pipeline and for every draw a
+// push constant update plus a vkCmdDraw, the cost of a draw in a real frame without its state changes. The baseline
+// records all of them inline into the primary, the parallel runs split them into secondary command buffers recorded by
+// 1, 2, 4, ... threads. Every frame is submitted and waited on so the command pools are reset the way the game does.
+//
+// A last run puts the draws into the second subpass of a two subpass render pass whose first subpass is recorded
+// inline, the way the render graph records a merged group with a secondaryCommandBuffers() pass, and times the whole
+// render pass on the GPU with one pair of timestamps outside it.
+
+namespace
+{
+	typedef std::chrono::steady_clock Clock;
+
+	const uint32_t FRAMES = 50;
+	const uint32_t CHUNKS = 64;			// the same split for every thread count, so only the parallelism changes
+	const VkExtent2D EXTENT = { 256, 256 };
+
+	const char* const VERTEX_SHADER = R"(
+		#version 450
+		layout(push_constant) uniform Draw { vec4 offsetScale; vec4 color; } draw;
+		void main()
+		{
+			const vec2 corners[3] = vec2[](vec2(0.0, 0.0), vec2(1.0, 0.0), vec2(0.0, 1.0));
+			gl_Position = vec4(draw.offsetScale.xy + corners[gl_VertexIndex] * draw.offsetScale.zw, 0.0, 1.0);
+		})";
+	const char* const FRAGMENT_SHADER = R"(
+		#version 450
+		layout(push_constant) uniform Draw { vec4 offsetScale; vec4 color; } draw;
+		layout(location = 0) out vec4 outColor;
+		void main()
+		{
+			outColor = draw.color;
+		})";
+
+	struct DrawConstants
+	{
+		float offsetScale[4];
+		float color[4];
+	};
+
+	double elapsedMs(Clock::time_point _start)
+	{
+		return std::chrono::duration<double, std::milli>(Clock::now() - _start).count();
+	}
+
+	class Benchmark
+	{
+	public:
+		void init()
+		{
+			VkApplicationInfo appInfo = {};
+			appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+			appInfo.pApplicationName = "RecordingBenchmark";
+			appInfo.apiVersion = VK_API_VERSION_1_0;
+			VkInstanceCreateInfo instanceInfo = {};
+			instanceInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+			instanceInfo.pApplicationInfo = &appInfo;
+			VkResult result = vkCreateInstance(&instanceInfo, nullptr, &m_instance);
+			CVerifyCrash(result == VK_SUCCESS, "Failed to create the Vulkan instance. Result: {}", result);
+
+			uint32_t deviceCount = 0;
+			vkEnumeratePhysicalDevices(m_instance, &deviceCount, nullptr);
+			std::vector<VkPhysicalDevice> devices(deviceCount);
+			vkEnumeratePhysicalDevices(m_instance, &deviceCount, devices.data());
+			for (VkPhysicalDevice device : devices)
+			{
+				uint32_t familyCount = 0;
+				vkGetPhysicalDeviceQueueFamilyProperties(device, &familyCount, nullptr);
+				std::vector<VkQueueFamilyProperties> families(familyCount);
+				vkGetPhysicalDeviceQueueFamilyProperties(device, &familyCount, families.data());
+				for (uint32_t i = 0; i < familyCount && m_physicalDevice == VK_NULL_HANDLE; i++)
+				{
+					if (families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)
+					{
+						m_physicalDevice = device;
+						m_queueFamily = i;
+						m_timestamps = families[i].timestampValidBits > 0;
+					}
+				}
+			}
+			CVerifyCrash(m_physicalDevice != VK_NULL_HANDLE, "No GPU with a graphics queue.");
+			VkPhysicalDeviceProperties properties;
+			vkGetPhysicalDeviceProperties(m_physicalDevice, &properties);
+			CLog(0, "GPU: {:s}", properties.deviceName);
+			m_timestampPeriod = properties.limits.timestampPeriod;
+
+			const float priority = 1.0f;
+			VkDeviceQueueCreateInfo queueInfo = {};
+			queueInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+			queueInfo.queueFamilyIndex = m_queueFamily;
+			queueInfo.queueCount = 1;
+			queueInfo.pQueuePriorities = &priority;
+			VkDeviceCreateInfo deviceInfo = {};
+			deviceInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+			deviceInfo.queueCreateInfoCount = 1;
+			deviceInfo.pQueueCreateInfos = &queueInfo;
+			result = vkCreateDevice(m_physicalDevice, &deviceInfo, nullptr, &m_device);
+			CVerifyCrash(result == VK_SUCCESS, "Failed to create the device. Result: {}", result);
+			vkGetDeviceQueue(m_device, m_queueFamily, 0, &m_queue);
+
+			createTarget();
+			m_renderPass = createRenderPass(1);
+			m_framebuffer = createFramebuffer(m_renderPass);
+			m_twoSubpassRenderPass = createRenderPass(2);
+			m_twoSubpassFramebuffer = createFramebuffer(m_twoSubpassRenderPass);
+			createPipelines();
+
+			VkQueryPoolCreateInfo queryInfo = {};
+			queryInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+			queryInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+			queryInfo.queryCount = 2;
+			result = vkCreateQueryPool(m_device, &queryInfo, nullptr, &m_queryPool);
+			CVerifyCrash(result == VK_SUCCESS, "Failed to create the query pool. Result: {}", result);
+
+			VkFenceCreateInfo fenceInfo = {};
+			fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+			result = vkCreateFence(m_device, &fenceInfo, nullptr, &m_fence);
+			CVerifyCrash(result == VK_SUCCESS, "Failed to create the fence. Result: {}", result);
+
+			m_inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+			m_inheritance.renderPass = m_renderPass;
+			m_inheritance.subpass = 0;
+			m_inheritance.framebuffer = m_framebuffer;
+		}
+
+		void destroy()
+		{
+			vkDestroyQueryPool(m_device, m_queryPool, nullptr);
+			vkDestroyFence(m_device, m_fence, nullptr);
+			vkDestroyPipeline(m_device, m_secondSubpassPipeline, nullptr);
+			vkDestroyPipeline(m_device, m_firstSubpassPipeline, nullptr);
+			vkDestroyPipeline(m_device, m_pipeline, nullptr);
+			vkDestroyPipelineLayout(m_device, m_pipelineLayout, nullptr);
+			vkDestroyFramebuffer(m_device, m_twoSubpassFramebuffer, nullptr);
+			vkDestroyRenderPass(m_device, m_twoSubpassRenderPass, nullptr);
+			vkDestroyFramebuffer(m_device, m_framebuffer, nullptr);
+			vkDestroyRenderPass(m_device, m_renderPass, nullptr);
+			vkDestroyImageView(m_device, m_imageView, nullptr);
+			vkDestroyImage(m_device, m_image, nullptr);
+			vkFreeMemory(m_device, m_memory, nullptr);
+			vkDestroyDevice(m_device, nullptr);
+			vkDestroyInstance(m_instance, nullptr);
+		}
+
+		// Median milliseconds to record a frame with every draw inline in the primary.
+		double runInline(uint32_t _draws)
+		{
+			CommandBufferManager commandBuffers;
+			commandBuffers.init(m_device, 1);
+			const CommandBufferManager::PoolHandle pool = commandBuffers.createPool(m_queueFamily, "Primary");
+
+			std::vector<double> times;
+			for (uint32_t frame = 0; frame < FRAMES; frame++)
+			{
+				commandBuffers.beginFrame(0);
+				const auto start = Clock::now();
+				m_commandBuffer = commandBuffers.get(pool);
+				beginFrame(m_renderPass, m_framebuffer, VK_SUBPASS_CONTENTS_INLINE);
+				recordDraws(m_commandBuffer, m_pipeline, 0, _draws, _draws);
+				endFrame();
+				times.push_back(elapsedMs(start));
+				submitAndWait();
+			}
+			commandBuffers.destroy();
+			return median(times);
+		}
+
+		// Median milliseconds to record a frame with the draws split across _threads job system workers. Also logs how
+		// long each thread spent recording per frame.
+		double runParallel(uint32_t _draws, uint32_t _threads)
+		{
+			JobSystem jobs;
+			jobs.init(_threads);
+			CommandBufferManager commandBuffers;
+			commandBuffers.init(m_device, 1);
+			const CommandBufferManager::PoolHandle pool = commandBuffers.createPool(m_queueFamily, "Primary");
+			ParallelCommandRecorder recorder;
+			recorder.init(commandBuffers, m_queueFamily, jobs);
+
+			const uint32_t drawsPerChunk = (_draws + CHUNKS - 1) / CHUNKS;
+			uint64_t allocationFrames = 0;
+			std::vector<double> times;
+			for (uint32_t frame = 0; frame < FRAMES; frame++)
+			{
+				commandBuffers.beginFrame(0);
+				if (frame == 1)
+				{
+					recorder.resetStats();	// the first frame allocates the secondary command buffers
+					allocationFrames = commandBuffers.getStats().framesWithAllocations;
+				}
+				const auto start = Clock::now();
+				m_commandBuffer = commandBuffers.get(pool);
+				beginFrame(m_renderPass, m_framebuffer, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+				recorder.record(m_commandBuffer, m_inheritance, CHUNKS, [&](VkCommandBuffer _commandBuffer, uint32_t _chunk)
+				{
+					const uint32_t first = _chunk * drawsPerChunk;
+					recordDraws(_commandBuffer, m_pipeline, first, std::min(first + drawsPerChunk, _draws), _draws);
+				});
+				endFrame();
+				times.push_back(elapsedMs(start));
+				submitAndWait();
+			}
+
+			std::string perThread;
+			for (uint32_t i = 0; i < _threads; i++)
+			{
+				const RecordingThreadStats& stats = recorder.getThreadStats(i);
+				perThread += fmt::format(" {:.3f}", stats.recordMicroseconds / 1000.0 / (FRAMES - 1));
+			}
+			CLog(0, "  {} threads, recording ms per frame by thread:{:s}", _threads, perThread);
+			commandBuffers.beginFrame(0);	// counts the last frame
+			const CommandBufferManagerStats stats = commandBuffers.getStats();
+			CLog(0, "  {} command buffer allocation calls in total, {} of the {} frames after the first allocated.",
+				stats.allocationCalls, stats.framesWithAllocations - allocationFrames, FRAMES - 1);
+
+			commandBuffers.destroy();
+			jobs.shutdown();
+			return median(times);
+		}
+
+		// Median milliseconds to record a frame whose render pass has an inline first subpass with a tenth of the draws
+		// and a second subpass with the rest in secondary command buffers recorded by _threads workers. Also logs the
+		// median GPU time of the render pass when the queue has timestamps.
+		double runTwoSubpasses(uint32_t _draws, uint32_t _threads)
+		{
+			JobSystem jobs;
+			jobs.init(_threads);
+			CommandBufferManager commandBuffers;
+			commandBuffers.init(m_device, 1);
+			const CommandBufferManager::PoolHandle pool = commandBuffers.createPool(m_queueFamily, "Primary");
+			ParallelCommandRecorder recorder;
+			recorder.init(commandBuffers, m_queueFamily, jobs);
+
+			VkCommandBufferInheritanceInfo inheritance = m_inheritance;
+			inheritance.renderPass = m_twoSubpassRenderPass;
+			inheritance.subpass = 1;
+			inheritance.framebuffer = m_twoSubpassFramebuffer;
+			const uint32_t inlineDraws = _draws / 10;
+			const uint32_t secondaryDraws = _draws - inlineDraws;
+			const uint32_t drawsPerChunk = (secondaryDraws + CHUNKS - 1) / CHUNKS;
+			std::vector<double> times;
+			std::vector<double> gpuTimes;
+			for (uint32_t frame = 0; frame < FRAMES; frame++)
+			{
+				commandBuffers.beginFrame(0);
+				const auto start = Clock::now();
+				m_commandBuffer = commandBuffers.get(pool);
+				VkCommandBufferBeginInfo beginInfo = {};
+				beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+				beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+				vkBeginCommandBuffer(m_commandBuffer, &beginInfo);
+				// The timestamps go outside the render pass, the second subpass takes nothing but vkCmdExecuteCommands
+				if (m_timestamps)
+				{
+					vkCmdResetQueryPool(m_commandBuffer, m_queryPool, 0, 2);
+					vkCmdWriteTimestamp(m_commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, m_queryPool, 0);
+				}
+				beginRenderPass(m_twoSubpassRenderPass, m_twoSubpassFramebuffer, VK_SUBPASS_CONTENTS_INLINE);
+				recordDraws(m_commandBuffer, m_firstSubpassPipeline, 0, inlineDraws, _draws);
+				vkCmdNextSubpass(m_commandBuffer, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+				recorder.record(m_commandBuffer, inheritance, CHUNKS, [&](VkCommandBuffer _commandBuffer, uint32_t _chunk)
+				{
+					const uint32_t first = inlineDraws + _chunk * drawsPerChunk;
+					recordDraws(_commandBuffer, m_secondSubpassPipeline, std::min(first, _draws), std::min(first + drawsPerChunk, _draws), _draws);
+				});
+				vkCmdEndRenderPass(m_commandBuffer);
+				if (m_timestamps)
+					vkCmdWriteTimestamp(m_commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_queryPool, 1);
+				VkResult result = vkEndCommandBuffer(m_commandBuffer);
+				CVerifyCrash(result == VK_SUCCESS, "Failed to record the frame. Result: {}", result);
+				times.push_back(elapsedMs(start));
+				submitAndWait();
+
+				if (m_timestamps)
+				{
+					uint64_t timestamps[2];
+					result = vkGetQueryPoolResults(m_device, m_queryPool, 0, 2, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+					CVerifyCrash(result == VK_SUCCESS, "Failed to read the timestamps. Result: {}", result);
+					gpuTimes.push_back((timestamps[1] - timestamps[0]) * m_timestampPeriod / 1e6);
+				}
+			}
+			if (!gpuTimes.empty())
+				CLog(0, "  Two subpass render pass: {:.3f} ms on the GPU.", median(gpuTimes));
+
+			commandBuffers.destroy();
+			jobs.shutdown();
+			return median(times);
+		}
+
+	private:
+		static double median(std::vector<double>& _times)
+		{
+			std::sort(_times.begin(), _times.end());
+			return _times[_times.size() / 2];
+		}
+
+		uint32_t findMemoryType(uint32_t _typeBits, VkMemoryPropertyFlags _properties) const
+		{
+			VkPhysicalDeviceMemoryProperties memory;
+			vkGetPhysicalDeviceMemoryProperties(m_physicalDevice, &memory);
+			for (uint32_t i = 0; i < memory.memoryTypeCount; i++)
+			{
+				if ((_typeBits & (1u << i)) && (memory.memoryTypes[i].propertyFlags & _properties) == _properties)
+					return i;
+			}
+			CVerifyCrash(false, "No memory type for bits {:x} and properties {:x}.", _typeBits, _properties);
+			return 0;
+		}
+
+		void createTarget()
+		{
+			VkImageCreateInfo imageInfo = {};
+			imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+			imageInfo.imageType = VK_IMAGE_TYPE_2D;
+			imageInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+			imageInfo.extent = { EXTENT.width, EXTENT.height, 1 };
+			imageInfo.mipLevels = 1;
+			imageInfo.arrayLayers = 1;
+			imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+			imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+			imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+			imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			VkResult result = vkCreateImage(m_device, &imageInfo, nullptr, &m_image);
+			CVerifyCrash(result == VK_SUCCESS, "Failed to create the target image. Result: {}", result);
+
+			VkMemoryRequirements requirements;
+			vkGetImageMemoryRequirements(m_device, m_image, &requirements);
+			VkMemoryAllocateInfo allocInfo = {};
+			allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+			allocInfo.allocationSize = requirements.size;
+			allocInfo.memoryTypeIndex = findMemoryType(requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+			result = vkAllocateMemory(m_device, &allocInfo, nullptr, &m_memory);
+			CVerifyCrash(result == VK_SUCCESS, "Failed to allocate the target memory. Result: {}", result);
+			vkBindImageMemory(m_device, m_image, m_memory, 0);
+
+			VkImageViewCreateInfo viewInfo = {};
+			viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+			viewInfo.image = m_image;
+			viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+			viewInfo.format = imageInfo.format;
+			viewInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+			result = vkCreateImageView(m_device, &viewInfo, nullptr, &m_imageView);
+			CVerifyCrash(result == VK_SUCCESS, "Failed to create the target view. Result: {}", result);
+		}
+
+		// The target as one color attachment, cleared on load. With two subpasses both draw into it, the second after
+		// the first.
+		VkRenderPass createRenderPass(uint32_t _subpassCount) const
+		{
+			VkAttachmentDescription attachment = {};
+			attachment.format = VK_FORMAT_R8G8B8A8_UNORM;
+			attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+			attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+			attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+			attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+			attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+			attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			attachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+			VkAttachmentReference reference = { 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+			VkSubpassDescription subpasses[2] = {};
+			for (VkSubpassDescription& it : subpasses)
+			{
+				it.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+				it.colorAttachmentCount = 1;
+				it.pColorAttachments = &reference;
+			}
+			VkSubpassDependency dependency = {};
+			dependency.srcSubpass = 0;
+			dependency.dstSubpass = 1;
+			dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+			dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+			dependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+			dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+			dependency.dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+			VkRenderPassCreateInfo renderPassInfo = {};
+			renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+			renderPassInfo.attachmentCount = 1;
+			renderPassInfo.pAttachments = &attachment;
+			renderPassInfo.subpassCount = _subpassCount;
+			renderPassInfo.pSubpasses = subpasses;
+			renderPassInfo.dependencyCount = _subpassCount > 1 ? 1 : 0;
+			renderPassInfo.pDependencies = &dependency;
+			VkRenderPass renderPass;
+			VkResult result = vkCreateRenderPass(m_device, &renderPassInfo, nullptr, &renderPass);
+			CVerifyCrash(result == VK_SUCCESS, "Failed to create the render pass. Result: {}", result);
+			return renderPass;
+		}
+
+		VkFramebuffer createFramebuffer(VkRenderPass _renderPass) const
+		{
+			VkFramebufferCreateInfo framebufferInfo = {};
+			framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+			framebufferInfo.renderPass = _renderPass;
+			framebufferInfo.attachmentCount = 1;
+			framebufferInfo.pAttachments = &m_imageView;
+			framebufferInfo.width = EXTENT.width;
+			framebufferInfo.height = EXTENT.height;
+			framebufferInfo.layers = 1;
+			VkFramebuffer framebuffer;
+			VkResult result = vkCreateFramebuffer(m_device, &framebufferInfo, nullptr, &framebuffer);
+			CVerifyCrash(result == VK_SUCCESS, "Failed to create the framebuffer. Result: {}", result);
+			return framebuffer;
+		}
+
+		VkShaderModule createShader(ShaderCompiler& _compiler, const char* _name, const char* _source)
+		{
+			std::vector<uint32_t> spirv;
+			std::string errors;
+			CVerifyCrash(_compiler.compileSource(_name, _source, spirv, errors), "Failed to compile {:s}: {:s}", _name, errors);
+			VkShaderModuleCreateInfo moduleInfo = {};
+			moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+			moduleInfo.codeSize = spirv.size() * sizeof(uint32_t);
+			moduleInfo.pCode = spirv.data();
+			VkShaderModule module;
+			VkResult result = vkCreateShaderModule(m_device, &moduleInfo, nullptr, &module);
+			CVerifyCrash(result == VK_SUCCESS, "Failed to create shader module {:s}. Result: {}", _name, result);
+			return module;
+		}
+
+		// The same pipeline for the single subpass render pass and each subpass of the two subpass one.
+		void createPipelines()
+		{
+			ShaderCompiler compiler;
+			VkShaderModule vertex = createShader(compiler, "benchmark.vert", VERTEX_SHADER);
+			VkShaderModule fragment = createShader(compiler, "benchmark.frag", FRAGMENT_SHADER);
+
+			VkPushConstantRange pushConstants = { VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(DrawConstants) };
+			VkPipelineLayoutCreateInfo layoutInfo = {};
+			layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+			layoutInfo.pushConstantRangeCount = 1;
+			layoutInfo.pPushConstantRanges = &pushConstants;
+			VkResult result = vkCreatePipelineLayout(m_device, &layoutInfo, nullptr, &m_pipelineLayout);
+			CVerifyCrash(result == VK_SUCCESS, "Failed to create the pipeline layout. Result: {}", result);
+
+			m_pipeline = createPipeline(vertex, fragment, m_renderPass, 0);
+			m_firstSubpassPipeline = createPipeline(vertex, fragment, m_twoSubpassRenderPass, 0);
+			m_secondSubpassPipeline = createPipeline(vertex, fragment, m_twoSubpassRenderPass, 1);
+			vkDestroyShaderModule(m_device, vertex, nullptr);
+			vkDestroyShaderModule(m_device, fragment, nullptr);
+		}
+
+		VkPipeline createPipeline(VkShaderModule _vertex, VkShaderModule _fragment, VkRenderPass _renderPass, uint32_t _subpass) const
+		{
+			VkPipelineShaderStageCreateInfo stages[2] = {};
+			stages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+			stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+			stages[0].module = _vertex;
+			stages[0].pName = "main";
+			stages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+			stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+			stages[1].module = _fragment;
+			stages[1].pName = "main";
+			VkPipelineVertexInputStateCreateInfo vertexInput = {};
+			vertexInput.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+			VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
+			inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+			inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+			VkPipelineViewportStateCreateInfo viewport = {};
+			viewport.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+			viewport.viewportCount = 1;
+			viewport.scissorCount = 1;
+			VkPipelineRasterizationStateCreateInfo rasterization = {};
+			rasterization.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+			rasterization.polygonMode = VK_POLYGON_MODE_FILL;
+			rasterization.cullMode = VK_CULL_MODE_NONE;
+			rasterization.lineWidth = 1.0f;
+			VkPipelineMultisampleStateCreateInfo multisample = {};
+			multisample.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+			multisample.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+			VkPipelineColorBlendAttachmentState blendAttachment = {};
+			blendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+			VkPipelineColorBlendStateCreateInfo blend = {};
+			blend.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+			blend.attachmentCount = 1;
+			blend.pAttachments = &blendAttachment;
+			const VkDynamicState dynamicStates[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+			VkPipelineDynamicStateCreateInfo dynamic = {};
+			dynamic.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+			dynamic.dynamicStateCount = 2;
+			dynamic.pDynamicStates = dynamicStates;
+
+			VkGraphicsPipelineCreateInfo pipelineInfo = {};
+			pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+			pipelineInfo.stageCount = 2;
+			pipelineInfo.pStages = stages;
+			pipelineInfo.pVertexInputState = &vertexInput;
+			pipelineInfo.pInputAssemblyState = &inputAssembly;
+			pipelineInfo.pViewportState = &viewport;
+			pipelineInfo.pRasterizationState = &rasterization;
+			pipelineInfo.pMultisampleState = &multisample;
+			pipelineInfo.pColorBlendState = &blend;
+			pipelineInfo.pDynamicState = &dynamic;
+			pipelineInfo.layout = m_pipelineLayout;
+			pipelineInfo.renderPass = _renderPass;
+			pipelineInfo.subpass = _subpass;
+			VkPipeline pipeline;
+			VkResult result = vkCreateGraphicsPipelines(m_device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline);
+			CVerifyCrash(result == VK_SUCCESS, "Failed to create the pipeline. Result: {}", result);
+			return pipeline;
+		}
+
+		void beginFrame(VkRenderPass _renderPass, VkFramebuffer _framebuffer, VkSubpassContents _contents)
+		{
+			VkCommandBufferBeginInfo beginInfo = {};
+			beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+			beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+			vkBeginCommandBuffer(m_commandBuffer, &beginInfo);
+			beginRenderPass(_renderPass, _framebuffer, _contents);
+		}
+
+		void beginRenderPass(VkRenderPass _renderPass, VkFramebuffer _framebuffer, VkSubpassContents _contents)
+		{
+			VkClearValue clear = {};
+			VkRenderPassBeginInfo renderPassInfo = {};
+			renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+			renderPassInfo.renderPass = _renderPass;
+			renderPassInfo.framebuffer = _framebuffer;
+			renderPassInfo.renderArea.extent = EXTENT;
+			renderPassInfo.clearValueCount = 1;
+			renderPassInfo.pClearValues = &clear;
+			vkCmdBeginRenderPass(m_commandBuffer, &renderPassInfo, _contents);
+		}
+
+		void endFrame()
+		{
+			vkCmdEndRenderPass(m_commandBuffer);
+			VkResult result = vkEndCommandBuffer(m_commandBuffer);
+			CVerifyCrash(result == VK_SUCCESS, "Failed to record the frame. Result: {}", result);
+		}
+
+		void submitAndWait()
+		{
+			VkSubmitInfo submitInfo = {};
+			submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+			submitInfo.commandBufferCount = 1;
+			submitInfo.pCommandBuffers = &m_commandBuffer;
+			VkResult result = vkQueueSubmit(m_queue, 1, &submitInfo, m_fence);
+			CVerifyCrash(result == VK_SUCCESS, "Failed to submit the frame. Result: {}", result);
+			vkWaitForFences(m_device, 1, &m_fence, VK_TRUE, UINT64_MAX);
+			vkResetFences(m_device, 1, &m_fence);
+		}
+
+		// Draws [_first, _end) of _total small triangles laid out on a grid. State isn't inherited by secondary command
+		// buffers, so every command buffer binds its own.
+		void recordDraws(VkCommandBuffer _commandBuffer, VkPipeline _pipeline, uint32_t _first, uint32_t _end, uint32_t _total) const
+		{
+			const VkViewport viewport = { 0.0f, 0.0f, static_cast<float>(EXTENT.width), static_cast<float>(EXTENT.height), 0.0f, 1.0f };
+			const VkRect2D scissor = { { 0, 0 }, EXTENT };
+			vkCmdBindPipeline(_commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _pipeline);
+			vkCmdSetViewport(_commandBuffer, 0, 1, &viewport);
+			vkCmdSetScissor(_commandBuffer, 0, 1, &scissor);
+
+			uint32_t columns = 1;
+			while (columns * columns < _total)
+			{
+				columns++;
+			}
+			const float cell = 2.0f / columns;
+			for (uint32_t i = _first; i < _end; i++)
+			{
+				const DrawConstants constants =
+				{
+					{ -1.0f + (i % columns) * cell, -1.0f + (i / columns) * cell, cell, cell },
+					{ (i & 255) / 255.0f, ((i >> 8) & 255) / 255.0f, 0.5f, 1.0f }
+				};
+				vkCmdPushConstants(_commandBuffer, m_pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(constants), &constants);
+				vkCmdDraw(_commandBuffer, 3, 1, 0, 0);
+			}
+		}
+
+		VkInstance m_instance = VK_NULL_HANDLE;
+		VkPhysicalDevice m_physicalDevice = VK_NULL_HANDLE;
+		uint32_t m_queueFamily = 0;
+		bool m_timestamps = false;
+		float m_timestampPeriod = 1.0f;		// nanoseconds per tick
+		VkDevice m_device = VK_NULL_HANDLE;
+		VkQueue m_queue = VK_NULL_HANDLE;
+		VkImage m_image = VK_NULL_HANDLE;
+		VkDeviceMemory m_memory = VK_NULL_HANDLE;
+		VkImageView m_imageView = VK_NULL_HANDLE;
+		VkRenderPass m_renderPass = VK_NULL_HANDLE;
+		VkFramebuffer m_framebuffer = VK_NULL_HANDLE;
+		VkRenderPass m_twoSubpassRenderPass = VK_NULL_HANDLE;
+		VkFramebuffer m_twoSubpassFramebuffer = VK_NULL_HANDLE;
+		VkPipelineLayout m_pipelineLayout = VK_NULL_HANDLE;
+		VkPipeline m_pipeline = VK_NULL_HANDLE;
+		VkPipeline m_firstSubpassPipeline = VK_NULL_HANDLE;
+		VkPipeline m_secondSubpassPipeline = VK_NULL_HANDLE;
+		VkQueryPool m_queryPool = VK_NULL_HANDLE;
+		VkCommandBuffer m_commandBuffer = VK_NULL_HANDLE;	// primary of the frame being recorded
+		VkFence m_fence = VK_NULL_HANDLE;
+		VkCommandBufferInheritanceInfo m_inheritance = {};
+	};
+}
+
+int main(int _argc, char** _argv)
+{
+	const uint32_t draws = _argc > 1 ? static_cast<uint32_t>(std::strtoul(_argv[1], nullptr, 10)) : 20000;
+	const uint32_t maxThreads = _argc > 2 ? static_cast<uint32_t>(std::strtoul(_argv[2], nullptr, 10)) : std::max(1u, std::thread::hardware_concurrency());
+
+	Benchmark benchmark;
+	benchmark.init();
+	CLog(0, "{} draws, {} chunks, median of {} frames.", draws, CHUNKS, FRAMES);
+
+	const double inlineMs = benchmark.runInline(draws);
+	CLog(0, "Inline, one thread: {:.3f} ms.", inlineMs);
+	double oneThreadMs = 0.0;
+	for (uint32_t threads = 1;; threads = std::min(threads * 2, maxThreads))
+	{
+		const double ms = benchmark.runParallel(draws, threads);
+		if (threads == 1)
+			oneThreadMs = ms;
+		CLog(0, "Secondary command buffers, {} threads: {:.3f} ms, {:.2f}x over 1 thread, {:.2f}x over inline.", threads, ms, oneThreadMs / ms, inlineMs / ms);
+		if (threads == maxThreads)
+			break;
+	}
+	const double twoSubpassMs = benchmark.runTwoSubpasses(draws, maxThreads);
+	CLog(0, "Inline subpass then secondary command buffer subpass, {} threads: {:.3f} ms.", maxThreads, twoSubpassMs);
+
+	benchmark.destroy();
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,176 @@
+#include "Core.h"
+#include "ShaderCompiler.h"
+#include "ShaderReflection.h"
+#include "ShaderPack.h"
+
+#include <filesystem>
+#include <chrono>
+#include <map>
+#include <cstdlib>
+
+// Builds the shader pack the game maps at startup.
+//
+//   ShaderPacker <shader directory> <output pack> [--compare]
+//
+// Sources are compiled, precompiled foo.frag.spv files are taken as foo.frag when there's no source of that name.
+// --compare also writes the shaders as loose .spv files next to the pack and times loading them one by one against
+// loading the pack, both including what startup does with the data (reflection for loose files).
+
+namespace
+{
+	double elapsedMs(std::chrono::steady_clock::time_point _start)
+	{
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - _start).count();
+	}
+
+	bool readFile(const std::filesystem::path& _path, std::vector<uint32_t>& _words)
+	{
+		std::ifstream file(_path, std::ios::binary | std::ios::ate);
+		if (!file)
+			return false;
+		const size_t size = static_cast<size_t>(file.tellg());
+		_words.resize(size / sizeof(uint32_t));
+		file.seekg(0);
+		file.read(reinterpret_cast<char*>(_words.data()), _words.size() * sizeof(uint32_t));
+		return static_cast<bool>(file);
+	}
+
+	// Touches everything startup touches so both paths pay for the same page faults.
+	uint64_t checksum(const uint32_t* _code, size_t _words)
+	{
+		uint64_t sum = 0;
+		for (size_t i = 0; i < _words; i++)
+		{
+			sum += _code[i];
+		}
+		return sum;
+	}
+
+	void compare(const std::map<std::string, std::vector<uint32_t>>& _shaders, const std::string& _packPath)
+	{
+		const std::filesystem::path looseDirectory = _packPath + ".loose";
+		for (const auto& it : _shaders)
+		{
+			const std::filesystem::path path = looseDirectory / (it.first + ".spv");
+			std::filesystem::create_directories(path.parent_path());
+			std::ofstream out(path, std::ios::binary | std::ios::trunc);
+			out.write(reinterpret_cast<const char*>(it.second.data()), it.second.size() * sizeof(uint32_t));
+		}
+
+		const uint32_t runs = 5;
+		double looseBest = 1e30, packBest = 1e30;
+		uint64_t looseSum = 0, packSum = 0;
+		for (uint32_t run = 0; run < runs; run++)
+		{
+			auto start = std::chrono::steady_clock::now();
+			std::vector<uint32_t> words;
+			for (const auto& it : _shaders)
+			{
+				CVerifyCrash(readFile(looseDirectory / (it.first + ".spv"), words), "Can't read back loose shader {:s}.", it.first);
+				ShaderReflection reflection;
+				SpirvReflector::reflect(words.data(), words.size() * sizeof(uint32_t), reflection);
+				looseSum += checksum(words.data(), words.size()) + reflection.bindings.size();
+			}
+			looseBest = std::min(looseBest, elapsedMs(start));
+
+			start = std::chrono::steady_clock::now();
+			ShaderPack pack;
+			CVerifyCrash(pack.open(_packPath), "Can't open {:s}.", _packPath);
+			for (uint32_t i = 0; i < pack.getEntryCount(); i++)
+			{
+				const ShaderPackEntry& entry = pack.getEntry(i);
+				const ShaderReflection reflection = pack.getReflection(entry);
+				packSum += checksum(pack.getCode(entry), entry.codeSize / sizeof(uint32_t)) + reflection.bindings.size();
+			}
+			pack.close();
+			packBest = std::min(packBest, elapsedMs(start));
+		}
+		CVerifyCrash(looseSum == packSum, "Loose files and pack disagree.");
+
+		// Warm file cache on both sides, on cold or networked storage the per file open cost grows and so does the gap
+		CLog(0, "{} shaders, best of {} runs: loose .spv files {:.3f} ms, shader pack {:.3f} ms ({:.1f}x).",
+			_shaders.size(), runs, looseBest, packBest, packBest > 0.0 ? looseBest / packBest : 0.0);
+	}
+}
+
+int main(int _argc, char** _argv)
+{
+	if (_argc < 3)
+	{
+		CLog(2, "Usage: ShaderPacker <shader directory> <output pack> [--compare]");
+		return EXIT_FAILURE;
+	}
+	const std::filesystem::path directory = _argv[1];
+	const std::string packPath = _argv[2];
+	const bool runCompare = _argc > 3 && std::string(_argv[3]) == "--compare";
+
+	const auto start = std::chrono::steady_clock::now();
+	ShaderCompiler compiler;
+	std::map<std::string, std::vector<uint32_t>> shaders;	// sorted so packs are reproducible
+	std::vector<std::string> precompiled;
+	uint32_t failures = 0;
+
+	std::error_code error;
+	for (const auto& entry : std::filesystem::recursive_directory_iterator(directory, error))
+	{
+		if (!entry.is_regular_file())
+			continue;
+		const std::string name = std::filesystem::relative(entry.path(), directory).generic_string();
+		if (ShaderCompiler::isShaderSource(name))
+		{
+			std::string errors;
+			if (!compiler.compile(entry.path().string(), shaders[name], errors))
+			{
+				CLog(2, "{:s} failed to compile:\n{:s}", name, errors);
+				shaders.erase(name);
+				failures++;
+			}
+		}
+		else if (entry.path().extension() == ".spv")
+		{
+			precompiled.push_back(name);
+		}
+	}
+	if (error)
+	{
+		CLog(2, "Can't read shader directory {:s}: {:s}", directory.string(), error.message());
+		return EXIT_FAILURE;
+	}
+	for (const auto& name : precompiled)
+	{
+		const std::string shaderName = name.substr(0, name.size() - 4);
+		if (shaders.count(shaderName) == 0)
+			CVerifyCrash(readFile(directory / name, shaders[shaderName]), "Can't read {:s}.", name);
+	}
+	if (failures > 0)
+	{
+		CLog(2, "{} shaders failed to compile, pack not written.", failures);
+		return EXIT_FAILURE;
+	}
+
+	// The pack stores reflection for every shader, one reflection can't describe is loaded from source by the game instead
+	ShaderPackWriter writer;
+	for (auto it = shaders.begin(); it != shaders.end();)
+	{
+		ShaderReflection reflection;
+		if (!SpirvReflector::reflect(it->second.data(), it->second.size() * sizeof(uint32_t), reflection))
+		{
+			CLog(1, "{:s} can't be reflected, left out of the pack.", it->first);
+			it = shaders.erase(it);
+			continue;
+		}
+		writer.add(it->first, it->second, reflection);
+		++it;
+	}
+	std::string writeError;
+	if (!writer.write(packPath, writeError))
+	{
+		CLog(2, "{:s}", writeError);
+		return EXIT_FAILURE;
+	}
+	CLog(0, "Packed {} shaders into {:s} ({} KB) in {:.2f} ms.", writer.getShaderCount(), packPath, std::filesystem::file_size(packPath) / 1024, elapsedMs(start));
+
+	if (runCompare)
+		compare(shaders, packPath);
+	return EXIT_SUCCESS;
+}